@@ -44,6 +44,7 @@ extern "C" {
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "application.hpp"
 #include "atffile.hpp"
@@ -57,17 +58,37 @@ extern "C" {
 #include "requirements.hpp"
 #include "test-program.hpp"
 #include "text.hpp"
+#include "ui.hpp"
 
 namespace {
 
 typedef std::map< std::string, std::string > vars_map;
 
+//
+// A test program to be run by run_parallel(), with the configuration
+// it would have been given by run_test().
+//
+struct test_job {
+    tools::fs::path tp;
+    std::string tc;
+    vars_map config;
+
+    test_job(const tools::fs::path& p_tp, const std::string& p_tc,
+             const vars_map& p_config) :
+        tp(p_tp),
+        tc(p_tc),
+        config(p_config)
+    {
+    }
+};
+
 } // anonymous namespace
 
 class atf_run : public tools::application::app {
     static const char* m_description;
 
     vars_map m_cmdline_vars;
+    size_t m_jobs;
 
     static vars_map::value_type parse_var(const std::string&);
 
@@ -75,6 +96,7 @@ class atf_run : public tools::application::app {
     std::string specific_args(void) const;
     options_set specific_options(void) const;
 
+    void parse_jflag(const std::string&);
     void parse_vflag(const std::string&);
 
     std::vector< std::string > conf_args(void) const;
@@ -90,6 +112,17 @@ class atf_run : public tools::application::app {
                          const std::string tc,
                          tools::test_program::atf_tps_writer&,
                          const vars_map&);
+    int run_test_cases(const tools::fs::path&,
+                       const std::string tc,
+                       const tools::test_program::metadata&,
+                       tools::test_program::atf_tps_writer&,
+                       const vars_map&);
+
+    void collect_tests(const tools::fs::path&, const std::string&,
+                       const vars_map&, std::vector< test_job >&);
+    pid_t start_job(const test_job&, const tools::test_program::metadata*,
+                    const tools::fs::path&);
+    int run_parallel(const std::vector< test_job >&);
 
     tools::test_program::test_case_result get_test_case_result(
         const std::string&, const tools::process::status&,
@@ -160,7 +193,8 @@ const char* atf_run::m_description =
     "results.";
 
 atf_run::atf_run(void) :
-    app(m_description, "atf-run(1)", "atf(7)")
+    app(m_description, "atf-run(1)", "atf(7)"),
+    m_jobs(1)
 {
 }
 
@@ -168,6 +202,10 @@ void
 atf_run::process_option(int ch, const char* arg)
 {
     switch (ch) {
+    case 'j':
+        parse_jflag(arg);
+        break;
+
     case 'v':
         parse_vflag(arg);
         break;
@@ -190,12 +228,30 @@ atf_run::specific_options(void)
 {
     using tools::application::option;
     options_set opts;
+    opts.insert(option('j', "jobs", "Runs up to `jobs' test programs "
+                                    "concurrently"));
     opts.insert(option('v', "var=value", "Sets the configuration variable "
                                          "`var' to `value'; overrides "
                                          "values in configuration files"));
     return opts;
 }
 
+void
+atf_run::parse_jflag(const std::string& str)
+{
+    int jobs;
+
+    try {
+        jobs = tools::text::to_type< int >(str);
+    } catch (const std::runtime_error&) {
+        jobs = 0;
+    }
+    if (jobs < 1)
+        throw std::runtime_error("-j requires a positive integer argument");
+
+    m_jobs = jobs;
+}
+
 void
 atf_run::parse_vflag(const std::string& str)
 {
@@ -369,8 +425,6 @@ atf_run::run_test_program(const tools::fs::path& tp,
                           tools::test_program::atf_tps_writer& w,
                           const vars_map& config)
 {
-    int errcode = EXIT_SUCCESS;
-
     tools::test_program::metadata md;
     try {
         md = tools::test_program::get_metadata(tp, config);
@@ -385,6 +439,18 @@ atf_run::run_test_program(const tools::fs::path& tp,
         return EXIT_FAILURE;
     }
 
+    return run_test_cases(tp, tc, md, w, config);
+}
+
+int
+atf_run::run_test_cases(const tools::fs::path& tp,
+                        const std::string tc,
+                        const tools::test_program::metadata& md,
+                        tools::test_program::atf_tps_writer& w,
+                        const vars_map& config)
+{
+    int errcode = EXIT_SUCCESS;
+
     tools::fs::temp_dir resdir(
         tools::fs::path(tools::config::get("atf_workdir")) / "atf-run.XXXXXX");
 
@@ -486,6 +552,176 @@ atf_run::run_test_program(const tools::fs::path& tp,
     return errcode;
 }
 
+void
+atf_run::collect_tests(const tools::fs::path& tp,
+                       const std::string& tc,
+                       const vars_map& config,
+                       std::vector< test_job >& jobs)
+{
+    tools::fs::file_info fi(tp);
+
+    if (fi.get_type() == tools::fs::file_info::dir_type) {
+        tools::atffile af = tools::read_atffile(tp / "Atffile");
+
+        vars_map test_suite_vars;
+        {
+            vars_map::const_iterator iter = af.props().find("test-suite");
+            assert(iter != af.props().end());
+            test_suite_vars =
+                tools::config_file::read_config_files((*iter).second);
+        }
+
+        for (std::vector< std::string >::const_iterator iter =
+             af.tps().begin(); iter != af.tps().end(); iter++)
+            collect_tests(tp / *iter, "",
+                tools::config_file::merge_configs(af.conf(), test_suite_vars),
+                jobs);
+    } else
+        jobs.push_back(test_job(tp, tc,
+            tools::config_file::merge_configs(config, m_cmdline_vars)));
+}
+
+static bool
+is_exclusive(const tools::test_program::metadata& md, const std::string& tc)
+{
+    for (std::map< std::string, vars_map >::const_iterator iter
+         = md.test_cases.begin(); iter != md.test_cases.end(); iter++) {
+        if (!tc.empty() && (*iter).first != tc)
+            continue;
+
+        const vars_map::const_iterator prop = (*iter).second.find(
+            "is.exclusive");
+        if (prop != (*iter).second.end() &&
+            tools::text::to_bool((*prop).second))
+            return true;
+    }
+    return false;
+}
+
+//
+// Runs a test program in a subprocess that writes its part of the report
+// to 'out'.  If the test program's metadata is already known, it is
+// passed in 'md' so that the subprocess does not have to query it again.
+//
+pid_t
+atf_run::start_job(const test_job& job,
+                   const tools::test_program::metadata* md,
+                   const tools::fs::path& out)
+{
+    std::cout.flush();
+    std::cerr.flush();
+
+    const pid_t pid = ::fork();
+    if (pid == -1)
+        throw tools::system_error("fork", "fork(2) failed", errno);
+    if (pid > 0)
+        return pid;
+
+    int errcode = EXIT_FAILURE;
+    try {
+        std::ofstream os(out.c_str());
+        if (!os)
+            throw std::runtime_error("Cannot create " + out.str());
+
+        tools::test_program::atf_tps_writer w(os, false);
+        if (md != NULL)
+            errcode = run_test_cases(job.tp, job.tc, *md, w, job.config);
+        else
+            errcode = run_test_program(job.tp, job.tc, w, job.config);
+        os.close();
+    } catch (const std::exception& e) {
+        std::cerr << tools::ui::format_error(m_prog_name, e.what()) << "\n";
+        errcode = EXIT_FAILURE;
+    }
+    std::cerr.flush();
+    ::_exit(errcode);
+}
+
+//
+// Runs the given test programs, up to m_jobs of them at a time.  Each one
+// runs in its own subprocess and writes its report to a file, which is
+// copied to the standard output once all the test programs before it have
+// been reported; the result is thus the same as if they had been run one
+// after the other.  A test program that has an "is.exclusive" test case
+// does not run concurrently with any other.
+//
+int
+atf_run::run_parallel(const std::vector< test_job >& jobs)
+{
+    tools::fs::temp_dir outdir(
+        tools::fs::path(tools::config::get("atf_workdir")) / "atf-run.XXXXXX");
+
+    std::map< pid_t, size_t > running;
+    std::vector< int > results(jobs.size(), -1);
+    size_t next = 0, emitted = 0;
+    bool exclusive_running = false;
+
+    tools::test_program::metadata next_md;
+    bool next_listed = false, next_has_md = false, next_exclusive = false;
+
+    bool ok = true;
+    while (emitted < jobs.size()) {
+        while (next < jobs.size() && running.size() < m_jobs &&
+               !exclusive_running) {
+            if (!next_listed) {
+                // Errors are reported by the subprocess when it retries.
+                try {
+                    next_md = tools::test_program::get_metadata(
+                        jobs[next].tp, jobs[next].config);
+                    next_has_md = true;
+                    next_exclusive = is_exclusive(next_md, jobs[next].tc);
+                } catch (const std::runtime_error&) {
+                    next_has_md = false;
+                    next_exclusive = false;
+                }
+                next_listed = true;
+            }
+            if (next_exclusive && !running.empty())
+                break;
+
+            const pid_t pid = start_job(jobs[next],
+                next_has_md ? &next_md : NULL,
+                outdir.get_path() / tools::text::to_string(next));
+            running[pid] = next;
+            exclusive_running = next_exclusive;
+            next++;
+            next_listed = false;
+        }
+
+        int status;
+        const pid_t pid = ::waitpid(-1, &status, 0);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            throw tools::system_error("waitpid", "waitpid(2) failed", errno);
+        }
+        const std::map< pid_t, size_t >::iterator iter = running.find(pid);
+        if (iter == running.end())
+            continue;
+        results[(*iter).second] = WIFEXITED(status) &&
+            WEXITSTATUS(status) == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+        running.erase(iter);
+        exclusive_running = false;
+
+        while (emitted < jobs.size() && results[emitted] != -1) {
+            const tools::fs::path out = outdir.get_path() /
+                tools::text::to_string(emitted);
+            std::ifstream is(out.c_str());
+            if (is)
+                std::cout << is.rdbuf();
+            std::cout.flush();
+            is.close();
+            if (tools::fs::exists(out))
+                tools::fs::remove(out);
+
+            ok &= (results[emitted] == EXIT_SUCCESS);
+            emitted++;
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 static void
 colon_split(const std::string &s, std::string &tp, std::string &tc)
 {
@@ -575,13 +811,26 @@ atf_run::main(void)
     w.ntps(count_tps(tps));
 
     bool ok = true;
-    for (std::vector< std::string >::const_iterator iter = tps.begin();
-         iter != tps.end(); iter++) {
-        std::string tp, tc;
-        colon_split(*iter, tp, tc);
-        const bool result = run_test(tools::fs::path(tp), tc, w,
-            tools::config_file::merge_configs(af.conf(), test_suite_vars));
-        ok &= (result == EXIT_SUCCESS);
+    if (m_jobs > 1) {
+        std::vector< test_job > jobs;
+        for (std::vector< std::string >::const_iterator iter = tps.begin();
+             iter != tps.end(); iter++) {
+            std::string tp, tc;
+            colon_split(*iter, tp, tc);
+            collect_tests(tools::fs::path(tp), tc,
+                tools::config_file::merge_configs(af.conf(), test_suite_vars),
+                jobs);
+        }
+        ok = (run_parallel(jobs) == EXIT_SUCCESS);
+    } else {
+        for (std::vector< std::string >::const_iterator iter = tps.begin();
+             iter != tps.end(); iter++) {
+            std::string tp, tc;
+            colon_split(*iter, tp, tc);
+            const bool result = run_test(tools::fs::path(tp), tc, w,
+                tools::config_file::merge_configs(af.conf(), test_suite_vars));
+            ok &= (result == EXIT_SUCCESS);
+        }
     }
 
     call_hook("atf-run", "info_end_hook");
@@ -240,6 +240,34 @@ EOF
         "ATF_CONFDIR=$(pwd)/etc atf-run -v testvar='a value' helper"
 }
 
+atf_test_case jflag
+jflag_head()
+{
+    atf_set "descr" "Tests that the -j flag runs test programs concurrently" \
+                    "but reports them in order"
+}
+jflag_body()
+{
+    for i in 1 2 3; do
+        create_helper_stdin helper${i} 1 <<EOF
+sleep $((4 - ${i}))
+echo "output of helper${i}"
+echo passed >\${resfile}
+exit 0
+EOF
+        chmod +x helper${i}
+    done
+    create_atffile helper1 helper2 helper3
+
+    atf_check -s eq:0 -o save:serial -e empty atf-run
+    atf_check -s eq:0 -o save:parallel -e empty atf-run -j 3
+    grep -v '^info: ' serial | sed -e 's,[0-9][0-9]*\.[0-9]*,T,' >expout
+    atf_check -s eq:0 -o file:expout -e empty -x \
+        "grep -v '^info: ' parallel | sed -e 's,[0-9][0-9]*\.[0-9]*,T,'"
+
+    atf_check -s eq:1 -o empty -e match:'positive integer' atf-run -j 0
+}
+
 atf_test_case atffile
 atffile_head()
 {
@@ -1095,6 +1123,7 @@ atf_init_test_cases()
     atf_add_test_case no_warnings
     atf_add_test_case config
     atf_add_test_case vflag
+    atf_add_test_case jflag
     atf_add_test_case atffile
     atf_add_test_case atffile_recursive
     atf_add_test_case expect
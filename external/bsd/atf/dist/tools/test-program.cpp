@@ -451,6 +451,13 @@ detail::atf_tp_reader::validate_and_insert(const std::string& name,
             throw parse_error(lineno, "The has.cleanup property requires a"
                               " boolean value");
         }
+    } else if (name == "is.exclusive") {
+        try {
+            (void)tools::text::to_bool(value);
+        } catch (const std::runtime_error&) {
+            throw parse_error(lineno, "The is.exclusive property requires a"
+                              " boolean value");
+        }
     } else if (name == "ident") {
         if (!tools::text::match(value, ident_regex))
             throw parse_error(lineno, "The identifier must match " +
@@ -563,9 +570,13 @@ detail::parse_test_case_result(const std::string& line)
         throw std::runtime_error("Unknown test case result type in: " + line);
 }
 
-impl::atf_tps_writer::atf_tps_writer(std::ostream& os) :
+impl::atf_tps_writer::atf_tps_writer(std::ostream& os,
+                                     const bool write_headers) :
     m_os(os)
 {
+    if (!write_headers)
+        return;
+
     tools::parser::headers_map hm;
     tools::parser::attrs_map ct_attrs;
     ct_attrs["version"] = "3";
@@ -110,7 +110,9 @@ class atf_tps_writer {
     std::string m_tpname, m_tcname;
 
 public:
-    atf_tps_writer(std::ostream&);
+    // Pass false as the second argument when the output is to be appended
+    // to that of another writer that already printed the headers.
+    atf_tps_writer(std::ostream&, const bool = true);
 
     void info(const std::string&, const std::string&);
     void ntps(size_t);
@@ -516,6 +516,28 @@ ATF_TEST_CASE_BODY(tp_60)
     do_parser_test< tp_reader >(input, exp_calls, exp_errors);
 }
 
+ATF_TEST_CASE_WITHOUT_HEAD(tp_61);
+ATF_TEST_CASE_BODY(tp_61)
+{
+    const char* input =
+        "Content-Type: application/X-atf-tp; version=\"1\"\n"
+        "\n"
+        "ident: test\n"
+        "is.exclusive: sometimes\n"
+    ;
+
+    const char* exp_calls[] = {
+        NULL
+    };
+
+    const char* exp_errors[] = {
+        "4: The is.exclusive property requires a boolean value",
+        NULL
+    };
+
+    do_parser_test< tp_reader >(input, exp_calls, exp_errors);
+}
+
 // -------------------------------------------------------------------------
 // Tests for the "tps" writer.
 // -------------------------------------------------------------------------
@@ -994,6 +1016,7 @@ ATF_INIT_TEST_CASES(tcs)
     ATF_ADD_TEST_CASE(tcs, tp_58);
     ATF_ADD_TEST_CASE(tcs, tp_59);
     ATF_ADD_TEST_CASE(tcs, tp_60);
+    ATF_ADD_TEST_CASE(tcs, tp_61);
 
     ATF_ADD_TEST_CASE(tcs, atf_tps_writer);
 
@@ -135,6 +135,8 @@ file_private struct mlist *mlist_alloc(void);
 file_private void mlist_free_all(struct magic_set *);
 file_private void mlist_free(struct mlist *);
 file_private void byteswap(struct magic *, uint32_t);
+file_private int mindex_byte(const struct magic *);
+file_private struct magic_index *mindex_build(const struct magic *, size_t);
 file_private void bs1(struct magic *);
 
 #if defined(HAVE_BYTESWAP_H)
@@ -466,6 +468,8 @@ add_mlist(struct mlist *mlp, struct magic_map *map, size_t idx)
 		}
 	} else
 		ml->magic_rxcomp = NULL;
+	/* the index is only an optimization, so go on without it */
+	ml->mindex = mindex_build(ml->magic, ml->nmagic);
 	mlp->prev->next = ml;
 	ml->prev = mlp->prev;
 	ml->next = mlp;
@@ -672,9 +676,110 @@ mlist_free_one(struct mlist *ml)
 	}
 	free(ml->magic_rxcomp);
 	ml->magic_rxcomp = NULL;
+	free(ml->mindex);
 	free(ml);
 }
 
+/*
+ * Return the byte that a file must start with for the top-level entry
+ * m to match, or -1 if m can match files starting with anything.
+ */
+file_private int
+mindex_byte(const struct magic *m)
+{
+	uint64_t v = m->value.q;
+
+	if (m->cont_level != 0 || m->offset != 0 || m->reln != '=' ||
+	    (m->flag & (INDIR|OFFADD|INDIROFFADD|OFFNEGATIVE)) != 0 ||
+	    m->mask_op != 0)
+		return -1;
+
+	switch (m->type) {
+	case FILE_STRING:
+		if (m->vallen == 0 || m->str_range != 0 ||
+		    (m->str_flags & ~(STRING_TEXTTEST|STRING_BINTEST)) != 0)
+			return -1;
+		return CAST(unsigned char, m->value.s[0]);
+	case FILE_BYTE:
+	case FILE_BESHORT:
+	case FILE_BELONG:
+	case FILE_BEQUAD:
+	case FILE_LESHORT:
+	case FILE_LELONG:
+	case FILE_LEQUAD:
+		if (m->num_mask != 0)
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+
+	switch (m->type) {
+	case FILE_BESHORT:
+		return CAST(int, (v >> 8) & 0xff);
+	case FILE_BELONG:
+		return CAST(int, (v >> 24) & 0xff);
+	case FILE_BEQUAD:
+		return CAST(int, (v >> 56) & 0xff);
+	default:
+		return CAST(int, v & 0xff);
+	}
+}
+
+/*
+ * Build the first byte index of the nmagic entries in magic.  All the
+ * lists share one allocation, which follows the index itself.
+ */
+file_private struct magic_index *
+mindex_build(const struct magic *magic, size_t nmagic)
+{
+	struct magic_index *mi;
+	uint32_t *p, i;
+	size_t ntop;
+	int c;
+
+	if (nmagic == 0 || nmagic > UINT32_MAX)
+		return NULL;
+
+	for (ntop = 0, i = 0; i < nmagic; i++)
+		if (magic[i].cont_level == 0)
+			ntop++;
+
+	mi = CAST(struct magic_index *,
+	    calloc(1, sizeof(*mi) + ntop * sizeof(*mi->any)));
+	if (mi == NULL)
+		return NULL;
+
+	for (i = 0; i < nmagic; i++) {
+		if (magic[i].cont_level != 0)
+			continue;
+		if ((c = mindex_byte(&magic[i])) == -1)
+			mi->nany++;
+		else
+			mi->nbyte[c]++;
+	}
+
+	p = CAST(uint32_t *, CAST(void *, mi + 1));
+	mi->any = p;
+	p += mi->nany;
+	for (c = 0; c < 256; c++) {
+		mi->byte[c] = p;
+		p += mi->nbyte[c];
+	}
+
+	memset(mi->nbyte, 0, sizeof(mi->nbyte));
+	mi->nany = 0;
+	for (i = 0; i < nmagic; i++) {
+		if (magic[i].cont_level != 0)
+			continue;
+		if ((c = mindex_byte(&magic[i])) == -1)
+			mi->any[mi->nany++] = i;
+		else
+			mi->byte[c][mi->nbyte[c]++] = i;
+	}
+	return mi;
+}
+
 file_private void
 mlist_free(struct mlist *mlist)
 {
@@ -46,6 +46,10 @@ __RCSID("$NetBSD: file.c,v 1.18 2023/08/18 19:00:11 christos Exp $");
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #ifdef RESTORE_TIME
 # if (__COHERENT__ >= 0x420)
 #  include <sys/utime.h>
@@ -92,12 +96,13 @@ int getopt_long(int, char * const *, const char *,
 #endif
 
 #define FILE_FLAGS	"bcCdE" IFLNK_h "ik" IFLNK_L "lNnprsSvzZ0"
-#define OPTSTRING	"bcCde:Ef:F:hiklLm:nNpP:rsSvzZ0"
+#define OPTSTRING	"bcCde:Ef:F:hij:klLm:nNpP:rsSvzZ0"
 
 # define USAGE  \
     "Usage: %s [-" FILE_FLAGS "] [--apple] [--extension] [--mime-encoding]\n" \
     "            [--mime-type] [-e <testname>] [-F <separator>] " \
     " [-f <namefile>]\n" \
+    "            [-j <jobs>]\n" \
     "            [-m <magicfiles>] [-P <parameter=value>] [--exclude-quiet]\n" \
     "            <file> ...\n" \
     "       %s -C [-m <magicfiles>]\n" \
@@ -109,7 +114,11 @@ file_private int 		/* Global command-line options 		*/
 	nobuffer = 0,   /* Do not buffer stdout 		*/
 	nulsep = 0;	/* Append '\0' to the separator		*/
 
+file_private size_t jobs = 1;	/* Number of threads classifying files	*/
+
 file_private const char *separator = ":";	/* Default field separator	*/
+file_private const char *loadfile;	/* Arguments of the last load(),	*/
+file_private int loadflags;		/* to make more magic sets	*/
 file_private const struct option long_options[] = {
 #define OPT_HELP		1
 #define OPT_APPLE		2
@@ -187,7 +196,10 @@ __dead
 file_private void help(void);
 
 file_private int unwrap(struct magic_set *, const char *);
+file_private void print_name(struct magic_set *, const char *, int);
+file_private int print_type(const char *, const char *);
 file_private int process(struct magic_set *ms, const char *, int);
+file_private int process_list(struct magic_set *, char **, size_t, int);
 file_private struct magic_set *load(const char *, int);
 file_private void setparam(const char *);
 file_private void applyparam(magic_t);
@@ -296,6 +308,10 @@ main(int argc, char *argv[])
 		case 'i':
 			flags |= MAGIC_MIME;
 			break;
+		case 'j':
+			if ((jobs = CAST(size_t, atoi(optarg))) < 1)
+				usage();
+			break;
 		case 'k':
 			flags |= MAGIC_CONTINUE;
 			break;
@@ -445,8 +461,8 @@ main(int argc, char *argv[])
 	if (bflag == 2) {
 		bflag = optind >= argc - 1;
 	}
-	for (; optind < argc; optind++)
-		e |= process(magic, argv[optind], wid);
+	e |= process_list(magic, argv + optind, CAST(size_t, argc - optind),
+	    wid);
 
 out:
 	if (!nobuffer)
@@ -497,6 +513,8 @@ load(const char *magicfile, int flags)
 	struct magic_set *magic = magic_open(flags);
 	const char *e;
 
+	loadfile = magicfile;
+	loadflags = flags;
 	if (magic == NULL) {
 		file_warn("Can't create magic");
 		return NULL;
@@ -565,10 +583,9 @@ unwrap(struct magic_set *ms, const char *fn)
 
 	if (!nobuffer) {
 		fimax = fi;
-		for (fi = 0; fi < fimax; fi++) {
-			e |= process(ms, flist[fi], wid);
+		e |= process_list(ms, flist, fimax, wid);
+		for (fi = 0; fi < fimax; fi++)
 			free(flist[fi]);
-		}
 	}
 	free(flist);
 
@@ -630,14 +647,12 @@ fname_print(const char *inname)
 }
 
 /*
- * Called for each input file on the command line (or in a list of files)
+ * Print the file name part of the output line for inname
  */
-file_private int
-process(struct magic_set *ms, const char *inname, int wid)
+file_private void
+print_name(struct magic_set *ms, const char *inname, int wid)
 {
-	const char *type, c = nulsep > 1 ? '\0' : '\n';
 	int std_in = strcmp(inname, "-") == 0;
-	int haderror = 0;
 
 	if (wid > 0 && !bflag) {
 		const char *pname = std_in ? "/dev/stdin" : inname;
@@ -653,11 +668,19 @@ process(struct magic_set *ms, const char *inname, int wid)
 			    : (wid - file_mbswidth(ms, inname))), "");
 		}
 	}
+}
 
-	type = magic_file(ms, std_in ? NULL : inname);
+/*
+ * Print the type part of the output line, or error if type is NULL
+ */
+file_private int
+print_type(const char *type, const char *error)
+{
+	const char c = nulsep > 1 ? '\0' : '\n';
+	int haderror = 0;
 
 	if (type == NULL) {
-		haderror |= printf("ERROR: %s%c", magic_error(ms), c);
+		haderror |= printf("ERROR: %s%c", error, c);
 	} else {
 		haderror |= printf("%s%c", type, c) < 0;
 	}
@@ -666,6 +689,198 @@ process(struct magic_set *ms, const char *inname, int wid)
 	return haderror || type == NULL;
 }
 
+/*
+ * Called for each input file on the command line (or in a list of files)
+ */
+file_private int
+process(struct magic_set *ms, const char *inname, int wid)
+{
+	const char *type;
+	int std_in = strcmp(inname, "-") == 0;
+
+	print_name(ms, inname, wid);
+	type = magic_file(ms, std_in ? NULL : inname);
+	return print_type(type, type == NULL ? magic_error(ms) : NULL);
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Parallel classification (-j): each worker thread has its own magic
+ * set, takes the next name from the list and stores a copy of the
+ * result; the main thread prints the results in list order as they
+ * become available.
+ */
+struct job {
+	const char *name;
+	char *type;			/* result, or NULL on error */
+	char *error;			/* magic_error() if type is NULL */
+	int done;
+};
+
+struct joblist {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	struct job *job;
+	size_t njob;
+	size_t next;			/* next job to hand out */
+	size_t nworker;
+};
+
+struct worker {
+	pthread_t thread;
+	struct joblist *jl;
+	struct magic_set *ms;
+};
+
+/*
+ * Ask the kernel to start reading the part of a regular file that
+ * libmagic is going to look at, so that it is cached by the time a
+ * worker gets to it.
+ */
+file_private void
+prefetch(struct magic_set *ms, const char *name)
+{
+#ifdef POSIX_FADV_WILLNEED
+	struct stat st;
+	size_t len;
+	int fd;
+
+	if (strcmp(name, "-") == 0 || (ms->flags & MAGIC_PRESERVE_ATIME))
+		return;
+	if (stat(name, &st) == -1 || !S_ISREG(st.st_mode))
+		return;
+	if ((fd = open(name, O_RDONLY|O_NONBLOCK)) == -1)
+		return;
+	if (magic_getparam(ms, MAGIC_PARAM_BYTES_MAX, &len) == -1)
+		len = 0;
+	(void)posix_fadvise(fd, 0, CAST(off_t, len), POSIX_FADV_WILLNEED);
+	(void)close(fd);
+#endif
+}
+
+file_private void *
+worker(void *arg)
+{
+	struct worker *w = CAST(struct worker *, arg);
+	struct joblist *jl = w->jl;
+	struct job *j;
+	const char *type;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&jl->lock);
+		i = jl->next++;
+		pthread_mutex_unlock(&jl->lock);
+		if (i >= jl->njob)
+			break;
+
+		/* Read ahead for the job that will follow ours */
+		if (i + jl->nworker < jl->njob)
+			prefetch(w->ms, jl->job[i + jl->nworker].name);
+
+		j = &jl->job[i];
+		type = magic_file(w->ms,
+		    strcmp(j->name, "-") == 0 ? NULL : j->name);
+		if (type != NULL)
+			j->type = strdup(type);
+		else if ((j->error = strdup(magic_error(w->ms))) == NULL)
+			j->error = strdup("");
+		if (j->type == NULL && j->error == NULL)
+			file_err(EXIT_FAILURE, "Cannot allocate memory");
+
+		pthread_mutex_lock(&jl->lock);
+		j->done = 1;
+		pthread_cond_broadcast(&jl->done);
+		pthread_mutex_unlock(&jl->lock);
+	}
+	return NULL;
+}
+
+file_private int
+process_parallel(struct magic_set *ms, char **name, size_t n, int wid)
+{
+	struct joblist jl;
+	struct worker *w;
+	size_t i, nw;
+	int e = 0;
+
+	memset(&jl, 0, sizeof(jl));
+	jl.njob = n;
+	if ((jl.job = CAST(struct job *, calloc(n, sizeof(*jl.job)))) == NULL)
+		file_err(EXIT_FAILURE, "Cannot allocate memory for job list");
+	for (i = 0; i < n; i++)
+		jl.job[i].name = name[i];
+	jl.nworker = MIN(jobs, n);
+	if ((w = CAST(struct worker *, calloc(jl.nworker, sizeof(*w)))) == NULL)
+		file_err(EXIT_FAILURE, "Cannot allocate memory for workers");
+	pthread_mutex_init(&jl.lock, NULL);
+	pthread_cond_init(&jl.done, NULL);
+
+	/*
+	 * libmagic keeps per set state (output buffers, compiled regexps),
+	 * so every worker gets a set of its own; loading a compiled
+	 * database maps the same file, so the entries are shared.
+	 */
+	for (nw = 0; nw < jl.nworker; nw++) {
+		w[nw].jl = &jl;
+		if ((w[nw].ms = load(loadfile, loadflags)) == NULL)
+			break;
+		applyparam(w[nw].ms);
+	}
+	jl.nworker = nw;
+	for (i = 0; i < nw; i++)
+		if ((errno = pthread_create(&w[i].thread, NULL, worker,
+		    &w[i])) != 0)
+			file_err(EXIT_FAILURE, "Cannot create thread");
+
+	for (i = 0; i < n; i++) {
+		struct job *j = &jl.job[i];
+
+		if (nw == 0) {
+			e |= process(ms, j->name, wid);
+			continue;
+		}
+		pthread_mutex_lock(&jl.lock);
+		while (!j->done)
+			pthread_cond_wait(&jl.done, &jl.lock);
+		pthread_mutex_unlock(&jl.lock);
+
+		print_name(ms, j->name, wid);
+		e |= print_type(j->type, j->error);
+		free(j->type);
+		free(j->error);
+	}
+
+	for (i = 0; i < nw; i++) {
+		pthread_join(w[i].thread, NULL);
+		magic_close(w[i].ms);
+	}
+	pthread_cond_destroy(&jl.done);
+	pthread_mutex_destroy(&jl.lock);
+	free(w);
+	free(jl.job);
+	return e;
+}
+#endif
+
+/*
+ * Classify a list of files, in parallel if requested
+ */
+file_private int
+process_list(struct magic_set *ms, char **name, size_t n, int wid)
+{
+	size_t i;
+	int e = 0;
+
+#ifdef HAVE_PTHREAD_H
+	if (jobs > 1 && n > 1)
+		return process_parallel(ms, name, n, wid);
+#endif
+	for (i = 0; i < n; i++)
+		e |= process(ms, name[i], wid);
+	return e;
+}
+
 file_protected size_t
 file_mbswidth(struct magic_set *ms, const char *s)
 {
@@ -419,11 +419,26 @@ struct magic {
 #define	INDIRECT_RELATIVE			BIT(0)
 #define	CHAR_INDIRECT_RELATIVE			'r'
 
+/*
+ * index of the top-level entries of an mlist by the first byte of the
+ * file they require.  entries that test a fixed value at offset 0 are
+ * listed under that value; all the others are in the "any" list.  both
+ * lists are in magic order, so merging "any" with byte[c] yields the
+ * candidates for a file starting with c in the original order.
+ */
+struct magic_index {
+	uint32_t *any;			/* entries that cannot be indexed */
+	uint32_t nany;
+	uint32_t *byte[256];		/* entries requiring this first byte */
+	uint32_t nbyte[256];
+};
+
 /* list of magic entries */
 struct mlist {
 	struct magic *magic;		/* array of magic entries */
 	file_regex_t **magic_rxcomp;	/* array of compiled regexps */
 	size_t nmagic;			/* number of entries in array */
+	struct magic_index *mindex;	/* first byte index, or NULL */
 	void *map;			/* internal resources used by entry */
 	struct mlist *next, *prev;
 };
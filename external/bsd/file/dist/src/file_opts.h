@@ -55,6 +55,8 @@ OPT_LONGONLY("mime-type", 0, 0,
     "            output the MIME type\n", OPT_MIME_TYPE)
 OPT_LONGONLY("mime-encoding", 0, 0,
     "        output the MIME encoding\n", OPT_MIME_ENCODING)
+OPT('j', "jobs", 1, 0,
+    " N               classify files using N threads\n")
 OPT('k', "keep-going", 0, 0,
     "           don't stop at the first match\n")
 OPT('l', "list", 0, 0,
@@ -52,8 +52,10 @@ __RCSID("$NetBSD: softmagic.c,v 1.26 2023/08/18 19:00:11 christos Exp $");
 #include "der.h"
 
 file_private int match(struct magic_set *, struct magic *, file_regex_t **, size_t,
-    const struct buffer *, size_t, int, int, int, uint16_t *,
-    uint16_t *, int *, int *, int *, int *, int *);
+    const struct magic_index *, const struct buffer *, size_t, int, int, int,
+    uint16_t *, uint16_t *, int *, int *, int *, int *, int *);
+file_private uint32_t mindex_next(const struct magic_index *, int, size_t *,
+    size_t *, uint32_t);
 file_private int mget(struct magic_set *, struct magic *, const struct buffer *,
     const unsigned char *, size_t,
     size_t, unsigned int, int, int, int, uint16_t *,
@@ -139,8 +141,8 @@ file_softmagic(struct magic_set *ms, const struct buffer *b,
 	}
 
 	for (ml = ms->mlist[0]->next; ml != ms->mlist[0]; ml = ml->next) {
-		int ret = match(ms, ml->magic, ml->magic_rxcomp, ml->nmagic, b,
-		    0, mode, text, 0, indir_count, name_count,
+		int ret = match(ms, ml->magic, ml->magic_rxcomp, ml->nmagic,
+		    ml->mindex, b, 0, mode, text, 0, indir_count, name_count,
 		    &printed_something, &need_separator, &firstline,
 		    NULL, NULL);
 		switch (ret) {
@@ -183,6 +185,29 @@ file_fmtcheck(struct magic_set *ms, const char *desc, const char *def,
 #define F(a, b, c) fmtcheck((b), (c))
 #endif
 
+/*
+ * Return the first top-level entry at or after magindex that may match
+ * a file starting with byte c, or UINT32_MAX if there are no more.  The
+ * cursors *ia and *ib remember the position in the "any" and byte[c]
+ * lists, since magindex only increases.
+ */
+file_private uint32_t
+mindex_next(const struct magic_index *mi, int c, size_t *ia, size_t *ib,
+    uint32_t magindex)
+{
+	uint32_t a = UINT32_MAX, b = UINT32_MAX;
+
+	while (*ia < mi->nany && mi->any[*ia] < magindex)
+		(*ia)++;
+	if (*ia < mi->nany)
+		a = mi->any[*ia];
+	while (*ib < mi->nbyte[c] && mi->byte[c][*ib] < magindex)
+		(*ib)++;
+	if (*ib < mi->nbyte[c])
+		b = mi->byte[c][*ib];
+	return MIN(a, b);
+}
+
 /*
  * Go through the whole list, stopping if you find a match.  Process all
  * the continuations of that match before returning.
@@ -212,10 +237,10 @@ file_fmtcheck(struct magic_set *ms, const char *desc, const char *def,
  */
 file_private int
 match(struct magic_set *ms, struct magic *magic, file_regex_t **magic_rxcomp,
-    size_t nmagic, const struct buffer *b, size_t offset, int mode, int text,
-    int flip, uint16_t *indir_count, uint16_t *name_count,
-    int *printed_something, int *need_separator, int *firstline,
-    int *returnval, int *found_match)
+    size_t nmagic, const struct magic_index *mi, const struct buffer *b,
+    size_t offset, int mode, int text, int flip, uint16_t *indir_count,
+    uint16_t *name_count, int *printed_something, int *need_separator,
+    int *firstline, int *returnval, int *found_match)
 {
 	uint32_t magindex = 0;
 	unsigned int cont_level = 0;
@@ -223,6 +248,8 @@ match(struct magic_set *ms, struct magic *magic, file_regex_t **magic_rxcomp,
 	int returnvalv = 0, e;
 	struct buffer bb;
 	int print = (ms->flags & MAGIC_NODESC) == 0;
+	size_t ia = 0, ib = 0;
+	int c = -1;
 
 	/*
 	 * returnval can be 0 if a match is found, but there was no
@@ -236,10 +263,26 @@ match(struct magic_set *ms, struct magic *magic, file_regex_t **magic_rxcomp,
 	if (file_check_mem(ms, cont_level) == -1)
 		return -1;
 
+	/*
+	 * The index describes entries at offset 0 of the unflipped buffer;
+	 * an empty buffer is left to the entries themselves.
+	 */
+	if (mi != NULL && offset == 0 && flip == 0 && b->flen > 0)
+		c = CAST(const unsigned char *, b->fbuf)[0];
+
 	for (magindex = 0; magindex < nmagic; magindex++) {
 		int flush = 0;
-		struct magic *m = &magic[magindex];
-		file_regex_t **m_rxcomp = &magic_rxcomp[magindex];
+		struct magic *m;
+		file_regex_t **m_rxcomp;
+
+		/* Skip top-level tests that cannot match the first byte */
+		if (c != -1 && magic[magindex].cont_level == 0) {
+			magindex = mindex_next(mi, c, &ia, &ib, magindex);
+			if (magindex >= nmagic)
+				break;
+		}
+		m = &magic[magindex];
+		m_rxcomp = &magic_rxcomp[magindex];
 
 		if (m->type != FILE_NAME)
 		if ((IS_STRING(m->type) &&
@@ -1901,7 +1944,8 @@ mget(struct magic_set *ms, struct magic *m, const struct buffer *b,
 		    mlp = mlp->next)
 		{
 			if ((rv = match(ms, mlp->magic, mlp->magic_rxcomp,
-			    mlp->nmagic, &bb, 0, BINTEST, text, 0, indir_count,
+			    mlp->nmagic, mlp->mindex, &bb, 0, BINTEST, text, 0,
+			    indir_count,
 			    name_count, printed_something, need_separator,
 			    firstline, NULL, NULL)) != 0)
 				break;
@@ -1954,7 +1998,7 @@ mget(struct magic_set *ms, struct magic *m, const struct buffer *b,
 		nfound_match = 0;
 		(*name_count)++;
 		eoffset = ms->eoffset;
-		rv = match(ms, ml.magic, ml.magic_rxcomp, ml.nmagic, b,
+		rv = match(ms, ml.magic, ml.magic_rxcomp, ml.nmagic, NULL, b,
 		    offset + o, mode, text, flip, indir_count, name_count,
 		    printed_something, need_separator, firstline, returnval,
 		    &nfound_match);
@@ -54,6 +54,7 @@
 #define DEFAULT_TARGET_NUM_BLOCKS   204800
 #define DEFAULT_TARGET_NAME         "iqn.1994-04.org.netbsd.iscsi-target"
 #define DEFAULT_TARGET_QUEUE_DEPTH  8
+#define MAX_TARGET_QUEUE_DEPTH      64
 #define DEFAULT_TARGET_TCQ          0
 
 enum {
@@ -61,6 +62,21 @@ enum {
 
 };
 
+struct target_session_t;
+
+/* a SCSI command queued for the session's command workers */
+typedef struct target_job_t {
+	uint8_t		 header[ISCSI_HEADER_LEN];
+	iscsi_scsi_cmd_args_t scsi_cmd;
+} target_job_t;
+
+/* a command worker thread, with its own scratch buffer */
+typedef struct target_worker_t {
+	iscsi_thread_t	 thread;
+	struct target_session_t *sess;
+	uint8_t		*buff;
+} target_worker_t;
+
 /* session parameters */
 typedef struct target_session_t {
 	int             id;
@@ -84,6 +100,16 @@ typedef struct target_session_t {
 	char		initiator[MAX_INITIATOR_ADDRESS_SIZE];
 	int		address_family;
 	int32_t		last_tsih;
+	int		queue_depth;	/* max # of outstanding commands */
+	iscsi_mutex_t	tx_mutex;	/* serialises PDUs sent on sock */
+	iscsi_mutex_t	cmd_mutex;	/* protects the fields below */
+	iscsi_cond_t	cmd_cond;	/* work queued, or workers exiting */
+	iscsi_cond_t	idle_cond;	/* no commands or workers left */
+	iscsi_queue_t	cmd_q;		/* commands for the workers */
+	target_worker_t	*cmd_workers;
+	int		cmd_workerc;	/* # of running workers */
+	int		outstanding;	/* # of queued or running commands */
+	int		cmd_exit;	/* tell the workers to exit */
 } target_session_t;
 
 typedef struct target_cmd_t {
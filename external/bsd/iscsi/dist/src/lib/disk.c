@@ -248,87 +248,6 @@ de_open(disc_de_t *dp, int flags, int mode)
 	}
 }
 
-/* lseek on the extent */
-static off_t
-extent_lseek(disc_extent_t *xp, off_t off, int whence)
-{
-	return lseek(xp->fd, (long long)(xp->sacred + off), whence);
-}
-
-/* (recursively) lseek on the device's devices */
-static off_t
-device_lseek(disc_device_t *dp, off_t off, int whence)
-{
-	uint64_t	suboff;
-	off_t		ret;
-	uint32_t	d;
-
-	ret = -1;
-	switch(dp->raid) {
-	case 0:
-		if (raid0_getoff(dp, (uint64_t) off, &d, &suboff)) {
-			switch (dp->xv[d].type) {
-			case DE_DEVICE:
-				ret = device_lseek(dp->xv[d].u.dp,
-					(off_t) suboff, whence);
-				if (ret < 0) {
-					return -1;
-				}
-				break;
-			case DE_EXTENT:
-				ret = extent_lseek(dp->xv[d].u.xp,
-						(off_t) suboff, whence);
-				if (ret < 0) {
-					return -1;
-				}
-				break;
-			default:
-				break;
-			}
-		}
-		break;
-	case 1:
-		for (d = 0 ; d < dp->c ; d++) {
-			switch (dp->xv[d].type) {
-			case DE_DEVICE:
-				ret = device_lseek(dp->xv[d].u.dp, (off_t)off,
-							whence);
-				if (ret < 0) {
-					return -1;
-				}
-				break;
-			case DE_EXTENT:
-				ret = extent_lseek(dp->xv[d].u.xp, (off_t)off,
-							whence);
-				if (ret < 0) {
-					return -1;
-				}
-				break;
-			default:
-				break;
-			}
-		}
-		break;
-	default:
-		break;
-	}
-	return dp->off = ret;
-}
-
-/* and for the undecided... */
-static off_t
-de_lseek(disc_de_t *dp, off_t off, int whence)
-{
-	switch(dp->type) {
-	case DE_DEVICE:
-		return device_lseek(dp->u.dp, off, whence);
-	case DE_EXTENT:
-		return extent_lseek(dp->u.xp, off, whence);
-	default:
-		return -1;
-	}
-}
-
 /* fsync_range on the extent */
 static int
 extent_fsync_range(disc_extent_t *xp, int how, off_t from, off_t len)
@@ -415,16 +334,16 @@ de_fsync_range(disc_de_t *dp, int how, off_t from, off_t len)
 	}
 }
 
-/* read from the extent */
+/* read from the extent at the given offset */
 static ssize_t
-extent_read(disc_extent_t *xp, void *buf, size_t cc)
+extent_pread(disc_extent_t *xp, void *buf, size_t cc, off_t off)
 {
-	return read(xp->fd, buf, cc);
+	return pread(xp->fd, buf, cc, (off_t)(xp->sacred + off));
 }
 
-/* (recursively) read from the device's devices */
+/* (recursively) read from the device's devices at the given offset */
 static ssize_t
-device_read(disc_device_t *dp, void *buf, size_t cc)
+device_pread(disc_device_t *dp, void *buf, size_t cc, off_t off)
 {
 	uint64_t	 suboff;
 	uint64_t	 got;
@@ -437,56 +356,44 @@ device_read(disc_device_t *dp, void *buf, size_t cc)
 	switch(dp->raid) {
 	case 0:
 		for (cbuf = (char *) buf, got = 0 ; got < cc ; got += ret) {
-			if (!raid0_getoff(dp, dp->off, &d, &suboff)) {
+			if (!raid0_getoff(dp, (uint64_t)off + got, &d,
+					&suboff)) {
 				return -1;
 			}
-			if (device_lseek(dp, (off_t)dp->off, SEEK_SET) < 0) {
-				return -1;
-			}
-			subcc = MIN(cc - (size_t)got,
-					(size_t)(dp->len - (size_t)dp->off));
+			subcc = (size_t)MIN(cc - got, dp->xv[d].size - suboff);
 			switch (dp->xv[d].type) {
 			case DE_DEVICE:
-				ret = device_read(dp->xv[d].u.dp,
-						&cbuf[(int)got], subcc);
-				if (ret < 0) {
-					return -1;
-				}
+				ret = device_pread(dp->xv[d].u.dp,
+						&cbuf[got], subcc,
+						(off_t)suboff);
 				break;
 			case DE_EXTENT:
-				ret = extent_read(dp->xv[d].u.xp,
-						&cbuf[(int)got], subcc);
-				if (ret < 0) {
-					return -1;
-				}
+				ret = extent_pread(dp->xv[d].u.xp,
+						&cbuf[got], subcc,
+						(off_t)suboff);
 				break;
 			default:
+				ret = -1;
 				break;
 			}
-			dp->off += ret;
+			if (ret <= 0) {
+				return (got > 0) ? (ssize_t)got : ret;
+			}
 		}
 		ret = (ssize_t)got;
 		break;
 	case 1:
-		for (d = 0 ; d < dp->c ; d++) {
-			switch (dp->xv[d].type) {
-			case DE_DEVICE:
-				ret = device_read(dp->xv[d].u.dp, buf, cc);
-				if (ret < 0) {
-					return -1;
-				}
-				break;
-			case DE_EXTENT:
-				ret = extent_read(dp->xv[d].u.xp, buf, cc);
-				if (ret < 0) {
-					return -1;
-				}
-				break;
-			default:
-				break;
-			}
+		/* all the mirrors hold the same data, so read the first */
+		switch (dp->xv[0].type) {
+		case DE_DEVICE:
+			ret = device_pread(dp->xv[0].u.dp, buf, cc, off);
+			break;
+		case DE_EXTENT:
+			ret = extent_pread(dp->xv[0].u.xp, buf, cc, off);
+			break;
+		default:
+			break;
 		}
-		dp->off += ret;
 		break;
 	default:
 		break;
@@ -496,67 +403,62 @@ device_read(disc_device_t *dp, void *buf, size_t cc)
 
 /* and for the undecided... */
 static ssize_t
-de_read(disc_de_t *dp, void *buf, size_t cc)
+de_pread(disc_de_t *dp, void *buf, size_t cc, off_t off)
 {
 	switch(dp->type) {
 	case DE_DEVICE:
-		return device_read(dp->u.dp, buf, cc);
+		return device_pread(dp->u.dp, buf, cc, off);
 	case DE_EXTENT:
-		return extent_read(dp->u.xp, buf, cc);
+		return extent_pread(dp->u.xp, buf, cc, off);
 	default:
 		return -1;
 	}
 }
 
-/* write to the extent */
+/* write to the extent at the given offset */
 static ssize_t
-extent_write(disc_extent_t *xp, void *buf, size_t cc)
+extent_pwrite(disc_extent_t *xp, const void *buf, size_t cc, off_t off)
 {
-	return write(xp->fd, buf, cc);
+	return pwrite(xp->fd, buf, cc, (off_t)(xp->sacred + off));
 }
 
-/* (recursively) write to the device's devices */
+/* (recursively) write to the device's devices at the given offset */
 static ssize_t
-device_write(disc_device_t *dp, void *buf, size_t cc)
+device_pwrite(disc_device_t *dp, const void *buf, size_t cc, off_t off)
 {
 	uint64_t	 suboff;
 	uint64_t	 done;
 	uint32_t	 d;
 	ssize_t		 ret;
 	size_t		 subcc;
-	char		*cbuf;
+	const char	*cbuf;
 
 	ret = -1;
 	switch(dp->raid) {
 	case 0:
-		for (cbuf = (char *) buf, done = 0 ; done < cc ; done += ret) {
-			if (!raid0_getoff(dp, dp->off, &d, &suboff)) {
-				return -1;
-			}
-			subcc = (size_t)MIN(cc - (size_t)done,
-					(size_t)(dp->len - dp->off));
-			if (device_lseek(dp, (off_t)dp->off, SEEK_SET) < 0) {
+		for (cbuf = (const char *) buf, done = 0 ; done < cc ;
+		     done += ret) {
+			if (!raid0_getoff(dp, (uint64_t)off + done, &d,
+					&suboff)) {
 				return -1;
 			}
+			subcc = (size_t)MIN(cc - done, dp->xv[d].size - suboff);
 			switch (dp->xv[d].type) {
 			case DE_DEVICE:
-				ret = device_write(dp->xv[d].u.dp,
-					&cbuf[(int)done], subcc);
-				if (ret < 0) {
-					return -1;
-				}
+				ret = device_pwrite(dp->xv[d].u.dp,
+					&cbuf[done], subcc, (off_t)suboff);
 				break;
 			case DE_EXTENT:
-				ret = extent_write(dp->xv[d].u.xp,
-						&cbuf[(int)done], subcc);
-				if (ret < 0) {
-					return -1;
-				}
+				ret = extent_pwrite(dp->xv[d].u.xp,
+					&cbuf[done], subcc, (off_t)suboff);
 				break;
 			default:
+				ret = -1;
 				break;
 			}
-			dp->off += ret;
+			if (ret <= 0) {
+				return -1;
+			}
 		}
 		ret = (ssize_t) done;
 		break;
@@ -564,19 +466,21 @@ device_write(disc_device_t *dp, void *buf, size_t cc)
 		for (d = 0 ; d < dp->c ; d++) {
 			switch (dp->xv[d].type) {
 			case DE_DEVICE:
-				ret = device_write(dp->xv[d].u.dp, buf, cc);
+				ret = device_pwrite(dp->xv[d].u.dp, buf, cc,
+						off);
 				if (ret < 0) {
 					iscsi_err(__FILE__, __LINE__,
-						"device_write RAID1 device "
+						"device_pwrite RAID1 device "
 						"write failure\n");
 					return -1;
 				}
 				break;
 			case DE_EXTENT:
-				ret = extent_write(dp->xv[d].u.xp, buf, cc);
+				ret = extent_pwrite(dp->xv[d].u.xp, buf, cc,
+						off);
 				if (ret < 0) {
 					iscsi_err(__FILE__, __LINE__,
-						"device_write RAID1 extent "
+						"device_pwrite RAID1 extent "
 						"write failure\n");
 					return -1;
 				}
@@ -585,7 +489,6 @@ device_write(disc_device_t *dp, void *buf, size_t cc)
 				break;
 			}
 		}
-		dp->off += ret;
 		break;
 	default:
 		break;
@@ -595,13 +498,13 @@ device_write(disc_device_t *dp, void *buf, size_t cc)
 
 /* and for the undecided... */
 static ssize_t
-de_write(disc_de_t *dp, void *buf, size_t cc)
+de_pwrite(disc_de_t *dp, const void *buf, size_t cc, off_t off)
 {
 	switch(dp->type) {
 	case DE_DEVICE:
-		return device_write(dp->u.dp, buf, cc);
+		return device_pwrite(dp->u.dp, buf, cc, off);
 	case DE_EXTENT:
-		return extent_write(dp->u.xp, buf, cc);
+		return extent_pwrite(dp->u.xp, buf, cc, off);
 	default:
 		return -1;
 	}
@@ -700,8 +603,8 @@ device_set_var(const char *var, const char *arg)
 	}
 }
 
-/* allocate some space for a disk/extent, using an lseek, read and
-* write combination */
+/* allocate some space for a disk/extent, by reading and rewriting
+* its last block */
 static int
 de_allocate(disc_de_t *de, char *filename, uint64_t blocklen)
 {
@@ -710,19 +613,13 @@ de_allocate(disc_de_t *de, char *filename, uint64_t blocklen)
 
 	block = malloc(blocklen);
 	size = de_getsize(de);
-	if (de_lseek(de, size - blocklen, SEEK_SET) == -1) {
-		iscsi_err(__FILE__, __LINE__,
-				"error seeking \"%s\"\n", filename);
-		free(block);
-		return 0;
-	}
-	if (de_read(de, block, blocklen) == -1) {
+	if (de_pread(de, block, blocklen, size - blocklen) == -1) {
 		iscsi_err(__FILE__, __LINE__,
 				"error reading \"%s\"\n", filename);
 		free(block);
 		return 0;
 	}
-	if (de_write(de, block, blocklen) == -1) {
+	if (de_pwrite(de, block, blocklen, size - blocklen) == -1) {
 		iscsi_err(__FILE__, __LINE__,
 				"error writing \"%s\"\n", filename);
 		free(block);
@@ -1420,14 +1317,6 @@ disk_write(target_session_t *sess, iscsi_scsi_cmd_args_t *args, uint8_t lun,
 		goto out;
 	}
 	/* Finish up write */
-	if (de_lseek(&disks.v[sess->d].lunv->v[lun].de, (off_t)byte_offset,
-				SEEK_SET) == -1) {
-		iscsi_err(__FILE__, __LINE__,
-			"lseek() to offset %" PRIu64 " failed\n",
-			byte_offset);
-		result = -1;
-		goto out;
-	}
 	if (!target_writable(&disks.v[sess->d].lunv->v[lun])) {
 		iscsi_err(__FILE__, __LINE__,
 			"write() of %" PRIu64 " bytes failed at offset %"
@@ -1437,8 +1326,8 @@ disk_write(target_session_t *sess, iscsi_scsi_cmd_args_t *args, uint8_t lun,
 		result = -1;
 		goto out;
 	}
-	if ((uint64_t)de_write(&disks.v[sess->d].lunv->v[lun].de, ptr,
-			(unsigned) bytec) != bytec) {
+	if ((uint64_t)de_pwrite(&disks.v[sess->d].lunv->v[lun].de, ptr,
+			(unsigned) bytec, (off_t)byte_offset) != bytec) {
 		iscsi_err(__FILE__, __LINE__,
 			"write() of %" PRIu64 " bytes failed at offset %"
 			PRIu64 ", size %" PRIu64 "\n",
@@ -1492,14 +1381,8 @@ disk_read(target_session_t *sess, iscsi_scsi_cmd_args_t *args, uint32_t lba,
 	ptr = malloc(MB(1));
 	n = 0;
 	do {
-		if (de_lseek(&disks.v[sess->d].lunv->v[lun].de,
-				(off_t)(n + byte_offset), SEEK_SET) == -1) {
-			iscsi_err(__FILE__, __LINE__, "lseek failed\n");
-			result = -1;
-			goto out;
-		}
-		rc = de_read(&disks.v[sess->d].lunv->v[lun].de, ptr + n,
-				(size_t)(bytec - n));
+		rc = de_pread(&disks.v[sess->d].lunv->v[lun].de, ptr + n,
+				(size_t)(bytec - n), (off_t)(n + byte_offset));
 		if (rc <= 0) {
 			iscsi_err(__FILE__, __LINE__,
 				"read failed: rc %d errno %d\n", rc, errno);
@@ -91,6 +91,8 @@
 #endif
            
 
+#include "scsi_cmd_codes.h"
+
 #include "iscsiprotocol.h"
 #include "conffile.h"
 #include "storage.h"
@@ -164,167 +166,39 @@ reject_t(target_session_t * sess, uint8_t *header, uint8_t reason)
 	return 0;
 }
 
-static int 
-scsi_command_t(target_session_t *sess, uint8_t *header)
+/*
+ * Execute a decoded SCSI command, and send its data and response.
+ * This runs on the session's Rx thread, or on a command worker for
+ * commands queued by scsi_command_t(); buff is a scratch buffer of
+ * MaxRecvDataSegmentLength bytes for device_command().  The job is
+ * freed.
+ */
+static int
+scsi_command_exec(target_session_t *sess, target_job_t *job, uint8_t *buff)
 {
-	iscsi_scsi_cmd_args_t	scsi_cmd;
+	iscsi_scsi_cmd_args_t	*scsi_cmd = &job->scsi_cmd;
 	iscsi_read_data_t	data;
 	iscsi_scsi_rsp_t	scsi_rsp;
 	target_cmd_t		cmd;
 	uint32_t		DataSN = 0;
 	uint8_t			rsp_header[ISCSI_HEADER_LEN];
 	struct iovec		*sg_new = NULL;
+	int			locked = 0;
 	int			result;
 
-	(void) memset(&scsi_cmd, 0x0, sizeof(scsi_cmd));
-	scsi_cmd.ahs = NULL;
-	scsi_cmd.send_buffer = NULL;
-	if (iscsi_scsi_cmd_decap(header, &scsi_cmd) != 0) {
-		iscsi_err(__FILE__, __LINE__,
-				"iscsi_scsi_cmd_decap() failed\n");
-		result = -1;
-		goto out;
-	}
-	iscsi_trace(TRACE_ISCSI_DEBUG,
-		"session %d: SCSI Command (CmdSN %u, op %#x)\n",
-		sess->id, scsi_cmd.CmdSN, scsi_cmd.cdb[0]);
-
-	/* For Non-immediate commands, the CmdSN should be between ExpCmdSN  */
-	/* and MaxCmdSN, inclusive of both.  Otherwise, ignore the command */
-	if (!scsi_cmd.immediate &&
-	    (scsi_cmd.CmdSN < sess->ExpCmdSN ||
-	     scsi_cmd.CmdSN > sess->MaxCmdSN)) {
-		iscsi_err(__FILE__, __LINE__,
-			"CmdSN(%d) of SCSI Command not valid, "
-			"ExpCmdSN(%d) MaxCmdSN(%d). Ignoring the command\n",
-			scsi_cmd.CmdSN, sess->ExpCmdSN, sess->MaxCmdSN);
-		result = 0;
-		goto out;
-	}
-	/* Arg check.   */
-	scsi_cmd.attr = 0;	/* Temp fix FIXME */
-	/*
-	 * RETURN_NOT_EQUAL("ATTR (FIX ME)", scsi_cmd.attr, 0, NO_CLEANUP,
-	 * -1);
-	 */
-
-	/* Check Numbering */
-
-	if (scsi_cmd.CmdSN != sess->ExpCmdSN) {
-		iscsi_warn(__FILE__, __LINE__,
-			"Expected CmdSN %d, got %d. "
-			"(ignoring and resetting expectations)\n",
-			sess->ExpCmdSN, scsi_cmd.CmdSN);
-		sess->ExpCmdSN = scsi_cmd.CmdSN;
-	}
-	/* Check Transfer Lengths */
-	if (sess->sess_params.first_burst_length
-	    && (scsi_cmd.length > sess->sess_params.first_burst_length)) {
-		iscsi_err(__FILE__, __LINE__,
-			"scsi_cmd.length (%u) > FirstBurstLength (%u)\n",
-			scsi_cmd.length, sess->sess_params.first_burst_length);
-		scsi_cmd.status = 0x02;
-		scsi_cmd.length = 0;
+	cmd.callback = NULL;
+	if (scsi_cmd->status) {
+		/* rejected by scsi_command_t() */
 		goto response;
 	}
-	if (sess->sess_params.max_dataseg_len &&
-	    scsi_cmd.length > sess->sess_params.max_dataseg_len) {
-		iscsi_err(__FILE__, __LINE__,
-			"scsi_cmd.length (%u) > MaxRecvDataSegmentLength "
-			"(%u)\n",
-			scsi_cmd.length, sess->sess_params.max_dataseg_len);
-		result = -1;
-		goto out;
-	}
-
-#if 0
-	/* commented out in original Intel reference code */
-	if (scsi_cmd.final && scsi_cmd.output) {
-		RETURN_NOT_EQUAL("Length", scsi_cmd.length,
-			scsi_cmd.trans_len, NO_CLEANUP, -1);
-	}
-#endif
-
-	/* Read AHS.  Need to optimize/clean this.   */
-	/* We should not be calling malloc(). */
-	/* We need to check for properly formated AHS segments. */
-
-	if (scsi_cmd.ahs_len) {
-		uint32_t        ahs_len;
-		uint8_t  *ahs_ptr;
-		uint8_t   ahs_type;
 
-		iscsi_trace(TRACE_ISCSI_DEBUG,
-				"reading %u bytes AHS\n", scsi_cmd.ahs_len);
-		scsi_cmd.ahs = iscsi_malloc_atomic((unsigned)scsi_cmd.ahs_len);
-		if (scsi_cmd.ahs == NULL) {
-			iscsi_err(__FILE__, __LINE__,
-				"iscsi_malloc_atomic() failed\n");
-			result = -1;
-			goto out;
-		}
-		if (iscsi_sock_msg(sess->sock, 0, (unsigned)scsi_cmd.ahs_len,
-				scsi_cmd.ahs, 0) != scsi_cmd.ahs_len) {
-			iscsi_err(__FILE__, __LINE__,
-				"iscsi_sock_msg() failed\n");
-			result = -1;
-			goto out;
-		}
-		iscsi_trace(TRACE_ISCSI_DEBUG,
-				"read %u bytes AHS\n", scsi_cmd.ahs_len);
-		for (ahs_ptr = scsi_cmd.ahs;
-		     ahs_ptr < (scsi_cmd.ahs + scsi_cmd.ahs_len - 1) ;
-		     ahs_ptr += ahs_len) {
-			ahs_len = ISCSI_NTOHS(*((uint16_t *) (void *)ahs_ptr));
-			if (ahs_len == 0) {
-				iscsi_err(__FILE__, __LINE__,
-				 		"Zero ahs_len\n");
-				result = -1;
-				goto out;
-			}
-			switch (ahs_type = *(ahs_ptr + 2)) {
-			case ISCSI_AHS_EXTENDED_CDB:
-				iscsi_trace(TRACE_ISCSI_DEBUG,
-					"Got ExtendedCDB AHS - %u bytes extra "
-					"CDB)\n", ahs_len - 1);
-				scsi_cmd.ext_cdb = ahs_ptr + 4;
-				break;
-			case ISCSI_AHS_BIDI_READ:
-				scsi_cmd.bidi_trans_len =
-					ISCSI_NTOHL(*((uint32_t *)(void *)
-							(ahs_ptr + 4)));
-				*((uint32_t *)(void *)(ahs_ptr + 4)) =
-						scsi_cmd.bidi_trans_len;
-				iscsi_trace(TRACE_ISCSI_DEBUG,
-					"Got Bidirectional Read AHS "
-					"(expected read length %u)\n",
-					scsi_cmd.bidi_trans_len);
-				break;
-			default:
-				iscsi_err(__FILE__, __LINE__,
-					"unknown AHS type %x\n", ahs_type);
-				result = -1;
-				goto out;
-			}
-		}
-		iscsi_trace(TRACE_ISCSI_DEBUG,
-			"done parsing %u bytes AHS\n", scsi_cmd.ahs_len);
-	} else {
-		iscsi_trace(TRACE_ISCSI_DEBUG, "no AHS to read\n");
-		scsi_cmd.ahs = NULL;
-	}
-
-	sess->ExpCmdSN++;
-	sess->MaxCmdSN++;
-
-	/* Execute cdb.  device_command() will set scsi_cmd.input if
+	/* Execute cdb.  device_command() will set scsi_cmd->input if
 	* there is input data and set the length of the input to
-	* either scsi_cmd.trans_len or scsi_cmd.bidi_trans_len,
-	* depending on whether scsi_cmd.output was set.  */
-	scsi_cmd.send_data = sess->buff;
-	scsi_cmd.input = 0;
-	cmd.scsi_cmd = &scsi_cmd;
-	cmd.callback = NULL;
+	* either scsi_cmd->trans_len or scsi_cmd->bidi_trans_len,
+	* depending on whether scsi_cmd->output was set.  */
+	scsi_cmd->send_data = buff;
+	scsi_cmd->input = 0;
+	cmd.scsi_cmd = scsi_cmd;
 	if (device_command(sess, &cmd) != 0) {
 		iscsi_err(__FILE__, __LINE__,
 				"device_command() failed\n");
@@ -333,8 +207,10 @@ scsi_command_t(target_session_t *sess, uint8_t *header)
 	}
 	/* Send any input data */
 
-	scsi_cmd.bytes_sent = 0;
-	if (!scsi_cmd.status && scsi_cmd.input) {
+	ISCSI_LOCK(&sess->tx_mutex, result = -1; goto out);
+	locked = 1;
+	scsi_cmd->bytes_sent = 0;
+	if (!scsi_cmd->status && scsi_cmd->input) {
 		struct iovec    sg_singleton;
 		struct iovec   *sg, *sg_orig;
 		int             sg_len_orig, sg_len;
@@ -342,24 +218,24 @@ scsi_command_t(target_session_t *sess, uint8_t *header)
 		int             fragment_flag = 0;
 		int             offset_inc;
 
-		if (scsi_cmd.output) {
+		if (scsi_cmd->output) {
 			iscsi_trace(TRACE_ISCSI_DEBUG,
 				"sending %u bytes bi-directional input data\n",
-				scsi_cmd.bidi_trans_len);
-			trans_len = scsi_cmd.bidi_trans_len;
+				scsi_cmd->bidi_trans_len);
+			trans_len = scsi_cmd->bidi_trans_len;
 		} else {
-			trans_len = scsi_cmd.trans_len;
+			trans_len = scsi_cmd->trans_len;
 		}
 		iscsi_trace(TRACE_ISCSI_DEBUG,
 			"sending %u bytes input data as separate PDUs\n",
 			trans_len);
 
-		if (scsi_cmd.send_sg_len) {
-			sg_orig = (struct iovec *)(void *)scsi_cmd.send_data;
-			sg_len_orig = scsi_cmd.send_sg_len;
+		if (scsi_cmd->send_sg_len) {
+			sg_orig = (struct iovec *)(void *)scsi_cmd->send_data;
+			sg_len_orig = scsi_cmd->send_sg_len;
 		} else {
 			sg_len_orig = 1;
-			sg_singleton.iov_base = scsi_cmd.send_data;
+			sg_singleton.iov_base = scsi_cmd->send_data;
 			sg_singleton.iov_len = trans_len;
 			sg_orig = &sg_singleton;
 		}
@@ -400,7 +276,7 @@ scsi_command_t(target_session_t *sess, uint8_t *header)
 
 				if (sess->UsePhaseCollapsedRead) {
 					data.status = 1;
-					data.status = scsi_cmd.status;
+					data.status = scsi_cmd->status;
 					data.StatSN = ++(sess->StatSN);
 					iscsi_trace(TRACE_ISCSI_DEBUG, "status %#x collapsed into last data PDU\n", data.status);
 				} else {
@@ -411,7 +287,7 @@ scsi_command_t(target_session_t *sess, uint8_t *header)
 				result = -1;
 				goto out;
 			}
-			data.task_tag = scsi_cmd.tag;
+			data.task_tag = scsi_cmd->tag;
 			data.ExpCmdSN = sess->ExpCmdSN;
 			data.MaxCmdSN = sess->MaxCmdSN;
 			data.DataSN = DataSN++;
@@ -427,7 +303,7 @@ scsi_command_t(target_session_t *sess, uint8_t *header)
 				result = -1;
 				goto out;
 			}
-			scsi_cmd.bytes_sent += data.length;
+			scsi_cmd->bytes_sent += data.length;
 			iscsi_trace(TRACE_ISCSI_DEBUG, "sent read data PDU ok (offset %u, len %u)\n", data.offset, data.length);
 		}
 		iscsi_trace(TRACE_ISCSI_DEBUG, "successfully sent %u bytes read data\n", trans_len);
@@ -440,28 +316,32 @@ scsi_command_t(target_session_t *sess, uint8_t *header)
          * 3) command had non-zero status and possible sense data
          */
 response:
-	if (!sess->UsePhaseCollapsedRead || !scsi_cmd.length || scsi_cmd.status) {
+	if (!locked) {
+		ISCSI_LOCK(&sess->tx_mutex, result = -1; goto out);
+		locked = 1;
+	}
+	if (!sess->UsePhaseCollapsedRead || !scsi_cmd->length || scsi_cmd->status) {
 		iscsi_trace(TRACE_ISCSI_DEBUG, "sending SCSI response PDU\n");
 		(void) memset(&scsi_rsp, 0x0, sizeof(scsi_rsp));
-		scsi_rsp.length = scsi_cmd.status ? scsi_cmd.length : 0;
-		scsi_rsp.tag = scsi_cmd.tag;
+		scsi_rsp.length = scsi_cmd->status ? scsi_cmd->length : 0;
+		scsi_rsp.tag = scsi_cmd->tag;
 		/* If r2t send, then the StatSN is already incremented */
-		if (sess->StatSN < scsi_cmd.ExpStatSN) {
+		if (sess->StatSN < scsi_cmd->ExpStatSN) {
 			++sess->StatSN;
 		}
 		scsi_rsp.StatSN = sess->StatSN;
 		scsi_rsp.ExpCmdSN = sess->ExpCmdSN;
 		scsi_rsp.MaxCmdSN = sess->MaxCmdSN;
-		scsi_rsp.ExpDataSN = (!scsi_cmd.status && scsi_cmd.input) ? DataSN : 0;
+		scsi_rsp.ExpDataSN = (!scsi_cmd->status && scsi_cmd->input) ? DataSN : 0;
 		scsi_rsp.response = 0x00;	/* iSCSI response */
-		scsi_rsp.status = scsi_cmd.status;	/* SCSI status */
+		scsi_rsp.status = scsi_cmd->status;	/* SCSI status */
 		if (iscsi_scsi_rsp_encap(rsp_header, &scsi_rsp) != 0) {
 			iscsi_err(__FILE__, __LINE__, "iscsi_scsi_rsp_encap() failed\n");
 			result = -1;
 			goto out;
 		}
 		if ((uint32_t)iscsi_sock_send_header_and_data(sess->sock, rsp_header, ISCSI_HEADER_LEN,
-		  scsi_cmd.send_data, scsi_rsp.length, scsi_cmd.send_sg_len)
+		  scsi_cmd->send_data, scsi_rsp.length, scsi_cmd->send_sg_len)
 		    != ISCSI_HEADER_LEN + scsi_rsp.length) {
 			iscsi_err(__FILE__, __LINE__,
 				"iscsi_sock_send_header_and_data() failed\n");
@@ -470,27 +350,27 @@ response:
 		}
 		/* Make sure all data was transferred */
 
-		if (scsi_cmd.output) {
-			if (scsi_cmd.bytes_recv != scsi_cmd.trans_len) {
+		if (scsi_cmd->output) {
+			if (scsi_cmd->bytes_recv != scsi_cmd->trans_len) {
 				iscsi_err(__FILE__, __LINE__,
-					"scsi_cmd.bytes_recv");
+					"scsi_cmd->bytes_recv");
 				result = -1;
 				goto out;
 			}
-			if (scsi_cmd.input) {
-				if (scsi_cmd.bytes_sent !=
-						scsi_cmd.bidi_trans_len) {
+			if (scsi_cmd->input) {
+				if (scsi_cmd->bytes_sent !=
+						scsi_cmd->bidi_trans_len) {
 					iscsi_err(__FILE__, __LINE__,
-						"scsi_cmd.bytes_sent");
+						"scsi_cmd->bytes_sent");
 					result = -1;
 					goto out;
 				}
 			}
 		} else {
-			if (scsi_cmd.input) {
-				if (scsi_cmd.bytes_sent != scsi_cmd.trans_len) {
+			if (scsi_cmd->input) {
+				if (scsi_cmd->bytes_sent != scsi_cmd->trans_len) {
 					iscsi_err(__FILE__, __LINE__,
-						"scsi_cmd.bytes_sent");
+						"scsi_cmd->bytes_sent");
 					result = -1;
 					goto out;
 				}
@@ -498,6 +378,9 @@ response:
 		}
 	}
 
+	ISCSI_UNLOCK(&sess->tx_mutex, result = -1; goto out);
+	locked = 0;
+
 	/* Device callback after command has completed */
 	if (cmd.callback) {
 		iscsi_trace(TRACE_ISCSI_DEBUG, "issuing device callback\n");
@@ -510,13 +393,357 @@ response:
 	}
 	result = 0;
 out:
-	if (scsi_cmd.ahs != NULL) {					\
-		iscsi_free_atomic(scsi_cmd.ahs);			\
+	if (locked) {
+		ISCSI_UNLOCK(&sess->tx_mutex, result = -1);
+	}
+	if (scsi_cmd->ahs != NULL) {					\
+		iscsi_free_atomic(scsi_cmd->ahs);			\
 	}								\
 	if (sg_new != NULL) {
 		iscsi_free_atomic(sg_new);
 	}
-	free(scsi_cmd.send_buffer);
+	free(scsi_cmd->send_buffer);
+	iscsi_free_atomic(job);
+	return result;
+}
+
+/*
+ * Command workers.  READs are decoded on the session's Rx thread and
+ * queued for a pool of worker threads, which do the disk I/O and send
+ * the data and response under tx_mutex, so several of them can be
+ * outstanding while the Rx thread reads the next command.  Anything
+ * else waits for the queue to drain and runs on the Rx thread, as
+ * before.
+ */
+static int
+cmd_worker_proc_t(void *arg)
+{
+	target_worker_t	*me = (target_worker_t *) arg;
+	target_session_t *sess = me->sess;
+	target_job_t	*job;
+
+	ISCSI_THREAD_START("cmd_worker_thread");
+	ISCSI_LOCK(&sess->cmd_mutex, return -1);
+	for (;;) {
+		while ((job = iscsi_queue_remove(&sess->cmd_q)) == NULL &&
+		       !sess->cmd_exit) {
+			ISCSI_WAIT(&sess->cmd_cond, &sess->cmd_mutex,
+				return -1);
+		}
+		if (job == NULL) {
+			break;
+		}
+		ISCSI_UNLOCK(&sess->cmd_mutex, return -1);
+		if (scsi_command_exec(sess, job, me->buff) != 0) {
+			iscsi_err(__FILE__, __LINE__,
+				"session %d: scsi_command_exec() failed\n",
+				sess->id);
+			/* the Rx thread will see the connection drop */
+			(void) iscsi_sock_shutdown(sess->sock, 2);
+		}
+		ISCSI_LOCK(&sess->cmd_mutex, return -1);
+		if (--sess->outstanding == 0) {
+			ISCSI_SIGNAL(&sess->idle_cond, ;);
+		}
+	}
+	/* pass the exit request on to the next worker */
+	sess->cmd_workerc -= 1;
+	ISCSI_SIGNAL(&sess->cmd_cond, ;);
+	ISCSI_SIGNAL(&sess->idle_cond, ;);
+	ISCSI_UNLOCK(&sess->cmd_mutex, return -1);
+	return 0;
+}
+
+/* start the session's command workers */
+static int
+cmd_start(target_session_t *sess)
+{
+	target_worker_t	*w;
+	unsigned	 len;
+	int		 i;
+
+	len = (unsigned) param_atoi(sess->params, "MaxRecvDataSegmentLength");
+	if (iscsi_queue_init(&sess->cmd_q, sess->queue_depth) != 0) {
+		return -1;
+	}
+	NEWARRAY(target_worker_t, sess->cmd_workers, sess->queue_depth,
+		"cmd_start", iscsi_queue_destroy(&sess->cmd_q); return -1);
+	for (i = 0 ; i < sess->queue_depth ; i++) {
+		w = &sess->cmd_workers[i];
+		w->sess = sess;
+		if ((w->buff = iscsi_malloc(len)) == NULL) {
+			iscsi_err(__FILE__, __LINE__,
+				"iscsi_malloc() failed\n");
+			break;
+		}
+		ISCSI_LOCK(&sess->cmd_mutex, return -1);
+		if (iscsi_thread_create(&w->thread,
+				(void *) cmd_worker_proc_t, w) != 0) {
+			ISCSI_UNLOCK(&sess->cmd_mutex, return -1);
+			iscsi_free(w->buff);
+			w->buff = NULL;
+			break;
+		}
+		sess->cmd_workerc += 1;
+		ISCSI_UNLOCK(&sess->cmd_mutex, return -1);
+	}
+	iscsi_trace(TRACE_ISCSI_DEBUG, "session %d: %d command workers\n",
+		sess->id, sess->cmd_workerc);
+	return (sess->cmd_workerc > 0) ? 0 : -1;
+}
+
+/* wait for the commands given to the workers to complete */
+static int
+cmd_drain(target_session_t *sess)
+{
+	if (sess->cmd_workers == NULL) {
+		return 0;
+	}
+	ISCSI_LOCK(&sess->cmd_mutex, return -1);
+	while (sess->outstanding > 0) {
+		ISCSI_WAIT(&sess->idle_cond, &sess->cmd_mutex, return -1);
+	}
+	ISCSI_UNLOCK(&sess->cmd_mutex, return -1);
+	return 0;
+}
+
+/* drain the queue, and stop the session's command workers */
+static void
+cmd_stop(target_session_t *sess)
+{
+	int	i;
+
+	if (sess->cmd_workers == NULL) {
+		return;
+	}
+	ISCSI_LOCK(&sess->cmd_mutex, return);
+	sess->cmd_exit = 1;
+	ISCSI_SIGNAL(&sess->cmd_cond, ;);
+	while (sess->cmd_workerc > 0 || sess->outstanding > 0) {
+		ISCSI_WAIT(&sess->idle_cond, &sess->cmd_mutex, ;);
+	}
+	ISCSI_UNLOCK(&sess->cmd_mutex, return);
+	for (i = 0 ; i < sess->queue_depth ; i++) {
+		if (sess->cmd_workers[i].buff != NULL) {
+			iscsi_free(sess->cmd_workers[i].buff);
+		}
+	}
+	free(sess->cmd_workers);
+	sess->cmd_workers = NULL;
+	iscsi_queue_destroy(&sess->cmd_q);
+}
+
+/* return non-zero if the command can run out of order on a worker */
+static int
+cmd_may_queue(target_session_t *sess, iscsi_scsi_cmd_args_t *scsi_cmd)
+{
+	if (sess->queue_depth <= 1 || scsi_cmd->output ||
+	    scsi_cmd->length != 0) {
+		return 0;
+	}
+	switch (scsi_cmd->cdb[0]) {
+	case READ_6:
+	case READ_10:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* queue a command for the workers, starting them if need be */
+static int
+cmd_enqueue(target_session_t *sess, target_job_t *job)
+{
+	if (sess->cmd_workers == NULL && cmd_start(sess) != 0) {
+		/* run everything on the Rx thread from now on */
+		cmd_stop(sess);
+		sess->queue_depth = 1;
+		return -1;
+	}
+	ISCSI_LOCK(&sess->cmd_mutex, return -1);
+	if (iscsi_queue_full(&sess->cmd_q)) {
+		ISCSI_UNLOCK(&sess->cmd_mutex, return -1);
+		return -1;
+	}
+	(void) iscsi_queue_insert(&sess->cmd_q, job);
+	sess->outstanding += 1;
+	ISCSI_SIGNAL(&sess->cmd_cond, ;);
+	ISCSI_UNLOCK(&sess->cmd_mutex, return -1);
+	return 0;
+}
+
+static int 
+scsi_command_t(target_session_t *sess, uint8_t *header)
+{
+	iscsi_scsi_cmd_args_t	*scsi_cmd;
+	target_job_t		*job;
+	int			result;
+
+	if ((job = iscsi_malloc_atomic(sizeof(*job))) == NULL) {
+		iscsi_err(__FILE__, __LINE__,
+				"iscsi_malloc_atomic() failed\n");
+		return -1;
+	}
+	(void) memset(job, 0x0, sizeof(*job));
+	(void) memcpy(job->header, header, ISCSI_HEADER_LEN);
+	scsi_cmd = &job->scsi_cmd;
+	scsi_cmd->ahs = NULL;
+	scsi_cmd->send_buffer = NULL;
+	if (iscsi_scsi_cmd_decap(job->header, scsi_cmd) != 0) {
+		iscsi_err(__FILE__, __LINE__,
+				"iscsi_scsi_cmd_decap() failed\n");
+		result = -1;
+		goto bad;
+	}
+	iscsi_trace(TRACE_ISCSI_DEBUG,
+		"session %d: SCSI Command (CmdSN %u, op %#x)\n",
+		sess->id, scsi_cmd->CmdSN, scsi_cmd->cdb[0]);
+
+	/* For Non-immediate commands, the CmdSN should be between ExpCmdSN  */
+	/* and MaxCmdSN, inclusive of both.  Otherwise, ignore the command */
+	if (!scsi_cmd->immediate &&
+	    (scsi_cmd->CmdSN < sess->ExpCmdSN ||
+	     scsi_cmd->CmdSN > sess->MaxCmdSN)) {
+		iscsi_err(__FILE__, __LINE__,
+			"CmdSN(%d) of SCSI Command not valid, "
+			"ExpCmdSN(%d) MaxCmdSN(%d). Ignoring the command\n",
+			scsi_cmd->CmdSN, sess->ExpCmdSN, sess->MaxCmdSN);
+		result = 0;
+		goto bad;
+	}
+	/* Arg check.   */
+	scsi_cmd->attr = 0;	/* Temp fix FIXME */
+	/*
+	 * RETURN_NOT_EQUAL("ATTR (FIX ME)", scsi_cmd->attr, 0, NO_CLEANUP,
+	 * -1);
+	 */
+
+	/* Check Numbering */
+
+	if (scsi_cmd->CmdSN != sess->ExpCmdSN) {
+		iscsi_warn(__FILE__, __LINE__,
+			"Expected CmdSN %d, got %d. "
+			"(ignoring and resetting expectations)\n",
+			sess->ExpCmdSN, scsi_cmd->CmdSN);
+		sess->ExpCmdSN = scsi_cmd->CmdSN;
+	}
+	/* Check Transfer Lengths */
+	if (sess->sess_params.first_burst_length
+	    && (scsi_cmd->length > sess->sess_params.first_burst_length)) {
+		iscsi_err(__FILE__, __LINE__,
+			"scsi_cmd->length (%u) > FirstBurstLength (%u)\n",
+			scsi_cmd->length, sess->sess_params.first_burst_length);
+		scsi_cmd->status = 0x02;
+		scsi_cmd->length = 0;
+		goto execute;
+	}
+	if (sess->sess_params.max_dataseg_len &&
+	    scsi_cmd->length > sess->sess_params.max_dataseg_len) {
+		iscsi_err(__FILE__, __LINE__,
+			"scsi_cmd->length (%u) > MaxRecvDataSegmentLength "
+			"(%u)\n",
+			scsi_cmd->length, sess->sess_params.max_dataseg_len);
+		result = -1;
+		goto bad;
+	}
+
+#if 0
+	/* commented out in original Intel reference code */
+	if (scsi_cmd->final && scsi_cmd->output) {
+		RETURN_NOT_EQUAL("Length", scsi_cmd->length,
+			scsi_cmd->trans_len, NO_CLEANUP, -1);
+	}
+#endif
+
+	/* Read AHS.  Need to optimize/clean this.   */
+	/* We should not be calling malloc(). */
+	/* We need to check for properly formated AHS segments. */
+
+	if (scsi_cmd->ahs_len) {
+		uint32_t        ahs_len;
+		uint8_t  *ahs_ptr;
+		uint8_t   ahs_type;
+
+		iscsi_trace(TRACE_ISCSI_DEBUG,
+				"reading %u bytes AHS\n", scsi_cmd->ahs_len);
+		scsi_cmd->ahs = iscsi_malloc_atomic((unsigned)scsi_cmd->ahs_len);
+		if (scsi_cmd->ahs == NULL) {
+			iscsi_err(__FILE__, __LINE__,
+				"iscsi_malloc_atomic() failed\n");
+			result = -1;
+			goto bad;
+		}
+		if (iscsi_sock_msg(sess->sock, 0, (unsigned)scsi_cmd->ahs_len,
+				scsi_cmd->ahs, 0) != scsi_cmd->ahs_len) {
+			iscsi_err(__FILE__, __LINE__,
+				"iscsi_sock_msg() failed\n");
+			result = -1;
+			goto bad;
+		}
+		iscsi_trace(TRACE_ISCSI_DEBUG,
+				"read %u bytes AHS\n", scsi_cmd->ahs_len);
+		for (ahs_ptr = scsi_cmd->ahs;
+		     ahs_ptr < (scsi_cmd->ahs + scsi_cmd->ahs_len - 1) ;
+		     ahs_ptr += ahs_len) {
+			ahs_len = ISCSI_NTOHS(*((uint16_t *) (void *)ahs_ptr));
+			if (ahs_len == 0) {
+				iscsi_err(__FILE__, __LINE__,
+				 		"Zero ahs_len\n");
+				result = -1;
+				goto bad;
+			}
+			switch (ahs_type = *(ahs_ptr + 2)) {
+			case ISCSI_AHS_EXTENDED_CDB:
+				iscsi_trace(TRACE_ISCSI_DEBUG,
+					"Got ExtendedCDB AHS - %u bytes extra "
+					"CDB)\n", ahs_len - 1);
+				scsi_cmd->ext_cdb = ahs_ptr + 4;
+				break;
+			case ISCSI_AHS_BIDI_READ:
+				scsi_cmd->bidi_trans_len =
+					ISCSI_NTOHL(*((uint32_t *)(void *)
+							(ahs_ptr + 4)));
+				*((uint32_t *)(void *)(ahs_ptr + 4)) =
+						scsi_cmd->bidi_trans_len;
+				iscsi_trace(TRACE_ISCSI_DEBUG,
+					"Got Bidirectional Read AHS "
+					"(expected read length %u)\n",
+					scsi_cmd->bidi_trans_len);
+				break;
+			default:
+				iscsi_err(__FILE__, __LINE__,
+					"unknown AHS type %x\n", ahs_type);
+				result = -1;
+				goto bad;
+			}
+		}
+		iscsi_trace(TRACE_ISCSI_DEBUG,
+			"done parsing %u bytes AHS\n", scsi_cmd->ahs_len);
+	} else {
+		iscsi_trace(TRACE_ISCSI_DEBUG, "no AHS to read\n");
+		scsi_cmd->ahs = NULL;
+	}
+
+	ISCSI_LOCK(&sess->tx_mutex, result = -1; goto bad);
+	sess->ExpCmdSN++;
+	sess->MaxCmdSN++;
+	ISCSI_UNLOCK(&sess->tx_mutex, result = -1; goto bad);
+
+	/* Hand the command to the workers if it can run out of order */
+	if (cmd_may_queue(sess, scsi_cmd) && cmd_enqueue(sess, job) == 0) {
+		return 0;
+	}
+execute:
+	if (cmd_drain(sess) != 0) {
+		result = -1;
+		goto bad;
+	}
+	return scsi_command_exec(sess, job, sess->buff);
+bad:
+	if (scsi_cmd->ahs != NULL) {
+		iscsi_free_atomic(scsi_cmd->ahs);
+	}
+	iscsi_free_atomic(job);
 	return result;
 }
 
@@ -1116,7 +1343,8 @@ login_command_t(target_session_t * sess, uint8_t *header)
 
 	/* Send login response */
 response:
-	sess->ExpCmdSN = sess->MaxCmdSN = cmd.CmdSN;
+	sess->ExpCmdSN = cmd.CmdSN;
+	sess->MaxCmdSN = cmd.CmdSN + MAX(sess->queue_depth, 1) - 1;
 	rsp.isid = cmd.isid;
 	rsp.StatSN = cmd.ExpStatSN;	/* debug  */
 	rsp.tag = cmd.tag;
@@ -1415,7 +1643,8 @@ execute_t(target_session_t *sess, uint8_t *header)
 }
 
 /*
- * Currently one thread per session, used for both Rx and Tx.
+ * One Rx thread per session.  It also sends the responses, except for
+ * the READs it hands to the command workers (see cmd_worker_proc_t()).
  */
 static int 
 worker_proc_t(void *arg)
@@ -1423,6 +1652,7 @@ worker_proc_t(void *arg)
 	target_session_t *sess = (target_session_t *) arg;
 	uint8_t   header[ISCSI_HEADER_LEN];
 	iscsi_parameter_t **l = &sess->params;
+	char	 *depth;
 
 	ISCSI_THREAD_START("worker_thread");
 	sess->worker.pid = getpid();
@@ -1482,6 +1712,13 @@ worker_proc_t(void *arg)
 	/* Set remaining session parameters  */
 
 	sess->UsePhaseCollapsedRead = ISCSI_USE_PHASE_COLLAPSED_READ_DFLT;
+	if ((depth = iscsi_target_getvar(sess->target, "queue depth")) != NULL) {
+		sess->queue_depth = MIN(atoi(depth), MAX_TARGET_QUEUE_DEPTH);
+	}
+	ISCSI_MUTEX_INIT(&sess->tx_mutex, return -1);
+	ISCSI_MUTEX_INIT(&sess->cmd_mutex, return -1);
+	ISCSI_COND_INIT(&sess->cmd_cond, return -1);
+	ISCSI_COND_INIT(&sess->idle_cond, return -1);
 
 	/* Loop for commands */
 
@@ -1498,6 +1735,10 @@ worker_proc_t(void *arg)
 		iscsi_trace(TRACE_ISCSI_DEBUG,
 			"session %d: iscsi op %#x\n", sess->id,
 			ISCSI_OPCODE(header));
+		if (ISCSI_OPCODE(header) != ISCSI_SCSI_CMD &&
+		    cmd_drain(sess) != 0) {
+			break;
+		}
 		if (execute_t(sess, header) != 0) {
 			iscsi_err(__FILE__, __LINE__,
 				"execute_t() failed\n");
@@ -1516,6 +1757,11 @@ worker_proc_t(void *arg)
 
 	/* Clean up */
 
+	cmd_stop(sess);
+	ISCSI_COND_DESTROY(&sess->idle_cond, ;);
+	ISCSI_COND_DESTROY(&sess->cmd_cond, ;);
+	ISCSI_MUTEX_DESTROY(&sess->cmd_mutex, ;);
+	ISCSI_MUTEX_DESTROY(&sess->tx_mutex, ;);
 	iscsi_free(sess->buff);
 	if (param_list_destroy(sess->params) != 0) {
 		iscsi_err(__FILE__, __LINE__,
@@ -1888,6 +2134,8 @@ iscsi_target_set_defaults(iscsi_target_t *tgt)
 	iscsi_target_setvar(tgt, "address family", "unspec");
 	(void) snprintf(buf, sizeof(buf), "%d", DEFAULT_TARGET_MAX_SESSIONS);
 	iscsi_target_setvar(tgt, "max sessions", buf);
+	(void) snprintf(buf, sizeof(buf), "%d", DEFAULT_TARGET_QUEUE_DEPTH);
+	iscsi_target_setvar(tgt, "queue depth", buf);
 	iscsi_target_setvar(tgt, "configfile", _PATH_ISCSI_TARGETS);
 	iscsi_target_setvar(tgt, "blocklen", "512");
 	return 1;
@@ -22,6 +22,12 @@
 #include <windows.h>
 #endif
 
+#if HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#endif
+
 #if HAVE_PROCFS
 #include <sys/statfs.h>
 #if HAVE_LINUX_MAGIC_H
@@ -68,6 +74,10 @@ struct filestate {
 	BLOCKNUM block;
 	unsigned int offset;
 	POSITION fsize;
+#if HAVE_MMAP
+	unsigned char *map;
+	POSITION mapsize;
+#endif
 };
 
 #define ch_bufhead      thisfile->buflist.next
@@ -126,6 +136,10 @@ struct filestate {
 static struct filestate *thisfile;
 static int ch_ungotchar = -1;
 static int maxbufs = -1;
+#if HAVE_MMAP
+static struct filestate *mapfile; /* The filestate whose file is mapped */
+static volatile sig_atomic_t map_lost;
+#endif
 
 extern int autobuf;
 extern int sigs;
@@ -142,6 +156,11 @@ extern char *namelogfile;
 #endif
 
 static int ch_addbuf(void);
+#if HAVE_MMAP
+static void ch_mapfile(void);
+static void ch_unmap(void);
+static void ch_lostmap(void);
+#endif
 
 
 /*
@@ -160,6 +179,24 @@ static int ch_get(void)
 	if (thisfile == NULL)
 		return (EOI);
 
+#if HAVE_MMAP
+	/*
+	 * If the file is mapped, anything within the mapping
+	 * can be had directly.
+	 */
+	if (thisfile->map != NULL)
+	{
+		if (map_lost)
+			ch_lostmap();
+		else
+		{
+			pos = (ch_block * LBUFSIZE) + ch_offset;
+			if (pos < thisfile->mapsize)
+				return (thisfile->map[pos]);
+		}
+	}
+#endif
+
 	/*
 	 * Quick check for the common case where 
 	 * the desired char is in the head buffer.
@@ -662,6 +699,89 @@ public void ch_setbufspace(int bufspace)
 	}
 }
 
+#if HAVE_MMAP
+/*
+ * A regular file is mapped into memory, so that ch_get can return
+ * its characters without going through the buffer pool, and so that
+ * the line number index and the search code can scan it directly.
+ * Only the part of the file which existed when it was mapped is
+ * mapped; anything appended later is read through the buffers.
+ */
+
+/*
+ * SIGBUS means the file was truncated under us.  Replace the mapping
+ * with zero-filled pages so the faulting access can complete, and let
+ * ch_get go back to reading the file.
+ */
+static RETSIGTYPE ch_sigbus(int type)
+{
+	if (mapfile == NULL || mmap(mapfile->map, (size_t) mapfile->mapsize,
+		PROT_READ, MAP_PRIVATE|MAP_ANON|MAP_FIXED, -1, (off_t)0) == MAP_FAILED)
+	{
+		/* Not ours; let the access fault again and kill us. */
+		LSIGNAL(SIGBUS, SIG_DFL);
+		return;
+	}
+	map_lost = 1;
+}
+
+/*
+ * Discard the mapping of the current file, if any.
+ */
+static void ch_unmap(void)
+{
+	if (thisfile->map == NULL)
+		return;
+	munmap(thisfile->map, (size_t) thisfile->mapsize);
+	thisfile->map = NULL;
+	thisfile->mapsize = 0;
+	if (mapfile == thisfile)
+		mapfile = NULL;
+}
+
+/*
+ * The mapped file has shrunk: drop the mapping and
+ * continue with the buffers from the file's new size.
+ */
+static void ch_lostmap(void)
+{
+	ch_unmap();
+	map_lost = 0;
+	ch_fsize = filesize(ch_file);
+	screen_trashed = 1;
+}
+
+/*
+ * Map the current file, if it is a non-empty regular file.
+ */
+static void ch_mapfile(void)
+{
+	static int sigbus_set = FALSE;
+	struct stat st;
+	void *p;
+
+	ch_unmap();
+	if (mapfile != NULL || ch_file < 0 || (ch_flags & (CH_HELPFILE|CH_NODATA)))
+		return;
+	if (fstat(ch_file, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return;
+	if ((off_t)(size_t) st.st_size != st.st_size)
+		/* Too big for the address space. */
+		return;
+	p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, ch_file, (off_t)0);
+	if (p == MAP_FAILED)
+		return;
+	if (!sigbus_set)
+	{
+		LSIGNAL(SIGBUS, ch_sigbus);
+		sigbus_set = TRUE;
+	}
+	thisfile->map = (unsigned char *) p;
+	thisfile->mapsize = st.st_size;
+	mapfile = thisfile;
+}
+#endif
+
 /*
  * Flush (discard) any saved file state, including buffer contents.
  */
@@ -732,6 +852,9 @@ public void ch_flush(void)
 		 */
 		error("seek error to 0", NULL_PARG);
 	}
+#if HAVE_MMAP
+	ch_mapfile();
+#endif
 }
 
 /*
@@ -844,6 +967,10 @@ public void ch_init(int f, int flags)
 		thisfile->offset = 0;
 		thisfile->file = -1;
 		thisfile->fsize = NULL_POSITION;
+#if HAVE_MMAP
+		thisfile->map = NULL;
+		thisfile->mapsize = 0;
+#endif
 		init_hashtbl();
 		/*
 		 * Try to seek; set CH_CANSEEK if it works.
@@ -867,6 +994,9 @@ public void ch_close(void)
 	if (thisfile == NULL)
 		return;
 
+#if HAVE_MMAP
+	ch_unmap();
+#endif
 	if ((ch_flags & (CH_CANSEEK|CH_POPENED|CH_HELPFILE)) && !(ch_flags & CH_KEEPOPEN))
 	{
 		/*
@@ -909,6 +1039,25 @@ public int ch_getflags(void)
 	return (ch_flags);
 }
 
+#if HAVE_MMAP
+/*
+ * Return the mapping of the current file and (via plen) its length,
+ * or NULL if the file is not mapped.
+ */
+public constant unsigned char * ch_map(POSITION *plen)
+{
+	if (thisfile == NULL || thisfile->map == NULL)
+		return (NULL);
+	if (map_lost)
+	{
+		ch_lostmap();
+		return (NULL);
+	}
+	*plen = thisfile->mapsize;
+	return (thisfile->map);
+}
+#endif
+
 #if 0
 static void ch_dump(struct filestate *fs)
 {
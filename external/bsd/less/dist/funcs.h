@@ -60,6 +60,7 @@ public void ch_set_eof(void);
 public void ch_init(int f, int flags);
 public void ch_close(void);
 public int ch_getflags(void);
+public constant unsigned char * ch_map(POSITION *plen);
 public void setfmt(char *s, char **fmtvarptr, int *attrptr, char *default_fmt, int for_printf);
 public void init_charset(void);
 public int binary_char(LWCHAR c);
@@ -233,6 +234,7 @@ public LINENUM find_linenum(POSITION pos);
 public POSITION find_pos(LINENUM linenum);
 public LINENUM currline(int where);
 public void scan_eof(void);
+public int idle_linenum(void);
 public LINENUM vlinenum(LINENUM linenum);
 public void lsystem(char *cmd, char *donemsg);
 public int pipe_mark(int c, char *cmd);
@@ -32,6 +32,12 @@
  * position in the file.  As a side effect, it calls add_lnum
  * to cache the line number.  Therefore currline is occasionally
  * called to make sure we cache line numbers often enough.
+ *
+ * When the file is mapped into memory (see ch_map), none of that is
+ * needed: we count newlines directly in the mapping and keep a sparse
+ * index of the position of every LNIDX_STEP'th line.  The index is
+ * extended on demand, and a chunk at a time while we are waiting for
+ * the user to type something (see idle_linenum).
  */
 
 #include "less.h"
@@ -74,6 +80,19 @@ extern int screen_trashed;
 extern int header_lines;
 extern int nonum_headers;
 
+#if HAVE_MMAP
+#define LNIDX_STEP      1024            /* Lines between index entries */
+#define LNIDX_CHUNK     (1024*1024)     /* Bytes scanned per step */
+
+static constant unsigned char *lnidx_map; /* Mapping the index describes */
+static POSITION lnidx_maplen;           /* Length of that mapping */
+static POSITION *lnidx;                 /* lnidx[i] is where line i*LNIDX_STEP+1 starts */
+static size_t lnidx_count;              /* Number of entries in lnidx */
+static size_t lnidx_size;               /* Allocated size of lnidx */
+static POSITION lnidx_scanned;          /* Bytes of the mapping scanned so far */
+static LINENUM lnidx_line;              /* Line number at lnidx_scanned */
+#endif
+
 /*
  * Initialize the line number structures.
  */
@@ -99,6 +118,10 @@ public void clr_linenum(void)
 	anchor.gap = 0;
 	anchor.pos = (POSITION)0;
 	anchor.line = 1;
+
+#if HAVE_MMAP
+	lnidx_map = NULL;
+#endif
 }
 
 /*
@@ -255,6 +278,164 @@ static void abort_long(void)
 	error("Line numbers turned off", NULL_PARG);
 }
 
+#if HAVE_MMAP
+/*
+ * Return the mapping of the current file, or NULL if it is not mapped.
+ * Start a new index if the mapping is not the one the index describes.
+ */
+static constant unsigned char * lnidx_check(POSITION *plen)
+{
+	constant unsigned char *map;
+
+	map = ch_map(plen);
+	if (map == NULL)
+		return (NULL);
+	if (map != lnidx_map || *plen != lnidx_maplen)
+	{
+		if (lnidx == NULL)
+		{
+			lnidx_size = 1024;
+			lnidx = (POSITION *) ecalloc(lnidx_size, sizeof(POSITION));
+		}
+		lnidx_map = map;
+		lnidx_maplen = *plen;
+		lnidx[0] = 0;
+		lnidx_count = 1;
+		lnidx_scanned = 0;
+		lnidx_line = 1;
+	}
+	return (map);
+}
+
+/*
+ * Scan the next chunk of the mapping, adding to the index.
+ */
+static void lnidx_scan(void)
+{
+	constant unsigned char *p = lnidx_map + lnidx_scanned;
+	constant unsigned char *end;
+	POSITION *nidx;
+
+	end = p + ((lnidx_maplen - lnidx_scanned > LNIDX_CHUNK) ?
+		LNIDX_CHUNK : lnidx_maplen - lnidx_scanned);
+	while ((p = memchr(p, '\n', end - p)) != NULL)
+	{
+		p++;
+		if (lnidx_line++ % LNIDX_STEP == 0)
+		{
+			if (lnidx_count == lnidx_size)
+			{
+				nidx = (POSITION *) realloc(lnidx, 2 * lnidx_size * sizeof(POSITION));
+				if (nidx == NULL)
+					out_of_memory();
+				lnidx = nidx;
+				lnidx_size *= 2;
+			}
+			lnidx[lnidx_count++] = p - lnidx_map;
+		}
+	}
+	lnidx_scanned = end - lnidx_map;
+}
+
+/*
+ * Count the newlines in a part of the mapping.
+ */
+static LINENUM count_newlines(constant unsigned char *p, constant unsigned char *end)
+{
+	LINENUM n = 0;
+
+	while ((p = memchr(p, '\n', end - p)) != NULL)
+	{
+		p++;
+		n++;
+	}
+	return (n);
+}
+
+/*
+ * Find the line number of a position in the mapping.
+ * Return 0 if interrupted.
+ */
+static LINENUM lnidx_linenum(POSITION pos)
+{
+	size_t lo, hi, mid;
+	LINENUM linenum;
+
+	/*
+	 * Make sure the index covers the position.
+	 */
+#if HAVE_TIME
+	startime = get_time();
+#endif
+	loopcount = 0;
+	while (lnidx_scanned < pos)
+	{
+		lnidx_scan();
+		if (ABORT_SIGS())
+		{
+			abort_long();
+			return (0);
+		}
+		longish();
+	}
+	loopcount = 0;
+
+	/*
+	 * Find the last entry at or before the position
+	 * and count lines from there.
+	 */
+	lo = 0;
+	hi = lnidx_count;
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (lnidx[mid] <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	linenum = (LINENUM) lo * LNIDX_STEP + 1 +
+		count_newlines(lnidx_map + lnidx[lo], lnidx_map + pos);
+	/*
+	 * Like forw_raw_line, count a partial last line as a line.
+	 */
+	if (pos == lnidx_maplen && lnidx_map[pos-1] != '\n' && ch_length() == pos)
+		linenum++;
+	return (linenum);
+}
+
+/*
+ * Find the position of a line in the mapping.
+ * This mimics what repeated calls to forw_raw_line would return.
+ */
+static POSITION lnidx_pos(LINENUM linenum)
+{
+	constant unsigned char *p;
+	POSITION cpos;
+	LINENUM clinenum;
+	size_t i;
+
+	while (lnidx_line < linenum && lnidx_scanned < lnidx_maplen)
+	{
+		lnidx_scan();
+		if (ABORT_SIGS())
+			return (NULL_POSITION);
+	}
+	i = (linenum - 1) / LNIDX_STEP;
+	if (i >= lnidx_count)
+		i = lnidx_count - 1;
+	clinenum = (LINENUM) i * LNIDX_STEP + 1;
+	for (cpos = lnidx[i];  clinenum < linenum;  clinenum++)
+	{
+		if (cpos >= lnidx_maplen)
+			return (NULL_POSITION);
+		p = memchr(lnidx_map + cpos, '\n', lnidx_maplen - cpos);
+		cpos = (p == NULL) ? lnidx_maplen : (p + 1) - lnidx_map;
+	}
+	return (cpos);
+}
+#endif
+
 /*
  * Find the line number associated with a given position.
  * Return 0 if we can't figure it out.
@@ -264,6 +445,9 @@ public LINENUM find_linenum(POSITION pos)
 	struct linenum_info *p;
 	LINENUM linenum;
 	POSITION cpos;
+#if HAVE_MMAP
+	POSITION len;
+#endif
 
 	if (!linenums)
 		/*
@@ -281,6 +465,11 @@ public LINENUM find_linenum(POSITION pos)
 		 */
 		return (1);
 
+#if HAVE_MMAP
+	if (lnidx_check(&len) != NULL && pos <= len)
+		return (lnidx_linenum(pos));
+#endif
+
 	/*
 	 * Find the entry nearest to the position we want.
 	 */
@@ -376,6 +565,9 @@ public POSITION find_pos(LINENUM linenum)
 	struct linenum_info *p;
 	POSITION cpos;
 	LINENUM clinenum;
+#if HAVE_MMAP
+	POSITION len;
+#endif
 
 	if (linenum <= 1)
 		/*
@@ -383,6 +575,11 @@ public POSITION find_pos(LINENUM linenum)
 		 */
 		return (ch_zero());
 
+#if HAVE_MMAP
+	if (lnidx_check(&len) != NULL && ch_length() == len)
+		return (lnidx_pos(linenum));
+#endif
+
 	/*
 	 * Find the entry nearest to the line number we want.
 	 */
@@ -467,6 +664,9 @@ public void scan_eof(void)
 {
 	POSITION pos = ch_zero();
 	LINENUM linenum = 0;
+#if HAVE_MMAP
+	POSITION len;
+#endif
 
 	if (ch_seek(0))
 		return;
@@ -476,6 +676,13 @@ public void scan_eof(void)
 	 * overwriting "Determining length of file".
 	 */
 	scanning_eof = TRUE;
+#if HAVE_MMAP
+	if (lnidx_check(&len) != NULL && ch_length() == len)
+	{
+		while (lnidx_scanned < len && !ABORT_SIGS())
+			lnidx_scan();
+	} else
+#endif
 	while (pos != NULL_POSITION)
 	{
 		/* For efficiency, only add one every 256 line numbers. */
@@ -488,6 +695,24 @@ public void scan_eof(void)
 	scanning_eof = FALSE;
 }
 
+/*
+ * Do a little of the work of indexing line numbers in the background.
+ * Return TRUE if there is more to do.
+ */
+public int idle_linenum(void)
+{
+#if HAVE_MMAP
+	POSITION len;
+
+	if (!linenums || lnidx_check(&len) == NULL || lnidx_scanned >= len)
+		return (FALSE);
+	lnidx_scan();
+	return (lnidx_scanned < len);
+#else
+	return (FALSE);
+#endif
+}
+
 /*
  * Return a line number adjusted for display
  * (handles the --no-number-headers option).
@@ -215,6 +215,22 @@ start:
 	}
 
 	flush();
+#if USE_POLL && HAVE_MMAP
+	if (fd == tty && use_poll)
+	{
+		/*
+		 * Until a key is pressed, use the time to
+		 * index the line numbers of the current file.
+		 */
+		struct pollfd poller = { tty, POLLIN, 0 };
+		int idled = FALSE;
+
+		while (!sigs && poll(&poller, 1, 0) == 0 && idle_linenum())
+			idled = TRUE;
+		if (idled && sigs)
+			return (READ_INTR);
+	}
+#endif
 	reading = 1;
 #if MSDOS_COMPILER==DJGPPC
 	if (isatty(fd))
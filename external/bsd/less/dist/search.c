@@ -1171,6 +1171,144 @@ static int get_seg(POSITION pos, POSITION tpos)
 	}
 }
 
+#if HAVE_MMAP
+/*
+ * When the file is mapped and the search pattern is a literal string,
+ * a forward search need not read and convert every line: it can look
+ * for the string in the raw file data and skip straight to the line
+ * containing it.  This is only done when every matching line must
+ * contain the pattern exactly as it appears in the file.
+ */
+struct lskip {
+	constant unsigned char *map;
+	POSITION len;
+	constant char *pat;
+	size_t patlen;
+	int special;            /* Also stop at backspaces/escapes */
+	POSITION next_match;    /* Next occurrence of pat, or len */
+	POSITION next_special;  /* Next backspace/escape, or len */
+};
+
+/*
+ * Set up to skip lines in a search, if we can.
+ * Return FALSE if every line must be read.
+ */
+static int lskip_init(struct lskip *ls, int search_type, int maxlines)
+{
+	constant char *p;
+	int cvt_ops;
+
+	if (!(search_type & SRCH_FORW) || (search_type & SRCH_NO_MATCH) || maxlines >= 0)
+		return (FALSE);
+#if HILITE_SEARCH
+	if (filter_infos != NULL)
+		return (FALSE);
+#endif
+	if (!prev_pattern(&search_info) || search_info.text == NULL || search_info.text[0] == '\0')
+		return (FALSE);
+	for (p = search_info.text;  *p != '\0';  p++)
+	{
+		if (is_caseless && (ASCII_IS_UPPER(*p) || ASCII_IS_LOWER(*p) || (*p & 0x80)))
+			return (FALSE);
+		if (*p == '\r')
+			return (FALSE);
+#if !NO_REGEX
+		if (!(search_info.search_type & SRCH_NO_REGEX) && strchr("\\^$.[]|()*+?{}", *p) != NULL)
+			return (FALSE);
+#endif
+	}
+	ls->map = ch_map(&ls->len);
+	if (ls->map == NULL)
+		return (FALSE);
+	ls->pat = search_info.text;
+	ls->patlen = strlen(search_info.text);
+	cvt_ops = get_cvt_ops(search_type);
+	ls->special = (cvt_ops & (CVT_BS|CVT_ANSI)) != 0;
+	ls->next_match = ls->next_special = NULL_POSITION;
+	return (TRUE);
+}
+
+/*
+ * Find the next occurrence of the pattern at or after pos.
+ */
+static POSITION lskip_match(struct lskip *ls, POSITION pos)
+{
+	constant unsigned char *p = ls->map + pos;
+	constant unsigned char *end = ls->map + ls->len - ls->patlen + 1;
+	unsigned char c = (unsigned char) ls->pat[0];
+
+	if (pos + (POSITION) ls->patlen > ls->len)
+		return (ls->len);
+	while ((p = memchr(p, c, end - p)) != NULL)
+	{
+		if (memcmp(p, ls->pat, ls->patlen) == 0)
+			return (p - ls->map);
+		p++;
+	}
+	return (ls->len);
+}
+
+/*
+ * Find the next character at or after pos which changes
+ * the text when the line is converted for matching.
+ */
+static POSITION lskip_special(struct lskip *ls, POSITION pos)
+{
+	static constant unsigned char specials[] = { '\b', ESC, CSI };
+	constant unsigned char *p;
+	POSITION next = ls->len;
+	int i;
+
+	if (!ls->special)
+		return (ls->len);
+	for (i = 0;  i < (int) sizeof(specials);  i++)
+	{
+		p = memchr(ls->map + pos, specials[i], next - pos);
+		if (p != NULL)
+			next = p - ls->map;
+	}
+	return (next);
+}
+
+/*
+ * Skip over the lines starting at pos which cannot match.
+ * Return the position of the first line which might match
+ * (or which contains endpos), and adjust *plinenum to suit.
+ */
+static POSITION lskip_lines(struct lskip *ls, POSITION pos, POSITION endpos, LINENUM *plinenum)
+{
+	constant unsigned char *p;
+	constant unsigned char *lp;
+	POSITION target;
+
+	if (pos >= ls->len)
+		return (pos);
+	if (ls->next_match == NULL_POSITION || ls->next_match < pos)
+		ls->next_match = lskip_match(ls, pos);
+	if (ls->next_special == NULL_POSITION || ls->next_special < pos)
+		ls->next_special = lskip_special(ls, pos);
+	target = ls->next_match;
+	if (ls->next_special < target)
+		target = ls->next_special;
+	if (endpos != NULL_POSITION && endpos < target)
+		target = endpos;
+
+	/* Back up to the start of the line containing the target. */
+	lp = ls->map + pos;
+	for (p = ls->map + target;  p > lp && p[-1] != '\n';  p--)
+		continue;
+	if (*plinenum != 0)
+	{
+		while ((lp = memchr(lp, '\n', p - lp)) != NULL)
+		{
+			lp++;
+			(*plinenum)++;
+		}
+	}
+	return (p - ls->map);
+}
+#endif
+
 /*
  * Search a subset of the file, specified by start/end position.
  */
@@ -1191,6 +1329,10 @@ static int search_range(POSITION pos, POSITION endpos, int search_type, int matc
 	int skip_bytes = 0;
 	int swidth = sc_width - line_pfx_width();
 	int sheight = sc_height - sindex_from_sline(jump_sline);
+#if HAVE_MMAP
+	struct lskip lskip;
+	int skipping = lskip_init(&lskip, search_type, maxlines);
+#endif
 
 	linenum = find_linenum(pos);
 	if (nosearch_headers && linenum <= header_lines)
@@ -1239,6 +1381,12 @@ static int search_range(POSITION pos, POSITION endpos, int search_type, int matc
 			 * Read the next line, and save the 
 			 * starting position of that line in linepos.
 			 */
+#if HAVE_MMAP
+			if (skipping)
+				pos = lskip_lines(&lskip, pos,
+					(search_type & SRCH_WRAP) ? NULL_POSITION : endpos,
+					&linenum);
+#endif
 			linepos = pos;
 			pos = forw_raw_line(pos, &line, &line_len);
 			if (linenum != 0)
@@ -1286,6 +1434,9 @@ static int search_range(POSITION pos, POSITION endpos, int search_type, int matc
 					 */
 					search_type &= ~SRCH_WRAP;
 					linenum = find_linenum(pos);
+#if HAVE_MMAP
+					lskip.next_match = lskip.next_special = NULL_POSITION;
+#endif
 					continue;
 				}
 			}
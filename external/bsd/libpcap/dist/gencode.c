@@ -237,6 +237,45 @@ struct chunk {
 	void *m;
 };
 
+/*
+ * The qualifiers of a "host" or "port" primitive, and the parts of the
+ * code generator state that the code generated for it depends on.
+ * Primitives with equal keys differ only in the value they compare
+ * against.
+ */
+struct vset_key {
+	int addr;
+	int proto;
+	int dir;
+	int linktype;
+	bpf_abs_offset off_linkpl;
+	bpf_abs_offset off_linktype;
+	u_int off_nl;
+	u_int off_nl_nosnap;
+	u_int label_stack_depth;
+	u_int vlan_stack_depth;
+	int is_geneve;
+};
+
+/*
+ * The set of values tested by an "or" of "host" or "port" primitives
+ * with equal keys; see gen_or_set().  Sets are merged by chaining
+ * them, and the leaves generated for the first primitive are turned
+ * into tests of all the values in finish_parse().
+ */
+struct vset {
+	struct vset_key key;
+	struct block *rep;	/* block generated for the primitive */
+	struct block *head;	/* ... its head, */
+	int sense;		/* ... and its sense */
+	bpf_u_int32 val;
+	struct vset *next;	/* sets merged into this one */
+	struct vset *last;
+	u_int nvals;
+	bpf_u_int32 *vals;	/* values, once expanded */
+	int sorted;		/* ... and whether they're to be searched */
+};
+
 /* Code generator state */
 
 struct _compiler_state {
@@ -246,6 +285,19 @@ struct _compiler_state {
 
 	struct icode ic;
 
+	/*
+	 * Set for the "host" or "port" primitive being generated, if
+	 * it can be merged with others.
+	 */
+	struct vset *vset;
+
+	/*
+	 * Set if the filter names a host, network, port or protocol
+	 * that has to be looked up, so that the program mustn't be
+	 * cached.
+	 */
+	int resolved_names;
+
 	int snaplen;
 
 	int linktype;
@@ -768,12 +820,17 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 		(p->save_current_filter_op)(p, buf);
 #endif
 
+	if (pcap_fcache_lookup(p, program, buf, optimize, mask) == 0)
+		return (0);
+
 	initchunks(&cstate);
 	cstate.no_optimize = 0;
 #ifdef INET6
 	cstate.ai = NULL;
 #endif
 	cstate.e = NULL;
+	cstate.vset = NULL;
+	cstate.resolved_names = 0;
 	cstate.ic.root = NULL;
 	cstate.ic.cur_mark = 0;
 	cstate.bpf_pcap = p;
@@ -850,6 +907,13 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 	}
 	program->bf_len = len;
 
+	/*
+	 * Programs for filters that name hosts or networks aren't
+	 * cached, as what the names resolve to can change.
+	 */
+	if (!cstate.resolved_names)
+		pcap_fcache_store(p, program, buf, optimize, mask);
+
 	rc = 0;  /* We're all okay */
 
 quit:
@@ -943,6 +1007,157 @@ merge(struct block *b0, struct block *b1)
 	*p = b1;
 }
 
+static int
+vset_cmp(const void *a, const void *b)
+{
+	bpf_u_int32 va = *(const bpf_u_int32 *)a;
+	bpf_u_int32 vb = *(const bpf_u_int32 *)b;
+
+	return (va < vb ? -1 : va > vb);
+}
+
+/*
+ * Sets with at least this many values are searched with a binary search;
+ * smaller ones are tested with a chain of equality tests, which is what
+ * the optimizer makes of the "or" of their primitives.  The search costs
+ * an extra instruction for every VSET_LINEAR values and needs more long
+ * jumps, so it's kept for sets whose chain couldn't be loaded into the
+ * kernel anyway.
+ */
+#ifdef BPF_MAXINSNS
+#define VSET_SEARCH	BPF_MAXINSNS
+#else
+#define VSET_SEARCH	512
+#endif
+#define VSET_LINEAR	4
+
+/*
+ * Collect the values of a merged set, in the order in which they were
+ * merged; if the set is to be searched, sort them and remove duplicates.
+ */
+static void
+vset_collect(compiler_state_t *cstate, struct vset *vs)
+{
+	struct vset *p;
+	u_int i, n;
+
+	vs->vals = (bpf_u_int32 *)newchunk(cstate,
+	    vs->nvals * sizeof(*vs->vals));
+	n = 0;
+	for (p = vs; p != NULL; p = p->next)
+		vs->vals[n++] = p->val;
+	if (n < VSET_SEARCH)
+		return;
+	vs->sorted = 1;
+	qsort(vs->vals, n, sizeof(*vs->vals), vset_cmp);
+	for (i = n = 1; i < vs->nvals; i++)
+		if (vs->vals[i] != vs->vals[n - 1])
+			vs->vals[n++] = vs->vals[i];
+	vs->nvals = n;
+}
+
+/*
+ * Return a copy of the statements s.
+ */
+static struct slist *
+vset_stmts(compiler_state_t *cstate, struct slist *s)
+{
+	struct slist *head, **tail;
+
+	head = NULL;
+	tail = &head;
+	for (; s != NULL; s = s->next) {
+		*tail = new_stmt(cstate, s->s.code);
+		(*tail)->s = s->s;
+		tail = &(*tail)->next;
+	}
+	return (head);
+}
+
+/*
+ * Generate a chain of tests of the value loaded by the statements ld
+ * against the n values v[], branching to t if one of them matches and
+ * f if none does.
+ *
+ * Every test gets its own copy of ld, as it would if the primitives
+ * hadn't been merged: the optimizer assumes that no block depends on
+ * the accumulator being loaded by another one (see or_pullup()), and
+ * removes the loads that turn out to be redundant itself.
+ */
+static struct block *
+gen_vset_chain(compiler_state_t *cstate, struct slist *ld,
+    const bpf_u_int32 *v, u_int n, struct block *t, struct block *f)
+{
+	struct block *b, *b0;
+	u_int i;
+
+	b = f;
+	for (i = n; i-- > 0;) {
+		b0 = new_block(cstate, JMP(BPF_JEQ));
+		b0->stmts = vset_stmts(cstate, ld);
+		b0->s.k = v[i];
+		JT(b0) = t;
+		JF(b0) = b;
+		b = b0;
+	}
+	return (b);
+}
+
+/*
+ * Generate a binary search for the value loaded by the statements ld
+ * among the n sorted values v[], branching to t if it's found and f if
+ * not.
+ */
+static struct block *
+gen_vset_search(compiler_state_t *cstate, struct slist *ld,
+    const bpf_u_int32 *v, u_int n, struct block *t, struct block *f)
+{
+	struct block *b;
+
+	if (n <= VSET_LINEAR)
+		return (gen_vset_chain(cstate, ld, v, n, t, f));
+	b = new_block(cstate, JMP(BPF_JGE));
+	b->stmts = vset_stmts(cstate, ld);
+	b->s.k = v[n / 2];
+	JT(b) = gen_vset_search(cstate, ld, v + n / 2, n - n / 2, t, f);
+	JF(b) = gen_vset_search(cstate, ld, v, n / 2, t, f);
+	return (b);
+}
+
+/*
+ * Replace each equality test generated for a "host" or "port" primitive
+ * that had others merged into it by gen_or_set() with a test of all the
+ * values of its set.  The test keeps its statements, which load the
+ * value to be tested, and the tests added after it get copies of them.
+ */
+static void
+expand_vsets_r(compiler_state_t *cstate, struct block *b)
+{
+	struct vset *vs;
+	struct block *s;
+
+	if (b == NULL || isMarked(&cstate->ic, b))
+		return;
+	Mark(&cstate->ic, b);
+	expand_vsets_r(cstate, JT(b));
+	expand_vsets_r(cstate, JF(b));
+
+	vs = b->vset;
+	if (vs == NULL || vs->nvals < 2 || b->s.code != JMP(BPF_JEQ))
+		return;
+	if (vs->vals == NULL)
+		vset_collect(cstate, vs);
+	if (vs->sorted)
+		s = gen_vset_search(cstate, b->stmts, vs->vals, vs->nvals,
+		    JT(b), JF(b));
+	else
+		s = gen_vset_chain(cstate, b->stmts, vs->vals, vs->nvals,
+		    JT(b), JF(b));
+	b->s = s->s;
+	JT(b) = JT(s);
+	JF(b) = JF(s);
+}
+
 int
 finish_parse(compiler_state_t *cstate, struct block *p)
 {
@@ -997,6 +1212,9 @@ finish_parse(compiler_state_t *cstate, struct block *p)
 	p->sense = !p->sense;
 	backpatch(p, gen_retblk(cstate, 0));
 	cstate->ic.root = p->head;
+
+	unMarkAll(&cstate->ic);
+	expand_vsets_r(cstate, cstate->ic.root);
 	return (0);
 }
 
@@ -1021,6 +1239,51 @@ gen_or(struct block *b0, struct block *b1)
 	b1->head = b0->head;
 }
 
+/*
+ * Return the set of values b tests, if b consists of nothing but the
+ * "host" or "port" primitive for which the set was started.
+ */
+static struct vset *
+vset_of(struct block *b)
+{
+	struct vset *vs = b->vset;
+
+	if (vs == NULL || vs->rep != b || vs->head != b->head ||
+	    vs->sense != b->sense)
+		return (NULL);
+	return (vs);
+}
+
+/*
+ * If b0 and b1 both consist of nothing but a "host" or "port" primitive,
+ * and the primitives differ only in the value they compare against,
+ * add the value of b1 to the set of values tested by b0 and return b0,
+ * discarding b1.  Otherwise, "or" b0 and b1 as gen_or() does and return
+ * b1.
+ *
+ * This keeps filters such as "port 1 or port 2 or ... or port 1000"
+ * from compiling into a chain of a thousand copies of the same tests,
+ * which takes the optimizer a long time to take apart, and lets
+ * finish_parse() use a binary search for large sets.
+ */
+struct block *
+gen_or_set(struct block *b0, struct block *b1)
+{
+	struct vset *vs0, *vs1;
+
+	vs0 = vset_of(b0);
+	vs1 = vset_of(b1);
+	if (vs0 != NULL && vs1 != NULL &&
+	    memcmp(&vs0->key, &vs1->key, sizeof(vs0->key)) == 0) {
+		vs0->last->next = vs1;
+		vs0->last = vs1->last;
+		vs0->nvals += vs1->nvals;
+		return (b0);
+	}
+	gen_or(b0, b1);
+	return (b1);
+}
+
 void
 gen_not(struct block *b)
 {
@@ -4024,7 +4287,7 @@ static struct block *
 gen_hostop(compiler_state_t *cstate, bpf_u_int32 addr, bpf_u_int32 mask,
     int dir, bpf_u_int32 ll_proto, u_int src_off, u_int dst_off)
 {
-	struct block *b0, *b1;
+	struct block *b0, *b1, *b2;
 	u_int offset;
 
 	switch (dir) {
@@ -4045,10 +4308,14 @@ gen_hostop(compiler_state_t *cstate, bpf_u_int32 addr, bpf_u_int32 mask,
 
 	case Q_DEFAULT:
 	case Q_OR:
-		b0 = gen_hostop(cstate, addr, mask, Q_SRC, ll_proto, src_off, dst_off);
-		b1 = gen_hostop(cstate, addr, mask, Q_DST, ll_proto, src_off, dst_off);
-		gen_or(b0, b1);
-		return b1;
+		b0 = gen_linktype(cstate, ll_proto);
+		b1 = gen_mcmp(cstate, OR_LINKPL, src_off, BPF_W, addr, mask);
+		b1->vset = cstate->vset;
+		b2 = gen_mcmp(cstate, OR_LINKPL, dst_off, BPF_W, addr, mask);
+		b2->vset = cstate->vset;
+		gen_or(b1, b2);
+		gen_and(b0, b2);
+		return b2;
 
 	case Q_ADDR1:
 		bpf_error(cstate, "'addr1' and 'address1' are not valid qualifiers for addresses other than 802.11 MAC addresses");
@@ -4080,6 +4347,7 @@ gen_hostop(compiler_state_t *cstate, bpf_u_int32 addr, bpf_u_int32 mask,
 	}
 	b0 = gen_linktype(cstate, ll_proto);
 	b1 = gen_mcmp(cstate, OR_LINKPL, offset, BPF_W, addr, mask);
+	b1->vset = cstate->vset;
 	gen_and(b0, b1);
 	return b1;
 }
@@ -5624,13 +5892,21 @@ gen_ipfrag(compiler_state_t *cstate)
 static struct block *
 gen_portatom(compiler_state_t *cstate, int off, bpf_u_int32 v)
 {
-	return gen_cmp(cstate, OR_TRAN_IPV4, off, BPF_H, v);
+	struct block *b;
+
+	b = gen_cmp(cstate, OR_TRAN_IPV4, off, BPF_H, v);
+	b->vset = cstate->vset;
+	return b;
 }
 
 static struct block *
 gen_portatom6(compiler_state_t *cstate, int off, bpf_u_int32 v)
 {
-	return gen_cmp(cstate, OR_TRAN_IPV6, off, BPF_H, v);
+	struct block *b;
+
+	b = gen_cmp(cstate, OR_TRAN_IPV6, off, BPF_H, v);
+	b->vset = cstate->vset;
+	return b;
 }
 
 static struct block *
@@ -6044,6 +6320,7 @@ lookup_proto(compiler_state_t *cstate, const char *name, int proto)
 	case Q_DEFAULT:
 	case Q_IP:
 	case Q_IPV6:
+		cstate->resolved_names = 1;
 		v = pcap_nametoproto(name);
 		if (v == PROTO_UNDEF)
 			bpf_error(cstate, "unknown ip proto '%s'", name);
@@ -6051,6 +6328,7 @@ lookup_proto(compiler_state_t *cstate, const char *name, int proto)
 
 	case Q_LINK:
 		/* XXX should look up h/w protocol type based on cstate->linktype */
+		cstate->resolved_names = 1;
 		v = pcap_nametoeproto(name);
 		if (v == PROTO_UNDEF) {
 			v = pcap_nametollc(name);
@@ -6689,6 +6967,10 @@ gen_scode(compiler_state_t *cstate, const char *name, struct qual q)
 	if (setjmp(cstate->top_ctx))
 		return (NULL);
 
+	if (q.addr == Q_NET || q.addr == Q_DEFAULT || q.addr == Q_HOST ||
+	    q.addr == Q_PORT || q.addr == Q_PORTRANGE || q.addr == Q_GATEWAY)
+		cstate->resolved_names = 1;
+
 	switch (q.addr) {
 
 	case Q_NET:
@@ -7033,6 +7315,60 @@ gen_mcode(compiler_state_t *cstate, const char *s1, const char *s2,
 	/*NOTREACHED*/
 }
 
+/*
+ * If a "host" or "port" primitive with qualifiers q and value v is one
+ * that gen_or_set() can merge with others, start a set for it; the
+ * leaves that compare against v are tagged with the set until
+ * vset_end() is called with the code generated for the primitive.
+ */
+static void
+vset_begin(compiler_state_t *cstate, struct qual q, bpf_u_int32 v)
+{
+	struct vset *vs;
+
+	switch (q.dir) {
+
+	case Q_DEFAULT:
+	case Q_OR:
+	case Q_SRC:
+	case Q_DST:
+		break;
+
+	default:
+		return;
+	}
+	vs = (struct vset *)newchunk(cstate, sizeof(*vs));
+	vs->key.addr = q.addr;
+	vs->key.proto = q.proto;
+	vs->key.dir = q.dir;
+	vs->key.linktype = cstate->linktype;
+	vs->key.off_linkpl = cstate->off_linkpl;
+	vs->key.off_linktype = cstate->off_linktype;
+	vs->key.off_nl = cstate->off_nl;
+	vs->key.off_nl_nosnap = cstate->off_nl_nosnap;
+	vs->key.label_stack_depth = cstate->label_stack_depth;
+	vs->key.vlan_stack_depth = cstate->vlan_stack_depth;
+	vs->key.is_geneve = cstate->is_geneve;
+	vs->val = v;
+	vs->last = vs;
+	vs->nvals = 1;
+	cstate->vset = vs;
+}
+
+static struct block *
+vset_end(compiler_state_t *cstate, struct block *b)
+{
+	struct vset *vs = cstate->vset;
+
+	if (vs != NULL) {
+		vs->rep = b;
+		vs->head = b->head;
+		vs->sense = b->sense;
+		cstate->vset = NULL;
+	}
+	return (b);
+}
+
 struct block *
 gen_ncode(compiler_state_t *cstate, const char *s, bpf_u_int32 v, struct qual q)
 {
@@ -7084,7 +7420,10 @@ gen_ncode(compiler_state_t *cstate, const char *s, bpf_u_int32 v, struct qual q)
 				v <<= 32 - vlen;
 				mask <<= 32 - vlen ;
 			}
-			return gen_host(cstate, v, mask, proto, dir, q.addr);
+			if (mask == 0xffffffff)
+				vset_begin(cstate, q, v);
+			return vset_end(cstate,
+			    gen_host(cstate, v, mask, proto, dir, q.addr));
 		}
 
 	case Q_PORT:
@@ -7104,9 +7443,10 @@ gen_ncode(compiler_state_t *cstate, const char *s, bpf_u_int32 v, struct qual q)
 
 	    {
 		struct block *b;
+		vset_begin(cstate, q, v);
 		b = gen_port(cstate, v, proto, dir);
 		gen_or(gen_port6(cstate, v, proto, dir), b);
-		return b;
+		return vset_end(cstate, b);
 	    }
 
 	case Q_PORTRANGE:
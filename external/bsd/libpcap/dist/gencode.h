@@ -241,11 +241,6 @@ typedef bpf_u_int32 atomset;
 #define ATOMMASK(n) (1 << (n))
 #define ATOMELEM(d, n) (d & ATOMMASK(n))
 
-/*
- * An unbounded set.
- */
-typedef bpf_u_int32 *uset;
-
 /*
  * Total number of atomic entities, including accumulator (A) and index (X).
  * We treat all these guys similarly during flow analysis.
@@ -260,7 +255,6 @@ typedef bpf_u_int32 *uset;
 struct edge {
 	u_int id;
 	int code;		/* opcode for branch corresponding to this edge */
-	uset edom;
 	struct block *succ;	/* successor vertex */
 	struct block *pred;	/* predecessor vertex */
 	struct edge *next;	/* link list of incoming edges for a node */
@@ -285,14 +279,13 @@ struct block {
 	struct edge ef;		/* edge corresponding to the jf branch */
 	struct block *head;
 	struct block *link;	/* link field used by optimizer */
-	uset dom;
-	uset closure;
 	struct edge *in_edges;	/* first edge in the set (linked list) of edges with this as a successor */
 	atomset def, kill;
 	atomset in_use;
 	atomset out_use;
 	int oval;		/* value ID for value tested in branch stmt */
 	bpf_u_int32 val[N_ATOMS];
+	struct vset *vset;	/* set of values tested, for "host"/"port" */
 };
 
 /*
@@ -325,6 +318,7 @@ struct arth *gen_arth(compiler_state_t *, int, struct arth *, struct arth *);
 
 void gen_and(struct block *, struct block *);
 void gen_or(struct block *, struct block *);
+struct block *gen_or_set(struct block *, struct block *);
 void gen_not(struct block *);
 
 struct block *gen_scode(compiler_state_t *, const char *, struct qual);
@@ -232,6 +232,24 @@ struct vmapinfo {
 	bpf_u_int32 const_val;
 };
 
+/*
+ * A dominator tree, over nodes numbered from 0 to n - 1.
+ *
+ * Rather than a bit vector of dominators for each node, which costs
+ * time and space quadratic in the size of the program, each node
+ * keeps its depth in the tree and its 2^k'th dominator for each k,
+ * so that the nearest common dominator of two nodes, and whether
+ * one node dominates another, can be found in logarithmic time.
+ */
+struct domtree {
+	u_int n;		/* number of nodes */
+	u_int log;		/* number of dominators kept for each node */
+	u_int *depth;		/* 1 for the root, 0 if not reachable */
+	u_int *up;		/* up[k * n + i] is the 2^k'th dominator of i */
+};
+
+#define DOM_NONE	UINT_MAX
+
 typedef struct {
 	/*
 	 * Place to longjmp to on an error.
@@ -268,70 +286,16 @@ typedef struct {
 	u_int n_edges;		/* twice n_blocks, so guaranteed to be > 0 */
 	struct edge **edges;
 
-	/*
-	 * A bit vector set representation of the dominators.
-	 * We round up the set size to the next power of two.
-	 */
-	u_int nodewords;	/* number of 32-bit words for a bit vector of "number of nodes" bits; guaranteed to be > 0 */
-	u_int edgewords;	/* number of 32-bit words for a bit vector of "number of edges" bits; guaranteed to be > 0 */
 	struct block **levels;
-	bpf_u_int32 *space;
-
-#define BITS_PER_WORD (8*sizeof(bpf_u_int32))
-/*
- * True if a is in uset {p}
- */
-#define SET_MEMBER(p, a) \
-((p)[(unsigned)(a) / BITS_PER_WORD] & ((bpf_u_int32)1 << ((unsigned)(a) % BITS_PER_WORD)))
-
-/*
- * Add 'a' to uset p.
- */
-#define SET_INSERT(p, a) \
-(p)[(unsigned)(a) / BITS_PER_WORD] |= ((bpf_u_int32)1 << ((unsigned)(a) % BITS_PER_WORD))
-
-/*
- * Delete 'a' from uset p.
- */
-#define SET_DELETE(p, a) \
-(p)[(unsigned)(a) / BITS_PER_WORD] &= ~((bpf_u_int32)1 << ((unsigned)(a) % BITS_PER_WORD))
-
-/*
- * a := a intersect b
- * n must be guaranteed to be > 0
- */
-#define SET_INTERSECT(a, b, n)\
-{\
-	register bpf_u_int32 *_x = a, *_y = b;\
-	register u_int _n = n;\
-	do *_x++ &= *_y++; while (--_n != 0);\
-}
-
-/*
- * a := a - b
- * n must be guaranteed to be > 0
- */
-#define SET_SUBTRACT(a, b, n)\
-{\
-	register bpf_u_int32 *_x = a, *_y = b;\
-	register u_int _n = n;\
-	do *_x++ &=~ *_y++; while (--_n != 0);\
-}
-
-/*
- * a := a union b
- * n must be guaranteed to be > 0
- */
-#define SET_UNION(a, b, n)\
-{\
-	register bpf_u_int32 *_x = a, *_y = b;\
-	register u_int _n = n;\
-	do *_x++ |= *_y++; while (--_n != 0);\
-}
 
-	uset all_dom_sets;
-	uset all_closure_sets;
-	uset all_edge_sets;
+	/*
+	 * The dominator trees of the blocks and of the edges, and
+	 * scratch space used while finding them and by opt_j().
+	 */
+	struct domtree dom;
+	struct domtree edom;
+	u_int *dompend;
+	u_int *edomcand;
 
 #define MODULUS 213
 	struct valnode *hashtbl[MODULUS];
@@ -341,6 +305,16 @@ typedef struct {
 	struct vmapinfo *vmap;
 	struct valnode *vnode_base;
 	struct valnode *next_vnode;
+
+	/*
+	 * Hash table used by intern_blocks(); blkchain and blkrep are
+	 * indexed by block id, and hold the next block in the bucket
+	 * and the block chosen to replace the members of a class.
+	 */
+	u_int blkhashsize;	/* power of two, >= n_blocks */
+	struct block **blkhash;
+	struct block **blkchain;
+	struct block **blkrep;
 } opt_state_t;
 
 typedef struct {
@@ -416,117 +390,168 @@ find_levels(opt_state_t *opt_state, struct icode *ic)
 	find_levels_r(opt_state, ic, ic->root);
 }
 
+/*
+ * Enter node i into a dominator tree, with the given immediate
+ * dominator, which must already be in the tree; the root is its own
+ * immediate dominator.
+ */
+static void
+dt_add(struct domtree *dt, u_int i, u_int idom)
+{
+	u_int k, *up;
+
+	dt->depth[i] = idom == i ? 1 : dt->depth[idom] + 1;
+	up = &dt->up[i];
+	up[0] = idom;
+	for (k = 1; k < dt->log; ++k)
+		up[k * dt->n] = dt->up[(k - 1) * dt->n + up[(k - 1) * dt->n]];
+}
+
+/*
+ * Return the dominator of i at the given depth, which must be no
+ * greater than that of i.
+ */
+static u_int
+dt_ancestor(struct domtree *dt, u_int i, u_int depth)
+{
+	u_int d, k;
+
+	d = dt->depth[i] - depth;
+	while (d != 0) {
+		k = lowest_set_bit(d);
+		d &= ~((u_int)1 << k);
+		i = dt->up[k * dt->n + i];
+	}
+	return i;
+}
+
+/*
+ * Return the nearest common dominator of a and b.
+ */
+static u_int
+dt_nca(struct domtree *dt, u_int a, u_int b)
+{
+	u_int k;
+
+	if (dt->depth[a] > dt->depth[b])
+		a = dt_ancestor(dt, a, dt->depth[b]);
+	else
+		b = dt_ancestor(dt, b, dt->depth[a]);
+	if (a == b)
+		return a;
+	for (k = dt->log; k != 0; ) {
+		--k;
+		if (dt->up[k * dt->n + a] != dt->up[k * dt->n + b]) {
+			a = dt->up[k * dt->n + a];
+			b = dt->up[k * dt->n + b];
+		}
+	}
+	return dt->up[a];
+}
+
+/*
+ * True if a dominates b, i.e. if a is on every path from the root to b
+ * (every node dominates itself).  A node that wasn't reachable when
+ * the tree was built is taken to be dominated by every node.
+ */
+static int
+dt_dominates(struct domtree *dt, u_int a, u_int b)
+{
+	if (dt->depth[b] == 0)
+		return 1;
+	if (dt->depth[a] == 0 || dt->depth[a] > dt->depth[b])
+		return 0;
+	return dt_ancestor(dt, b, dt->depth[a]) == a;
+}
+
 /*
  * Find dominator relationships.
  * Assumes graph has been leveled.
+ *
+ * As all the predecessors of a block are at higher levels than it,
+ * walking the levels from the root down visits each block after all
+ * of its predecessors, by which time its immediate dominator, the
+ * nearest common dominator of its predecessors, is known.
  */
 static void
 find_dom(opt_state_t *opt_state, struct block *root)
 {
+	struct domtree *dt = &opt_state->dom;
+	u_int *pend = opt_state->dompend;
 	u_int i;
 	int level;
 	struct block *b;
-	bpf_u_int32 *x;
 
-	/*
-	 * Initialize sets to contain all nodes.
-	 */
-	x = opt_state->all_dom_sets;
-	/*
-	 * In opt_init(), we've made sure the product doesn't overflow.
-	 */
-	i = opt_state->n_blocks * opt_state->nodewords;
-	while (i != 0) {
-		--i;
-		*x++ = 0xFFFFFFFFU;
-	}
-	/* Root starts off empty. */
-	for (i = opt_state->nodewords; i != 0;) {
-		--i;
-		root->dom[i] = 0;
-	}
+	memset(dt->depth, 0, dt->n * sizeof(*dt->depth));
+	for (i = 0; i < opt_state->n_blocks; ++i)
+		pend[i] = DOM_NONE;
+	pend[root->id] = root->id;
 
 	/* root->level is the highest level no found. */
 	for (level = root->level; level >= 0; --level) {
 		for (b = opt_state->levels[level]; b; b = b->link) {
-			SET_INSERT(b->dom, b->id);
+			dt_add(dt, b->id, pend[b->id]);
 			if (JT(b) == 0)
 				continue;
-			SET_INTERSECT(JT(b)->dom, b->dom, opt_state->nodewords);
-			SET_INTERSECT(JF(b)->dom, b->dom, opt_state->nodewords);
+			i = JT(b)->id;
+			pend[i] = pend[i] == DOM_NONE ? b->id :
+			    dt_nca(dt, pend[i], b->id);
+			i = JF(b)->id;
+			pend[i] = pend[i] == DOM_NONE ? b->id :
+			    dt_nca(dt, pend[i], b->id);
 		}
 	}
 }
 
+/*
+ * Enter the edge ep into the edge dominator tree, and merge it into
+ * the dominators of the edges leaving its successor.
+ */
 static void
-propedom(opt_state_t *opt_state, struct edge *ep)
+propedom(opt_state_t *opt_state, struct edge *ep, u_int idom)
 {
-	SET_INSERT(ep->edom, ep->id);
+	struct domtree *dt = &opt_state->edom;
+	u_int *pend = opt_state->dompend;
+	u_int i;
+
+	dt_add(dt, ep->id, idom);
 	if (ep->succ) {
-		SET_INTERSECT(ep->succ->et.edom, ep->edom, opt_state->edgewords);
-		SET_INTERSECT(ep->succ->ef.edom, ep->edom, opt_state->edgewords);
+		i = ep->succ->id;
+		pend[i] = pend[i] == DOM_NONE ? ep->id :
+		    dt_nca(dt, pend[i], ep->id);
 	}
 }
 
 /*
  * Compute edge dominators.
  * Assumes graph has been leveled and predecessors established.
+ *
+ * The edges leaving a block are dominated by the nearest common
+ * dominator of the edges entering it; dompend holds that for each
+ * block as its predecessors are visited.  The edges leaving the root
+ * have no dominators other than themselves; an extra node, numbered
+ * n_edges, stands in as their immediate dominator, so that the edges
+ * form a single tree.
  */
 static void
 find_edom(opt_state_t *opt_state, struct block *root)
 {
 	u_int i;
-	uset x;
 	int level;
 	struct block *b;
 
-	x = opt_state->all_edge_sets;
-	/*
-	 * In opt_init(), we've made sure the product doesn't overflow.
-	 */
-	for (i = opt_state->n_edges * opt_state->edgewords; i != 0; ) {
-		--i;
-		x[i] = 0xFFFFFFFFU;
-	}
+	memset(opt_state->edom.depth, 0,
+	    opt_state->edom.n * sizeof(*opt_state->edom.depth));
+	for (i = 0; i < opt_state->n_blocks; ++i)
+		opt_state->dompend[i] = DOM_NONE;
+	dt_add(&opt_state->edom, opt_state->n_edges, opt_state->n_edges);
+	opt_state->dompend[root->id] = opt_state->n_edges;
 
 	/* root->level is the highest level no found. */
-	memset(root->et.edom, 0, opt_state->edgewords * sizeof(*(uset)0));
-	memset(root->ef.edom, 0, opt_state->edgewords * sizeof(*(uset)0));
 	for (level = root->level; level >= 0; --level) {
 		for (b = opt_state->levels[level]; b != 0; b = b->link) {
-			propedom(opt_state, &b->et);
-			propedom(opt_state, &b->ef);
-		}
-	}
-}
-
-/*
- * Find the backwards transitive closure of the flow graph.  These sets
- * are backwards in the sense that we find the set of nodes that reach
- * a given node, not the set of nodes that can be reached by a node.
- *
- * Assumes graph has been leveled.
- */
-static void
-find_closure(opt_state_t *opt_state, struct block *root)
-{
-	int level;
-	struct block *b;
-
-	/*
-	 * Initialize sets to contain no nodes.
-	 */
-	memset((char *)opt_state->all_closure_sets, 0,
-	      opt_state->n_blocks * opt_state->nodewords * sizeof(*opt_state->all_closure_sets));
-
-	/* root->level is the highest level no found. */
-	for (level = root->level; level >= 0; --level) {
-		for (b = opt_state->levels[level]; b; b = b->link) {
-			SET_INSERT(b->closure, b->id);
-			if (JT(b) == 0)
-				continue;
-			SET_UNION(JT(b)->closure, b->closure, opt_state->nodewords);
-			SET_UNION(JF(b)->closure, b->closure, opt_state->nodewords);
+			propedom(opt_state, &b->et, opt_state->dompend[b->id]);
+			propedom(opt_state, &b->ef, opt_state->dompend[b->id]);
 		}
 	}
 }
@@ -1690,6 +1715,14 @@ fold_edge(struct block *child, struct edge *ep)
 	return 0;
 }
 
+static int
+cmp_edge_id(const void *a, const void *b)
+{
+	u_int x = *(const u_int *)a, y = *(const u_int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
 /*
  * If we can make this edge go directly to a child of the edge's current
  * successor, do so.
@@ -1697,8 +1730,8 @@ fold_edge(struct block *child, struct edge *ep)
 static void
 opt_j(opt_state_t *opt_state, struct edge *ep)
 {
-	register u_int i, k;
-	register struct block *target;
+	u_int i, k, n;
+	struct block *target;
 
 	/*
 	 * Does this edge go to a block where, if the test
@@ -1750,52 +1783,53 @@ opt_j(opt_state_t *opt_state, struct edge *ep)
 	 * For each edge dominator that matches the successor of this
 	 * edge, promote the edge successor to the its grandchild.
 	 *
-	 * XXX We violate the set abstraction here in favor a reasonably
-	 * efficient loop.
+	 * The dominators are tried in order of edge number; walk up
+	 * the edge dominator tree, collecting the ones for which
+	 * fold_edge() finds a target, and sort those.
 	 */
  top:
-	for (i = 0; i < opt_state->edgewords; ++i) {
-		/* i'th word in the bitset of dominators */
-		register bpf_u_int32 x = ep->edom[i];
-
-		while (x != 0) {
-			/* Find the next dominator in that word and mark it as found */
-			k = lowest_set_bit(x);
-			x &=~ ((bpf_u_int32)1 << k);
-			k += i * BITS_PER_WORD;
-
-			target = fold_edge(ep->succ, opt_state->edges[k]);
+	n = 0;
+	for (k = ep->id; k != opt_state->n_edges;
+	    k = opt_state->edom.up[k]) {
+		if (fold_edge(ep->succ, opt_state->edges[k]) != 0)
+			opt_state->edomcand[n++] = k;
+	}
+	if (n > 1)
+		qsort(opt_state->edomcand, n, sizeof(*opt_state->edomcand),
+		    cmp_edge_id);
+	for (i = 0; i < n; ++i) {
+		k = opt_state->edomcand[i];
+		target = fold_edge(ep->succ, opt_state->edges[k]);
+		/*
+		 * We have a candidate to replace the successor
+		 * of ep.
+		 *
+		 * Check that there is no data dependency between
+		 * nodes that will be violated if we move the edge;
+		 * i.e., if any register used on exit from the
+		 * candidate has a value at that point different
+		 * from the value it has when we exit the
+		 * predecessor of that edge, there's a data
+		 * dependency that will be violated.
+		 */
+		if (!use_conflict(ep->pred, target)) {
 			/*
-			 * We have a candidate to replace the successor
-			 * of ep.
+			 * It's safe to replace the successor of
+			 * ep; do so, and note that we've made
+			 * at least one change.
 			 *
-			 * Check that there is no data dependency between
-			 * nodes that will be violated if we move the edge;
-			 * i.e., if any register used on exit from the
-			 * candidate has a value at that point different
-			 * from the value it has when we exit the
-			 * predecessor of that edge, there's a data
-			 * dependency that will be violated.
+			 * XXX - this is one of the operations that
+			 * happens when the optimizer gets into
+			 * one of those infinite loops.
 			 */
-			if (target != 0 && !use_conflict(ep->pred, target)) {
+			opt_state->done = 0;
+			ep->succ = target;
+			if (JT(target) != 0)
 				/*
-				 * It's safe to replace the successor of
-				 * ep; do so, and note that we've made
-				 * at least one change.
-				 *
-				 * XXX - this is one of the operations that
-				 * happens when the optimizer gets into
-				 * one of those infinite loops.
+				 * Start over unless we hit a leaf.
 				 */
-				opt_state->done = 0;
-				ep->succ = target;
-				if (JT(target) != 0)
-					/*
-					 * Start over unless we hit a leaf.
-					 */
-					goto top;
-				return;
-			}
+				goto top;
+			return;
 		}
 	}
 }
@@ -1888,7 +1922,7 @@ or_pullup(opt_state_t *opt_state, struct block *b)
 		 *
 		 * Does b dominate diffp?
 		 */
-		if (!SET_MEMBER((*diffp)->dom, b->id))
+		if (!dt_dominates(&opt_state->dom, b->id, (*diffp)->id))
 			return;
 
 		/*
@@ -1934,7 +1968,7 @@ or_pullup(opt_state_t *opt_state, struct block *b)
 		 *
 		 * Does b dominate samep?
 		 */
-		if (!SET_MEMBER((*samep)->dom, b->id))
+		if (!dt_dominates(&opt_state->dom, b->id, (*samep)->id))
 			return;
 
 		/*
@@ -2017,7 +2051,7 @@ and_pullup(opt_state_t *opt_state, struct block *b)
 		if (JF(*diffp) != JF(b))
 			return;
 
-		if (!SET_MEMBER((*diffp)->dom, b->id))
+		if (!dt_dominates(&opt_state->dom, b->id, (*diffp)->id))
 			return;
 
 		if ((*diffp)->val[A_ATOM] != val)
@@ -2034,7 +2068,7 @@ and_pullup(opt_state_t *opt_state, struct block *b)
 		if (JF(*samep) != JF(b))
 			return;
 
-		if (!SET_MEMBER((*samep)->dom, b->id))
+		if (!dt_dominates(&opt_state->dom, b->id, (*samep)->id))
 			return;
 
 		if ((*samep)->val[A_ATOM] == val)
@@ -2205,7 +2239,6 @@ opt_loop(opt_state_t *opt_state, struct icode *ic, int do_stmts)
 		opt_state->non_branch_movement_performed = 0;
 		find_levels(opt_state, ic);
 		find_dom(opt_state, ic->root);
-		find_closure(opt_state, ic->root);
 		find_ud(opt_state, ic->root);
 		find_edom(opt_state, ic->root);
 		opt_blks(opt_state, ic, do_stmts);
@@ -2299,29 +2332,6 @@ bpf_optimize(struct icode *ic, char *errbuf)
 	return 0;
 }
 
-static void
-make_marks(struct icode *ic, struct block *p)
-{
-	if (!isMarked(ic, p)) {
-		Mark(ic, p);
-		if (BPF_CLASS(p->s.code) != BPF_RET) {
-			make_marks(ic, JT(p));
-			make_marks(ic, JF(p));
-		}
-	}
-}
-
-/*
- * Mark code array such that isMarked(ic->cur_mark, i) is true
- * only for nodes that are alive.
- */
-static void
-mark_code(struct icode *ic)
-{
-	ic->cur_mark += 1;
-	make_marks(ic, ic->root);
-}
-
 /*
  * True iff the two stmt lists load the same value from the packet into
  * the accumulator.
@@ -2345,68 +2355,132 @@ eq_slist(struct slist *x, struct slist *y)
 	}
 }
 
+/*
+ * While intern_blocks() runs, the link field of each reachable block
+ * points at the first block found to be equal to it (possibly itself);
+ * two successors are the same if they share that block.
+ */
+#define BLK_CLASS(b)	((b) != NULL ? (b)->link : NULL)
+
 static inline int
 eq_blk(struct block *b0, struct block *b1)
 {
 	if (b0->s.code == b1->s.code &&
 	    b0->s.k == b1->s.k &&
-	    b0->et.succ == b1->et.succ &&
-	    b0->ef.succ == b1->ef.succ)
+	    BLK_CLASS(JT(b0)) == BLK_CLASS(JT(b1)) &&
+	    BLK_CLASS(JF(b0)) == BLK_CLASS(JF(b1)))
 		return eq_slist(b0->stmts, b1->stmts);
 	return 0;
 }
 
+/*
+ * Hash a block on the same fields eq_blk() compares, so that blocks
+ * that are equal always land in the same bucket.
+ */
+static u_int
+hash_blk(struct block *b)
+{
+	struct slist *s;
+	u_int h;
+
+	h = (u_int)b->s.code * 31 + b->s.k;
+	h = h * 31 + (JT(b) != NULL ? BLK_CLASS(JT(b))->id + 1 : 0);
+	h = h * 31 + (JF(b) != NULL ? BLK_CLASS(JF(b))->id + 1 : 0);
+	for (s = b->stmts; s != NULL; s = s->next) {
+		if (s->s.code == NOP)
+			continue;
+		h = h * 31 + (u_int)s->s.code;
+		h = h * 31 + s->s.k;
+	}
+	return h ^ (h >> 16);
+}
+
+/*
+ * Visit the blocks reachable from p children first, so that by the
+ * time a block is hashed its successors have already been assigned
+ * to their equivalence classes.
+ */
+static void
+intern_blocks_r(opt_state_t *opt_state, struct icode *ic, struct block *p)
+{
+	struct block *q;
+	u_int h;
+
+	if (isMarked(ic, p))
+		return;
+	Mark(ic, p);
+	if (BPF_CLASS(p->s.code) != BPF_RET) {
+		intern_blocks_r(opt_state, ic, JT(p));
+		intern_blocks_r(opt_state, ic, JF(p));
+	}
+
+	h = hash_blk(p) & (opt_state->blkhashsize - 1);
+	for (q = opt_state->blkhash[h]; q != NULL;
+	    q = opt_state->blkchain[q->id]) {
+		if (eq_blk(p, q))
+			break;
+	}
+	if (q != NULL) {
+		p->link = q;
+		/* Keep the highest-numbered block of the class. */
+		if (p->id > opt_state->blkrep[q->id]->id)
+			opt_state->blkrep[q->id] = p;
+		return;
+	}
+	p->link = p;
+	opt_state->blkrep[p->id] = p;
+	opt_state->blkchain[p->id] = opt_state->blkhash[h];
+	opt_state->blkhash[h] = p;
+}
+
+/*
+ * Merge equal blocks, redirecting every edge to the highest-numbered
+ * block of its class.  Equal blocks are found by hashing each block
+ * once its successors have been merged, rather than by comparing
+ * every pair of blocks and repeating until nothing changes, which is
+ * quadratic in the size of the program and dominated compile time
+ * for long filters.  The result is the same.
+ */
 static void
 intern_blocks(opt_state_t *opt_state, struct icode *ic)
 {
 	struct block *p;
-	u_int i, j;
-	int done1; /* don't shadow global */
- top:
-	done1 = 1;
+	u_int i;
+
 	for (i = 0; i < opt_state->n_blocks; ++i)
 		opt_state->blocks[i]->link = 0;
+	memset(opt_state->blkhash, 0,
+	    opt_state->blkhashsize * sizeof(*opt_state->blkhash));
 
-	mark_code(ic);
+	ic->cur_mark += 1;
+	intern_blocks_r(opt_state, ic, ic->root);
 
-	for (i = opt_state->n_blocks - 1; i != 0; ) {
-		--i;
-		if (!isMarked(ic, opt_state->blocks[i]))
-			continue;
-		for (j = i + 1; j < opt_state->n_blocks; ++j) {
-			if (!isMarked(ic, opt_state->blocks[j]))
-				continue;
-			if (eq_blk(opt_state->blocks[i], opt_state->blocks[j])) {
-				opt_state->blocks[i]->link = opt_state->blocks[j]->link ?
-					opt_state->blocks[j]->link : opt_state->blocks[j];
-				break;
-			}
-		}
-	}
 	for (i = 0; i < opt_state->n_blocks; ++i) {
 		p = opt_state->blocks[i];
 		if (JT(p) == 0)
 			continue;
-		if (JT(p)->link) {
-			done1 = 0;
-			JT(p) = JT(p)->link;
-		}
-		if (JF(p)->link) {
-			done1 = 0;
-			JF(p) = JF(p)->link;
-		}
+		if (JT(p)->link)
+			JT(p) = opt_state->blkrep[JT(p)->link->id];
+		if (JF(p)->link)
+			JF(p) = opt_state->blkrep[JF(p)->link->id];
 	}
-	if (!done1)
-		goto top;
 }
 
 static void
 opt_cleanup(opt_state_t *opt_state)
 {
+	free((void *)opt_state->blkrep);
+	free((void *)opt_state->blkchain);
+	free((void *)opt_state->blkhash);
 	free((void *)opt_state->vnode_base);
 	free((void *)opt_state->vmap);
+	free((void *)opt_state->edomcand);
+	free((void *)opt_state->dompend);
+	free((void *)opt_state->edom.up);
+	free((void *)opt_state->edom.depth);
+	free((void *)opt_state->dom.up);
+	free((void *)opt_state->dom.depth);
 	free((void *)opt_state->edges);
-	free((void *)opt_state->space);
 	free((void *)opt_state->levels);
 	free((void *)opt_state->blocks);
 }
@@ -2516,6 +2590,28 @@ count_stmts(struct icode *ic, struct block *p)
 	return slength(p->stmts) + n + 1 + p->longjt + p->longjf;
 }
 
+/*
+ * Allocate a dominator tree with n nodes.
+ */
+static void
+dt_init(opt_state_t *opt_state, struct domtree *dt, u_int n)
+{
+	dt->n = n;
+	for (dt->log = 1; dt->log < 32 && ((u_int)1 << dt->log) < n; ++dt->log)
+		continue;
+	if (n > SIZE_MAX / sizeof(*dt->up) / dt->log) {
+		opt_error(opt_state, "filter is too complex to optimize");
+	}
+	dt->depth = (u_int *)calloc(n, sizeof(*dt->depth));
+	if (dt->depth == NULL) {
+		opt_error(opt_state, "malloc");
+	}
+	dt->up = (u_int *)calloc((size_t)n * dt->log, sizeof(*dt->up));
+	if (dt->up == NULL) {
+		opt_error(opt_state, "malloc");
+	}
+}
+
 /*
  * Allocate memory.  All allocation is done before optimization
  * is begun.  A linear bound on the size of all data structures is computed
@@ -2524,10 +2620,7 @@ count_stmts(struct icode *ic, struct block *p)
 static void
 opt_init(opt_state_t *opt_state, struct icode *ic)
 {
-	bpf_u_int32 *p;
 	int i, n, max_stmts;
-	u_int product;
-	size_t block_memsize, edge_memsize;
 
 	/*
 	 * First, count the blocks, so we can malloc an array to map
@@ -2568,84 +2661,21 @@ opt_init(opt_state_t *opt_state, struct icode *ic)
 		opt_error(opt_state, "malloc");
 	}
 
-	opt_state->edgewords = opt_state->n_edges / BITS_PER_WORD + 1;
-	opt_state->nodewords = opt_state->n_blocks / BITS_PER_WORD + 1;
-
-	/*
-	 * Make sure opt_state->n_blocks * opt_state->nodewords fits
-	 * in a u_int; we use it as a u_int number-of-iterations
-	 * value.
-	 */
-	product = opt_state->n_blocks * opt_state->nodewords;
-	if ((product / opt_state->n_blocks) != opt_state->nodewords) {
-		/*
-		 * XXX - just punt and don't try to optimize?
-		 * In practice, this is unlikely to happen with
-		 * a normal filter.
-		 */
-		opt_error(opt_state, "filter is too complex to optimize");
-	}
-
-	/*
-	 * Make sure the total memory required for that doesn't
-	 * overflow.
-	 */
-	block_memsize = (size_t)2 * product * sizeof(*opt_state->space);
-	if ((block_memsize / product) != 2 * sizeof(*opt_state->space)) {
-		opt_error(opt_state, "filter is too complex to optimize");
-	}
-
-	/*
-	 * Make sure opt_state->n_edges * opt_state->edgewords fits
-	 * in a u_int; we use it as a u_int number-of-iterations
-	 * value.
-	 */
-	product = opt_state->n_edges * opt_state->edgewords;
-	if ((product / opt_state->n_edges) != opt_state->edgewords) {
-		opt_error(opt_state, "filter is too complex to optimize");
-	}
-
-	/*
-	 * Make sure the total memory required for that doesn't
-	 * overflow.
-	 */
-	edge_memsize = (size_t)product * sizeof(*opt_state->space);
-	if (edge_memsize / product != sizeof(*opt_state->space)) {
-		opt_error(opt_state, "filter is too complex to optimize");
-	}
-
-	/*
-	 * Make sure the total memory required for both of them doesn't
-	 * overflow.
-	 */
-	if (block_memsize > SIZE_MAX - edge_memsize) {
-		opt_error(opt_state, "filter is too complex to optimize");
-	}
-
-	/* XXX */
-	opt_state->space = (bpf_u_int32 *)malloc(block_memsize + edge_memsize);
-	if (opt_state->space == NULL) {
+	dt_init(opt_state, &opt_state->dom, opt_state->n_blocks);
+	/* One more node to be the immediate dominator of the root's edges. */
+	dt_init(opt_state, &opt_state->edom, opt_state->n_edges + 1);
+	opt_state->dompend = (u_int *)calloc(opt_state->n_blocks, sizeof(*opt_state->dompend));
+	if (opt_state->dompend == NULL) {
 		opt_error(opt_state, "malloc");
 	}
-	p = opt_state->space;
-	opt_state->all_dom_sets = p;
-	for (i = 0; i < n; ++i) {
-		opt_state->blocks[i]->dom = p;
-		p += opt_state->nodewords;
-	}
-	opt_state->all_closure_sets = p;
-	for (i = 0; i < n; ++i) {
-		opt_state->blocks[i]->closure = p;
-		p += opt_state->nodewords;
+	opt_state->edomcand = (u_int *)calloc(opt_state->n_edges, sizeof(*opt_state->edomcand));
+	if (opt_state->edomcand == NULL) {
+		opt_error(opt_state, "malloc");
 	}
-	opt_state->all_edge_sets = p;
+
 	for (i = 0; i < n; ++i) {
 		register struct block *b = opt_state->blocks[i];
 
-		b->et.edom = p;
-		p += opt_state->edgewords;
-		b->ef.edom = p;
-		p += opt_state->edgewords;
 		b->et.id = i;
 		opt_state->edges[i] = &b->et;
 		b->ef.id = opt_state->n_blocks + i;
@@ -2670,6 +2700,25 @@ opt_init(opt_state_t *opt_state, struct icode *ic)
 	if (opt_state->vnode_base == NULL) {
 		opt_error(opt_state, "malloc");
 	}
+
+	opt_state->blkhashsize = 1;
+	while (opt_state->blkhashsize < opt_state->n_blocks) {
+		opt_state->blkhashsize <<= 1;
+		if (opt_state->blkhashsize == 0)
+			opt_error(opt_state, "filter is too complex to optimize");
+	}
+	opt_state->blkhash = (struct block **)calloc(opt_state->blkhashsize, sizeof(*opt_state->blkhash));
+	if (opt_state->blkhash == NULL) {
+		opt_error(opt_state, "malloc");
+	}
+	opt_state->blkchain = (struct block **)calloc(opt_state->n_blocks, sizeof(*opt_state->blkchain));
+	if (opt_state->blkchain == NULL) {
+		opt_error(opt_state, "malloc");
+	}
+	opt_state->blkrep = (struct block **)calloc(opt_state->n_blocks, sizeof(*opt_state->blkrep));
+	if (opt_state->blkrep == NULL) {
+		opt_error(opt_state, "malloc");
+	}
 }
 
 /*
@@ -2698,15 +2747,23 @@ convert_code_r(conv_state_t *conv_state, struct icode *ic, struct block *p)
 	u_int slen;
 	u_int off;
 	struct slist **offset = NULL;
+	int ret = 1;
 
 	if (p == 0 || isMarked(ic, p))
 		return (1);
 	Mark(ic, p);
 
+	/*
+	 * If a branch turns out to need a long jump, carry on
+	 * converting to find any others before retrying, rather
+	 * than starting over for each one.  Marking a branch only
+	 * ever moves other branch targets further away, so this
+	 * marks the same branches as retrying for each one would.
+	 */
 	if (convert_code_r(conv_state, ic, JF(p)) == 0)
-		return (0);
+		ret = 0;
 	if (convert_code_r(conv_state, ic, JT(p)) == 0)
-		return (0);
+		ret = 0;
 
 	slen = slength(p->stmts);
 	dst = conv_state->ftail -= (slen + 1 + p->longjt + p->longjf);
@@ -2828,12 +2885,13 @@ filled:
 		    if (p->longjt == 0) {
 			/* mark this instruction and retry */
 			p->longjt++;
-			return(0);
+			ret = 0;
+		    } else {
+			dst->jt = extrajmps;
+			extrajmps++;
+			dst[extrajmps].code = BPF_JMP|BPF_JA;
+			dst[extrajmps].k = off - extrajmps;
 		    }
-		    dst->jt = extrajmps;
-		    extrajmps++;
-		    dst[extrajmps].code = BPF_JMP|BPF_JA;
-		    dst[extrajmps].k = off - extrajmps;
 		}
 		else
 		    dst->jt = (u_char)off;
@@ -2843,19 +2901,20 @@ filled:
 		    if (p->longjf == 0) {
 			/* mark this instruction and retry */
 			p->longjf++;
-			return(0);
+			ret = 0;
+		    } else {
+			/* branch if F to following jump */
+			/* if two jumps are inserted, F goes to second one */
+			dst->jf = extrajmps;
+			extrajmps++;
+			dst[extrajmps].code = BPF_JMP|BPF_JA;
+			dst[extrajmps].k = off - extrajmps;
 		    }
-		    /* branch if F to following jump */
-		    /* if two jumps are inserted, F goes to second one */
-		    dst->jf = extrajmps;
-		    extrajmps++;
-		    dst[extrajmps].code = BPF_JMP|BPF_JA;
-		    dst[extrajmps].k = off - extrajmps;
 		}
 		else
 		    dst->jf = (u_char)off;
 	}
-	return (1);
+	return (ret);
 }
 
 
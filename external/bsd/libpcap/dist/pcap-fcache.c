@@ -0,0 +1,273 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * On-disk cache of compiled filter programs.
+ *
+ * If PCAP_FILTER_CACHE names a directory, pcap_compile() looks there
+ * for a program compiled earlier from the same filter text for the
+ * same link-layer type, snapshot length, netmask and optimization
+ * setting by the same version of the library, and stores the programs
+ * it compiles there.  Daemons that start with the same large filters
+ * then only pay for compiling them once.
+ *
+ * Each program is kept in a file named after a hash of its key, which
+ * holds the key itself, so that collisions are detected, followed by
+ * the instructions.  Files are replaced atomically with rename(2), so
+ * concurrent compiles of the same filter are harmless.  Only files
+ * owned by the user or by root, and not writable by anyone else, are
+ * trusted, and the programs read are validated before they are used.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pcap-int.h"
+
+#define FCACHE_ENV	"PCAP_FILTER_CACHE"
+#define FCACHE_MAGIC	0x70664331	/* "pfC1" */
+#define FCACHE_MAXLEN	(1024 * 1024)	/* largest filter text cached */
+#define FCACHE_MAXINSNS	(1024 * 1024)	/* largest program cached */
+
+struct fcache_hdr {
+	uint32_t	magic;
+	int32_t		linktype;
+	int32_t		snaplen;
+	int32_t		optimize;
+	uint32_t	netmask;
+	uint32_t	codegen_flags;
+	uint32_t	keylen;		/* version and filter text */
+	uint32_t	len;		/* instructions */
+};
+
+/*
+ * Return the cache directory, or NULL if there isn't one.
+ */
+static const char *
+fcache_dir(void)
+{
+	const char *dir;
+
+#ifdef __NetBSD__
+	if (issetugid())
+		return (NULL);
+#endif
+	dir = getenv(FCACHE_ENV);
+	if (dir == NULL || *dir != '/')
+		return (NULL);
+	return (dir);
+}
+
+/*
+ * Build the key for a filter: the library version and the filter text,
+ * and the header that goes with it.  Return the key, which the caller
+ * frees, or NULL if the filter isn't to be cached.
+ */
+static char *
+fcache_key(pcap_t *p, const char *buf, int optimize, bpf_u_int32 mask,
+    struct fcache_hdr *hdr, char *path, size_t pathlen)
+{
+	const char *dir, *version;
+	const unsigned char *cp;
+	uint64_t h;
+	size_t vlen, blen;
+	char *key;
+
+	if ((dir = fcache_dir()) == NULL)
+		return (NULL);
+	/* pcap_compile() treats a null filter as an empty one */
+	if (buf == NULL)
+		buf = "";
+	version = pcap_lib_version();
+	vlen = strlen(version) + 1;
+	blen = strlen(buf) + 1;
+	if (blen > FCACHE_MAXLEN)
+		return (NULL);
+	if ((key = malloc(vlen + blen)) == NULL)
+		return (NULL);
+	memcpy(key, version, vlen);
+	memcpy(key + vlen, buf, blen);
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = FCACHE_MAGIC;
+	hdr->linktype = p->linktype;
+	hdr->snaplen = pcap_snapshot(p);
+	hdr->optimize = optimize != 0;
+	hdr->netmask = mask;
+	hdr->codegen_flags = (uint32_t)p->bpf_codegen_flags;
+	hdr->keylen = (uint32_t)(vlen + blen);
+
+	/* FNV-1a over the header and the key */
+	h = 0xcbf29ce484222325ULL;
+	for (cp = (const unsigned char *)hdr;
+	    cp < (const unsigned char *)(hdr + 1); cp++)
+		h = (h ^ *cp) * 0x100000001b3ULL;
+	for (cp = (const unsigned char *)key;
+	    cp < (const unsigned char *)key + hdr->keylen; cp++)
+		h = (h ^ *cp) * 0x100000001b3ULL;
+
+	if ((size_t)snprintf(path, pathlen, "%s/%016llx.bpf", dir,
+	    (unsigned long long)h) >= pathlen) {
+		free(key);
+		return (NULL);
+	}
+	return (key);
+}
+
+static int
+fcache_readall(int fd, void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, buf, len);
+		if (n <= 0)
+			return (-1);
+		buf = (char *)buf + n;
+		len -= (size_t)n;
+	}
+	return (0);
+}
+
+static int
+fcache_writeall(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n <= 0)
+			return (-1);
+		buf = (const char *)buf + n;
+		len -= (size_t)n;
+	}
+	return (0);
+}
+
+/*
+ * Look up the program for a filter.  On a hit, fill in program and
+ * return 0; otherwise, return -1.
+ */
+int
+pcap_fcache_lookup(pcap_t *p, struct bpf_program *program, const char *buf,
+    int optimize, bpf_u_int32 mask)
+{
+	struct fcache_hdr want, hdr;
+	struct bpf_insn *insns;
+	struct stat st;
+	char path[PATH_MAX], *key, *fkey;
+	int fd, rc;
+
+	if ((key = fcache_key(p, buf, optimize, mask, &want, path,
+	    sizeof(path))) == NULL)
+		return (-1);
+	rc = -1;
+	fkey = NULL;
+	insns = NULL;
+	if ((fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1)
+		goto out;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    (st.st_uid != geteuid() && st.st_uid != 0) ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+		goto out;
+	if (fcache_readall(fd, &hdr, sizeof(hdr)) == -1 ||
+	    hdr.len == 0 || hdr.len > FCACHE_MAXINSNS)
+		goto out;
+	/* Everything but the program length has to match. */
+	want.len = hdr.len;
+	if (memcmp(&hdr, &want, sizeof(hdr)) != 0)
+		goto out;
+	if ((fkey = malloc(hdr.keylen)) == NULL ||
+	    fcache_readall(fd, fkey, hdr.keylen) == -1 ||
+	    memcmp(fkey, key, hdr.keylen) != 0)
+		goto out;
+	if ((insns = calloc(hdr.len, sizeof(*insns))) == NULL ||
+	    fcache_readall(fd, insns, hdr.len * sizeof(*insns)) == -1 ||
+	    !pcap_validate_filter(insns, (int)hdr.len))
+		goto out;
+
+	program->bf_len = hdr.len;
+	program->bf_insns = insns;
+	insns = NULL;
+	rc = 0;
+out:
+	if (fd != -1)
+		close(fd);
+	free(insns);
+	free(fkey);
+	free(key);
+	return (rc);
+}
+
+/*
+ * Store the program compiled for a filter.  Failures are ignored; the
+ * cache is only an optimization.
+ */
+void
+pcap_fcache_store(pcap_t *p, const struct bpf_program *program,
+    const char *buf, int optimize, bpf_u_int32 mask)
+{
+	struct fcache_hdr hdr;
+	char path[PATH_MAX], tmp[PATH_MAX], *key;
+	int fd;
+
+	if (program->bf_len == 0 || program->bf_len > FCACHE_MAXINSNS)
+		return;
+	if ((key = fcache_key(p, buf, optimize, mask, &hdr, path,
+	    sizeof(path))) == NULL)
+		return;
+	hdr.len = program->bf_len;
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >=
+	    sizeof(tmp)) {
+		free(key);
+		return;
+	}
+	if ((fd = mkstemp(tmp)) == -1) {
+		free(key);
+		return;
+	}
+	if (fcache_writeall(fd, &hdr, sizeof(hdr)) == -1 ||
+	    fcache_writeall(fd, key, hdr.keylen) == -1 ||
+	    fcache_writeall(fd, program->bf_insns,
+	    program->bf_len * sizeof(*program->bf_insns)) == -1) {
+		(void)close(fd);
+		(void)unlink(tmp);
+	} else if (close(fd) == -1 || rename(tmp, path) == -1)
+		(void)unlink(tmp);
+	free(key);
+}
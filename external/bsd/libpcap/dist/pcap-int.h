@@ -638,6 +638,14 @@ u_int	pcap_filter(const struct bpf_insn *, const u_char *, u_int, u_int);
  */
 int	pcap_validate_filter(const struct bpf_insn *, int);
 
+/*
+ * On-disk cache of programs compiled by pcap_compile().
+ */
+int	pcap_fcache_lookup(pcap_t *, struct bpf_program *, const char *, int,
+    bpf_u_int32);
+void	pcap_fcache_store(pcap_t *, const struct bpf_program *, const char *,
+    int, bpf_u_int32);
+
 /*
  * Internal interfaces for both "pcap_create()" and routines that
  * open savefiles.
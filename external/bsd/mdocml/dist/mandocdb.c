@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include <assert.h>
 #include <ctype.h>
@@ -89,7 +90,9 @@ struct	mpage {
 	char		*desc;    /* description from file content */
 	struct mpage	*next;    /* singly linked list */
 	struct mlink	*mlinks;  /* singly linked list */
+	time_t		 mtime;   /* newest modification time */
 	int		 name_head_done;
+	int		 dirty;   /* needs to be parsed again */
 	enum form	 form;    /* format from file content */
 };
 
@@ -102,10 +105,16 @@ struct	mlink {
 	struct mlink	*next;    /* singly linked list */
 	struct mpage	*mpage;   /* parent */
 	int		 gzip;	  /* filename has a .gz suffix */
+	int		 indb;	  /* found in the existing database */
 	enum form	 dform;   /* format from directory */
 	enum form	 fform;   /* format from file name suffix */
 };
 
+struct	mworker {
+	FILE		*stream;  /* parse results, in page order */
+	pid_t		 pid;
+};
+
 typedef	int (*mdoc_fp)(struct mpage *, const struct roff_meta *,
 			const struct roff_node *);
 
@@ -121,6 +130,7 @@ int		 mandocdb(int, char *[]);
 static	void	 dbadd(struct dba *, struct mpage *);
 static	void	 dbadd_mlink(const struct mlink *mlink);
 static	void	 dbprune(struct dba *);
+static	struct dba *dbrefresh(void);
 static	void	 dbwrite(struct dba *);
 static	void	 filescan(const char *);
 #if HAVE_FTS_COMPARE_CONST
@@ -132,8 +142,16 @@ static	void	 mlink_add(struct mlink *, const struct stat *);
 static	void	 mlink_check(struct mpage *, struct mlink *);
 static	void	 mlink_free(struct mlink *);
 static	void	 mlinks_undupe(struct mpage *);
+static	char	*mpage_getstr(FILE *);
+static	int	 mpage_parse(struct mpage *, struct mparse *, char **);
+static	int	 mpage_recv(FILE *, struct mpage *, char **);
+static	void	 mpage_send(FILE *, struct mpage *, int, const char *);
+static	void	 mpage_sendkeys(FILE *, struct ohash *, int);
 static	void	 mpages_free(void);
 static	void	 mpages_merge(struct dba *, struct mparse *);
+static	size_t	 mworkers_start(struct mworker *, size_t,
+			struct mpage **, size_t, struct mparse *);
+static	void	 mworkers_wait(struct mworker *, size_t);
 static	void	 parse_cat(struct mpage *, int);
 static	void	 parse_man(struct mpage *, const struct roff_meta *,
 			const struct roff_node *);
@@ -172,6 +190,8 @@ static	int	 treescan(void);
 static	size_t	 utf8(unsigned int, char [7]);
 
 static	int		 nodb; /* no database changes */
+static	int		 incremental; /* only parse changed files */
+static	int		 jobs = 1; /* number of parsing processes */
 static	int		 mparse_options; /* abort the parse early */
 static	int		 use_all; /* use all found files */
 static	int		 debug; /* print what we're doing */
@@ -317,12 +337,12 @@ mandocdb(int argc, char *argv[])
 	struct manconf	  conf;
 	struct mparse	 *mp;
 	struct dba	 *dba;
-	const char	 *path_arg, *progname;
+	const char	 *path_arg, *progname, *errstr;
 	size_t		  j, sz;
 	int		  ch, i;
 
 #if HAVE_PLEDGE
-	if (pledge("stdio rpath wpath cpath", NULL) == -1) {
+	if (pledge("stdio rpath wpath cpath proc", NULL) == -1) {
 		warn("pledge");
 		return (int)MANDOCLEVEL_SYSERR;
 	}
@@ -352,7 +372,7 @@ mandocdb(int argc, char *argv[])
 	path_arg = NULL;
 	op = OP_DEFAULT;
 
-	while (-1 != (ch = getopt(argc, argv, "aC:Dd:npQT:tu:v")))
+	while (-1 != (ch = getopt(argc, argv, "aC:Dd:ij:npQT:tu:v")))
 		switch (ch) {
 		case 'a':
 			use_all = 1;
@@ -370,6 +390,16 @@ mandocdb(int argc, char *argv[])
 			path_arg = optarg;
 			op = OP_UPDATE;
 			break;
+		case 'i':
+			incremental = 1;
+			break;
+		case 'j':
+			jobs = strtonum(optarg, 1, 64, &errstr);
+			if (errstr != NULL) {
+				warnx("-j %s: %s", optarg, errstr);
+				goto usage;
+			}
+			break;
 		case 'n':
 			nodb = 1;
 			break;
@@ -410,7 +440,13 @@ mandocdb(int argc, char *argv[])
 
 #if HAVE_PLEDGE
 	if (nodb) {
-		if (pledge("stdio rpath", NULL) == -1) {
+		if (pledge(jobs > 1 ? "stdio rpath proc" : "stdio rpath",
+		    NULL) == -1) {
+			warn("pledge");
+			return (int)MANDOCLEVEL_SYSERR;
+		}
+	} else if (jobs == 1) {
+		if (pledge("stdio rpath wpath cpath", NULL) == -1) {
 			warn("pledge");
 			return (int)MANDOCLEVEL_SYSERR;
 		}
@@ -507,7 +543,9 @@ mandocdb(int argc, char *argv[])
 				continue;
 			if (0 == treescan())
 				continue;
-			dba = dba_new(128);
+			dba = incremental && nodb == 0 ? dbrefresh() : NULL;
+			if (dba == NULL)
+				dba = dba_new(128);
 			mpages_merge(dba, mp);
 			if (nodb == 0)
 				dbwrite(dba);
@@ -530,9 +568,9 @@ out:
 	return exitcode;
 usage:
 	progname = getprogname();
-	fprintf(stderr, "usage: %s [-aDnpQ] [-C file] [-Tutf8]\n"
-			"       %s [-aDnpQ] [-Tutf8] dir ...\n"
-			"       %s [-DnpQ] [-Tutf8] -d dir [file ...]\n"
+	fprintf(stderr, "usage: %s [-aDinpQ] [-C file] [-j jobs] [-Tutf8]\n"
+			"       %s [-aDinpQ] [-j jobs] [-Tutf8] dir ...\n"
+			"       %s [-DnpQ] [-j jobs] [-Tutf8] -d dir [file ...]\n"
 			"       %s [-Dnp] -u dir [file ...]\n"
 			"       %s [-Q] -t file ...\n",
 		        progname, progname, progname, progname, progname);
@@ -584,7 +622,7 @@ treescan(void)
 	argv[0] = ".";
 	argv[1] = NULL;
 
-	f = fts_open((char * const *)__UNCONST(*argv),
+	f = fts_open((char * const *)__UNCONST(argv),
 	    FTS_PHYSICAL | FTS_NOCHDIR, fts_compare);
 	if (f == NULL) {
 		exitcode = (int)MANDOCLEVEL_SYSERR;
@@ -972,6 +1010,8 @@ mlink_add(struct mlink *mlink, const struct stat *st)
 		mlink->next = mpage->mlinks;
 	mpage->mlinks = mlink;
 	mlink->mpage = mpage;
+	if (mpage->mtime < st->st_mtime)
+		mpage->mtime = st->st_mtime;
 }
 
 static void
@@ -1018,6 +1058,7 @@ mlinks_undupe(struct mpage *mpage)
 	struct mlink	**prev;
 	struct mlink	 *mlink;
 	char		 *bufp;
+	unsigned int	  slot;
 
 	mpage->form = FORM_CAT;
 	prev = &mpage->mlinks;
@@ -1041,6 +1082,8 @@ mlinks_undupe(struct mpage *mpage)
 		if (use_all)
 			goto nextlink;
 		*prev = mlink->next;
+		slot = ohash_qlookup(&mlinks, mlink->file);
+		ohash_remove(&mlinks, slot);
 		mlink_free(mlink);
 		continue;
 nextlink:
@@ -1111,52 +1154,80 @@ mlink_check(struct mpage *mpage, struct mlink *mlink)
  *
  * This handles the parsing scheme itself, using the cues of directory
  * and filename to determine whether the file is parsable or not.
+ * With more than one job, the parsing is done by worker processes,
+ * but the results are still added in the order of the list,
+ * such that the database comes out the same.
  */
 static void
 mpages_merge(struct dba *dba, struct mparse *mp)
 {
-	struct mpage		*mpage, *mpage_dest;
+	struct mworker		*w, *workers;
+	struct mpage		**todo, *mpage, *mpage_dest;
 	struct mlink		*mlink, *mlink_dest;
-	struct roff_meta	*meta;
-	char			*cp;
-	int			 fd;
+	char			*cp, *sodest;
+	size_t			 i, todosz, nw;
+	int			 rc;
+
+	/*
+	 * Pages already taken from the old database
+	 * and pages without any links left are skipped.
+	 */
 
+	todo = NULL;
+	todosz = 0;
 	for (mpage = mpage_head; mpage != NULL; mpage = mpage->next) {
 		mlinks_undupe(mpage);
-		if ((mlink = mpage->mlinks) == NULL)
+		if (mpage->mlinks == NULL || mpage->dba != NULL)
 			continue;
+		if ((todosz & 0xff) == 0)
+			todo = mandoc_reallocarray(todo, todosz + 256,
+			    sizeof(*todo));
+		todo[todosz++] = mpage;
+	}
+
+	nw = 0;
+	workers = NULL;
+	if (jobs > 1 && todosz > 1) {
+		nw = (size_t)jobs < todosz ? (size_t)jobs : todosz;
+		workers = mandoc_reallocarray(NULL, nw, sizeof(*workers));
+		nw = mworkers_start(workers, nw, todo, todosz, mp);
+	}
+
+	for (i = 0; i < todosz; i++) {
+		mpage = todo[i];
+		mlink = mpage->mlinks;
 
 		name_mask = NAME_MASK;
 		mandoc_ohash_init(&names, 4, offsetof(struct str, key));
 		mandoc_ohash_init(&strings, 6, offsetof(struct str, key));
-		mparse_reset(mp);
-		meta = NULL;
-
-		if ((fd = mparse_open(mp, mlink->file)) == -1) {
-			say(mlink->file, "&open");
-			goto nextpage;
-		}
 
 		/*
-		 * Interpret the file as mdoc(7) or man(7) source
-		 * code, unless it is known to be formatted.
+		 * If a worker died, parse its remaining pages here.
 		 */
-		if (mlink->dform != FORM_CAT || mlink->fform != FORM_CAT) {
-			mparse_readfd(mp, fd, mlink->file);
-			close(fd);
-			fd = -1;
-			meta = mparse_result(mp);
+
+		rc = -2;
+		w = nw > 0 ? workers + i % nw : NULL;
+		if (w != NULL && w->stream != NULL &&
+		    (rc = mpage_recv(w->stream, mpage, &sodest)) == -2) {
+			say(mlink->file, "Parsing process failed");
+			fclose(w->stream);
+			w->stream = NULL;
 		}
+		if (rc == -2)
+			rc = mpage_parse(mpage, mp, &sodest);
+		if (rc == -1)
+			goto nextpage;
 
-		if (meta != NULL && meta->sodest != NULL) {
+		if (rc == 1) {
 			mlink_dest = ohash_find(&mlinks,
-			    ohash_qlookup(&mlinks, meta->sodest));
+			    ohash_qlookup(&mlinks, sodest));
 			if (mlink_dest == NULL) {
-				mandoc_asprintf(&cp, "%s.gz", meta->sodest);
+				mandoc_asprintf(&cp, "%s.gz", sodest);
 				mlink_dest = ohash_find(&mlinks,
 				    ohash_qlookup(&mlinks, cp));
 				free(cp);
 			}
+			free(sodest);
 			if (mlink_dest != NULL) {
 
 				/* The .so target exists. */
@@ -1189,41 +1260,6 @@ mpages_merge(struct dba *dba, struct mparse *mp)
 				mpage->mlinks = NULL;
 			}
 			goto nextpage;
-		} else if (meta != NULL && meta->macroset == MACROSET_MDOC) {
-			mpage->form = FORM_SRC;
-			mpage->sec = meta->msec;
-			mpage->sec = mandoc_strdup(
-			    mpage->sec == NULL ? "" : mpage->sec);
-			mpage->arch = meta->arch;
-			mpage->arch = mandoc_strdup(
-			    mpage->arch == NULL ? "" : mpage->arch);
-			mpage->title = mandoc_strdup(meta->title);
-		} else if (meta != NULL && meta->macroset == MACROSET_MAN) {
-			if (*meta->msec != '\0' || *meta->title != '\0') {
-				mpage->form = FORM_SRC;
-				mpage->sec = mandoc_strdup(meta->msec);
-				mpage->arch = mandoc_strdup(mlink->arch);
-				mpage->title = mandoc_strdup(meta->title);
-			} else
-				meta = NULL;
-		}
-
-		assert(mpage->desc == NULL);
-		if (meta == NULL) {
-			mpage->form = FORM_CAT;
-			mpage->sec = mandoc_strdup(mlink->dsec);
-			mpage->arch = mandoc_strdup(mlink->arch);
-			mpage->title = mandoc_strdup(mlink->name);
-			parse_cat(mpage, fd);
-		} else if (meta->macroset == MACROSET_MDOC)
-			parse_mdoc(mpage, meta, meta->first);
-		else
-			parse_man(mpage, meta, meta->first);
-		if (mpage->desc == NULL) {
-			mpage->desc = mandoc_strdup(mlink->name);
-			if (warnings)
-				say(mlink->file, "No one-line description, "
-				    "using filename \"%s\"", mlink->name);
 		}
 
 		for (mlink = mpage->mlinks;
@@ -1240,6 +1276,330 @@ nextpage:
 		ohash_delete(&strings);
 		ohash_delete(&names);
 	}
+
+	mworkers_wait(workers, nw);
+	free(workers);
+	free(todo);
+}
+
+/*
+ * Parse one manual page, filling in the mpage and the tables
+ * of names and strings.
+ * Return 0 for a manual, 1 for a .so link to the file returned
+ * in *sodest, or -1 if the file cannot be read.
+ */
+static int
+mpage_parse(struct mpage *mpage, struct mparse *mp, char **sodest)
+{
+	struct mlink		*mlink;
+	struct roff_meta	*meta;
+	int			 fd;
+
+	mlink = mpage->mlinks;
+	name_mask = NAME_MASK;
+	mparse_reset(mp);
+	meta = NULL;
+
+	if ((fd = mparse_open(mp, mlink->file)) == -1) {
+		say(mlink->file, "&open");
+		return -1;
+	}
+
+	/*
+	 * Interpret the file as mdoc(7) or man(7) source
+	 * code, unless it is known to be formatted.
+	 */
+	if (mlink->dform != FORM_CAT || mlink->fform != FORM_CAT) {
+		mparse_readfd(mp, fd, mlink->file);
+		close(fd);
+		fd = -1;
+		meta = mparse_result(mp);
+	}
+
+	if (meta != NULL && meta->sodest != NULL) {
+		*sodest = mandoc_strdup(meta->sodest);
+		return 1;
+	} else if (meta != NULL && meta->macroset == MACROSET_MDOC) {
+		mpage->form = FORM_SRC;
+		mpage->sec = meta->msec;
+		mpage->sec = mandoc_strdup(
+		    mpage->sec == NULL ? "" : mpage->sec);
+		mpage->arch = meta->arch;
+		mpage->arch = mandoc_strdup(
+		    mpage->arch == NULL ? "" : mpage->arch);
+		mpage->title = mandoc_strdup(meta->title);
+	} else if (meta != NULL && meta->macroset == MACROSET_MAN) {
+		if (*meta->msec != '\0' || *meta->title != '\0') {
+			mpage->form = FORM_SRC;
+			mpage->sec = mandoc_strdup(meta->msec);
+			mpage->arch = mandoc_strdup(mlink->arch);
+			mpage->title = mandoc_strdup(meta->title);
+		} else
+			meta = NULL;
+	}
+
+	assert(mpage->desc == NULL);
+	if (meta == NULL) {
+		mpage->form = FORM_CAT;
+		mpage->sec = mandoc_strdup(mlink->dsec);
+		mpage->arch = mandoc_strdup(mlink->arch);
+		mpage->title = mandoc_strdup(mlink->name);
+		parse_cat(mpage, fd);
+	} else if (meta->macroset == MACROSET_MDOC)
+		parse_mdoc(mpage, meta, meta->first);
+	else
+		parse_man(mpage, meta, meta->first);
+	if (mpage->desc == NULL) {
+		mpage->desc = mandoc_strdup(mlink->name);
+		if (warnings)
+			say(mlink->file, "No one-line description, "
+			    "using filename \"%s\"", mlink->name);
+	}
+	return 0;
+}
+
+/*
+ * Fork worker processes, each of which parses every nw-th page
+ * of the todo list and writes the results to a pipe in list order.
+ * Return the number of workers actually started.
+ */
+static size_t
+mworkers_start(struct mworker *workers, size_t nw,
+	struct mpage **todo, size_t todosz, struct mparse *mp)
+{
+	struct mpage	*mpage;
+	FILE		*stream;
+	char		*sodest;
+	size_t		 i, iw;
+	int		 fd[2], rc;
+
+	fflush(stdout);
+	fflush(stderr);
+	for (iw = 0; iw < nw; iw++) {
+		if (pipe(fd) == -1) {
+			say("", "&pipe");
+			break;
+		}
+		switch (workers[iw].pid = fork()) {
+		case -1:
+			say("", "&fork");
+			close(fd[0]);
+			close(fd[1]);
+			return iw;
+		case 0:
+			break;
+		default:
+			close(fd[1]);
+			if ((workers[iw].stream = fdopen(fd[0], "r")) == NULL) {
+				say("", "&fdopen");
+				close(fd[0]);
+			}
+			continue;
+		}
+
+		/* Worker process. */
+
+#if HAVE_PLEDGE
+		if (pledge("stdio rpath", NULL) == -1) {
+			say("", "&pledge");
+			_exit((int)MANDOCLEVEL_SYSERR);
+		}
+#endif
+		close(fd[0]);
+		for (i = 0; i < iw; i++)
+			if (workers[i].stream != NULL)
+				fclose(workers[i].stream);
+		if ((stream = fdopen(fd[1], "w")) == NULL) {
+			say("", "&fdopen");
+			_exit((int)MANDOCLEVEL_SYSERR);
+		}
+		for (i = iw; i < todosz; i += nw) {
+			mpage = todo[i];
+			mandoc_ohash_init(&names, 4,
+			    offsetof(struct str, key));
+			mandoc_ohash_init(&strings, 6,
+			    offsetof(struct str, key));
+			rc = mpage_parse(mpage, mp, &sodest);
+			mpage_send(stream, mpage, rc, sodest);
+			if (rc == 1)
+				free(sodest);
+			free(mpage->sec);
+			free(mpage->arch);
+			free(mpage->title);
+			free(mpage->desc);
+			ohash_delete(&strings);
+			ohash_delete(&names);
+		}
+		if (fclose(stream) == EOF)
+			_exit((int)MANDOCLEVEL_SYSERR);
+		_exit(exitcode);
+	}
+	return iw;
+}
+
+static void
+mworkers_wait(struct mworker *workers, size_t nw)
+{
+	size_t		 iw;
+	int		 status;
+
+	for (iw = 0; iw < nw; iw++) {
+		if (workers[iw].stream != NULL)
+			fclose(workers[iw].stream);
+		if (waitpid(workers[iw].pid, &status, 0) == -1)
+			say("", "&waitpid");
+		else if (!WIFEXITED(status) ||
+		    WEXITSTATUS(status) == (int)MANDOCLEVEL_SYSERR)
+			exitcode = (int)MANDOCLEVEL_SYSERR;
+	}
+}
+
+/*
+ * Write the result of mpage_parse() to a worker's pipe.
+ * Strings are NUL-terminated, and each key is preceded
+ * by its type and mask.  The keys are freed.
+ */
+static void
+mpage_send(FILE *stream, struct mpage *mpage, int rc, const char *sodest)
+{
+
+	switch (rc) {
+	case -1:
+		putc('X', stream);
+		return;
+	case 1:
+		putc('S', stream);
+		fputs(sodest, stream);
+		putc('\0', stream);
+		return;
+	default:
+		break;
+	}
+	putc('P', stream);
+	putc(mpage->form, stream);
+	fputs(mpage->sec, stream);
+	putc('\0', stream);
+	fputs(mpage->arch, stream);
+	putc('\0', stream);
+	fputs(mpage->title, stream);
+	putc('\0', stream);
+	fputs(mpage->desc, stream);
+	putc('\0', stream);
+	mpage_sendkeys(stream, &names, 'N');
+	mpage_sendkeys(stream, &strings, 'K');
+	putc('E', stream);
+}
+
+static void
+mpage_sendkeys(FILE *stream, struct ohash *htab, int type)
+{
+	struct str	*key;
+	unsigned int	 slot;
+
+	for (key = ohash_first(htab, &slot); NULL != key;
+	     key = ohash_next(htab, &slot)) {
+		putc(type, stream);
+		fwrite(&key->mask, sizeof(key->mask), 1, stream);
+		fputs(key->key, stream);
+		putc('\0', stream);
+		free(key);
+	}
+}
+
+static char *
+mpage_getstr(FILE *stream)
+{
+	char		*buf;
+	size_t		 bufsz, len;
+	int		 c;
+
+	buf = NULL;
+	bufsz = len = 0;
+	while ((c = getc(stream)) != EOF) {
+		if (len == bufsz) {
+			bufsz += 64;
+			buf = mandoc_realloc(buf, bufsz);
+		}
+		buf[len++] = c;
+		if (c == '\0')
+			return buf;
+	}
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Read what mpage_send() wrote, filling in the mpage and the tables
+ * of names and strings like mpage_parse() does.
+ * Return what mpage_parse() returned in the worker,
+ * or -2 if the worker failed.
+ */
+static int
+mpage_recv(FILE *stream, struct mpage *mpage, char **sodest)
+{
+	struct ohash	*htab;
+	struct str	*s;
+	const char	*end;
+	char		*cp;
+	uint64_t	 mask;
+	size_t		 sz;
+	unsigned int	 slot;
+	int		 c;
+
+	switch (getc(stream)) {
+	case 'X':
+		return -1;
+	case 'S':
+		return (*sodest = mpage_getstr(stream)) == NULL ? -2 : 1;
+	case 'P':
+		break;
+	default:
+		return -2;
+	}
+	mpage->form = getc(stream);
+	if ((mpage->sec = mpage_getstr(stream)) == NULL ||
+	    (mpage->arch = mpage_getstr(stream)) == NULL ||
+	    (mpage->title = mpage_getstr(stream)) == NULL ||
+	    (mpage->desc = mpage_getstr(stream)) == NULL)
+		goto fail;
+
+	while ((c = getc(stream)) == 'N' || c == 'K') {
+		if (fread(&mask, sizeof(mask), 1, stream) != 1 ||
+		    (cp = mpage_getstr(stream)) == NULL)
+			goto fail;
+		htab = c == 'N' ? &names : &strings;
+		sz = strlen(cp);
+		end = cp + sz;
+		slot = ohash_qlookupi(htab, cp, &end);
+		if ((s = ohash_find(htab, slot)) == NULL) {
+			s = mandoc_calloc(1, sizeof(struct str) + sz + 1);
+			memcpy(s->key, cp, sz);
+			s->mpage = mpage;
+			ohash_insert(htab, slot, s);
+		}
+		s->mask |= mask;
+		free(cp);
+	}
+	if (c == 'E')
+		return 0;
+
+fail:
+	free(mpage->sec);
+	free(mpage->arch);
+	free(mpage->title);
+	free(mpage->desc);
+	mpage->sec = mpage->arch = mpage->title = mpage->desc = NULL;
+	for (s = ohash_first(&names, &slot); s != NULL;
+	     s = ohash_next(&names, &slot))
+		free(s);
+	for (s = ohash_first(&strings, &slot); s != NULL;
+	     s = ohash_next(&strings, &slot))
+		free(s);
+	ohash_delete(&strings);
+	ohash_delete(&names);
+	mandoc_ohash_init(&names, 4, offsetof(struct str, key));
+	mandoc_ohash_init(&strings, 6, offsetof(struct str, key));
+	return -2;
 }
 
 static void
@@ -2134,6 +2494,112 @@ dbprune(struct dba *dba)
 	}
 }
 
+/*
+ * For makewhatis -i, read the existing database and keep the pages
+ * whose files are all still there, are older than the database,
+ * and have no new links.  Mark the files of these pages as done,
+ * such that mpages_merge() only parses the rest.
+ * Return NULL if there is no usable database.
+ */
+static struct dba *
+dbrefresh(void)
+{
+	struct stat		 sb;
+	struct dba		*dba;
+	struct dba_array	*page, *files;
+	struct mpage		*mpage;
+	struct mlink		*mlink;
+	char			*file;
+	int			 changed, stale;
+
+	if (stat(MANDOC_DB, &sb) == -1 ||
+	    (dba = dba_read(MANDOC_DB)) == NULL) {
+		if (errno != ENOENT)
+			say(MANDOC_DB, "%s: Automatically recreating"
+			    " from scratch", strerror(errno));
+		return NULL;
+	}
+
+	/*
+	 * Files changed since the database was written
+	 * and pages that gained links need to be parsed again.
+	 */
+
+	for (mpage = mpage_head; mpage != NULL; mpage = mpage->next) {
+		mlinks_undupe(mpage);
+		if (mpage->mtime >= sb.st_mtime)
+			mpage->dirty = 1;
+	}
+	dba_array_FOREACH(dba->pages, page) {
+		files = dba_array_get(page, DBP_FILE);
+		dba_array_FOREACH(files, file) {
+			if (*file < ' ')
+				file++;
+			if ((mlink = ohash_find(&mlinks,
+			    ohash_qlookup(&mlinks, file))) != NULL)
+				mlink->indb = 1;
+		}
+	}
+	for (mpage = mpage_head; mpage != NULL; mpage = mpage->next)
+		for (mlink = mpage->mlinks; mlink != NULL;
+		     mlink = mlink->next)
+			if (mlink->indb == 0)
+				mpage->dirty = 1;
+
+	/*
+	 * Delete the pages with missing or changed files.
+	 * All their other files, for example .so links,
+	 * need to be parsed again as well, which may in turn
+	 * invalidate more pages.
+	 */
+
+	do {
+		changed = 0;
+		dba_array_FOREACH(dba->pages, page) {
+			files = dba_array_get(page, DBP_FILE);
+			stale = 0;
+			dba_array_FOREACH(files, file) {
+				if (*file < ' ')
+					file++;
+				mlink = ohash_find(&mlinks,
+				    ohash_qlookup(&mlinks, file));
+				if (mlink == NULL || mlink->mpage->dirty) {
+					stale = 1;
+					break;
+				}
+			}
+			if (stale == 0)
+				continue;
+			dba_array_FOREACH(files, file) {
+				if (*file < ' ')
+					file++;
+				mlink = ohash_find(&mlinks,
+				    ohash_qlookup(&mlinks, file));
+				if (mlink != NULL &&
+				    mlink->mpage->dirty == 0) {
+					mlink->mpage->dirty = 1;
+					changed = 1;
+				}
+				if (debug)
+					say(file, "Deleting from database");
+			}
+			dba_array_del(dba->pages);
+		}
+	} while (changed);
+
+	dba_array_FOREACH(dba->pages, page) {
+		files = dba_array_get(page, DBP_FILE);
+		dba_array_FOREACH(files, file) {
+			if (*file < ' ')
+				file++;
+			mlink = ohash_find(&mlinks,
+			    ohash_qlookup(&mlinks, file));
+			mlink->mpage->dba = page;
+		}
+	}
+	return dba;
+}
+
 /*
  * Write the database from memory to disk.
  */
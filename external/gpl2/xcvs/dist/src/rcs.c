@@ -88,6 +88,7 @@ static void rcsbuf_valpolish (struct rcsbuffer *, char *val, int polish,
 static void rcsbuf_valpolish_internal (struct rcsbuffer *, char *to,
                                        const char *from, size_t *lenp);
 static off_t rcsbuf_ftello (struct rcsbuffer *);
+static void rcsbuf_seek (struct rcsbuffer *, off_t);
 static void rcsbuf_get_buffered (struct rcsbuffer *, char **datap,
 				 size_t *lenp);
 static void rcsbuf_cache (RCSNode *, struct rcsbuffer *);
@@ -98,6 +99,8 @@ static void do_branches (List * list, char *val);
 static void do_symbols (List * list, char *val);
 static void do_locks (List * list, char *val);
 static void free_rcsnode_contents (RCSNode *);
+static List *rcs_text_pos (RCSNode *, FILE *);
+static void rcs_forget_text_pos (RCSNode *);
 static void free_rcsvers_contents (RCSVers *);
 static void rcsvers_delproc (Node * p);
 static char *translate_symtag (RCSNode *, const char *);
@@ -988,6 +991,90 @@ free_rcsvers_contents (RCSVers *rnode)
 
 
 
+/* Deltatext offsets recorded by RCS_deltas.  They are kept for the life
+   of the process rather than in the RCSNode, so that a server which
+   parses the same RCS file again (for another command, or because the
+   RCSNode was freed in between) does not have to scan it from the start.
+   The key of each node is the path of the RCS file and the data is a
+   struct text_pos_file.  */
+static List *text_pos_cache;
+
+struct text_pos_file
+{
+    /* Identity of the RCS file the offsets were recorded in.  */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+
+    /* List of nodes, the key of which is the numeric revision and the
+       data of which is the file offset (an off_t) of its deltatext.  */
+    List *offsets;
+};
+
+static void
+text_pos_file_delproc (Node *p)
+{
+    struct text_pos_file *tpf = p->data;
+
+    dellist (&tpf->offsets);
+    free (tpf);
+}
+
+/* Return the list of deltatext offsets known for RCS, whose RCS file is
+   open as FP.  If the file has not been seen before, or has changed since
+   the offsets were recorded, the list is empty.  Return NULL if the file
+   cannot be identified, in which case nothing is remembered.  */
+static List *
+rcs_text_pos (RCSNode *rcs, FILE *fp)
+{
+    struct text_pos_file *tpf;
+    struct stat sb;
+    Node *p;
+
+    if (fstat (fileno (fp), &sb) < 0)
+	return NULL;
+
+    if (text_pos_cache == NULL)
+	text_pos_cache = getlist ();
+    p = findnode (text_pos_cache, rcs->path);
+    if (p == NULL)
+    {
+	tpf = xmalloc (sizeof *tpf);
+	tpf->offsets = NULL;
+	p = getnode ();
+	p->key = xstrdup (rcs->path);
+	p->data = tpf;
+	p->delproc = text_pos_file_delproc;
+	(void) addnode (text_pos_cache, p);
+    }
+    tpf = p->data;
+
+    if (tpf->offsets == NULL
+	|| tpf->dev != sb.st_dev || tpf->ino != sb.st_ino
+	|| tpf->size != sb.st_size || tpf->mtime != sb.st_mtime)
+    {
+	dellist (&tpf->offsets);
+	tpf->offsets = getlist ();
+	tpf->dev = sb.st_dev;
+	tpf->ino = sb.st_ino;
+	tpf->size = sb.st_size;
+	tpf->mtime = sb.st_mtime;
+    }
+    return tpf->offsets;
+}
+
+/* Forget the deltatext offsets recorded for RCS.  This must be called
+   whenever the deltatexts of RCS are moved around in the file.  */
+static void
+rcs_forget_text_pos (RCSNode *rcs)
+{
+    if (text_pos_cache != NULL)
+	delnode (findnode (text_pos_cache, rcs->path));
+}
+
+
+
 /*
  * rcsvers_delproc - free up an RCSVers type node
  */
@@ -1905,6 +1992,40 @@ rcsbuf_ftello (struct rcsbuffer *rcsbuf)
 
 
 
+/* Move RCSBUF forward to file position POS, which must not be before
+   the current position.  The data between the two positions is never
+   looked at, so any keys or values previously returned by RCSBUF
+   become invalid.  */
+static void
+rcsbuf_seek (struct rcsbuffer *rcsbuf, off_t pos)
+{
+    assert (pos >= rcsbuf_ftello (rcsbuf));
+
+#ifdef HAVE_MMAP
+    if (pos - rcsbuf->pos > rcsbuf->ptrend - rcsbuf_buffer)
+	error (1, 0, "cannot seek past end of RCS file %s",
+	       primary_root_inverse_translate (rcsbuf->filename));
+    rcsbuf->ptr = rcsbuf_buffer + (pos - rcsbuf->pos);
+#else /* !HAVE_MMAP */
+    if (pos <= rcsbuf->pos + (rcsbuf->ptrend - rcsbuf_buffer))
+	rcsbuf->ptr = rcsbuf_buffer + (pos - rcsbuf->pos);
+    else
+    {
+	if (fseeko (rcsbuf->fp, pos, SEEK_SET) != 0)
+	    error (1, errno, "cannot fseeko RCS file %s", rcsbuf->filename);
+	rcsbuf->ptr = rcsbuf_buffer;
+	rcsbuf->ptrend = rcsbuf_buffer;
+	rcsbuf->pos = pos;
+    }
+#endif /* HAVE_MMAP */
+
+    rcsbuf->vlen = 0;
+    rcsbuf->at_string = 0;
+    rcsbuf->embedded_at = 0;
+}
+
+
+
 /* Return a pointer to any data buffered for RCSBUF, along with the
    length.  */
 static void
@@ -7273,6 +7394,7 @@ RCS_deltas (RCSNode *rcs, FILE *fp, struct rcsbuffer *rcsbuf,
     char *next;
     int ishead, isnext, isversion, onbranch;
     Node *node;
+    List *offsets;
     struct linevector headlines;
     struct linevector curlines;
     struct linevector trunklines;
@@ -7285,6 +7407,7 @@ RCS_deltas (RCSNode *rcs, FILE *fp, struct rcsbuffer *rcsbuf,
 	rcsbuf_cache_open (rcs, rcs->delta_pos, &fp, &rcsbuf_local);
 	rcsbuf = &rcsbuf_local;
     }
+    offsets = rcs_text_pos (rcs, fp);
 
    if (log) *log = NULL;
 
@@ -7312,9 +7435,37 @@ RCS_deltas (RCSNode *rcs, FILE *fp, struct rcsbuffer *rcsbuf,
         *cpversion = '\0';
 
     do {
+	off_t text_pos;
+
+	/* If an earlier pass over this file told us where the next
+	   version we need starts, skip straight to it rather than
+	   scanning the deltatexts of unrelated branches.  */
+	text_pos = rcsbuf_ftello (rcsbuf);
+	if (next != NULL && offsets != NULL)
+	{
+	    node = findnode (offsets, next);
+	    if (node != NULL && *(off_t *) node->data > text_pos)
+	    {
+		text_pos = *(off_t *) node->data;
+		rcsbuf_seek (rcsbuf, text_pos);
+	    }
+	}
+
 	if (! rcsbuf_getrevnum (rcsbuf, &key))
 	    error (1, 0, "unexpected EOF reading RCS file %s", rcs->print_path);
 
+	/* Remember where this deltatext is, for later passes.  */
+	if (offsets != NULL && findnode (offsets, key) == NULL)
+	{
+	    node = getnode ();
+	    node->key = xstrdup (key);
+	    node->data = xmalloc (sizeof (off_t));
+	    *(off_t *) node->data = text_pos;
+	    (void) addnode (offsets, node);
+	}
+
+	node = findnode (rcs->versions, key);
+
 	if (next != NULL && ! STREQ (next, key))
 	{
 	    /* This is not the next version we need.  It is a branch
@@ -7326,8 +7477,6 @@ RCS_deltas (RCSNode *rcs, FILE *fp, struct rcsbuffer *rcsbuf,
 	{
 	    isnext = 1;
 
-	    /* look up the revision */
-	    node = findnode (rcs->versions, key);
 	    if (node == NULL)
 	        error (1, 0,
 		       "mismatch in rcs file %s between deltas and deltatexts (%s)",
@@ -8635,6 +8784,7 @@ RCS_rewrite (RCSNode *rcs, Deltatext *newdtext, char *insertpt)
     rcs->delta_pos = ftello (fout);
     if (rcs->delta_pos == -1)
 	error (1, errno, "cannot ftello in RCS file %s", rcs->path);
+    rcs_forget_text_pos (rcs);
 
     RCS_copydeltas (rcs, fin, &rcsbufin, fout, newdtext, insertpt);
 
@@ -32,6 +32,7 @@
 __RCSID("$NetBSD: gettext.c,v 1.32 2024/04/13 02:01:38 christos Exp $");
 
 #include <sys/param.h>
+#include <sys/atomic.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/uio.h>
@@ -70,10 +71,16 @@ static uint32_t flip(uint32_t, uint32_t);
 static int validate(void *, struct mohandle *);
 static int mapit(const char *, struct domainbinding *);
 static int unmapit(struct domainbinding *);
-static const char *lookup_hash(const char *, struct domainbinding *, size_t *);
+static const char *lookup_hash(const char *, struct domainbinding *, size_t *,
+    const char **);
 static const char *lookup_bsearch(const char *, struct domainbinding *,
-				  size_t *);
-static const char *lookup(const char *, struct domainbinding *, size_t *);
+				  size_t *, const char **);
+static const char *lookup(const char *, struct domainbinding *, size_t *,
+    const char **);
+static const char *memo_lookup(unsigned int, const struct domainbinding *,
+    int, const char *, unsigned long);
+static void memo_enter(unsigned int, const struct domainbinding *, int,
+    const char *, unsigned long, const char *, const char *);
 static const char *get_lang_env(const char *);
 
 /*
@@ -709,7 +716,7 @@ mapit(const char *path, struct domainbinding *db)
 		}
 	}
 	/* grab MIME-header and charset field */
-	mohandle->mo.mo_header = lookup("", db, &headerlen);
+	mohandle->mo.mo_header = lookup("", db, &headerlen, NULL);
 	if (mohandle->mo.mo_header)
 		v = strstr(mohandle->mo.mo_header, "charset=");
 	else
@@ -744,6 +751,7 @@ mapit(const char *path, struct domainbinding *db)
 		}
 	}
 
+	atomic_inc_uint(&__intl_generation);
 	return 0;
 
 fail:
@@ -772,8 +780,10 @@ unmapit(struct domainbinding *db)
 	struct mohandle *mohandle = &db->mohandle;
 
 	/* unmap if there's already mapped region */
-	if (mohandle->addr && mohandle->addr != MAP_FAILED)
+	if (mohandle->addr && mohandle->addr != MAP_FAILED) {
+		atomic_inc_uint(&__intl_generation);
 		munmap(mohandle->addr, mohandle->len);
+	}
 	mohandle->addr = NULL;
 	free(mohandle->mo.mo_otable);
 	free(mohandle->mo.mo_ttable);
@@ -791,7 +801,8 @@ unmapit(struct domainbinding *db)
 
 /* ARGSUSED */
 static const char *
-lookup_hash(const char *msgid, struct domainbinding *db, size_t *rlen)
+lookup_hash(const char *msgid, struct domainbinding *db, size_t *rlen,
+    const char **rorig)
 {
 	struct mohandle *mohandle = &db->mohandle;
 	uint32_t idx, hashval, step, strno;
@@ -820,6 +831,9 @@ lookup_hash(const char *msgid, struct domainbinding *db, size_t *rlen)
 				if (rlen)
 					*rlen =
 					    mohandle->mo.mo_ttable[strno].len;
+				if (rorig)
+					*rorig =
+					    mohandle->mo.mo_otable[strno].off;
 				return mohandle->mo.mo_ttable[strno].off;
 			}
 		} else {
@@ -835,6 +849,8 @@ lookup_hash(const char *msgid, struct domainbinding *db, size_t *rlen)
 					return NULL;
 				if (rlen)
 					*rlen = sysdep_ttable->expanded_len;
+				if (rorig)
+					*rorig = sysdep_otable->expanded;
 				return sysdep_ttable->expanded;
 			}
 		}
@@ -844,7 +860,8 @@ lookup_hash(const char *msgid, struct domainbinding *db, size_t *rlen)
 }
 
 static const char *
-lookup_bsearch(const char *msgid, struct domainbinding *db, size_t *rlen)
+lookup_bsearch(const char *msgid, struct domainbinding *db, size_t *rlen,
+    const char **rorig)
 {
 	int top, bottom, middle, omiddle;
 	int n;
@@ -868,6 +885,8 @@ lookup_bsearch(const char *msgid, struct domainbinding *db, size_t *rlen)
 		if (n == 0) {
 			if (rlen)
 				*rlen = mohandle->mo.mo_ttable[middle].len;
+			if (rorig)
+				*rorig = mohandle->mo.mo_otable[middle].off;
 			return (const char *)mohandle->mo.mo_ttable[middle].off;
 		}
 		else if (n < 0)
@@ -881,15 +900,118 @@ lookup_bsearch(const char *msgid, struct domainbinding *db, size_t *rlen)
 }
 
 static const char *
-lookup(const char *msgid, struct domainbinding *db, size_t *rlen)
+lookup(const char *msgid, struct domainbinding *db, size_t *rlen,
+    const char **rorig)
 {
 	const char *v;
 
-	v = lookup_hash(msgid, db, rlen);
+	v = lookup_hash(msgid, db, rlen, rorig);
 	if (v)
 		return v;
 
-	return lookup_bsearch(msgid, db, rlen);
+	return lookup_bsearch(msgid, db, rlen, rorig);
+}
+
+/*
+ * memo cache of the final results of dcngettext().
+ *
+ * programs tend to pass the same string literals over and over, so we
+ * remember the converted translation keyed by binding, category, msgid
+ * pointer and plural index, in a small 2-way set associative table.
+ * a hit still compares the msgid against the original string in the
+ * *.mo file, as the caller may reuse a buffer.
+ *
+ * entries are tagged with __intl_generation, which is bumped whenever a
+ * binding, a codeset or a mapping changes.  each slot carries a sequence
+ * number (odd while being written) so that readers never use a torn
+ * entry, and writers simply give up if the slot is busy.
+ */
+#define MEMO_NSETS_LOG2	9
+#define MEMO_NSETS	(1U << MEMO_NSETS_LOG2)
+#define MEMO_NWAYS	2
+#define MEMO_HASH(msgid, idx) \
+	((((uint32_t)((uintptr_t)(msgid) >> 2) * 0x9e3779b1U) >> \
+	    (32 - MEMO_NSETS_LOG2) ^ (idx)) & (MEMO_NSETS - 1))
+
+struct memo {
+	volatile unsigned int m_seq;
+	unsigned int m_gen;
+	const struct domainbinding *m_db;
+	int m_category;
+	const char *m_msgid;
+	unsigned long m_index;
+	const char *m_orig;	/* msgid in the *.mo file */
+	const char *m_result;
+};
+
+static struct memoset {
+	struct memo ms_way[MEMO_NWAYS];
+	unsigned int ms_victim;	/* way to replace next; races are harmless */
+} memo[MEMO_NSETS];
+
+static const char *
+memo_lookup(unsigned int gen, const struct domainbinding *db, int category,
+    const char *msgid, unsigned long idx)
+{
+	struct memoset *ms = &memo[MEMO_HASH(msgid, idx)];
+	struct memo *m;
+	const char *orig, *result;
+	unsigned int seq;
+	int i;
+
+	for (i = 0; i < MEMO_NWAYS; i++) {
+		m = &ms->ms_way[i];
+		seq = m->m_seq;
+		if (seq & 1)
+			continue;
+		membar_consumer();
+		if (m->m_gen != gen || m->m_db != db ||
+		    m->m_category != category || m->m_msgid != msgid ||
+		    m->m_index != idx)
+			continue;
+		orig = m->m_orig;
+		result = m->m_result;
+		membar_consumer();
+		if (m->m_seq != seq)
+			continue;
+
+		if (strcmp(msgid, orig) != 0)
+			return NULL;
+		return result;
+	}
+	return NULL;
+}
+
+static void
+memo_enter(unsigned int gen, const struct domainbinding *db, int category,
+    const char *msgid, unsigned long idx, const char *orig, const char *result)
+{
+	struct memoset *ms = &memo[MEMO_HASH(msgid, idx)];
+	struct memo *m;
+	unsigned int seq;
+	int i;
+
+	/* prefer a stale slot, otherwise evict round robin */
+	for (i = 0; i < MEMO_NWAYS; i++)
+		if (ms->ms_way[i].m_gen != gen || ms->ms_way[i].m_seq == 0)
+			break;
+	if (i == MEMO_NWAYS)
+		i = ms->ms_victim++ % MEMO_NWAYS;
+	m = &ms->ms_way[i];
+
+	seq = m->m_seq;
+	if ((seq & 1) || atomic_cas_uint(&m->m_seq, seq, seq + 1) != seq)
+		return;
+	membar_producer();
+	m->m_gen = gen;
+	m->m_db = db;
+	m->m_category = category;
+	m->m_msgid = msgid;
+	m->m_index = idx;
+	m->m_orig = orig;
+	m->m_result = result;
+	membar_producer();
+	m->m_seq = seq + 2;
 }
 
 static const char *
@@ -952,11 +1074,12 @@ dcngettext(const char *domainname, const char *msgid1, const char *msgid2,
 	const char *lpath;
 	static char olpath[PATH_MAX];
 	const char *cname = NULL;
-	const char *v;
+	const char *v, *orig;
 	static char *ocname = NULL;
 	static char *odomainname = NULL;
 	struct domainbinding *db;
 	unsigned long plural_index = 0;
+	unsigned int gen;
 	size_t len;
 
 	if (!domainname)
@@ -1018,6 +1141,13 @@ dcngettext(const char *domainname, const char *msgid1, const char *msgid2,
 		strlcpy(olpath, lpath, sizeof(olpath));
 
 found:
+	/*
+	 * Only now that the catalog is mapped: lookup_mofile() may have
+	 * replaced it, and memo entries from before that must not match.
+	 */
+	gen = __intl_generation;
+	membar_consumer();
+
 	if (db->mohandle.mo.mo_plural) {
 		plural_index =
 		    _gettext_calculate_plural(db->mohandle.mo.mo_plural, n);
@@ -1030,7 +1160,11 @@ found:
 	if (msgid == NULL)
 		return NULL;
 
-	v = lookup(msgid, db, &len);
+	v = memo_lookup(gen, db, category, msgid, plural_index);
+	if (v)
+		return (char *)__UNCONST(v);
+
+	v = lookup(msgid, db, &len, &orig);
 	if (v) {
 		if (db->mohandle.mo.mo_plural)
 			v = get_indexed_string(v, len, plural_index);
@@ -1050,6 +1184,7 @@ found:
 		 * format identifiers.
 		 */
 
+		memo_enter(gen, db, category, msgid, plural_index, orig, v);
 		msgid = v;
 	}
 
@@ -140,6 +140,7 @@ struct domainbinding {
 
 extern struct domainbinding *__bindings;
 extern char __current_domainname[PATH_MAX];
+extern volatile unsigned int __intl_generation;
 
 __BEGIN_DECLS
 const char *__gettext_iconv(const char *, struct domainbinding *);
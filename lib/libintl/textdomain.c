@@ -30,6 +30,7 @@
 __RCSID("$NetBSD: textdomain.c,v 1.14 2015/05/29 12:26:28 christos Exp $");
 
 #include <sys/param.h>
+#include <sys/atomic.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -44,6 +45,7 @@ static struct domainbinding __default_binding = {
 };
 struct domainbinding *__bindings = &__default_binding;
 char __current_domainname[PATH_MAX] = DEFAULT_DOMAINNAME;
+volatile unsigned int __intl_generation;	/* invalidates dcngettext() memo */
 
 static struct domainbinding *domainbinding_lookup(const char *, int);
 
@@ -66,6 +68,7 @@ textdomain(const char *domainname)
 		strlcpy(__current_domainname, domainname,
 		    sizeof(__current_domainname));
 	}
+	atomic_inc_uint(&__intl_generation);
 	return __current_domainname;
 }
 
@@ -101,6 +104,7 @@ bindtextdomain(const char *domainname, const char *dirname)
 
 	strlcpy(p->path, dirname, sizeof(p->path));
 	p->mohandle.mo.mo_magic = 0; /* invalidate current mapping */
+	atomic_inc_uint(&__intl_generation);
 
 	return (p->path);
 }
@@ -117,6 +121,7 @@ bind_textdomain_codeset(const char *domainname, const char *codeset)
 	if (codeset) {
 		free(p->codeset);
 		p->codeset = strdup(codeset);
+		atomic_inc_uint(&__intl_generation);
 	}
 
 	return p->codeset;
@@ -41,9 +41,20 @@ __RCSID("$NetBSD: buf.c,v 1.2 2022/01/22 13:25:55 pho Exp $");
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/param.h> /* for MIN(a, b) */
+#include <sys/mman.h>
+#include <sys/param.h> /* for MIN(), MAX() and roundup() */
+#include <sys/stat.h>
 #include <unistd.h>
 
+/* The maximum size of the bounce buffer fuse_buf_copy_fd_to_fd()
+ * allocates. Anything smaller than this costs a syscall pair for
+ * every page, which dominates the cost of copying. */
+#define FUSE_BUF_BOUNCE_MAX     ((size_t)256 * 1024)
+
+/* The maximum size of the source file window
+ * fuse_buf_map_fd_to_fd() maps at once. */
+#define FUSE_BUF_MAP_MAX        ((size_t)8 * 1024 * 1024)
+
 size_t
 fuse_buf_size(const struct fuse_bufvec *bufv) {
     size_t i;
@@ -155,16 +166,87 @@ fuse_buf_write_mem_to_fd(const struct fuse_buf *dst, size_t dst_off,
     return total;
 }
 
-/* Copy data from one fd to another, and return the number of octets
- * that have been copied, or -1 on failure. */
+/* Copy data from a seekable fd referring to a regular file to another
+ * fd by mapping the source and writing directly from the mapping, so
+ * that the data is copied once by the kernel instead of being read
+ * into a bounce buffer first. This is the closest thing to splice(2)
+ * we have. Return the number of octets that have been copied, -1 on
+ * failure, or -2 if the source can't be mapped and the caller should
+ * fall back to fuse_buf_copy_fd_to_fd(). */
+static ssize_t
+fuse_buf_map_fd_to_fd(const struct fuse_buf *dst, size_t dst_off,
+                      const struct fuse_buf *src, size_t src_off,
+                      size_t len) {
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    ssize_t total = 0;
+    struct stat st;
+    off_t pos;
+
+    if (!(src->flags & FUSE_BUF_FD_SEEK))
+        return -2;
+
+    if (fstat(src->fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return -2;
+
+    /* Touching pages past EOF would raise SIGBUS. Don't map them. */
+    pos = src->pos + (off_t)src_off;
+    if (pos >= st.st_size)
+        return 0;
+    len = MIN(len, (size_t)(st.st_size - pos));
+
+    while (len > 0) {
+        /* mmap(2) wants a page-aligned offset. */
+        const size_t skew = (size_t)pos & (page_size - 1);
+        const size_t n_to_map = MIN(len, FUSE_BUF_MAP_MAX - skew);
+        struct fuse_buf tmp;
+        ssize_t n_wrote;
+        void* map;
+
+        map = mmap(NULL, skew + n_to_map, PROT_READ, MAP_SHARED,
+                   src->fd, pos - (off_t)skew);
+        if (map == MAP_FAILED)
+            return total == 0 ? -2 : total;
+
+        (void)madvise(map, skew + n_to_map, MADV_SEQUENTIAL);
+
+        tmp.size  = skew + n_to_map;
+        tmp.flags = (enum fuse_buf_flags)0;
+        tmp.mem   = map;
+
+        n_wrote = fuse_buf_write_mem_to_fd(dst, dst_off, &tmp, skew, n_to_map);
+        (void)munmap(map, skew + n_to_map);
+
+        if (n_wrote == -1)
+            return total == 0 ? -1 : total;
+
+        total   += n_wrote;
+        dst_off += (size_t)n_wrote;
+        pos     += n_wrote;
+        len     -= (size_t)n_wrote;
+
+        if ((size_t)n_wrote < n_to_map)
+            break;
+    }
+
+    return total;
+}
+
+/* Copy data from one fd to another through a bounce buffer, and
+ * return the number of octets that have been copied, or -1 on
+ * failure. */
 static ssize_t
 fuse_buf_copy_fd_to_fd(const struct fuse_buf *dst, size_t dst_off,
                        const struct fuse_buf *src, size_t src_off,
                        size_t len) {
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
     ssize_t total = 0;
     struct fuse_buf tmp;
 
-    tmp.size  = (size_t)sysconf(_SC_PAGESIZE);
+    /* Use a buffer as large as the request, within reason, and
+     * rounded up to a page so that the kernel can do page-sized
+     * transfers. */
+    tmp.size  = MIN(roundup(len, page_size), FUSE_BUF_BOUNCE_MAX);
+    tmp.size  = MAX(tmp.size, page_size);
     tmp.flags = (enum fuse_buf_flags)0;
     tmp.mem   = malloc(tmp.size);
 
@@ -229,7 +311,7 @@ static ssize_t
 fuse_buf_copy_one(const struct fuse_buf *dst, size_t dst_off,
                   const struct fuse_buf *src, size_t src_off,
                   size_t len,
-                  enum fuse_buf_copy_flags flags __attribute__((__unused__))) {
+                  enum fuse_buf_copy_flags flags) {
 
     const bool dst_is_fd = !!(dst->flags & FUSE_BUF_IS_FD);
     const bool src_is_fd = !!(src->flags & FUSE_BUF_IS_FD);
@@ -238,7 +320,10 @@ fuse_buf_copy_one(const struct fuse_buf *dst, size_t dst_off,
         void* dst_mem = (uint8_t*)dst->mem + dst_off;
         void* src_mem = (uint8_t*)src->mem + src_off;
 
-        memmove(dst_mem, src_mem, len);
+        /* Callers often "copy" a buffer onto itself, e.g. when a
+         * filesystem returns the very buffer it was given. */
+        if (dst_mem != src_mem)
+            memmove(dst_mem, src_mem, len);
 
         return (ssize_t)len;
     }
@@ -249,6 +334,12 @@ fuse_buf_copy_one(const struct fuse_buf *dst, size_t dst_off,
         return fuse_buf_write_mem_to_fd(dst, dst_off, src, src_off, len);
     }
     else {
+        if (!(flags & FUSE_BUF_NO_SPLICE)) {
+            const ssize_t n_copied =
+                fuse_buf_map_fd_to_fd(dst, dst_off, src, src_off, len);
+            if (n_copied != -2)
+                return n_copied;
+        }
         return fuse_buf_copy_fd_to_fd(dst, dst_off, src, src_off, len);
     }
 }
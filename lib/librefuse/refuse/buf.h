@@ -53,9 +53,10 @@ enum fuse_buf_flags {
 	FUSE_BUF_FD_RETRY	= (1 << 3),
 };
 enum fuse_buf_copy_flags {
-	/* These flags are always ignored because splice(2) is a
-	 * Linux-specific syscall and there are no alternatives on
-	 * NetBSD atm. */
+	/* splice(2) is a Linux-specific syscall. Copies from a
+	 * seekable regular file to another fd are instead done by
+	 * mapping the source, unless FUSE_BUF_NO_SPLICE is given. The
+	 * other flags are ignored. */
 	FUSE_BUF_NO_SPLICE		= (1 << 1),
 	FUSE_BUF_FORCE_SPLICE		= (1 << 2),
 	FUSE_BUF_SPLICE_MOVE		= (1 << 3),
@@ -85,7 +86,7 @@ struct fuse_bufvec {
 		/* .off = */ 0,				\
 		/* .buf = */ {				\
 			/* [0] = */ {			\
-				/* .size = */ (size_)	\
+				/* .size = */ (size_),	\
 				/* .flags = */ (enum fuse_buf_flags)0,	\
 				/* .mem = */ NULL,	\
 				/* .fd = */ -1,		\
@@ -52,6 +52,10 @@ __RCSID("$NetBSD: chan.c,v 1.1 2022/01/22 08:09:40 pho Exp $");
 struct fuse_chan {
     char* mountpoint;
     struct fuse_args* args;
+#if defined(MULTITHREADED_REFUSE)
+    /* Protects the members below. The ones above are immutable. */
+    pthread_mutex_t lock;
+#endif
     struct fuse* fuse;
     bool is_to_be_destroyed;
 };
@@ -62,10 +66,28 @@ struct refuse_chan_storage {
 };
 
 #if defined(MULTITHREADED_REFUSE)
-static pthread_mutex_t storage_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Only protects the storage itself, so that looking channels up
+ * doesn't serialize. Each channel has its own lock. */
+static pthread_rwlock_t storage_lock = PTHREAD_RWLOCK_INITIALIZER;
 #endif
 static struct refuse_chan_storage storage;
 
+#if defined(MULTITHREADED_REFUSE)
+#  define STORAGE_LOCK(lockfn)                  \
+        do {                                    \
+            int rv_ = lockfn(&storage_lock);    \
+            assert(rv_ == 0);                   \
+        } while (0)
+#  define CHAN_LOCK(chan, lockfn)               \
+        do {                                    \
+            int rv_ = lockfn(&(chan)->lock);    \
+            assert(rv_ == 0);                   \
+        } while (0)
+#else
+#  define STORAGE_LOCK(lockfn)          do {} while (0)
+#  define CHAN_LOCK(chan, lockfn)       do {} while (0)
+#endif
+
 
 struct fuse_chan* fuse_chan_new(const char* mountpoint, const struct fuse_args* args) {
     struct fuse_chan* chan;
@@ -91,11 +113,25 @@ struct fuse_chan* fuse_chan_new(const char* mountpoint, const struct fuse_args*
         return NULL;
     }
 
+#if defined(MULTITHREADED_REFUSE)
+    if (pthread_mutex_init(&chan->lock, NULL) != 0) {
+        warnx("%s: failed to initialize a mutex", __func__);
+        fuse_opt_free_args(chan->args);
+        free(chan->args);
+        free(chan->mountpoint);
+        free(chan);
+        return NULL;
+    }
+#endif
+
     return chan;
 }
 
 void
 fuse_chan_destroy(struct fuse_chan* chan) {
+#if defined(MULTITHREADED_REFUSE)
+    (void)pthread_mutex_destroy(&chan->lock);
+#endif
     free(chan->mountpoint);
     fuse_opt_free_args(chan->args);
     free(chan->args);
@@ -105,12 +141,8 @@ fuse_chan_destroy(struct fuse_chan* chan) {
 int
 fuse_chan_stash(struct fuse_chan* chan) {
     int idx;
-#if defined(MULTITHREADED_REFUSE)
-    int rv;
 
-    rv = pthread_mutex_lock(&storage_mutex);
-    assert(rv == 0);
-#endif
+    STORAGE_LOCK(pthread_rwlock_wrlock);
 
     /* Find the first empty slot in the storage. */
     for (idx = 0; idx < (int)storage.n_alloc; idx++) {
@@ -133,31 +165,21 @@ fuse_chan_stash(struct fuse_chan* chan) {
     memset(&storage.vec[idx+1], 0, sizeof(struct fuse_chan*) * (storage.n_alloc - (size_t)idx - 1));
 
   done:
-#if defined(MULTITHREADED_REFUSE)
-    rv = pthread_mutex_unlock(&storage_mutex);
-    assert(rv == 0);
-#endif
+    STORAGE_LOCK(pthread_rwlock_unlock);
     return idx;
 }
 
 /* Acquire a pointer to a stashed channel with a given index. */
 struct fuse_chan* fuse_chan_peek(int idx) {
     struct fuse_chan* chan = NULL;
-#if defined(MULTITHREADED_REFUSE)
-    int rv;
 
-    rv = pthread_mutex_lock(&storage_mutex);
-    assert(rv == 0);
-#endif
+    STORAGE_LOCK(pthread_rwlock_rdlock);
 
     if (idx >= 0 && idx < (int)storage.n_alloc) {
         chan = storage.vec[idx];
     }
 
-#if defined(MULTITHREADED_REFUSE)
-    rv = pthread_mutex_unlock(&storage_mutex);
-    assert(rv == 0);
-#endif
+    STORAGE_LOCK(pthread_rwlock_unlock);
     return chan;
 }
 
@@ -165,22 +187,15 @@ struct fuse_chan* fuse_chan_peek(int idx) {
  * storage. */
 struct fuse_chan* fuse_chan_take(int idx) {
     struct fuse_chan* chan = NULL;
-#if defined(MULTITHREADED_REFUSE)
-    int rv;
 
-    rv = pthread_mutex_lock(&storage_mutex);
-    assert(rv == 0);
-#endif
+    STORAGE_LOCK(pthread_rwlock_wrlock);
 
     if (idx >= 0 && idx < (int)storage.n_alloc) {
         chan = storage.vec[idx];
         storage.vec[idx] = NULL;
     }
 
-#if defined(MULTITHREADED_REFUSE)
-    rv = pthread_mutex_unlock(&storage_mutex);
-    assert(rv == 0);
-#endif
+    STORAGE_LOCK(pthread_rwlock_unlock);
     return chan;
 }
 
@@ -191,12 +206,8 @@ fuse_chan_find(bool (*pred)(struct fuse_chan*, void*),
                int* found_idx, void* priv) {
     int idx;
     struct fuse_chan* chan = NULL;
-#if defined(MULTITHREADED_REFUSE)
-    int rv;
 
-    rv = pthread_mutex_lock(&storage_mutex);
-    assert(rv == 0);
-#endif
+    STORAGE_LOCK(pthread_rwlock_rdlock);
 
     for (idx = 0; idx < (int)storage.n_alloc; idx++) {
         if (storage.vec[idx] != NULL) {
@@ -210,21 +221,22 @@ fuse_chan_find(bool (*pred)(struct fuse_chan*, void*),
     }
 
   done:
-#if defined(MULTITHREADED_REFUSE)
-    rv = pthread_mutex_unlock(&storage_mutex);
-    assert(rv == 0);
-#endif
+    STORAGE_LOCK(pthread_rwlock_unlock);
     return chan;
 }
 
 void
 fuse_chan_set_fuse(struct fuse_chan* chan, struct fuse* fuse) {
+    CHAN_LOCK(chan, pthread_mutex_lock);
     chan->fuse = fuse;
+    CHAN_LOCK(chan, pthread_mutex_unlock);
 }
 
 void
 fuse_chan_set_to_be_destroyed(struct fuse_chan* chan, bool is_to_be_destroyed) {
+    CHAN_LOCK(chan, pthread_mutex_lock);
     chan->is_to_be_destroyed = is_to_be_destroyed;
+    CHAN_LOCK(chan, pthread_mutex_unlock);
 }
 
 const char*
@@ -239,10 +251,21 @@ fuse_chan_args(struct fuse_chan* chan) {
 
 struct fuse*
 fuse_chan_fuse(struct fuse_chan* chan) {
-    return chan->fuse;
+    struct fuse* fuse;
+
+    CHAN_LOCK(chan, pthread_mutex_lock);
+    fuse = chan->fuse;
+    CHAN_LOCK(chan, pthread_mutex_unlock);
+    return fuse;
 }
 
 bool
 fuse_chan_is_to_be_destroyed(const struct fuse_chan* chan) {
-    return chan->is_to_be_destroyed;
+    bool rv;
+
+    /* The lock is mutable even though the channel isn't. */
+    CHAN_LOCK(__UNCONST(chan), pthread_mutex_lock);
+    rv = chan->is_to_be_destroyed;
+    CHAN_LOCK(__UNCONST(chan), pthread_mutex_unlock);
+    return rv;
 }
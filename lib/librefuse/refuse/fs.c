@@ -49,6 +49,8 @@ __RCSID("$NetBSD: fs.c,v 1.2 2023/07/14 02:43:50 pho Exp $");
 #include <sys/dirent.h>
 #include <sys/errno.h>
 
+#include "loop.h"
+
 struct fuse_fs {
     void* op;
     int   op_version;
@@ -119,15 +121,31 @@ clobber_context_user_data(struct fuse_fs* fs) {
     fuse_get_context()->private_data = fs->user_data;
 }
 
+/* Operations that may block for long, i.e. I/O and attribute
+ * lookups, are split into an fs_*() implementation and a fuse_fs_*()
+ * wrapper passing its arguments to __fuse_pool_call(), so that
+ * __fuse_loop_mt() can run them on its worker threads. The
+ * fuse_file_info given to us is usually that of the node, which
+ * other requests served meanwhile read and write as well, so the
+ * call gets a copy of its own. Only open() and create() return
+ * anything in it, and they copy it back once the call is over. */
+static struct fuse_file_info*
+copy_fi(struct fuse_file_info* dst, const struct fuse_file_info* src) {
+    if (src == NULL)
+        return NULL;
+    *dst = *src;
+    return dst;
+}
+
 /* Ugly... These are like hand-written vtables... */
 int
 fuse_fs_getattr_v27(struct fuse_fs *fs, const char *path, struct stat *buf) {
     return fuse_fs_getattr_v30(fs, path, buf, NULL);
 }
 
-int
-fuse_fs_getattr_v30(struct fuse_fs* fs, const char* path,
-                    struct stat* buf, struct fuse_file_info* fi) {
+static int
+fs_getattr_v30(struct fuse_fs* fs, const char* path,
+               struct stat* buf, struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
     switch (fs->op_version) {
 #define CALL_OLD_GETATTR(VER)                                           \
@@ -162,9 +180,30 @@ fuse_fs_getattr_v30(struct fuse_fs* fs, const char* path,
     }
 }
 
+struct getattr_v30_args {
+    struct fuse_fs* fs;
+    const char* path;
+    struct stat* buf;
+    struct fuse_file_info* fi;
+};
+
+static int
+getattr_v30_thunk(void* priv) {
+    struct getattr_v30_args* a = priv;
+    return fs_getattr_v30(a->fs, a->path, a->buf, a->fi);
+}
+
 int
-fuse_fs_fgetattr(struct fuse_fs* fs, const char* path, struct stat* buf,
-                 struct fuse_file_info* fi) {
+fuse_fs_getattr_v30(struct fuse_fs* fs, const char* path, struct stat* buf,
+                    struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct getattr_v30_args a = { fs, path, buf, copy_fi(&fi_copy, fi) };
+    return __fuse_pool_call(getattr_v30_thunk, &a, &a.path);
+}
+
+static int
+fs_fgetattr(struct fuse_fs* fs, const char* path, struct stat* buf,
+            struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
     /* fgetattr() was introduced on FUSE 2.5 then disappeared on FUSE
      * 3.0. Fall back to getattr() if it's missing. */
@@ -173,7 +212,7 @@ fuse_fs_fgetattr(struct fuse_fs* fs, const char* path, struct stat* buf,
     case 21:
     case 22:
     case 23:
-        return fuse_fs_getattr_v30(fs, path, buf, fi);
+        return fs_getattr_v30(fs, path, buf, fi);
 
 #define CALL_FGETATTR_OR_OLD_GETATTR(VER)       \
     case VER:                                   \
@@ -193,12 +232,33 @@ fuse_fs_fgetattr(struct fuse_fs* fs, const char* path, struct stat* buf,
     case 34:
     case 35:
     case 38:
-        return fuse_fs_getattr_v30(fs, path, buf, fi);
+        return fs_getattr_v30(fs, path, buf, fi);
     default:
         UNKNOWN_VERSION(fs->op_version);
     }
 }
 
+struct fgetattr_args {
+    struct fuse_fs* fs;
+    const char* path;
+    struct stat* buf;
+    struct fuse_file_info* fi;
+};
+
+static int
+fgetattr_thunk(void* priv) {
+    struct fgetattr_args* a = priv;
+    return fs_fgetattr(a->fs, a->path, a->buf, a->fi);
+}
+
+int
+fuse_fs_fgetattr(struct fuse_fs* fs, const char* path, struct stat* buf,
+                 struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct fgetattr_args a = { fs, path, buf, copy_fi(&fi_copy, fi) };
+    return __fuse_pool_call(fgetattr_thunk, &a, &a.path);
+}
+
 int
 fuse_fs_rename_v27(struct fuse_fs* fs, const char* oldpath, const char* newpath) {
     return fuse_fs_rename_v30(fs, oldpath, newpath, 0);
@@ -353,8 +413,8 @@ fuse_fs_link(struct fuse_fs* fs, const char* oldpath, const char* newpath) {
     }
 }
 
-int
-fuse_fs_release(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi) {
+static int
+fs_release(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
     switch (fs->op_version) {
 #define CALL_OLD_RELEASE(VER)                                           \
@@ -389,8 +449,28 @@ fuse_fs_release(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi)
     }
 }
 
+struct release_args {
+    struct fuse_fs* fs;
+    const char* path;
+    struct fuse_file_info* fi;
+};
+
+static int
+release_thunk(void* priv) {
+    struct release_args* a = priv;
+    return fs_release(a->fs, a->path, a->fi);
+}
+
 int
-fuse_fs_open(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi) {
+fuse_fs_release(struct fuse_fs* fs, const char* path,
+                struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct release_args a = { fs, path, copy_fi(&fi_copy, fi) };
+    return __fuse_pool_call(release_thunk, &a, &a.path);
+}
+
+static int
+fs_open(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
     switch (fs->op_version) {
 #define CALL_OLD_OPEN(VER)                                              \
@@ -425,9 +505,33 @@ fuse_fs_open(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi) {
     }
 }
 
+struct open_args {
+    struct fuse_fs* fs;
+    const char* path;
+    struct fuse_file_info* fi;
+};
+
+static int
+open_thunk(void* priv) {
+    struct open_args* a = priv;
+    return fs_open(a->fs, a->path, a->fi);
+}
+
 int
-fuse_fs_read(struct fuse_fs* fs, const char* path, char* buf,
-             size_t size, off_t off, struct fuse_file_info* fi) {
+fuse_fs_open(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct open_args a = { fs, path, copy_fi(&fi_copy, fi) };
+    int ret;
+
+    ret = __fuse_pool_call(open_thunk, &a, &a.path);
+    if (fi != NULL)
+        *fi = fi_copy;
+    return ret;
+}
+
+static int
+fs_read(struct fuse_fs* fs, const char* path, char* buf,
+        size_t size, off_t off, struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
     switch (fs->op_version) {
 #define CALL_OLD_READ(VER)                                              \
@@ -462,10 +566,36 @@ fuse_fs_read(struct fuse_fs* fs, const char* path, char* buf,
     }
 }
 
+struct read_args {
+    struct fuse_fs* fs;
+    const char* path;
+    char* buf;
+    size_t size;
+    off_t off;
+    struct fuse_file_info* fi;
+};
+
+static int
+read_thunk(void* priv) {
+    struct read_args* a = priv;
+    return fs_read(a->fs, a->path, a->buf, a->size, a->off, a->fi);
+}
+
 int
-fuse_fs_read_buf(struct fuse_fs* fs, const char* path,
-                 struct fuse_bufvec** bufp, size_t size, off_t off,
-                 struct fuse_file_info* fi) {
+fuse_fs_read(struct fuse_fs* fs, const char* path, char* buf, size_t size,
+             off_t off, struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct read_args a = { fs, path, buf, size, off, copy_fi(&fi_copy, fi) };
+    return __fuse_pool_call(read_thunk, &a, &a.path);
+}
+
+static int
+fs_read_buf(struct fuse_fs* fs, const char* path,
+            struct fuse_bufvec** bufp, size_t size, off_t off,
+            struct fuse_file_info* fi) {
+    struct fuse_bufvec* buf;
+    int rv;
+
     clobber_context_user_data(fs);
     switch (fs->op_version) {
         /* FUSE < 2.9 didn't have read_buf(). */
@@ -476,13 +606,13 @@ fuse_fs_read_buf(struct fuse_fs* fs, const char* path,
     case 25:
     case 26:
     case 28:
-        return -ENOSYS;
+        break;
 #define CALL_READ_BUF(VER)                                              \
     case VER:                                                           \
         if (((const struct __CONCAT(fuse_operations_v,VER)*)fs->op)->read_buf) \
             return ((const struct __CONCAT(fuse_operations_v,VER)*)fs->op)->read_buf(path, bufp, size, off, fi); \
         else                                                            \
-            return -ENOSYS
+            break
         CALL_READ_BUF(29);
         CALL_READ_BUF(30);
         CALL_READ_BUF(34);
@@ -492,11 +622,60 @@ fuse_fs_read_buf(struct fuse_fs* fs, const char* path,
     default:
         UNKNOWN_VERSION(fs->op_version);
     }
+
+    /* The filesystem has no read_buf(). Emulate it with read(),
+     * which is what libfuse does too. The caller frees both the
+     * vector and the memory. */
+    buf = malloc(sizeof(*buf));
+    if (!buf)
+        return -ENOMEM;
+    *buf = FUSE_BUFVEC_INIT(size);
+
+    buf->buf[0].mem = malloc(size > 0 ? size : 1);
+    if (!buf->buf[0].mem) {
+        free(buf);
+        return -ENOMEM;
+    }
+
+    rv = fs_read(fs, path, buf->buf[0].mem, size, off, fi);
+    if (rv < 0) {
+        free(buf->buf[0].mem);
+        free(buf);
+        return rv;
+    }
+
+    buf->buf[0].size = (size_t)rv;
+    *bufp = buf;
+    return 0;
+}
+
+struct read_buf_args {
+    struct fuse_fs* fs;
+    const char* path;
+    struct fuse_bufvec** bufp;
+    size_t size;
+    off_t off;
+    struct fuse_file_info* fi;
+};
+
+static int
+read_buf_thunk(void* priv) {
+    struct read_buf_args* a = priv;
+    return fs_read_buf(a->fs, a->path, a->bufp, a->size, a->off, a->fi);
 }
 
 int
-fuse_fs_write(struct fuse_fs* fs, const char* path, const char* buf,
-              size_t size, off_t off, struct fuse_file_info* fi) {
+fuse_fs_read_buf(struct fuse_fs* fs, const char* path,
+                 struct fuse_bufvec** bufp, size_t size, off_t off,
+                 struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct read_buf_args a = { fs, path, bufp, size, off, copy_fi(&fi_copy, fi) };
+    return __fuse_pool_call(read_buf_thunk, &a, &a.path);
+}
+
+static int
+fs_write(struct fuse_fs* fs, const char* path, const char* buf,
+         size_t size, off_t off, struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
     switch (fs->op_version) {
 #define CALL_OLD_WRITE(VER)                                             \
@@ -531,10 +710,38 @@ fuse_fs_write(struct fuse_fs* fs, const char* path, const char* buf,
     }
 }
 
+struct write_args {
+    struct fuse_fs* fs;
+    const char* path;
+    const char* buf;
+    size_t size;
+    off_t off;
+    struct fuse_file_info* fi;
+};
+
+static int
+write_thunk(void* priv) {
+    struct write_args* a = priv;
+    return fs_write(a->fs, a->path, a->buf, a->size, a->off, a->fi);
+}
+
 int
-fuse_fs_write_buf(struct fuse_fs* fs, const char* path,
-                  struct fuse_bufvec* bufp, off_t off,
-                  struct fuse_file_info* fi) {
+fuse_fs_write(struct fuse_fs* fs, const char* path, const char* buf,
+              size_t size, off_t off, struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct write_args a = { fs, path, buf, size, off, copy_fi(&fi_copy, fi) };
+    return __fuse_pool_call(write_thunk, &a, &a.path);
+}
+
+static int
+fs_write_buf(struct fuse_fs* fs, const char* path,
+             struct fuse_bufvec* bufp, off_t off,
+             struct fuse_file_info* fi) {
+    struct fuse_bufvec tmp;
+    size_t size;
+    ssize_t n_copied;
+    int rv;
+
     clobber_context_user_data(fs);
     switch (fs->op_version) {
         /* FUSE < 2.9 didn't have write_buf(). */
@@ -545,13 +752,13 @@ fuse_fs_write_buf(struct fuse_fs* fs, const char* path,
     case 25:
     case 26:
     case 28:
-        return -ENOSYS;
+        break;
 #define CALL_WRITE_BUF(VER)                                             \
     case VER:                                                           \
         if (((const struct __CONCAT(fuse_operations_v,VER)*)fs->op)->write_buf) \
             return ((const struct __CONCAT(fuse_operations_v,VER)*)fs->op)->write_buf(path, bufp, off, fi); \
         else                                                            \
-            return -ENOSYS
+            break
         CALL_WRITE_BUF(29);
         CALL_WRITE_BUF(30);
         CALL_WRITE_BUF(34);
@@ -561,10 +768,58 @@ fuse_fs_write_buf(struct fuse_fs* fs, const char* path,
     default:
         UNKNOWN_VERSION(fs->op_version);
     }
+
+    /* The filesystem has no write_buf(). Emulate it with write(). A
+     * vector consisting of a single memory buffer, which is by far
+     * the most common case, is passed through without copying. */
+    if (bufp->count == 1 && bufp->idx == 0 && bufp->off == 0 &&
+        !(bufp->buf[0].flags & FUSE_BUF_IS_FD)) {
+        return fs_write(fs, path, bufp->buf[0].mem, bufp->buf[0].size, off, fi);
+    }
+
+    size = fuse_buf_size(bufp);
+    tmp  = FUSE_BUFVEC_INIT(size);
+    tmp.buf[0].mem = malloc(size > 0 ? size : 1);
+    if (!tmp.buf[0].mem)
+        return -ENOMEM;
+
+    n_copied = fuse_buf_copy(&tmp, bufp, (enum fuse_buf_copy_flags)0);
+    if (n_copied < 0) {
+        rv = -errno;
+    }
+    else {
+        rv = fs_write(fs, path, tmp.buf[0].mem, (size_t)n_copied, off, fi);
+    }
+
+    free(tmp.buf[0].mem);
+    return rv;
+}
+
+struct write_buf_args {
+    struct fuse_fs* fs;
+    const char* path;
+    struct fuse_bufvec* buf;
+    off_t off;
+    struct fuse_file_info* fi;
+};
+
+static int
+write_buf_thunk(void* priv) {
+    struct write_buf_args* a = priv;
+    return fs_write_buf(a->fs, a->path, a->buf, a->off, a->fi);
 }
 
 int
-fuse_fs_fsync(struct fuse_fs* fs, const char* path, int datasync, struct fuse_file_info* fi) {
+fuse_fs_write_buf(struct fuse_fs* fs, const char* path,
+                  struct fuse_bufvec* buf, off_t off,
+                  struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct write_buf_args a = { fs, path, buf, off, copy_fi(&fi_copy, fi) };
+    return __fuse_pool_call(write_buf_thunk, &a, &a.path);
+}
+
+static int
+fs_fsync(struct fuse_fs* fs, const char* path, int datasync, struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
     switch (fs->op_version) {
 #define CALL_OLD_FSYNC(VER)                                             \
@@ -599,6 +854,27 @@ fuse_fs_fsync(struct fuse_fs* fs, const char* path, int datasync, struct fuse_fi
     }
 }
 
+struct fsync_args {
+    struct fuse_fs* fs;
+    const char* path;
+    int datasync;
+    struct fuse_file_info* fi;
+};
+
+static int
+fsync_thunk(void* priv) {
+    struct fsync_args* a = priv;
+    return fs_fsync(a->fs, a->path, a->datasync, a->fi);
+}
+
+int
+fuse_fs_fsync(struct fuse_fs* fs, const char* path, int datasync,
+              struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct fsync_args a = { fs, path, datasync, copy_fi(&fi_copy, fi) };
+    return __fuse_pool_call(fsync_thunk, &a, &a.path);
+}
+
 int
 fuse_fs_flush(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
@@ -895,10 +1171,10 @@ fuse_fs_readdir_v27(struct fuse_fs* fs, const char* path, void* buf,
     }
 }
 
-int
-fuse_fs_readdir_v30(struct fuse_fs* fs, const char* path, void* buf,
-                    fuse_fill_dir_t_v30 filler, off_t off,
-                    struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
+static int
+fs_readdir_v30(struct fuse_fs* fs, const char* path, void* buf,
+               fuse_fill_dir_t_v30 filler, off_t off,
+               struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
     clobber_context_user_data(fs);
 
     if (fs->op_version < 30) {
@@ -928,6 +1204,32 @@ fuse_fs_readdir_v30(struct fuse_fs* fs, const char* path, void* buf,
     }
 }
 
+struct readdir_v30_args {
+    struct fuse_fs* fs;
+    const char* path;
+    void* buf;
+    fuse_fill_dir_t_v30 filler;
+    off_t off;
+    struct fuse_file_info* fi;
+    enum fuse_readdir_flags flags;
+};
+
+static int
+readdir_v30_thunk(void* priv) {
+    struct readdir_v30_args* a = priv;
+    return fs_readdir_v30(a->fs, a->path, a->buf, a->filler, a->off, a->fi,
+                          a->flags);
+}
+
+int
+fuse_fs_readdir_v30(struct fuse_fs* fs, const char* path, void* buf,
+                    fuse_fill_dir_t_v30 filler, off_t off,
+                    struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
+    struct fuse_file_info fi_copy;
+    struct readdir_v30_args a = { fs, path, buf, filler, off, copy_fi(&fi_copy, fi), flags };
+    return __fuse_pool_call(readdir_v30_thunk, &a, &a.path);
+}
+
 /* ==============================
  *   The End of readdir Madness
  * ============================== */
@@ -995,8 +1297,8 @@ fuse_fs_releasedir(struct fuse_fs* fs, const char* path, struct fuse_file_info*
     }
 }
 
-int
-fuse_fs_create(struct fuse_fs* fs, const char* path, mode_t mode, struct fuse_file_info* fi) {
+static int
+fs_create(struct fuse_fs* fs, const char* path, mode_t mode, struct fuse_file_info* fi) {
     clobber_context_user_data(fs);
     switch (fs->op_version) {
         /* FUSE < 2.5 didn't have create(). */
@@ -1026,6 +1328,32 @@ fuse_fs_create(struct fuse_fs* fs, const char* path, mode_t mode, struct fuse_fi
     }
 }
 
+struct create_args {
+    struct fuse_fs* fs;
+    const char* path;
+    mode_t mode;
+    struct fuse_file_info* fi;
+};
+
+static int
+create_thunk(void* priv) {
+    struct create_args* a = priv;
+    return fs_create(a->fs, a->path, a->mode, a->fi);
+}
+
+int
+fuse_fs_create(struct fuse_fs* fs, const char* path, mode_t mode,
+               struct fuse_file_info* fi) {
+    struct fuse_file_info fi_copy;
+    struct create_args a = { fs, path, mode, copy_fi(&fi_copy, fi) };
+    int ret;
+
+    ret = __fuse_pool_call(create_thunk, &a, &a.path);
+    if (fi != NULL)
+        *fi = fi_copy;
+    return ret;
+}
+
 int
 fuse_fs_lock(struct fuse_fs* fs, const char* path, struct fuse_file_info* fi,
              int cmd, struct flock* lock) {
@@ -0,0 +1,360 @@
+/* $NetBSD$ */
+
+/*
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote
+ *    products derived from this software without specific prior written
+ *    permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#if !defined(lint)
+__RCSID("$NetBSD$");
+#endif /* !lint */
+
+/*
+ * Multi-threaded event loop.
+ *
+ * puffs hands requests to us on a single thread, and each of them is
+ * processed in a continuation of its own (see puffs_cc(3)). To serve
+ * requests concurrently, filesystem operations that may block are run
+ * on a pool of worker threads: the continuation making the call
+ * yields back to the puffs mainloop, which goes on accepting further
+ * requests, and it is resumed once a worker has finished the
+ * call. Workers report completion through a pipe watched by the
+ * mainloop.
+ *
+ * As with the libfuse worker loop, a new worker is started whenever a
+ * call finds none idle, and a worker quits instead of going idle when
+ * max_idle_threads others already are. clone_fd has no meaning for
+ * us as there is a single puffs descriptor per mount, and is ignored.
+ *
+ * Without MULTITHREADED_REFUSE the context returned by
+ * fuse_get_context() is shared by all threads, so the loop then
+ * falls back to processing requests one at a time.
+ */
+
+#include <sys/queue.h>
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse_internal.h>
+#if defined(MULTITHREADED_REFUSE)
+#  include <pthread.h>
+#endif
+#include <puffs.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "loop.h"
+
+#if defined(MULTITHREADED_REFUSE)
+
+/* The default value of max_idle_threads when "config" is NULL. */
+#define DEFAULT_MAX_IDLE_THREADS 10
+
+struct refuse_job {
+    TAILQ_ENTRY(refuse_job) link;
+    int (*fn)(void*);
+    void* arg;
+    int result;
+    struct fuse_context ctx;  /* context of the request */
+    struct puffs_cc* pcc;     /* continuation waiting for the result */
+};
+TAILQ_HEAD(refuse_jobq, refuse_job);
+
+struct refuse_pool {
+    struct fuse* fuse;
+    pthread_t mainloop;       /* thread running puffs_mainloop() */
+    pthread_mutex_t lock;     /* protects everything below */
+    pthread_cond_t work_cv;   /* a job has been queued */
+    pthread_cond_t exit_cv;   /* a worker has quit */
+    struct refuse_jobq todo;  /* jobs waiting for a worker */
+    struct refuse_jobq done;  /* jobs waiting to be resumed */
+    unsigned int n_threads;
+    unsigned int n_idle;
+    unsigned int max_idle;
+    bool exiting;
+    int pipe[2];              /* workers -> mainloop wakeup */
+};
+
+/* Only one multi-threaded loop can run at a time. It's only ever
+ * accessed by the mainloop thread. */
+static struct refuse_pool* active_pool;
+
+static void*
+worker_main(void* priv) {
+    struct refuse_pool* pool = priv;
+    struct refuse_job* job;
+    int rv;
+
+    rv = pthread_mutex_lock(&pool->lock);
+    assert(rv == 0);
+
+    for (;;) {
+        while ((job = TAILQ_FIRST(&pool->todo)) == NULL && !pool->exiting) {
+            pool->n_idle++;
+            rv = pthread_cond_wait(&pool->work_cv, &pool->lock);
+            assert(rv == 0);
+            pool->n_idle--;
+        }
+        if (job == NULL)
+            break;
+        TAILQ_REMOVE(&pool->todo, job, link);
+
+        rv = pthread_mutex_unlock(&pool->lock);
+        assert(rv == 0);
+
+        *fuse_get_context() = job->ctx;
+        job->result = job->fn(job->arg);
+
+        rv = pthread_mutex_lock(&pool->lock);
+        assert(rv == 0);
+
+        TAILQ_INSERT_TAIL(&pool->done, job, link);
+        /* The pipe being full is fine: it's readable anyway. */
+        (void)write(pool->pipe[1], "", 1);
+
+        if (TAILQ_EMPTY(&pool->todo) && pool->n_idle >= pool->max_idle)
+            break;
+    }
+
+    pool->n_threads--;
+    rv = pthread_cond_signal(&pool->exit_cv);
+    assert(rv == 0);
+    rv = pthread_mutex_unlock(&pool->lock);
+    assert(rv == 0);
+    return NULL;
+}
+
+/* Start a worker. Called with pool->lock held. */
+static int
+worker_start(struct refuse_pool* pool) {
+    pthread_attr_t attr;
+    pthread_t thr;
+    int rv;
+
+    rv = pthread_attr_init(&attr);
+    if (rv != 0)
+        return rv;
+    (void)pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    rv = pthread_create(&thr, &attr, worker_main, pool);
+    if (rv == 0)
+        pool->n_threads++;
+
+    (void)pthread_attr_destroy(&attr);
+    return rv;
+}
+
+int
+__fuse_pool_call(int (*fn)(void*), void* arg, const char** pathp) {
+    struct refuse_pool* pool = active_pool;
+    struct refuse_job job;
+    char* path_copy;
+    int rv;
+
+    /* Operations invoked outside of the mainloop, e.g. by a stacked
+     * filesystem from its own threads, are run right here. */
+    if (pool == NULL || !pthread_equal(pthread_self(), pool->mainloop))
+        return fn(arg);
+
+    /* The path is that of the node the request is for, and puffs
+     * frees or reallocates it when the node gets renamed or
+     * removed, which may happen while we yield. */
+    path_copy = NULL;
+    if (pathp != NULL && *pathp != NULL) {
+        path_copy = strdup(*pathp);
+        if (path_copy == NULL)
+            return -ENOMEM;
+        *pathp = path_copy;
+    }
+
+    job.fn  = fn;
+    job.arg = arg;
+    job.ctx = *fuse_get_context();
+    job.pcc = puffs_cc_getcc(pool->fuse->pu);
+
+    rv = pthread_mutex_lock(&pool->lock);
+    assert(rv == 0);
+
+    if (pool->n_idle == 0 && worker_start(pool) != 0 &&
+        pool->n_threads == 0) {
+        /* No worker to run it at all. */
+        rv = pthread_mutex_unlock(&pool->lock);
+        assert(rv == 0);
+        job.result = fn(arg);
+        free(path_copy);
+        return job.result;
+    }
+    TAILQ_INSERT_TAIL(&pool->todo, &job, link);
+    rv = pthread_cond_signal(&pool->work_cv);
+    assert(rv == 0);
+
+    rv = pthread_mutex_unlock(&pool->lock);
+    assert(rv == 0);
+
+    /* Let the mainloop serve other requests until pool_loopfn()
+     * resumes us. The job lives on our stack meanwhile. */
+    puffs_cc_yield(job.pcc);
+
+    free(path_copy);
+    return job.result;
+}
+
+/* The wakeup pipe never carries a frame; just drain it. The finished
+ * jobs are picked up by pool_loopfn(), which puffs calls once per
+ * mainloop iteration. */
+static int
+pool_readframe(struct puffs_usermount* pu __unused,
+               struct puffs_framebuf* pb __unused, int fd, int* done) {
+    char buf[64];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+    *done = 0;
+    return 0;
+}
+
+static int
+pool_writeframe(struct puffs_usermount* pu __unused,
+                struct puffs_framebuf* pb __unused, int fd __unused,
+                int* done) {
+    *done = 1;
+    return 0;
+}
+
+static void
+pool_loopfn(struct puffs_usermount* pu __unused) {
+    struct refuse_pool* pool = active_pool;
+    struct refuse_jobq done;
+    struct refuse_job* job;
+    int rv;
+
+    TAILQ_INIT(&done);
+
+    rv = pthread_mutex_lock(&pool->lock);
+    assert(rv == 0);
+    TAILQ_CONCAT(&done, &pool->done, link);
+    rv = pthread_mutex_unlock(&pool->lock);
+    assert(rv == 0);
+
+    while ((job = TAILQ_FIRST(&done)) != NULL) {
+        TAILQ_REMOVE(&done, job, link);
+        /* This may free the job, as it's on the stack of the
+         * continuation. */
+        puffs_cc_continue(job->pcc);
+    }
+}
+
+int
+__fuse_loop_mt(struct fuse* fuse, struct fuse_loop_config* config) {
+    struct refuse_pool pool;
+    int rv, ret;
+
+    if (active_pool != NULL) {
+        warnx("%s: a multi-threaded loop is already running; "
+              "falling back to a single-threaded one", __func__);
+        return puffs_mainloop(fuse->pu);
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pool.fuse     = fuse;
+    pool.max_idle = config ? config->max_idle_threads
+                           : DEFAULT_MAX_IDLE_THREADS;
+    TAILQ_INIT(&pool.todo);
+    TAILQ_INIT(&pool.done);
+
+    if (pipe2(pool.pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        warn("%s: pipe2", __func__);
+        return -1;
+    }
+    rv = pthread_mutex_init(&pool.lock, NULL);
+    assert(rv == 0);
+    rv = pthread_cond_init(&pool.work_cv, NULL);
+    assert(rv == 0);
+    rv = pthread_cond_init(&pool.exit_cv, NULL);
+    assert(rv == 0);
+
+    puffs_framev_init(fuse->pu, pool_readframe, pool_writeframe,
+                      NULL, NULL, NULL);
+    if (puffs_framev_addfd(fuse->pu, pool.pipe[0], PUFFS_FBIO_READ) == -1) {
+        warn("%s: puffs_framev_addfd", __func__);
+        ret = -1;
+        goto out;
+    }
+    puffs_ml_setloopfn(fuse->pu, pool_loopfn);
+
+    pool.mainloop = pthread_self();
+    active_pool = &pool;
+    ret = puffs_mainloop(fuse->pu);
+    active_pool = NULL;
+
+    puffs_ml_setloopfn(fuse->pu, NULL);
+    (void)puffs_framev_removefd(fuse->pu, pool.pipe[0], 0);
+
+    /* Let the workers finish what they have and wait for them to
+     * quit. Continuations still waiting for them are never resumed,
+     * since the filesystem is going away. */
+    rv = pthread_mutex_lock(&pool.lock);
+    assert(rv == 0);
+    pool.exiting = true;
+    rv = pthread_cond_broadcast(&pool.work_cv);
+    assert(rv == 0);
+    while (pool.n_threads > 0) {
+        rv = pthread_cond_wait(&pool.exit_cv, &pool.lock);
+        assert(rv == 0);
+    }
+    rv = pthread_mutex_unlock(&pool.lock);
+    assert(rv == 0);
+
+  out:
+    (void)pthread_cond_destroy(&pool.exit_cv);
+    (void)pthread_cond_destroy(&pool.work_cv);
+    (void)pthread_mutex_destroy(&pool.lock);
+    (void)close(pool.pipe[0]);
+    (void)close(pool.pipe[1]);
+    return ret;
+}
+
+#else /* !defined(MULTITHREADED_REFUSE) */
+
+int
+__fuse_pool_call(int (*fn)(void*), void* arg,
+                 const char** pathp __attribute__((__unused__))) {
+    return fn(arg);
+}
+
+int
+__fuse_loop_mt(struct fuse* fuse,
+               struct fuse_loop_config* config __attribute__((__unused__))) {
+    return puffs_mainloop(fuse->pu);
+}
+
+#endif /* !defined(MULTITHREADED_REFUSE) */
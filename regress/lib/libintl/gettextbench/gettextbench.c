@@ -0,0 +1,172 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure gettext(3) calls per second.
+ *
+ * A catalog with a few hundred messages is generated in a temporary
+ * directory, and the same set of msgid literals is then translated in
+ * a loop, the way a localized daemon would.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <err.h>
+#include <libintl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define	NMSG	512
+#define	NCALL	(10 * 1000 * 1000)
+
+static char *msgids[NMSG];
+
+static int
+cmp(const void *a, const void *b)
+{
+
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Write a little-endian rev 0 *.mo file, without a hash table so that
+ * the lookups go through the binary search.
+ */
+static void
+writemo(const char *path)
+{
+	char *sorted[NMSG + 1];
+	uint32_t hdr[7], ent[2];
+	uint32_t off;
+	size_t i, n;
+	FILE *fp;
+
+	sorted[0] = __UNCONST("");
+	for (i = 0; i < NMSG; i++)
+		sorted[i + 1] = msgids[i];
+	n = NMSG + 1;
+	qsort(sorted, n, sizeof(sorted[0]), cmp);
+
+	if ((fp = fopen(path, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", path);
+
+	hdr[0] = 0x950412de;
+	hdr[1] = 0;
+	hdr[2] = (uint32_t)n;
+	hdr[3] = sizeof(hdr);
+	hdr[4] = (uint32_t)(sizeof(hdr) + n * sizeof(ent));
+	hdr[5] = 0;
+	hdr[6] = 0;
+	fwrite(hdr, sizeof(hdr), 1, fp);
+
+	/* original strings, then translations ("xx " + msgid) */
+	off = (uint32_t)(sizeof(hdr) + 2 * n * sizeof(ent));
+	for (i = 0; i < n; i++) {
+		ent[0] = (uint32_t)strlen(sorted[i]);
+		ent[1] = off;
+		fwrite(ent, sizeof(ent), 1, fp);
+		off += ent[0] + 1;
+	}
+	for (i = 0; i < n; i++) {
+		ent[0] = (uint32_t)strlen(sorted[i]) + (i == 0 ? 0 : 3);
+		ent[1] = off;
+		fwrite(ent, sizeof(ent), 1, fp);
+		off += ent[0] + 1;
+	}
+	for (i = 0; i < n; i++)
+		fwrite(sorted[i], strlen(sorted[i]) + 1, 1, fp);
+	for (i = 0; i < n; i++) {
+		if (i != 0)
+			fputs("xx ", fp);
+		fwrite(sorted[i], strlen(sorted[i]) + 1, 1, fp);
+	}
+
+	if (fclose(fp) != 0)
+		err(EXIT_FAILURE, "%s", path);
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/gettextbench.XXXXXX";
+	char path[PATH_MAX];
+	struct timeval start, end;
+	const char *v;
+	double secs;
+	size_t i;
+
+	for (i = 0; i < NMSG; i++)
+		if (asprintf(&msgids[i], "message number %zu", i) == -1)
+			err(EXIT_FAILURE, "asprintf");
+
+	if (mkdtemp(dir) == NULL)
+		err(EXIT_FAILURE, "mkdtemp");
+	snprintf(path, sizeof(path), "%s/xx", dir);
+	if (mkdir(path, 0700) == -1)
+		err(EXIT_FAILURE, "%s", path);
+	snprintf(path, sizeof(path), "%s/xx/LC_MESSAGES", dir);
+	if (mkdir(path, 0700) == -1)
+		err(EXIT_FAILURE, "%s", path);
+	snprintf(path, sizeof(path), "%s/xx/LC_MESSAGES/bench.mo", dir);
+	writemo(path);
+
+	setenv("LANGUAGE", "xx", 1);
+	bindtextdomain("bench", dir);
+	textdomain("bench");
+
+	v = gettext(msgids[0]);
+	if (strncmp(v, "xx ", 3) != 0)
+		errx(EXIT_FAILURE, "catalog not used: \"%s\"", v);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < NCALL; i++)
+		(void)gettext(msgids[i % NMSG]);
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &end);
+	secs = end.tv_sec + end.tv_usec / 1000000.0;
+	printf("%d calls in %.3f sec, %.0f calls/sec\n", NCALL, secs,
+	    NCALL / secs);
+
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/xx/LC_MESSAGES", dir);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/xx", dir);
+	rmdir(path);
+	rmdir(dir);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,400 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure iSCSI target IOPS.
+ *
+ * Log in to a target (normally iscsi-target(8) on the loopback
+ * interface), then keep up to the given number of random READ(10)
+ * and WRITE(10) commands outstanding for a fixed time, like a fio
+ * random I/O job, and report the rate at which they complete.
+ * Writes are sent as immediate data.  The number of outstanding
+ * commands is also limited by the MaxCmdSN the target advertises.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <err.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iscsiprotocol.h"
+#include "iscsiutil.h"
+
+#define	MAXDEPTH	256
+#define	TEXTLEN		2048
+
+static const char *target = "iqn.1994-04.org.netbsd.iscsi-target:target0";
+static uint32_t	 CmdSN;
+static uint32_t	 ExpStatSN;
+static uint32_t	 MaxCmdSN;
+static uint32_t	 blocklen = 512;
+static uint64_t	 nblocks;
+
+struct io {
+	int		 busy;
+	int		 write;
+	struct timeval	 start;
+};
+
+static struct io ios[MAXDEPTH];
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-b bytes] [-d depth] [-h host] "
+	    "[-p port] [-t seconds] [-T target] [-w percent]\n",
+	    getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/* Sequence number arithmetic, RFC 1982 */
+static int
+sn_le(uint32_t a, uint32_t b)
+{
+
+	return (int32_t)(a - b) <= 0;
+}
+
+static int
+connect_to(const char *host, const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int s, one = 1, error;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if ((error = getaddrinfo(host, port, &hints, &res)) != 0)
+		errx(EXIT_FAILURE, "%s: %s", host, gai_strerror(error));
+	for (s = -1, ai = res; ai != NULL; ai = ai->ai_next) {
+		if ((s = socket(ai->ai_family, ai->ai_socktype,
+		    ai->ai_protocol)) == -1)
+			continue;
+		if (connect(s, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(s);
+		s = -1;
+	}
+	if (s == -1)
+		err(EXIT_FAILURE, "connect to %s:%s", host, port);
+	freeaddrinfo(res);
+	(void)setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return s;
+}
+
+static size_t
+addkey(char *text, size_t len, const char *key, const char *val)
+{
+
+	len += snprintf(text + len, TEXTLEN - len, "%s=%s", key, val) + 1;
+	if (len > TEXTLEN)
+		errx(EXIT_FAILURE, "login text too long");
+	return len;
+}
+
+static void
+login_stage(int s, uint8_t csg, uint8_t nsg, char *text, size_t len)
+{
+	iscsi_login_cmd_args_t cmd;
+	iscsi_login_rsp_args_t rsp;
+	uint8_t header[ISCSI_HEADER_LEN];
+	char reply[TEXTLEN];
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.transit = 1;
+	cmd.csg = csg;
+	cmd.nsg = nsg;
+	cmd.length = (uint32_t)len;
+	cmd.isid = 0x80000000abcdULL;
+	cmd.CmdSN = CmdSN;
+	cmd.ExpStatSN = ExpStatSN;
+	if (iscsi_login_cmd_encap(header, &cmd) != 0)
+		errx(EXIT_FAILURE, "iscsi_login_cmd_encap failed");
+	if (iscsi_sock_send_header_and_data(s, header, ISCSI_HEADER_LEN,
+	    text, (unsigned)len, 0) != ISCSI_HEADER_LEN + (int)len)
+		errx(EXIT_FAILURE, "login send failed");
+	if (iscsi_sock_msg(s, 0, ISCSI_HEADER_LEN, header, 0) !=
+	    ISCSI_HEADER_LEN)
+		errx(EXIT_FAILURE, "login receive failed");
+	if (iscsi_login_rsp_decap(header, &rsp) != 0)
+		errx(EXIT_FAILURE, "iscsi_login_rsp_decap failed");
+	if (rsp.status_class != 0)
+		errx(EXIT_FAILURE, "login failed, class %u detail %u",
+		    rsp.status_class, rsp.status_detail);
+	if (rsp.length > sizeof(reply) ||
+	    (rsp.length && iscsi_sock_msg(s, 0, rsp.length, reply, 0) !=
+	    (int)rsp.length))
+		errx(EXIT_FAILURE, "login text receive failed");
+	ExpStatSN = rsp.StatSN + 1;
+	MaxCmdSN = rsp.MaxCmdSN;
+}
+
+static void
+login(int s, uint32_t maxlen)
+{
+	char text[TEXTLEN], buf[16];
+	size_t len;
+
+	len = addkey(text, 0, "InitiatorName",
+	    "iqn.1994-04.org.netbsd:iscsibench");
+	len = addkey(text, len, "SessionType", "Normal");
+	len = addkey(text, len, "TargetName", target);
+	len = addkey(text, len, "AuthMethod", "None");
+	login_stage(s, ISCSI_LOGIN_STAGE_SECURITY,
+	    ISCSI_LOGIN_STAGE_NEGOTIATE, text, len);
+
+	snprintf(buf, sizeof(buf), "%u", maxlen);
+	len = addkey(text, 0, "HeaderDigest", "None");
+	len = addkey(text, len, "DataDigest", "None");
+	len = addkey(text, len, "ImmediateData", "Yes");
+	len = addkey(text, len, "InitialR2T", "No");
+	len = addkey(text, len, "MaxRecvDataSegmentLength", buf);
+	login_stage(s, ISCSI_LOGIN_STAGE_NEGOTIATE,
+	    ISCSI_LOGIN_STAGE_FULL_FEATURE, text, len);
+}
+
+static void
+send_cmd(int s, uint32_t tag, uint8_t *cdb, int write, void *data,
+    uint32_t len)
+{
+	iscsi_scsi_cmd_args_t cmd;
+	uint8_t header[ISCSI_HEADER_LEN];
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.final = 1;
+	cmd.input = !write && len != 0;
+	cmd.output = write;
+	cmd.tag = tag;
+	cmd.trans_len = len;
+	cmd.length = write ? len : 0;
+	cmd.CmdSN = CmdSN++;
+	cmd.ExpStatSN = ExpStatSN;
+	cmd.cdb = cdb;
+	if (iscsi_scsi_cmd_encap(header, &cmd) != 0)
+		errx(EXIT_FAILURE, "iscsi_scsi_cmd_encap failed");
+	if (iscsi_sock_send_header_and_data(s, header, ISCSI_HEADER_LEN,
+	    data, cmd.length, 0) != ISCSI_HEADER_LEN + (int)cmd.length)
+		errx(EXIT_FAILURE, "command send failed");
+}
+
+/*
+ * Read one PDU.  Returns the tag of the command it completes, or -1.
+ */
+static int
+recv_pdu(int s, void *buf, uint32_t buflen)
+{
+	iscsi_read_data_t data;
+	iscsi_scsi_rsp_t rsp;
+	uint8_t header[ISCSI_HEADER_LEN];
+
+	if (iscsi_sock_msg(s, 0, ISCSI_HEADER_LEN, header, 0) !=
+	    ISCSI_HEADER_LEN)
+		errx(EXIT_FAILURE, "receive failed");
+	switch (ISCSI_OPCODE(header)) {
+	case ISCSI_READ_DATA:
+		if (iscsi_read_data_decap(header, &data) != 0)
+			errx(EXIT_FAILURE, "iscsi_read_data_decap failed");
+		if (data.length > buflen ||
+		    iscsi_sock_msg(s, 0, data.length, buf, 0) !=
+		    (int)data.length)
+			errx(EXIT_FAILURE, "data receive failed");
+		if (!data.S_bit)
+			return -1;
+		if (data.status != 0)
+			errx(EXIT_FAILURE, "status %#x", data.status);
+		ExpStatSN = data.StatSN + 1;
+		MaxCmdSN = data.MaxCmdSN;
+		return (int)data.task_tag;
+	case ISCSI_SCSI_RSP:
+		if (iscsi_scsi_rsp_decap(header, &rsp) != 0)
+			errx(EXIT_FAILURE, "iscsi_scsi_rsp_decap failed");
+		if (rsp.length > buflen ||
+		    (rsp.length && iscsi_sock_msg(s, 0, rsp.length, buf, 0) !=
+		    (int)rsp.length))
+			errx(EXIT_FAILURE, "sense receive failed");
+		if (rsp.status != 0)
+			errx(EXIT_FAILURE, "status %#x", rsp.status);
+		ExpStatSN = rsp.StatSN + 1;
+		MaxCmdSN = rsp.MaxCmdSN;
+		return (int)rsp.tag;
+	default:
+		errx(EXIT_FAILURE, "unexpected opcode %#x",
+		    ISCSI_OPCODE(header));
+	}
+	/* NOTREACHED */
+	return -1;
+}
+
+static void
+read_capacity(int s, void *buf, uint32_t buflen)
+{
+	uint8_t cdb[16], *p = buf;
+
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = 0x25;		/* READ CAPACITY(10) */
+	send_cmd(s, 0, cdb, 0, NULL, 8);
+	while (recv_pdu(s, buf, buflen) != 0)
+		continue;
+	nblocks = (uint64_t)((p[0] << 24) | (p[1] << 16) | (p[2] << 8) |
+	    p[3]) + 1;
+	blocklen = (uint32_t)((p[4] << 24) | (p[5] << 16) | (p[6] << 8) |
+	    p[7]);
+}
+
+static void
+submit(int s, uint32_t tag, int wpct, uint32_t bytes, void *buf)
+{
+	uint8_t cdb[16];
+	uint32_t lba, n;
+	int write;
+
+	n = bytes / blocklen;
+	lba = (uint32_t)(arc4random_uniform((uint32_t)(nblocks / n)) * n);
+	write = (int)arc4random_uniform(100) < wpct;
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = write ? 0x2a : 0x28;	/* WRITE(10), READ(10) */
+	cdb[2] = (uint8_t)(lba >> 24);
+	cdb[3] = (uint8_t)(lba >> 16);
+	cdb[4] = (uint8_t)(lba >> 8);
+	cdb[5] = (uint8_t)lba;
+	cdb[7] = (uint8_t)(n >> 8);
+	cdb[8] = (uint8_t)n;
+	ios[tag].busy = 1;
+	ios[tag].write = write;
+	gettimeofday(&ios[tag].start, NULL);
+	send_cmd(s, tag, cdb, write, buf, bytes);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *host = "127.0.0.1", *port = "3260";
+	struct timeval start, end, now, d;
+	uint64_t nio[2], lat[2];
+	uint32_t bytes = 4096, tag;
+	unsigned secs = 10;
+	int depth = 8, wpct = 0, s, ch, inflight, t;
+	double el;
+	void *buf;
+
+	while ((ch = getopt(argc, argv, "b:d:h:p:t:T:w:")) != -1) {
+		switch (ch) {
+		case 'b':
+			bytes = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 't':
+			secs = (unsigned)atoi(optarg);
+			break;
+		case 'T':
+			target = optarg;
+			break;
+		case 'w':
+			wpct = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (depth < 1 || depth > MAXDEPTH || bytes == 0 || secs == 0)
+		usage();
+	if ((buf = calloc(1, bytes)) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	s = connect_to(host, port);
+	login(s, bytes);
+	read_capacity(s, buf, bytes);
+	if (bytes % blocklen != 0 || nblocks < bytes / blocklen)
+		errx(EXIT_FAILURE, "bad transfer size %u for %" PRIu64
+		    " blocks of %u bytes", bytes, nblocks, blocklen);
+
+	memset(nio, 0, sizeof(nio));
+	memset(lat, 0, sizeof(lat));
+	gettimeofday(&start, NULL);
+	end = start;
+	end.tv_sec += secs;
+	inflight = 0;
+	for (now = start;;) {
+		/* Fill the queue, as far as the target's window allows */
+		for (tag = 1; tag <= (uint32_t)depth; tag++) {
+			if (ios[tag].busy || !timercmp(&now, &end, <) ||
+			    !sn_le(CmdSN, MaxCmdSN))
+				continue;
+			submit(s, tag, wpct, bytes, buf);
+			inflight++;
+		}
+		if (inflight == 0)
+			break;
+		if ((t = recv_pdu(s, buf, bytes)) == -1)
+			continue;
+		if (t < 1 || t > depth || !ios[t].busy)
+			errx(EXIT_FAILURE, "unexpected tag %d", t);
+		gettimeofday(&now, NULL);
+		timersub(&now, &ios[t].start, &d);
+		lat[ios[t].write] += (uint64_t)d.tv_sec * 1000000 +
+		    (uint64_t)d.tv_usec;
+		nio[ios[t].write]++;
+		ios[t].busy = 0;
+		inflight--;
+	}
+	timersub(&now, &start, &d);
+	el = (double)d.tv_sec + (double)d.tv_usec / 1e6;
+
+	printf("%u byte I/O, depth %d, %d%% writes, %.1f seconds\n",
+	    bytes, depth, wpct, el);
+	printf("read:  %10.0f IOPS %8.2f MB/s avg latency %8.1f us\n",
+	    (double)nio[0] / el, (double)nio[0] * bytes / el / 1e6,
+	    nio[0] ? (double)lat[0] / (double)nio[0] : 0.0);
+	printf("write: %10.0f IOPS %8.2f MB/s avg latency %8.1f us\n",
+	    (double)nio[1] / el, (double)nio[1] * bytes / el / 1e6,
+	    nio[1] ? (double)lat[1] / (double)nio[1] : 0.0);
+	close(s);
+	return EXIT_SUCCESS;
+}
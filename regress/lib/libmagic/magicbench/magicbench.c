@@ -0,0 +1,197 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure how long libmagic(3) takes to classify a corpus of files.
+ *
+ * Read up to a given number of regular files found under the given
+ * directories (by default a mix of binaries, libraries, scripts and
+ * data from /usr) into memory, so that file system access does not
+ * skew the result, then classify all of them with magic_buffer(3) a
+ * number of times and report the time per file.  With -v the results
+ * are printed, so that they can be compared between libraries.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <magic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct sample {
+	char *path;
+	void *data;
+	size_t len;
+};
+
+static char *defdirs[] = {
+	"/usr/bin", "/usr/lib", "/usr/libexec", "/usr/sbin", "/usr/share",
+	NULL
+};
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-ikv] [-b maxbytes] [-m magicfile] "
+	    "[-n count] [-r rounds] [dir ...]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static int
+readsample(struct sample *s, const char *path, size_t maxbytes)
+{
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_NOFOLLOW)) == -1)
+		return -1;
+	if ((s->data = malloc(maxbytes)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	n = read(fd, s->data, maxbytes);
+	close(fd);
+	if (n <= 0) {
+		free(s->data);
+		return -1;
+	}
+	s->len = (size_t)n;
+	if ((s->path = strdup(path)) == NULL)
+		err(EXIT_FAILURE, "strdup");
+	return 0;
+}
+
+static size_t
+load(struct sample *samples, size_t count, char **dirs, size_t maxbytes)
+{
+	FTS *fts;
+	FTSENT *e;
+	size_t n = 0;
+
+	if ((fts = fts_open(dirs, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+		err(EXIT_FAILURE, "fts_open");
+	while (n < count && (e = fts_read(fts)) != NULL) {
+		if (e->fts_info != FTS_F || e->fts_statp->st_size == 0)
+			continue;
+		if (readsample(&samples[n], e->fts_path, maxbytes) == 0)
+			n++;
+	}
+	fts_close(fts);
+	return n;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct timespec start, end;
+	struct sample *samples;
+	const char *magicfile = NULL, *res;
+	size_t count = 5000, maxbytes = 256 * 1024, n, i;
+	unsigned rounds = 3, r;
+	int flags = MAGIC_NONE, verbose = 0, ch;
+	magic_t ms;
+	double el;
+
+	while ((ch = getopt(argc, argv, "b:ikm:n:r:v")) != -1) {
+		switch (ch) {
+		case 'b':
+			maxbytes = (size_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			flags |= MAGIC_MIME;
+			break;
+		case 'k':
+			flags |= MAGIC_CONTINUE;
+			break;
+		case 'm':
+			magicfile = optarg;
+			break;
+		case 'n':
+			count = (size_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = (unsigned)atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (count == 0 || rounds == 0 || maxbytes == 0)
+		usage();
+
+	if ((ms = magic_open(flags)) == NULL)
+		err(EXIT_FAILURE, "magic_open");
+	if (magic_load(ms, magicfile) == -1)
+		errx(EXIT_FAILURE, "%s", magic_error(ms));
+
+	if ((samples = calloc(count, sizeof(*samples))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	n = load(samples, count, argc ? argv : defdirs, maxbytes);
+	if (n == 0)
+		errx(EXIT_FAILURE, "no files found");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n; i++) {
+			res = magic_buffer(ms, samples[i].data,
+			    samples[i].len);
+			if (res == NULL)
+				errx(EXIT_FAILURE, "%s: %s", samples[i].path,
+				    magic_error(ms));
+			if (verbose && r == 0)
+				printf("%s: %s\n", samples[i].path, res);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	el = (double)(end.tv_sec - start.tv_sec) +
+	    (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%zu files, %u rounds: %.1f us per file, %.2f s total\n",
+	    n, rounds, el * 1e6 / ((double)n * rounds), el);
+
+	for (i = 0; i < n; i++) {
+		free(samples[i].path);
+		free(samples[i].data);
+	}
+	free(samples);
+	magic_close(ms);
+	return EXIT_SUCCESS;
+}
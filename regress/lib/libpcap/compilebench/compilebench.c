@@ -0,0 +1,162 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure how long pcap_compile(3) takes on large filters.
+ *
+ * Generate a filter that matches any of a given number of random
+ * hosts or ports, the way tools that build filters from lists of
+ * addresses do, compile it a number of times, and report the time
+ * per compile and the size of the resulting program.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <err.h>
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const struct {
+	const char *name;
+	const char *prefix;	/* text before the list */
+	const char *prim;	/* primitive for each value */
+	int port;		/* values are ports, not hosts */
+	const char *suffix;
+} kinds[] = {
+	{ "host",	"",		"host",		0,	"" },
+	{ "port",	"",		"port",		1,	"" },
+	{ "srchost",	"ip and (",	"src host",	0,	")" },
+	{ "dstport",	"tcp and (",	"dst port",	1,	")" },
+};
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-O] [-n count] [-r rounds] "
+	    "[-t host|port|srchost|dstport]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static char *
+mkfilter(size_t k, unsigned n)
+{
+	char *buf;
+	size_t len, off;
+	unsigned i;
+	long v;
+
+	len = strlen(kinds[k].prefix) + strlen(kinds[k].suffix) +
+	    (size_t)n * (strlen(kinds[k].prim) + 24) + 1;
+	if ((buf = malloc(len)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	off = (size_t)snprintf(buf, len, "%s", kinds[k].prefix);
+	for (i = 0; i < n; i++) {
+		v = random();
+		if (kinds[k].port)
+			off += (size_t)snprintf(buf + off, len - off,
+			    "%s%s %ld", i ? " or " : "", kinds[k].prim,
+			    v % 65535 + 1);
+		else
+			off += (size_t)snprintf(buf + off, len - off,
+			    "%s%s 10.%ld.%ld.%ld", i ? " or " : "",
+			    kinds[k].prim, (v >> 16) & 0xff, (v >> 8) & 0xff,
+			    v & 0xff);
+	}
+	snprintf(buf + off, len - off, "%s", kinds[k].suffix);
+	return buf;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bpf_program prog;
+	struct timespec start, end;
+	unsigned n = 1000, rounds = 5, r;
+	int optimize = 1, ch;
+	size_t k = 0;
+	pcap_t *p;
+	char *filter;
+	double el;
+
+	while ((ch = getopt(argc, argv, "On:r:t:")) != -1) {
+		switch (ch) {
+		case 'O':
+			optimize = 0;
+			break;
+		case 'n':
+			n = (unsigned)atoi(optarg);
+			break;
+		case 'r':
+			rounds = (unsigned)atoi(optarg);
+			break;
+		case 't':
+			for (k = 0; k < __arraycount(kinds); k++)
+				if (strcmp(optarg, kinds[k].name) == 0)
+					break;
+			if (k == __arraycount(kinds))
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (n == 0 || rounds == 0)
+		usage();
+
+	srandom(1);
+	filter = mkfilter(k, n);
+	if ((p = pcap_open_dead(DLT_EN10MB, 65535)) == NULL)
+		errx(EXIT_FAILURE, "pcap_open_dead failed");
+
+	memset(&prog, 0, sizeof(prog));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < rounds; r++) {
+		pcap_freecode(&prog);
+		if (pcap_compile(p, &prog, filter, optimize,
+		    PCAP_NETMASK_UNKNOWN) == -1)
+			errx(EXIT_FAILURE, "%s", pcap_geterr(p));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	el = (double)(end.tv_sec - start.tv_sec) +
+	    (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("%u %s, %soptimized: %.2f ms per compile, %u instructions\n",
+	    n, kinds[k].name, optimize ? "" : "not ", el * 1e3 / rounds,
+	    prog.bf_len);
+
+	pcap_freecode(&prog);
+	pcap_close(p);
+	free(filter);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,369 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure how fuse_loop_mt() scales with concurrent requests.
+ *
+ * Mount a synthetic file system whose read operation sleeps for a
+ * fixed time, as if it were waiting for a remote server, then let a
+ * number of threads pread(2) its only file for a fixed time and
+ * report the rate at which the reads complete.  With -s the file
+ * system is served by the single-threaded fuse_loop() instead, which
+ * gives the baseline to compare against.
+ *
+ * With -p the file system instead passes the file through to an
+ * existing regular file, using read_buf and write_buf so that data
+ * never goes through a buffer of the file system's own, and -w makes
+ * the threads pwrite(2) rather than pread(2).
+ */
+
+#define FUSE_USE_VERSION	32
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define	FILENAME	"file"
+#define	FILESIZE	(1024 * 1024)
+#define	MAXTHREADS	256
+
+static useconds_t	 latency = 1000;
+static size_t		 iosize = 4096;
+static off_t		 filesize = FILESIZE;
+static int		 backing_fd = -1;
+static int		 writing;
+static volatile int	 done;
+static char		 path[PATH_MAX];
+
+static int
+bench_getattr(const char *p, struct stat *st, struct fuse_file_info *fi)
+{
+
+	memset(st, 0, sizeof(*st));
+	if (strcmp(p, "/") == 0) {
+		st->st_mode = S_IFDIR | 0755;
+		st->st_nlink = 2;
+	} else if (strcmp(p, "/" FILENAME) == 0) {
+		st->st_mode = S_IFREG | (backing_fd == -1 ? 0444 : 0644);
+		st->st_nlink = 1;
+		st->st_size = filesize;
+	} else
+		return -ENOENT;
+	return 0;
+}
+
+static int
+bench_open(const char *p, struct fuse_file_info *fi)
+{
+
+	if (strcmp(p, "/" FILENAME) != 0)
+		return -ENOENT;
+	if (backing_fd == -1 && (fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EACCES;
+	return 0;
+}
+
+static int
+bench_read(const char *p, char *buf, size_t size, off_t off,
+    struct fuse_file_info *fi)
+{
+
+	if (off >= FILESIZE)
+		return 0;
+	if (size > (size_t)(FILESIZE - off))
+		size = FILESIZE - off;
+	usleep(latency);
+	memset(buf, 'x', size);
+	return (int)size;
+}
+
+static int
+bench_readdir(const char *p, void *buf, fuse_fill_dir_t filler, off_t off,
+    struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+
+	if (strcmp(p, "/") != 0)
+		return -ENOENT;
+	filler(buf, ".", NULL, 0, 0);
+	filler(buf, "..", NULL, 0, 0);
+	filler(buf, FILENAME, NULL, 0, 0);
+	return 0;
+}
+
+static int
+pass_read_buf(const char *p, struct fuse_bufvec **bufp, size_t size,
+    off_t off, struct fuse_file_info *fi)
+{
+	struct fuse_bufvec *bufv;
+
+	/* Hand out the backing file itself rather than its contents. */
+	if ((bufv = malloc(sizeof(*bufv))) == NULL)
+		return -ENOMEM;
+	*bufv = FUSE_BUFVEC_INIT(size);
+	bufv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	bufv->buf[0].fd = backing_fd;
+	bufv->buf[0].pos = off;
+	*bufp = bufv;
+	return 0;
+}
+
+static int
+pass_write_buf(const char *p, struct fuse_bufvec *bufv, off_t off,
+    struct fuse_file_info *fi)
+{
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(bufv));
+	ssize_t n;
+
+	dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+	dst.buf[0].fd = backing_fd;
+	dst.buf[0].pos = off;
+	if ((n = fuse_buf_copy(&dst, bufv, 0)) < 0)
+		return -errno;
+	return (int)n;
+}
+
+static struct fuse_operations bench_ops = {
+	.getattr	= bench_getattr,
+	.open		= bench_open,
+	.read		= bench_read,
+	.readdir	= bench_readdir,
+};
+
+static int
+serve(const char *mnt, int single, unsigned int max_idle)
+{
+	char *argv[] = { __UNCONST(getprogname()), NULL };
+	struct fuse_args args = FUSE_ARGS_INIT(1, argv);
+	struct fuse_loop_config config;
+	struct fuse *fuse;
+	int rv;
+
+	fuse = fuse_new(&args, &bench_ops, sizeof(bench_ops), NULL);
+	if (fuse == NULL)
+		errx(EXIT_FAILURE, "fuse_new failed");
+	if (fuse_mount(fuse, mnt) != 0)
+		errx(EXIT_FAILURE, "fuse_mount %s failed", mnt);
+	if (fuse_set_signal_handlers(fuse_get_session(fuse)) != 0)
+		errx(EXIT_FAILURE, "fuse_set_signal_handlers failed");
+
+	if (single)
+		rv = fuse_loop(fuse);
+	else {
+		memset(&config, 0, sizeof(config));
+		config.clone_fd = 0;
+		config.max_idle_threads = max_idle;
+		rv = fuse_loop_mt(fuse, &config);
+	}
+
+	fuse_remove_signal_handlers(fuse_get_session(fuse));
+	fuse_unmount(fuse);
+	fuse_destroy(fuse);
+	return rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void *
+client(void *arg)
+{
+	unsigned long *nops = arg;
+	char *buf;
+	off_t off;
+	int fd;
+
+	if ((buf = malloc(iosize)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	memset(buf, 'y', iosize);
+	if ((fd = open(path, writing ? O_WRONLY : O_RDONLY)) == -1)
+		err(EXIT_FAILURE, "open %s", path);
+
+	/* Spread the threads over the file. */
+	off = (off_t)(random() % (filesize / (off_t)iosize)) * (off_t)iosize;
+	while (!done) {
+		if (writing) {
+			if (pwrite(fd, buf, iosize, off) != (ssize_t)iosize)
+				err(EXIT_FAILURE, "pwrite");
+		} else {
+			if (pread(fd, buf, iosize, off) != (ssize_t)iosize)
+				err(EXIT_FAILURE, "pread");
+		}
+		(*nops)++;
+		off += (off_t)iosize;
+		if (off + (off_t)iosize > filesize)
+			off = 0;
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-sw] [-b iosize] [-i max_idle_threads] "
+	    "[-l latency_us] [-p file] [-T seconds] [-t threads] "
+	    "mountpoint\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t tids[MAXTHREADS];
+	unsigned long nops[MAXTHREADS], total;
+	struct timeval start, end;
+	struct stat st;
+	unsigned int max_idle = 10;
+	int ch, i, nthreads = 16, seconds = 5, single = 0, status;
+	const char *backing = NULL;
+	double elapsed;
+	pid_t pid;
+
+	while ((ch = getopt(argc, argv, "b:i:l:p:sT:t:w")) != -1) {
+		switch (ch) {
+		case 'b':
+			iosize = (size_t)strtoul(optarg, NULL, 0);
+			if (iosize == 0 || iosize > FILESIZE)
+				usage();
+			break;
+		case 'i':
+			max_idle = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency = (useconds_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			backing = optarg;
+			break;
+		case 's':
+			single = 1;
+			break;
+		case 'T':
+			seconds = atoi(optarg);
+			if (seconds <= 0)
+				usage();
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			if (nthreads <= 0 || nthreads > MAXTHREADS)
+				usage();
+			break;
+		case 'w':
+			writing = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || (writing && backing == NULL))
+		usage();
+
+	if (backing != NULL) {
+		if ((backing_fd = open(backing, O_RDWR)) == -1)
+			err(EXIT_FAILURE, "open %s", backing);
+		if (fstat(backing_fd, &st) == -1)
+			err(EXIT_FAILURE, "fstat %s", backing);
+		if (!S_ISREG(st.st_mode) || st.st_size < (off_t)iosize)
+			errx(EXIT_FAILURE, "%s: not a regular file of at "
+			    "least %zu bytes", backing, iosize);
+		filesize = st.st_size;
+		bench_ops.read_buf = pass_read_buf;
+		bench_ops.write_buf = pass_write_buf;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", argv[0], FILENAME);
+
+	if ((pid = fork()) == -1)
+		err(EXIT_FAILURE, "fork");
+	if (pid == 0)
+		_exit(serve(argv[0], single, max_idle));
+
+	/* Wait for the file system to appear. */
+	for (i = 0; stat(path, &st) == -1; i++) {
+		if (i == 100 || waitpid(pid, &status, WNOHANG) != 0) {
+			kill(pid, SIGTERM);
+			errx(EXIT_FAILURE, "%s did not show up", path);
+		}
+		usleep(100000);
+	}
+
+	memset(nops, 0, sizeof(nops));
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if ((errno = pthread_create(&tids[i], NULL, client,
+		    &nops[i])) != 0)
+			err(EXIT_FAILURE, "pthread_create");
+	}
+	sleep((unsigned int)seconds);
+	done = 1;
+	total = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tids[i], NULL);
+		total += nops[i];
+	}
+	gettimeofday(&end, NULL);
+
+	kill(pid, SIGTERM);
+	if (waitpid(pid, &status, 0) == -1)
+		err(EXIT_FAILURE, "waitpid");
+
+	timersub(&end, &start, &end);
+	elapsed = end.tv_sec + end.tv_usec / 1e6;
+	if (backing != NULL)
+		printf("%s, %d threads, passthrough, %zu byte %s: "
+		    "%lu ops in %.2f s, %.0f ops/s, %.1f MB/s\n",
+		    single ? "fuse_loop" : "fuse_loop_mt", nthreads, iosize,
+		    writing ? "writes" : "reads", total, elapsed,
+		    total / elapsed, total * iosize / elapsed / 1e6);
+	else
+		printf("%s, %d threads, %u us latency, %zu byte reads: "
+		    "%lu ops in %.2f s, %.0f ops/s\n",
+		    single ? "fuse_loop" : "fuse_loop_mt", nthreads,
+		    (unsigned int)latency, iosize, total, elapsed,
+		    total / elapsed);
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ?
+	    EXIT_SUCCESS : EXIT_FAILURE;
+}
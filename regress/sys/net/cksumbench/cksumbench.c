@@ -0,0 +1,261 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check and time the implementations of cpu_in_cksum().
+ *
+ * sys/netinet/cpu_in_cksum.c is built into this program as is.  With
+ * -c, checksum random mbuf chains, with random offsets, lengths and
+ * alignments, with every implementation the CPU supports and compare
+ * them with a byte-at-a-time reference, as well as cpu_in_cksum_copy()
+ * and the copy it makes.  Otherwise report the throughput of each
+ * implementation for a range of buffer sizes.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/param.h>
+#include <sys/mbuf.h>
+#include <sys/time.h>
+
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int		cpu_in_cksum(struct mbuf *, int, int, uint32_t);
+uint32_t	cpu_in_cksum_copy(const void *, void *, size_t, uint32_t);
+const char *	cpu_in_cksum_select(const char *);
+
+static const char *const impls[] = { "portable", "sse2", "avx2", "neon" };
+
+#define MAXLEN		65536
+#define MAXCHAIN	8
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-c] [-n iterations] [-s seed]\n",
+	    getprogname());
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * RFC 1071, one byte at a time, plus initial, not inverted.  The
+ * result is in host byte order, as the kernel would store it.
+ */
+static uint16_t
+ref_cksum(const uint8_t *p, size_t len, uint32_t initial)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sum += (i & 1) ? p[i] : (uint32_t)p[i] << 8;
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+	sum = htons((uint16_t)sum);
+	sum += (initial >> 16) + (initial & 0xffff);
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+	return sum;
+}
+
+static void
+fill(uint8_t *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = (uint8_t)random();
+}
+
+/*
+ * Split len bytes of buf into a chain of up to MAXCHAIN mbufs, each of
+ * them with its data at a random misalignment in a buffer of its own.
+ */
+static struct mbuf *
+mkchain(const uint8_t *buf, size_t len, struct mbuf *mv, uint8_t **bufs)
+{
+	size_t left = len, mlen;
+	unsigned i, n = 1 + (unsigned)random() % MAXCHAIN;
+
+	for (i = 0; i < n; i++) {
+		mlen = (i == n - 1) ? left : (size_t)random() % (left + 1);
+		mv[i].m_next = (i == n - 1) ? NULL : &mv[i + 1];
+		mv[i].m_data = (char *)bufs[i] + random() % 16;
+		mv[i].m_len = (int)mlen;
+		memcpy(mv[i].m_data, buf, mlen);
+		buf += mlen;
+		left -= mlen;
+	}
+	return &mv[0];
+}
+
+static int
+check(unsigned iterations)
+{
+	struct mbuf mv[MAXCHAIN];
+	uint8_t *buf, *copy, *bufs[MAXCHAIN];
+	unsigned i, j, k, failed = 0;
+	uint32_t initial;
+	size_t len, off, end;
+	uint16_t ref;
+	int sum;
+
+	if ((buf = malloc(MAXLEN)) == NULL ||
+	    (copy = malloc(MAXLEN + 16)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	for (i = 0; i < MAXCHAIN; i++)
+		if ((bufs[i] = malloc(MAXLEN + 16)) == NULL)
+			err(EXIT_FAILURE, "malloc");
+
+	for (i = 0; i < iterations; i++) {
+		/* Favour the sizes around the vector thresholds. */
+		len = (size_t)random() % ((i & 1) ? 2048 : MAXLEN);
+		off = len ? (size_t)random() % len : 0;
+		end = off + (size_t)random() % (len - off + 1);
+		initial = (uint32_t)random();
+		fill(buf, len);
+		mkchain(buf, len, mv, bufs);
+		ref = ref_cksum(buf + off, end - off, initial);
+
+		for (j = 0; j < __arraycount(impls); j++) {
+			if (cpu_in_cksum_select(impls[j]) == NULL)
+				continue;
+			sum = cpu_in_cksum(mv, (int)(end - off), (int)off,
+			    initial);
+			if ((uint16_t)~sum != ref) {
+				printf("%s: len %zu off %zu end %zu: "
+				    "0x%04x != 0x%04x\n", impls[j], len, off,
+				    end, (uint16_t)~sum, ref);
+				failed++;
+			}
+
+			k = (unsigned)random() % 16;
+			sum = (int)cpu_in_cksum_copy(buf + off, copy + k,
+			    end - off, 0);
+			if ((uint16_t)sum != ref_cksum(buf + off, end - off, 0) ||
+			    memcmp(buf + off, copy + k, end - off) != 0) {
+				printf("%s: copy of %zu bytes failed\n",
+				    impls[j], end - off);
+				failed++;
+			}
+		}
+	}
+
+	for (i = 0; i < MAXCHAIN; i++)
+		free(bufs[i]);
+	free(copy);
+	free(buf);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void
+bench(unsigned iterations)
+{
+	static const size_t sizes[] = { 64, 576, 1500, 9000, MAXLEN };
+	struct mbuf m;
+	struct timeval start, end;
+	uint8_t *buf;
+	unsigned i, j, k;
+	double elapsed;
+	volatile int sink;
+
+	if ((buf = malloc(MAXLEN)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	fill(buf, MAXLEN);
+	memset(&m, 0, sizeof(m));
+	m.m_data = (char *)buf;
+
+	printf("%-10s", "bytes");
+	for (j = 0; j < __arraycount(impls); j++)
+		if (cpu_in_cksum_select(impls[j]) != NULL)
+			printf("%12s", impls[j]);
+	printf("  (MB/s)\n");
+
+	for (k = 0; k < __arraycount(sizes); k++) {
+		m.m_len = (int)sizes[k];
+		printf("%-10zu", sizes[k]);
+		for (j = 0; j < __arraycount(impls); j++) {
+			if (cpu_in_cksum_select(impls[j]) == NULL)
+				continue;
+			gettimeofday(&start, NULL);
+			for (i = 0; i < iterations; i++)
+				sink = cpu_in_cksum(&m, m.m_len, 0, 0);
+			gettimeofday(&end, NULL);
+			timersub(&end, &start, &end);
+			elapsed = end.tv_sec + end.tv_usec / 1e6;
+			printf("%12.0f", (double)sizes[k] * iterations /
+			    elapsed / 1e6);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+	(void)sink;
+	free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned iterations = 0, seed = 1;
+	bool docheck = false;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "cn:s:")) != -1) {
+		switch (ch) {
+		case 'c':
+			docheck = true;
+			break;
+		case 'n':
+			iterations = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	srandom(seed);
+	if (docheck)
+		return check(iterations ? iterations : 10000);
+	bench(iterations ? iterations : 100000);
+	return EXIT_SUCCESS;
+}
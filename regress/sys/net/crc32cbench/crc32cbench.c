@@ -0,0 +1,200 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check and time the CRC32C implementations used for SCTP checksums.
+ *
+ * sys/netinet/sctp_crc32.c is built into this program as is.  With -c,
+ * run every implementation the CPU supports over random buffers, at
+ * random alignments, and compare the result with the original table
+ * lookup a byte at a time; also check sctp_crc32c_combine() on random
+ * splits.  Otherwise report the throughput of each implementation for
+ * a range of buffer sizes.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/time.h>
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void		sctp_crc32_init(void);
+const char *	sctp_crc32c_select(const char *);
+uint32_t	sctp_crc32c_combine(uint32_t, uint32_t, size_t);
+uint32_t	update_crc32(uint32_t, unsigned char *, unsigned int);
+
+static const char *const impls[] = { "byte", "sb8", "sse4.2", "armv8" };
+
+#define MAXLEN		65536
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-c] [-n iterations] [-s seed]\n",
+	    getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+fill(uint8_t *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = (uint8_t)random();
+}
+
+static int
+check(unsigned iterations)
+{
+	uint8_t *buf;
+	unsigned i, j, failed = 0;
+	size_t len, off, split;
+	uint32_t ref, crc, crc1, crc2;
+
+	if ((buf = malloc(MAXLEN + 16)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	for (i = 0; i < iterations; i++) {
+		/* Favour the sizes around the interleaving threshold. */
+		len = (size_t)random() % ((i & 1) ? 2048 : MAXLEN);
+		off = (size_t)random() % 16;
+		fill(buf + off, len);
+
+		sctp_crc32c_select("byte");
+		ref = update_crc32(0xffffffff, buf + off, len);
+
+		for (j = 0; j < __arraycount(impls); j++) {
+			if (sctp_crc32c_select(impls[j]) == NULL)
+				continue;
+			crc = update_crc32(0xffffffff, buf + off, len);
+			if (crc != ref) {
+				printf("%s: len %zu off %zu: "
+				    "0x%08x != 0x%08x\n", impls[j], len, off,
+				    crc, ref);
+				failed++;
+			}
+		}
+
+		split = len ? (size_t)random() % len : 0;
+		crc1 = update_crc32(0xffffffff, buf + off, split);
+		crc2 = update_crc32(0, buf + off + split, len - split);
+		crc = sctp_crc32c_combine(crc1, crc2, len - split);
+		if (crc != ref) {
+			printf("combine: len %zu split %zu: "
+			    "0x%08x != 0x%08x\n", len, split, crc, ref);
+			failed++;
+		}
+	}
+
+	free(buf);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void
+bench(unsigned iterations)
+{
+	static const size_t sizes[] = { 64, 576, 1500, 9000, MAXLEN };
+	struct timeval start, end;
+	uint8_t *buf;
+	unsigned i, j, k;
+	double elapsed;
+	volatile uint32_t sink;
+
+	if ((buf = malloc(MAXLEN)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	fill(buf, MAXLEN);
+
+	printf("%-10s", "bytes");
+	for (j = 0; j < __arraycount(impls); j++)
+		if (sctp_crc32c_select(impls[j]) != NULL)
+			printf("%12s", impls[j]);
+	printf("  (MB/s)\n");
+
+	for (k = 0; k < __arraycount(sizes); k++) {
+		printf("%-10zu", sizes[k]);
+		for (j = 0; j < __arraycount(impls); j++) {
+			if (sctp_crc32c_select(impls[j]) == NULL)
+				continue;
+			gettimeofday(&start, NULL);
+			for (i = 0; i < iterations; i++)
+				sink = update_crc32(0xffffffff, buf,
+				    (unsigned)sizes[k]);
+			gettimeofday(&end, NULL);
+			timersub(&end, &start, &end);
+			elapsed = end.tv_sec + end.tv_usec / 1e6;
+			printf("%12.0f", (double)sizes[k] * iterations /
+			    elapsed / 1e6);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+	(void)sink;
+	free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned iterations = 0, seed = 1;
+	bool docheck = false;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "cn:s:")) != -1) {
+		switch (ch) {
+		case 'c':
+			docheck = true;
+			break;
+		case 'n':
+			iterations = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	srandom(seed);
+	sctp_crc32_init();
+	if (docheck)
+		return check(iterations ? iterations : 10000);
+	bench(iterations ? iterations : 20000);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure the packet rate of l2tp(4) with many sessions.
+ *
+ * Add the given number of peer addresses to lo0 and create the given
+ * number of l2tp interfaces spread over them, each tunnelled from its
+ * peer address to itself with equal local and remote session IDs, so
+ * that every frame sent on a session comes back in on it through the
+ * L2TPv3 input path.  Write frames to each session in turn through
+ * bpf(4), and report frames per second and how many the sessions took
+ * in.  With -c, the sessions use 64bit cookies.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/sockio.h>
+#include <sys/time.h>
+
+#include <net/bpf.h>
+#include <net/if.h>
+#include <net/if_ether.h>
+#include <net/if_l2tp.h>
+#include <netinet/in.h>
+#include <netinet/in_var.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FRAMELEN	64
+#define L2TP_BASE	4096	/* first l2tp unit number we create */
+#define PEER_NET	0x0afe0000	/* 10.254.0.0/16 for the peers */
+
+static volatile sig_atomic_t done;
+static unsigned nsessions = 4000, npeers = 64;
+static bool cookies;
+static int sock;
+static unsigned created, peers_added;
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-c] [-n sessions] [-p peers] "
+	    "[-t seconds]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+alarmed(int sig)
+{
+
+	done = 1;
+}
+
+static void
+l2tpname(char *buf, unsigned i)
+{
+
+	snprintf(buf, IFNAMSIZ, "l2tp%u", L2TP_BASE + i);
+}
+
+static void
+peeraddr(struct sockaddr_in *sin, unsigned p)
+{
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(PEER_NET + 1 + p);
+}
+
+static void
+setflags(const char *name, int set)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, name, sizeof(ifr.ifr_name));
+	if (ioctl(sock, SIOCGIFFLAGS, &ifr) == -1)
+		err(EXIT_FAILURE, "SIOCGIFFLAGS %s", name);
+	ifr.ifr_flags |= set;
+	if (ioctl(sock, SIOCSIFFLAGS, &ifr) == -1)
+		err(EXIT_FAILURE, "SIOCSIFFLAGS %s", name);
+}
+
+static void
+destroy(void)
+{
+	struct in_aliasreq ifra;
+	struct ifreq ifr;
+	unsigned i;
+
+	for (i = 0; i < created; i++) {
+		memset(&ifr, 0, sizeof(ifr));
+		l2tpname(ifr.ifr_name, i);
+		(void)ioctl(sock, SIOCIFDESTROY, &ifr);
+	}
+	for (i = 0; i < peers_added; i++) {
+		memset(&ifra, 0, sizeof(ifra));
+		strlcpy(ifra.ifra_name, "lo0", sizeof(ifra.ifra_name));
+		peeraddr(&ifra.ifra_addr, i);
+		(void)ioctl(sock, SIOCDIFADDR, &ifra);
+	}
+}
+
+static void
+create(void)
+{
+	struct in_aliasreq ifra;
+	struct if_laddrreq iflr;
+	struct l2tp_req l2tpr;
+	struct ifreq ifr;
+	unsigned i;
+
+	atexit(destroy);
+	for (i = 0; i < npeers; i++) {
+		memset(&ifra, 0, sizeof(ifra));
+		strlcpy(ifra.ifra_name, "lo0", sizeof(ifra.ifra_name));
+		peeraddr(&ifra.ifra_addr, i);
+		ifra.ifra_mask.sin_len = sizeof(ifra.ifra_mask);
+		ifra.ifra_mask.sin_family = AF_INET;
+		ifra.ifra_mask.sin_addr.s_addr = htonl(0xffffffff);
+		if (ioctl(sock, SIOCAIFADDR, &ifra) == -1)
+			err(EXIT_FAILURE, "SIOCAIFADDR lo0");
+		peers_added++;
+	}
+
+	for (i = 0; i < nsessions; i++) {
+		memset(&ifr, 0, sizeof(ifr));
+		l2tpname(ifr.ifr_name, i);
+		if (ioctl(sock, SIOCIFCREATE, &ifr) == -1)
+			err(EXIT_FAILURE, "SIOCIFCREATE %s", ifr.ifr_name);
+		created++;
+
+		memset(&iflr, 0, sizeof(iflr));
+		strlcpy(iflr.iflr_name, ifr.ifr_name, sizeof(iflr.iflr_name));
+		peeraddr((struct sockaddr_in *)&iflr.addr, i % npeers);
+		peeraddr((struct sockaddr_in *)&iflr.dstaddr, i % npeers);
+		if (ioctl(sock, SIOCSLIFPHYADDR, &iflr) == -1)
+			err(EXIT_FAILURE, "SIOCSLIFPHYADDR %s", ifr.ifr_name);
+
+		memset(&l2tpr, 0, sizeof(l2tpr));
+		l2tpr.my_sess_id = l2tpr.peer_sess_id = i + 1;
+		ifr.ifr_data = &l2tpr;
+		if (ioctl(sock, SIOCSL2TPSESSION, &ifr) == -1)
+			err(EXIT_FAILURE, "SIOCSL2TPSESSION %s", ifr.ifr_name);
+		if (cookies) {
+			l2tpr.my_cookie = l2tpr.peer_cookie =
+			    0x0123456789abcdefULL + i;
+			l2tpr.my_cookie_len = l2tpr.peer_cookie_len = 8;
+			if (ioctl(sock, SIOCSL2TPCOOKIE, &ifr) == -1)
+				err(EXIT_FAILURE, "SIOCSL2TPCOOKIE %s",
+				    ifr.ifr_name);
+		}
+		l2tpr.state = L2TP_STATE_UP;
+		if (ioctl(sock, SIOCSL2TPSTATE, &ifr) == -1)
+			err(EXIT_FAILURE, "SIOCSL2TPSTATE %s", ifr.ifr_name);
+		setflags(ifr.ifr_name, IFF_UP);
+	}
+}
+
+/* Sum the input packet counters of our sessions. */
+static unsigned long
+l2tp_ipackets(void)
+{
+	struct ifaddrs *ifap, *ifa;
+	const struct if_data *ifd;
+	unsigned long n = 0;
+	unsigned unit;
+
+	if (getifaddrs(&ifap) == -1)
+		err(EXIT_FAILURE, "getifaddrs");
+	for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr == NULL ||
+		    ifa->ifa_addr->sa_family != AF_LINK ||
+		    ifa->ifa_data == NULL)
+			continue;
+		if (sscanf(ifa->ifa_name, "l2tp%u", &unit) != 1 ||
+		    unit < L2TP_BASE || unit >= L2TP_BASE + nsessions)
+			continue;
+		ifd = ifa->ifa_data;
+		n += ifd->ifi_ipackets;
+	}
+	freeifaddrs(ifap);
+	return n;
+}
+
+/* Write broadcast frames to each session in turn through bpf(4). */
+static unsigned long
+sender(void)
+{
+	struct rlimit rl;
+	struct ifreq ifr;
+	struct ether_header *eh;
+	char frame[FRAMELEN];
+	int *bpf;
+	unsigned long n = 0;
+	unsigned i;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(EXIT_FAILURE, "getrlimit");
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(EXIT_FAILURE, "setrlimit");
+
+	if ((bpf = calloc(nsessions, sizeof(*bpf))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < nsessions; i++) {
+		if ((bpf[i] = open("/dev/bpf", O_WRONLY)) == -1)
+			err(EXIT_FAILURE, "/dev/bpf");
+		memset(&ifr, 0, sizeof(ifr));
+		l2tpname(ifr.ifr_name, i);
+		if (ioctl(bpf[i], BIOCSETIF, &ifr) == -1)
+			err(EXIT_FAILURE, "BIOCSETIF %s", ifr.ifr_name);
+	}
+
+	memset(frame, 0, sizeof(frame));
+	eh = (void *)frame;
+	memset(eh->ether_dhost, 0xff, ETHER_ADDR_LEN);
+	eh->ether_shost[0] = 0x02;
+	/* An unassigned ethertype, so that nobody answers. */
+	eh->ether_type = htons(0x88b5);
+
+	i = 0;
+	while (!done) {
+		if (write(bpf[i], frame, sizeof(frame)) == -1)
+			err(EXIT_FAILURE, "write");
+		n++;
+		if (++i == nsessions)
+			i = 0;
+	}
+
+	for (i = 0; i < nsessions; i++)
+		close(bpf[i]);
+	free(bpf);
+	return n;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct timeval start, end;
+	unsigned long total, before;
+	unsigned seconds = 10;
+	double elapsed;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "cn:p:t:")) != -1) {
+		switch (ch) {
+		case 'c':
+			cookies = true;
+			break;
+		case 'n':
+			nsessions = (unsigned)strtoul(optarg, NULL, 0);
+			if (nsessions < 1)
+				usage();
+			break;
+		case 'p':
+			npeers = (unsigned)strtoul(optarg, NULL, 0);
+			if (npeers < 1 || npeers > 65000)
+				usage();
+			break;
+		case 't':
+			seconds = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+
+	gettimeofday(&start, NULL);
+	create();
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &end);
+	printf("created %u sessions over %u peers in %.2f s\n", nsessions,
+	    npeers, end.tv_sec + end.tv_usec / 1e6);
+
+	signal(SIGALRM, alarmed);
+	alarm(seconds);
+	before = l2tp_ipackets();
+	gettimeofday(&start, NULL);
+	total = sender();
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &end);
+	elapsed = end.tv_sec + end.tv_usec / 1e6;
+	printf("%lu frames in %.2f s, %.0f frames/s\n", total, elapsed,
+	    total / elapsed);
+	/* Let the input softints catch up. */
+	sleep(1);
+	printf("%lu frames taken in by the sessions\n",
+	    l2tp_ipackets() - before);
+	return EXIT_SUCCESS;
+}
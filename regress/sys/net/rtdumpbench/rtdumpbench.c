@@ -0,0 +1,300 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check and time the resumable routing table dump.
+ *
+ * Dump the routing table of one address family with a single
+ * NET_RT_DUMP request, sized and retried the way netstat(1) does, and
+ * again with NET_RT_DUMPFROM in chunks of a fixed buffer size, passing
+ * the last destination of each chunk back in as the cursor.  With -c,
+ * check that both return the same routes in the same order and that no
+ * destination is split across chunks.  Otherwise report the time per
+ * dump and the buffer each needs.  Load a large table (e.g. a full BGP
+ * feed) beforehand for meaningful numbers.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+
+#include <net/if.h>
+#include <net/route.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct route_id {
+	uint8_t		ri_dst[sizeof(struct sockaddr_storage)];
+	uint8_t		ri_mask[sizeof(struct sockaddr_storage)];
+};
+
+struct routes {
+	struct route_id	*r_ids;
+	size_t		 r_count;
+	size_t		 r_size;
+};
+
+static int	checkonly;
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-c] [-b chunk_size] [-f inet|inet6] "
+	    "[-n iterations]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static double
+elapsed(const struct timeval *t0)
+{
+	struct timeval t1;
+
+	gettimeofday(&t1, NULL);
+	timersub(&t1, t0, &t1);
+	return t1.tv_sec + t1.tv_usec / 1e6;
+}
+
+static const struct sockaddr *
+rtm_addr(const struct rt_msghdr *rtm, int which)
+{
+	const char *cp = (const char *)(rtm + 1);
+	const struct sockaddr *sa;
+	int i;
+
+	for (i = 0; i < RTAX_MAX; i++) {
+		if ((rtm->rtm_addrs & (1 << i)) == 0)
+			continue;
+		sa = (const struct sockaddr *)cp;
+		if (i == which)
+			return sa;
+		RT_ADVANCE(cp, sa);
+	}
+	return NULL;
+}
+
+static void
+routes_add(struct routes *r, const struct rt_msghdr *rtm)
+{
+	const struct sockaddr *dst, *mask;
+	struct route_id *ri;
+
+	if (r == NULL)
+		return;
+	if (r->r_count == r->r_size) {
+		r->r_size = r->r_size ? r->r_size * 2 : 1024;
+		r->r_ids = realloc(r->r_ids, r->r_size * sizeof(*r->r_ids));
+		if (r->r_ids == NULL)
+			err(EXIT_FAILURE, "realloc");
+	}
+	ri = &r->r_ids[r->r_count++];
+	memset(ri, 0, sizeof(*ri));
+	if ((dst = rtm_addr(rtm, RTAX_DST)) != NULL)
+		memcpy(ri->ri_dst, dst, MIN(dst->sa_len, sizeof(ri->ri_dst)));
+	if ((mask = rtm_addr(rtm, RTAX_NETMASK)) != NULL)
+		memcpy(ri->ri_mask, mask,
+		    MIN(mask->sa_len, sizeof(ri->ri_mask)));
+}
+
+/*
+ * One NET_RT_DUMP request: size the buffer, then retry until the table
+ * fits.  ARP/NDP entries come with it; skip them.
+ */
+static size_t
+dump_full(int af, struct routes *r)
+{
+	int mib[6] = { CTL_NET, PF_ROUTE, 0, af, NET_RT_DUMP, 0 };
+	const struct rt_msghdr *rtm;
+	char *buf = NULL, *cp, *lim;
+	size_t len, bufsize;
+
+	for (;;) {
+		if (sysctl(mib, __arraycount(mib), NULL, &len, NULL, 0) == -1)
+			err(EXIT_FAILURE, "sysctl NET_RT_DUMP estimate");
+		bufsize = len;
+		if ((buf = realloc(buf, bufsize)) == NULL)
+			err(EXIT_FAILURE, "realloc");
+		if (sysctl(mib, __arraycount(mib), buf, &len, NULL, 0) == 0)
+			break;
+		if (errno != ENOMEM)
+			err(EXIT_FAILURE, "sysctl NET_RT_DUMP");
+	}
+	lim = buf + len;
+	for (cp = buf; cp < lim; cp += rtm->rtm_msglen) {
+		rtm = (const struct rt_msghdr *)cp;
+		if ((rtm->rtm_flags & RTF_LLDATA) == 0)
+			routes_add(r, rtm);
+	}
+	free(buf);
+	return bufsize;
+}
+
+/*
+ * NET_RT_DUMPFROM requests of at most chunk bytes each, resuming after
+ * the last destination returned until a request comes back empty.
+ */
+static size_t
+dump_chunked(int af, size_t chunk, struct routes *r, size_t *nreqs)
+{
+	int mib[6] = { CTL_NET, PF_ROUTE, 0, af, NET_RT_DUMPFROM, 0 };
+	struct sockaddr_storage cursor;
+	const struct sockaddr *dst, *first, *sa;
+	const struct rt_msghdr *rtm;
+	char *buf, *cp, *lim;
+	size_t len, newlen = 0;
+
+	if ((buf = malloc(chunk)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	*nreqs = 0;
+	for (;;) {
+		len = chunk;
+		if (sysctl(mib, __arraycount(mib), buf, &len,
+		    newlen ? &cursor : NULL, newlen) == -1) {
+			if (errno != ENOMEM)
+				err(EXIT_FAILURE, "sysctl NET_RT_DUMPFROM");
+			/* One destination's routes did not fit. */
+			chunk *= 2;
+			if ((buf = realloc(buf, chunk)) == NULL)
+				err(EXIT_FAILURE, "realloc");
+			continue;
+		}
+		++*nreqs;
+		if (len == 0)
+			break;
+		lim = buf + len;
+		rtm = (const struct rt_msghdr *)buf;
+		first = rtm_addr(rtm, RTAX_DST);
+		if (checkonly && newlen && first != NULL &&
+		    first->sa_len == cursor.ss_len &&
+		    memcmp(first, &cursor, first->sa_len) == 0)
+			errx(EXIT_FAILURE, "destination split across chunks");
+		dst = NULL;
+		for (cp = buf; cp < lim; cp += rtm->rtm_msglen) {
+			rtm = (const struct rt_msghdr *)cp;
+			routes_add(r, rtm);
+			if ((sa = rtm_addr(rtm, RTAX_DST)) != NULL)
+				dst = sa;
+		}
+		if (dst == NULL)
+			errx(EXIT_FAILURE, "no destination in chunk");
+		memcpy(&cursor, dst, dst->sa_len);
+		newlen = dst->sa_len;
+	}
+	free(buf);
+	return chunk;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct routes full, chunked;
+	struct timeval t0;
+	size_t chunk = 16384, fullsize, chunksize, nreqs, i;
+	unsigned long n = 10, iter;
+	double tfull, tchunked;
+	int af = AF_INET;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "b:cf:n:")) != -1) {
+		switch (ch) {
+		case 'b':
+			chunk = strtoul(optarg, NULL, 0);
+			if (chunk < sizeof(struct rt_msghdr))
+				usage();
+			break;
+		case 'c':
+			checkonly = 1;
+			break;
+		case 'f':
+			if (strcmp(optarg, "inet") == 0)
+				af = AF_INET;
+			else if (strcmp(optarg, "inet6") == 0)
+				af = AF_INET6;
+			else
+				usage();
+			break;
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			if (n == 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	if (checkonly) {
+		/*
+		 * The table may change between the two dumps; run this
+		 * on a quiet system.
+		 */
+		memset(&full, 0, sizeof(full));
+		memset(&chunked, 0, sizeof(chunked));
+		dump_full(af, &full);
+		dump_chunked(af, chunk, &chunked, &nreqs);
+		if (full.r_count != chunked.r_count)
+			errx(EXIT_FAILURE, "NET_RT_DUMP returned %zu routes, "
+			    "NET_RT_DUMPFROM %zu", full.r_count,
+			    chunked.r_count);
+		for (i = 0; i < full.r_count; i++)
+			if (memcmp(&full.r_ids[i], &chunked.r_ids[i],
+			    sizeof(full.r_ids[i])) != 0)
+				errx(EXIT_FAILURE, "route %zu differs", i);
+		printf("%zu routes in %zu requests: ok\n", full.r_count,
+		    nreqs);
+		return EXIT_SUCCESS;
+	}
+
+	gettimeofday(&t0, NULL);
+	for (fullsize = 0, iter = 0; iter < n; iter++)
+		fullsize = dump_full(af, NULL);
+	tfull = elapsed(&t0);
+
+	gettimeofday(&t0, NULL);
+	for (chunksize = 0, iter = 0; iter < n; iter++)
+		chunksize = dump_chunked(af, chunk, NULL, &nreqs);
+	tchunked = elapsed(&t0);
+
+	printf("NET_RT_DUMP      %10.3f ms/dump  %10zu byte buffer\n",
+	    tfull * 1e3 / n, fullsize);
+	printf("NET_RT_DUMPFROM  %10.3f ms/dump  %10zu byte buffer  "
+	    "%zu requests\n", tchunked * 1e3 / n, chunksize, nreqs);
+	return EXIT_SUCCESS;
+}
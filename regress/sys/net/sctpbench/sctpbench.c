@@ -0,0 +1,214 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure SCTP association setup and lookup cost with many associations.
+ *
+ * Open a one-to-many server socket on the loopback and connect the
+ * given number of one-to-one client sockets to it.  Then bounce small
+ * messages off the server, which replies with sendto(2) so that every
+ * reply needs an association lookup by address, a window of clients at
+ * a time.  Report associations and round trips per second.
+ *
+ * With -a, each client is bound to the same port on its own address,
+ * counting up from 127.0.1.1, as SIGTRAN peers usually are; those
+ * addresses have to be configured on lo0 beforehand.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CLIENT_PORT	2905
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-a] [-n associations] [-r rounds] "
+	    "[-w window]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static double
+since(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &now);
+	return now.tv_sec + now.tv_usec / 1e6;
+}
+
+static int
+client(const struct sockaddr_in *server, unsigned i, int aliases)
+{
+	struct sockaddr_in sin;
+	int fd, on = 1;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP)) == -1)
+		err(EXIT_FAILURE, "socket");
+	if (aliases) {
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on,
+		    sizeof(on)) == -1)
+			err(EXIT_FAILURE, "SO_REUSEADDR");
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_len = sizeof(sin);
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(CLIENT_PORT);
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 0x100 + i + 1);
+		if (bind(fd, (const struct sockaddr *)&sin, sizeof(sin)) == -1)
+			err(EXIT_FAILURE, "bind %s", inet_ntoa(sin.sin_addr));
+	}
+	if (connect(fd, (const struct sockaddr *)server,
+	    sizeof(*server)) == -1)
+		err(EXIT_FAILURE, "connect association %u", i);
+	return fd;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sockaddr_in server, from;
+	struct timeval start;
+	struct rlimit rl;
+	socklen_t fromlen;
+	unsigned nassoc = 1000, rounds = 10, window = 64;
+	unsigned i, j, k, r, n;
+	uint32_t msg;
+	double elapsed;
+	int *fds, sfd, ch, aliases = 0, size;
+
+	while ((ch = getopt(argc, argv, "an:r:w:")) != -1) {
+		switch (ch) {
+		case 'a':
+			aliases = 1;
+			break;
+		case 'n':
+			nassoc = (unsigned)strtoul(optarg, NULL, 0);
+			if (nassoc < 1)
+				usage();
+			break;
+		case 'r':
+			rounds = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = (unsigned)strtoul(optarg, NULL, 0);
+			if (window < 1)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind || (aliases && nassoc > 0xfefe))
+		usage();
+
+	rl.rlim_cur = rl.rlim_max = nassoc + 16;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(EXIT_FAILURE, "setrlimit");
+	if ((fds = calloc(nassoc, sizeof(*fds))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	if ((sfd = socket(AF_INET, SOCK_SEQPACKET, IPPROTO_SCTP)) == -1)
+		err(EXIT_FAILURE, "socket");
+	size = 4 * 1024 * 1024;
+	(void)setsockopt(sfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	(void)setsockopt(sfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	memset(&server, 0, sizeof(server));
+	server.sin_len = sizeof(server);
+	server.sin_family = AF_INET;
+	server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(sfd, (const struct sockaddr *)&server, sizeof(server)) == -1)
+		err(EXIT_FAILURE, "bind");
+	if (listen(sfd, 128) == -1)
+		err(EXIT_FAILURE, "listen");
+	fromlen = sizeof(server);
+	if (getsockname(sfd, (struct sockaddr *)&server, &fromlen) == -1)
+		err(EXIT_FAILURE, "getsockname");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nassoc; i++)
+		fds[i] = client(&server, i, aliases);
+	elapsed = since(&start);
+	printf("%u associations in %.2f s, %.0f associations/s\n",
+	    nassoc, elapsed, nassoc / elapsed);
+
+	gettimeofday(&start, NULL);
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < nassoc; i += n) {
+			n = nassoc - i < window ? nassoc - i : window;
+			for (j = 0; j < n; j++) {
+				msg = htonl(i + j);
+				if (send(fds[i + j], &msg, sizeof(msg), 0) == -1)
+					err(EXIT_FAILURE, "send");
+			}
+			for (j = 0; j < n; j++) {
+				fromlen = sizeof(from);
+				if (recvfrom(sfd, &msg, sizeof(msg), 0,
+				    (struct sockaddr *)&from, &fromlen) !=
+				    sizeof(msg))
+					err(EXIT_FAILURE, "recvfrom");
+				if (sendto(sfd, &msg, sizeof(msg), 0,
+				    (const struct sockaddr *)&from,
+				    fromlen) == -1)
+					err(EXIT_FAILURE, "sendto");
+			}
+			for (j = 0; j < n; j++) {
+				if (recv(fds[i + j], &msg, sizeof(msg), 0) !=
+				    sizeof(msg))
+					err(EXIT_FAILURE, "recv");
+				k = ntohl(msg);
+				if (k != i + j)
+					errx(EXIT_FAILURE, "association %u got "
+					    "the reply for %u", i + j, k);
+			}
+		}
+	}
+	elapsed = since(&start);
+	printf("%u round trips in %.2f s, %.0f round trips/s\n",
+	    rounds * nassoc, elapsed, rounds * nassoc / elapsed);
+
+	for (i = 0; i < nassoc; i++)
+		close(fds[i]);
+	close(sfd);
+	free(fds);
+	return EXIT_SUCCESS;
+}
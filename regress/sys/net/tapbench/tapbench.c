@@ -0,0 +1,333 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure the packet rate of tap(4).
+ *
+ * In write mode, inject minimal UDP frames into the host stack as fast
+ * as possible.  In read mode, send UDP datagrams to a destination
+ * routed through the tap interface from one thread and drain them from
+ * every queue of the device from others.  The interface has to be up
+ * and, for read mode, addressed and given a static ARP entry for the
+ * destination beforehand.  Report frames per second in either case.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <net/if.h>
+#include <net/if_ether.h>
+#include <net/if_tap.h>
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAXQUEUES	16
+#define PAYLOAD		18
+
+static volatile sig_atomic_t done;
+static unsigned long counts[MAXQUEUES];
+static int fds[MAXQUEUES];
+static size_t bufsize = 65536;
+static int flags;
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-bv] [-d dest] [-q queues] [-s bufsize] "
+	    "[-t seconds]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+alarmed(int sig)
+{
+
+	done = 1;
+}
+
+static size_t
+hdrlen(void)
+{
+	size_t len = 0;
+
+	if (flags & TAP_F_BATCH)
+		len += sizeof(struct tap_batch_hdr);
+	if (flags & TAP_F_VNETHDR)
+		len += sizeof(struct tap_vnet_hdr);
+	return len;
+}
+
+/*
+ * Build a broadcast Ethernet frame carrying a UDP datagram to the
+ * discard port, preceded by whatever headers the mode calls for.
+ */
+static size_t
+mkframe(char *buf)
+{
+	struct ether_header *eh;
+	struct ip *ip;
+	struct udphdr *uh;
+	size_t len, off;
+
+	off = hdrlen();
+	len = sizeof(*eh) + sizeof(*ip) + sizeof(*uh) + PAYLOAD;
+	memset(buf, 0, off + len);
+	if (flags & TAP_F_BATCH) {
+		struct tap_batch_hdr tb;
+
+		tb.tb_len = (uint32_t)(len + off - sizeof(tb));
+		memcpy(buf, &tb, sizeof(tb));
+	}
+
+	eh = (void *)(buf + off);
+	memset(eh->ether_dhost, 0xff, ETHER_ADDR_LEN);
+	eh->ether_shost[0] = 0x02;
+	eh->ether_type = htons(ETHERTYPE_IP);
+
+	ip = (void *)(eh + 1);
+	ip->ip_v = IPVERSION;
+	ip->ip_hl = sizeof(*ip) >> 2;
+	ip->ip_len = htons(sizeof(*ip) + sizeof(*uh) + PAYLOAD);
+	ip->ip_ttl = 64;
+	ip->ip_p = IPPROTO_UDP;
+	ip->ip_src.s_addr = htonl(0x0a000002);
+	ip->ip_dst.s_addr = htonl(INADDR_BROADCAST);
+
+	uh = (void *)(ip + 1);
+	uh->uh_sport = htons(9);
+	uh->uh_dport = htons(9);
+	uh->uh_ulen = htons(sizeof(*uh) + PAYLOAD);
+
+	return off + len;
+}
+
+static unsigned long
+writer(int fd, unsigned batch)
+{
+	char frame[256], *buf;
+	size_t len, step;
+	unsigned long n = 0;
+	unsigned i;
+
+	len = mkframe(frame);
+	step = TAP_WORDALIGN(len);
+	if ((buf = calloc(batch, step)) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < batch; i++)
+		memcpy(buf + i * step, frame, len);
+	len = (batch - 1) * step + len;
+
+	while (!done) {
+		if (write(fd, buf, len) == -1)
+			err(EXIT_FAILURE, "write");
+		n += batch;
+	}
+	free(buf);
+	return n;
+}
+
+/* Count the frames in a batched read. */
+static unsigned long
+nframes(const char *buf, size_t len)
+{
+	struct tap_batch_hdr tb;
+	unsigned long n = 0;
+	size_t off = 0;
+
+	while (off + sizeof(tb) <= len) {
+		memcpy(&tb, buf + off, sizeof(tb));
+		off += TAP_WORDALIGN(sizeof(tb) + tb.tb_len);
+		n++;
+	}
+	return n;
+}
+
+static void *
+reader(void *arg)
+{
+	int q = (int)(intptr_t)arg;
+	struct pollfd pfd;
+	char *buf;
+	ssize_t len;
+
+	if ((buf = malloc(bufsize)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	pfd.fd = fds[q];
+	pfd.events = POLLIN;
+	while (!done) {
+		/* Time out now and then to notice the end of the run. */
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		if ((len = read(fds[q], buf, bufsize)) == -1)
+			err(EXIT_FAILURE, "read");
+		counts[q] += (flags & TAP_F_BATCH) ?
+		    nframes(buf, (size_t)len) : 1;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void
+generate(const char *dest)
+{
+	struct sockaddr_in sin;
+	char payload[PAYLOAD];
+	int s;
+	uint16_t port = 1024;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	if (inet_pton(AF_INET, dest, &sin.sin_addr) != 1)
+		errx(EXIT_FAILURE, "bad address: %s", dest);
+	if ((s = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+	memset(payload, 0, sizeof(payload));
+
+	/* Vary the port so that flows spread over the queues. */
+	while (!done) {
+		sin.sin_port = htons(port);
+		if (++port == 0)
+			port = 1024;
+		(void)sendto(s, payload, sizeof(payload), 0,
+		    (struct sockaddr *)&sin, sizeof(sin));
+	}
+	close(s);
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t threads[MAXQUEUES];
+	char frame[256];
+	struct ifreq ifr;
+	struct timeval start, end;
+	const char *dest = NULL;
+	unsigned long total;
+	unsigned nqueues = 1, seconds = 10, batch = 1, i;
+	double elapsed;
+	int ch, error;
+
+	while ((ch = getopt(argc, argv, "bd:q:s:t:v")) != -1) {
+		switch (ch) {
+		case 'b':
+			flags |= TAP_F_BATCH;
+			break;
+		case 'd':
+			dest = optarg;
+			break;
+		case 'q':
+			nqueues = (unsigned)strtoul(optarg, NULL, 0);
+			if (nqueues < 1 || nqueues > MAXQUEUES)
+				usage();
+			break;
+		case 's':
+			bufsize = strtoul(optarg, NULL, 0);
+			if (bufsize < 128)
+				usage();
+			break;
+		case 't':
+			seconds = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			flags |= TAP_F_VNETHDR;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	if ((fds[0] = open("/dev/tap", O_RDWR)) == -1)
+		err(EXIT_FAILURE, "/dev/tap");
+	if (ioctl(fds[0], TAPGIFNAME, &ifr) == -1)
+		err(EXIT_FAILURE, "TAPGIFNAME");
+	if (ioctl(fds[0], TAPSFLAGS, &flags) == -1)
+		err(EXIT_FAILURE, "TAPSFLAGS");
+	for (i = 1; i < nqueues; i++)
+		if (ioctl(fds[0], TAPADDQUEUE, &fds[i]) == -1)
+			err(EXIT_FAILURE, "TAPADDQUEUE");
+
+	if (dest != NULL) {
+		printf("%s: waiting for %s to be configured, "
+		    "press return to start\n", ifr.ifr_name, ifr.ifr_name);
+		(void)getchar();
+	}
+
+	signal(SIGALRM, alarmed);
+	alarm(seconds);
+	gettimeofday(&start, NULL);
+	if (dest == NULL) {
+		if (flags & TAP_F_BATCH)
+			batch = (unsigned)(bufsize /
+			    TAP_WORDALIGN(mkframe(frame)));
+		total = writer(fds[0], batch);
+	} else {
+		for (i = 0; i < nqueues; i++) {
+			error = pthread_create(&threads[i], NULL, reader,
+			    (void *)(intptr_t)i);
+			if (error)
+				errc(EXIT_FAILURE, error, "pthread_create");
+		}
+		generate(dest);
+		for (i = 0; i < nqueues; i++)
+			pthread_join(threads[i], NULL);
+		total = 0;
+		for (i = 0; i < nqueues; i++) {
+			if (nqueues > 1)
+				printf("queue %u: %lu frames\n", i, counts[i]);
+			total += counts[i];
+		}
+	}
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &end);
+	elapsed = end.tv_sec + end.tv_usec / 1e6;
+	printf("%s: %lu frames in %.2f s, %.0f frames/s\n", ifr.ifr_name,
+	    total, elapsed, total / elapsed);
+	return EXIT_SUCCESS;
+}
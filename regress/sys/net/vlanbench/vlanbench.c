@@ -0,0 +1,425 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure the packet rate of vlan(4) with many vlans on one parent.
+ *
+ * Create a tap(4) interface and the given number of vlan interfaces on
+ * it, with VLAN IDs counting up from 1.  In receive mode, write frames
+ * tagged for each of the vlans in turn into the tap device, so that
+ * the host stack has to find the vlan for every frame.  In transmit
+ * mode (-T), write frames to each vlan in turn through bpf(4) and read
+ * them back, tagged, from the tap device.  With -q, the vlans use
+ * 802.1ad service tags instead of 802.1Q tags.  Report frames per
+ * second, and in receive mode how many the vlans took in.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/sockio.h>
+#include <sys/time.h>
+
+#include <net/bpf.h>
+#include <net/if.h>
+#include <net/if_ether.h>
+#include <net/if_tap.h>
+#include <net/if_vlanvar.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FRAMELEN	64
+#define VLAN_BASE	4096	/* first vlan unit number we create */
+
+static volatile sig_atomic_t done;
+static char tapname[IFNAMSIZ];
+static unsigned nvlans = 4000;
+static uint16_t proto = ETHERTYPE_VLAN;
+static int tapfd, sock, flags;
+static unsigned created;
+static unsigned long rcount;
+static size_t rbufsize;
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-bqT] [-n vlans] [-s bufsize] "
+	    "[-t seconds]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+alarmed(int sig)
+{
+
+	done = 1;
+}
+
+static void
+vlanname(char *buf, unsigned i)
+{
+
+	snprintf(buf, IFNAMSIZ, "vlan%u", VLAN_BASE + i);
+}
+
+static void
+setflags(const char *name, int set)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, name, sizeof(ifr.ifr_name));
+	if (ioctl(sock, SIOCGIFFLAGS, &ifr) == -1)
+		err(EXIT_FAILURE, "SIOCGIFFLAGS %s", name);
+	ifr.ifr_flags |= set;
+	if (ioctl(sock, SIOCSIFFLAGS, &ifr) == -1)
+		err(EXIT_FAILURE, "SIOCSIFFLAGS %s", name);
+}
+
+static void
+destroy(void)
+{
+	struct ifreq ifr;
+	unsigned i;
+
+	for (i = 0; i < created; i++) {
+		memset(&ifr, 0, sizeof(ifr));
+		vlanname(ifr.ifr_name, i);
+		(void)ioctl(sock, SIOCIFDESTROY, &ifr);
+	}
+}
+
+static void
+create(void)
+{
+	struct vlanreq vlr;
+	struct ifreq ifr;
+	unsigned i;
+
+	atexit(destroy);
+	for (i = 0; i < nvlans; i++) {
+		memset(&ifr, 0, sizeof(ifr));
+		vlanname(ifr.ifr_name, i);
+		if (ioctl(sock, SIOCIFCREATE, &ifr) == -1)
+			err(EXIT_FAILURE, "SIOCIFCREATE %s", ifr.ifr_name);
+		created++;
+
+		/* link0 has to be set before the vlan is attached. */
+		if (proto == ETHERTYPE_QINQ)
+			setflags(ifr.ifr_name, IFF_LINK0);
+
+		memset(&vlr, 0, sizeof(vlr));
+		strlcpy(vlr.vlr_parent, tapname, sizeof(vlr.vlr_parent));
+		vlr.vlr_tag = (uint16_t)(i + 1);
+		ifr.ifr_data = &vlr;
+		if (ioctl(sock, SIOCSETVLAN, &ifr) == -1)
+			err(EXIT_FAILURE, "SIOCSETVLAN %s", ifr.ifr_name);
+		setflags(ifr.ifr_name, IFF_UP);
+	}
+}
+
+/* Sum the input packet counters of our vlans. */
+static unsigned long
+vlan_ipackets(void)
+{
+	struct ifaddrs *ifap, *ifa;
+	const struct if_data *ifd;
+	unsigned long n = 0;
+	unsigned unit;
+
+	if (getifaddrs(&ifap) == -1)
+		err(EXIT_FAILURE, "getifaddrs");
+	for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr == NULL ||
+		    ifa->ifa_addr->sa_family != AF_LINK ||
+		    ifa->ifa_data == NULL)
+			continue;
+		if (sscanf(ifa->ifa_name, "vlan%u", &unit) != 1 ||
+		    unit < VLAN_BASE || unit >= VLAN_BASE + nvlans)
+			continue;
+		ifd = ifa->ifa_data;
+		n += ifd->ifi_ipackets;
+	}
+	freeifaddrs(ifap);
+	return n;
+}
+
+/*
+ * Build a broadcast frame for the given vlan.  A frame for the tap
+ * device is tagged and, if asked for, preceded by a batch header.
+ */
+static size_t
+mkframe(char *buf, unsigned i, bool totap)
+{
+	struct ether_header *eh;
+	size_t len, off;
+
+	off = (totap && (flags & TAP_F_BATCH)) ?
+	    sizeof(struct tap_batch_hdr) : 0;
+	len = FRAMELEN;
+	memset(buf, 0, off + len);
+	if (off != 0) {
+		struct tap_batch_hdr tb;
+
+		tb.tb_len = (uint32_t)len;
+		memcpy(buf, &tb, sizeof(tb));
+	}
+
+	eh = (void *)(buf + off);
+	memset(eh->ether_dhost, 0xff, ETHER_ADDR_LEN);
+	eh->ether_shost[0] = 0x02;
+	if (totap) {
+		struct ether_vlan_header *evl = (void *)eh;
+
+		evl->evl_encap_proto = htons(proto);
+		evl->evl_tag = htons((uint16_t)(i + 1));
+		/* An unassigned ethertype, so that nobody answers. */
+		evl->evl_proto = htons(0x88b5);
+	} else
+		eh->ether_type = htons(0x88b5);
+
+	return off + len;
+}
+
+static unsigned long
+writer(size_t bufsize)
+{
+	char frame[FRAMELEN + sizeof(struct tap_batch_hdr)], *buf;
+	size_t len, step;
+	unsigned long n = 0;
+	unsigned batch, i, v = 0;
+
+	step = TAP_WORDALIGN(mkframe(frame, 0, true));
+	batch = (flags & TAP_F_BATCH) ? (unsigned)(bufsize / step) : 1;
+	if ((buf = calloc(batch, step)) == NULL)
+		err(EXIT_FAILURE, "calloc");
+
+	while (!done) {
+		len = 0;
+		for (i = 0; i < batch; i++) {
+			len = i * step + mkframe(buf + i * step, v, true);
+			if (++v == nvlans)
+				v = 0;
+		}
+		if (write(tapfd, buf, len) == -1)
+			err(EXIT_FAILURE, "write");
+		n += batch;
+	}
+	free(buf);
+	return n;
+}
+
+/* Count the frames in a batched read. */
+static unsigned long
+nframes(const char *buf, size_t len)
+{
+	struct tap_batch_hdr tb;
+	unsigned long n = 0;
+	size_t off = 0;
+
+	while (off + sizeof(tb) <= len) {
+		memcpy(&tb, buf + off, sizeof(tb));
+		off += TAP_WORDALIGN(sizeof(tb) + tb.tb_len);
+		n++;
+	}
+	return n;
+}
+
+static void *
+reader(void *arg)
+{
+	struct pollfd pfd;
+	char *buf;
+	ssize_t len;
+
+	if ((buf = malloc(rbufsize)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+	pfd.fd = tapfd;
+	pfd.events = POLLIN;
+	while (!done) {
+		/* Time out now and then to notice the end of the run. */
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		if ((len = read(tapfd, buf, rbufsize)) == -1)
+			err(EXIT_FAILURE, "read");
+		rcount += (flags & TAP_F_BATCH) ?
+		    nframes(buf, (size_t)len) : 1;
+	}
+	free(buf);
+	return NULL;
+}
+
+/* Write untagged frames to each vlan in turn through bpf(4). */
+static unsigned long
+sender(void)
+{
+	struct rlimit rl;
+	struct ifreq ifr;
+	char frame[FRAMELEN];
+	int *bpf;
+	unsigned long n = 0;
+	unsigned i;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(EXIT_FAILURE, "getrlimit");
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(EXIT_FAILURE, "setrlimit");
+
+	if ((bpf = calloc(nvlans, sizeof(*bpf))) == NULL)
+		err(EXIT_FAILURE, "calloc");
+	for (i = 0; i < nvlans; i++) {
+		if ((bpf[i] = open("/dev/bpf", O_WRONLY)) == -1)
+			err(EXIT_FAILURE, "/dev/bpf");
+		memset(&ifr, 0, sizeof(ifr));
+		vlanname(ifr.ifr_name, i);
+		if (ioctl(bpf[i], BIOCSETIF, &ifr) == -1)
+			err(EXIT_FAILURE, "BIOCSETIF %s", ifr.ifr_name);
+	}
+
+	i = 0;
+	while (!done) {
+		(void)mkframe(frame, i, false);
+		if (write(bpf[i], frame, sizeof(frame)) == -1)
+			err(EXIT_FAILURE, "write");
+		n++;
+		if (++i == nvlans)
+			i = 0;
+	}
+
+	for (i = 0; i < nvlans; i++)
+		close(bpf[i]);
+	free(bpf);
+	return n;
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t thread;
+	struct ifreq ifr;
+	struct timeval start, end;
+	unsigned long total, before = 0;
+	unsigned seconds = 10;
+	size_t bufsize = 65536;
+	double elapsed;
+	bool transmit = false;
+	int ch, error;
+
+	while ((ch = getopt(argc, argv, "bn:qs:t:T")) != -1) {
+		switch (ch) {
+		case 'b':
+			flags |= TAP_F_BATCH;
+			break;
+		case 'n':
+			nvlans = (unsigned)strtoul(optarg, NULL, 0);
+			if (nvlans < 1 || nvlans > 4094)
+				usage();
+			break;
+		case 'q':
+			proto = ETHERTYPE_QINQ;
+			break;
+		case 's':
+			bufsize = strtoul(optarg, NULL, 0);
+			if (bufsize < 128)
+				usage();
+			break;
+		case 't':
+			seconds = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			transmit = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+		err(EXIT_FAILURE, "socket");
+	if ((tapfd = open("/dev/tap", O_RDWR)) == -1)
+		err(EXIT_FAILURE, "/dev/tap");
+	if (ioctl(tapfd, TAPGIFNAME, &ifr) == -1)
+		err(EXIT_FAILURE, "TAPGIFNAME");
+	strlcpy(tapname, ifr.ifr_name, sizeof(tapname));
+	if (ioctl(tapfd, TAPSFLAGS, &flags) == -1)
+		err(EXIT_FAILURE, "TAPSFLAGS");
+	setflags(tapname, IFF_UP);
+
+	gettimeofday(&start, NULL);
+	create();
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &end);
+	printf("%s: created %u vlans in %.2f s\n", tapname, nvlans,
+	    end.tv_sec + end.tv_usec / 1e6);
+
+	signal(SIGALRM, alarmed);
+	alarm(seconds);
+	gettimeofday(&start, NULL);
+	if (transmit) {
+		rbufsize = bufsize;
+		error = pthread_create(&thread, NULL, reader, NULL);
+		if (error)
+			errc(EXIT_FAILURE, error, "pthread_create");
+		total = sender();
+		pthread_join(thread, NULL);
+		printf("%s: %lu frames read back\n", tapname, rcount);
+	} else {
+		before = vlan_ipackets();
+		total = writer(bufsize);
+	}
+	gettimeofday(&end, NULL);
+
+	timersub(&end, &start, &end);
+	elapsed = end.tv_sec + end.tv_usec / 1e6;
+	printf("%s: %lu frames in %.2f s, %.0f frames/s\n", tapname,
+	    total, elapsed, total / elapsed);
+	if (!transmit) {
+		/* Let the input softints catch up. */
+		sleep(1);
+		printf("%s: %lu frames taken in by the vlans\n", tapname,
+		    vlan_ipackets() - before);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,371 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check and time the kernel's deflate implementation.
+ *
+ * sys/net/zlib.c is built into this program as is, and driven the way
+ * ppp-deflate.c drives it: a raw deflate stream per direction, with a
+ * Z_SYNC_FLUSH after every packet.  With -c, compress random packets
+ * of several kinds of data at every level and strategy, decompress
+ * them again and compare, and check adler32() against a byte-at-a-time
+ * reference.  Otherwise report the compression ratio and the throughput
+ * of deflate() and inflate() for each level and strategy.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/time.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <net/zlib.h>
+
+#define	WBITS		15
+#define	MAXPKT		16384
+#define	NPKTS		256
+
+enum kind { TEXT, RUNS, RANDOM, NKINDS };
+static const char *const kinds[] = { "text", "runs", "random" };
+
+static const struct {
+	const char	*name;
+	int		 strategy;
+} strategies[] = {
+	{ "default",	Z_DEFAULT_STRATEGY },
+	{ "filtered",	Z_FILTERED },
+	{ "huffman",	Z_HUFFMAN_ONLY },
+	{ "rle",	Z_RLE },
+};
+
+static void *
+zalloc(void *opaque, unsigned items, unsigned size)
+{
+
+	return calloc(items, size);
+}
+
+static void
+zfree(void *opaque, void *ptr)
+{
+
+	free(ptr);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-c] [-n iterations] [-p packet_size] "
+	    "[-s seed]\n", getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void
+fill(uint8_t *p, size_t len, enum kind kind)
+{
+	static const char *const words[] = {
+		"the ", "of ", "and ", "packet ", "link ", "compress ",
+		"deflate ", "window ", "\n", "GET /index.html HTTP/1.1\r\n",
+		"Host: ", "www.", ".org", "Content-Length: ", "0123456789",
+	};
+	size_t i, n;
+	const char *w;
+
+	switch (kind) {
+	case TEXT:
+		for (i = 0; i < len; i += n) {
+			w = words[random() % __arraycount(words)];
+			n = strlen(w);
+			if (n > len - i)
+				n = len - i;
+			memcpy(p + i, w, n);
+		}
+		break;
+	case RUNS:
+		for (i = 0; i < len; i += n) {
+			n = (size_t)random() % 64 + 1;
+			if (n > len - i)
+				n = len - i;
+			memset(p + i, (random() & 3) ? 0 : (int)random(), n);
+		}
+		break;
+	default:
+		for (i = 0; i < len; i++)
+			p[i] = (uint8_t)random();
+		break;
+	}
+}
+
+static void
+stream_init(z_stream *c, z_stream *d, int level, int strategy)
+{
+
+	memset(c, 0, sizeof(*c));
+	c->zalloc = zalloc;
+	c->zfree = zfree;
+	if (deflateInit2(c, level, Z_DEFLATED, -WBITS, 8, strategy) != Z_OK)
+		errx(EXIT_FAILURE, "deflateInit2 level %d strategy %d",
+		    level, strategy);
+
+	memset(d, 0, sizeof(*d));
+	d->zalloc = zalloc;
+	d->zfree = zfree;
+	if (inflateInit2(d, -WBITS) != Z_OK)
+		errx(EXIT_FAILURE, "inflateInit2");
+}
+
+/* Compress one packet, returning the length of the output. */
+static size_t
+compress_pkt(z_stream *c, const uint8_t *in, size_t len, uint8_t *out,
+    size_t outlen)
+{
+
+	c->next_in = __UNCONST(in);
+	c->avail_in = (uInt)len;
+	c->next_out = out;
+	c->avail_out = (uInt)outlen;
+	if (deflate(c, Z_SYNC_FLUSH) != Z_OK || c->avail_in != 0 ||
+	    c->avail_out == 0)
+		errx(EXIT_FAILURE, "deflate: %s", c->msg ? c->msg : "overflow");
+	return outlen - c->avail_out;
+}
+
+/* Decompress one packet, returning the length of the output. */
+static size_t
+decompress_pkt(z_stream *d, const uint8_t *in, size_t len, uint8_t *out,
+    size_t outlen)
+{
+	int r;
+
+	d->next_in = __UNCONST(in);
+	d->avail_in = (uInt)len;
+	d->next_out = out;
+	d->avail_out = (uInt)outlen;
+	r = inflate(d, Z_SYNC_FLUSH);
+	if ((r != Z_OK && r != Z_BUF_ERROR) || d->avail_in != 0)
+		errx(EXIT_FAILURE, "inflate: %s (%d)",
+		    d->msg ? d->msg : "?", r);
+	return outlen - d->avail_out;
+}
+
+static uint32_t
+adler32_ref(uint32_t adler, const uint8_t *p, size_t len)
+{
+	uint32_t s1 = adler & 0xffff, s2 = adler >> 16;
+
+	while (len--) {
+		s1 = (s1 + *p++) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+	return (s2 << 16) | s1;
+}
+
+static int
+check(unsigned iterations, size_t pktsize)
+{
+	const size_t outsize = MAXPKT + MAXPKT / 8 + 64;
+	uint8_t *in, *comp, *out;
+	z_stream c, d;
+	unsigned i, failed = 0;
+	size_t len, clen, dlen, off;
+	int level, k;
+	uint32_t a, ref;
+	unsigned st;
+
+	if ((in = malloc(MAXPKT)) == NULL ||
+	    (comp = malloc(outsize)) == NULL ||
+	    (out = malloc(MAXPKT)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	for (level = 0; level <= 9; level++) {
+		for (st = 0; st < __arraycount(strategies); st++) {
+			stream_init(&c, &d, level, strategies[st].strategy);
+			for (i = 0; i < iterations; i++) {
+				len = (size_t)random() % pktsize + 1;
+				fill(in, len, (enum kind)(i % NKINDS));
+				clen = compress_pkt(&c, in, len, comp, outsize);
+				dlen = decompress_pkt(&d, comp, clen, out,
+				    MAXPKT);
+				if (dlen != len || memcmp(in, out, len) != 0) {
+					printf("level %d %s: packet %u of "
+					    "%zu bytes %s: got %zu bytes\n",
+					    level, strategies[st].name, i,
+					    len, kinds[i % NKINDS], dlen);
+					failed++;
+					break;
+				}
+			}
+			deflateEnd(&c);
+			inflateEnd(&d);
+		}
+	}
+
+	for (i = 0; i < iterations; i++) {
+		len = (size_t)random() % ((i & 1) ? 32 : MAXPKT);
+		off = (size_t)random() % 16;
+		k = (int)(random() % NKINDS);
+		fill(in, MAXPKT, (enum kind)k);
+		len = len > MAXPKT - off ? MAXPKT - off : len;
+		a = (uint32_t)random() % 65521;
+		ref = adler32_ref(a, in + off, len);
+		if ((uint32_t)adler32(a, in + off, (uInt)len) != ref) {
+			printf("adler32: len %zu off %zu: 0x%08x != 0x%08x\n",
+			    len, off, (uint32_t)adler32(a, in + off,
+			    (uInt)len), ref);
+			failed++;
+		}
+	}
+
+	free(in);
+	free(comp);
+	free(out);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static double
+since(const struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+	timersub(&end, start, &end);
+	return end.tv_sec + end.tv_usec / 1e6;
+}
+
+static void
+bench(unsigned iterations, size_t pktsize)
+{
+	const size_t outsize = pktsize + pktsize / 8 + 64;
+	struct timeval start;
+	uint8_t *in, *comp, *out;
+	size_t clen[NPKTS], total, ctotal;
+	z_stream c, d;
+	unsigned i, j, st;
+	int kind, level;
+	double ctime, dtime;
+
+	if ((in = malloc(NPKTS * pktsize)) == NULL ||
+	    (comp = malloc(NPKTS * outsize)) == NULL ||
+	    (out = malloc(pktsize)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+
+	printf("%-7s %-9s %5s %7s %12s %12s\n", "data", "strategy", "level",
+	    "ratio", "deflate MB/s", "inflate MB/s");
+	for (kind = 0; kind < NKINDS; kind++) {
+		fill(in, NPKTS * pktsize, (enum kind)kind);
+		for (st = 0; st < __arraycount(strategies); st++) {
+			for (level = 1; level <= 9; level++) {
+				/* The strategy overrides the level. */
+				if (strategies[st].strategy >= Z_HUFFMAN_ONLY
+				    && level > 1)
+					break;
+
+				ctime = dtime = 0;
+				total = ctotal = 0;
+				for (j = 0; j < iterations; j++) {
+					stream_init(&c, &d, level,
+					    strategies[st].strategy);
+
+					gettimeofday(&start, NULL);
+					for (i = 0; i < NPKTS; i++)
+						clen[i] = compress_pkt(&c,
+						    in + i * pktsize, pktsize,
+						    comp + i * outsize,
+						    outsize);
+					ctime += since(&start);
+
+					gettimeofday(&start, NULL);
+					for (i = 0; i < NPKTS; i++)
+						(void)decompress_pkt(&d,
+						    comp + i * outsize,
+						    clen[i], out, pktsize);
+					dtime += since(&start);
+
+					for (i = 0; i < NPKTS; i++) {
+						total += pktsize;
+						ctotal += clen[i];
+					}
+					deflateEnd(&c);
+					inflateEnd(&d);
+				}
+				printf("%-7s %-9s %5d %7.3f %12.1f %12.1f\n",
+				    kinds[kind], strategies[st].name, level,
+				    (double)ctotal / total,
+				    total / ctime / 1e6, total / dtime / 1e6);
+			}
+		}
+	}
+
+	free(in);
+	free(comp);
+	free(out);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned iterations = 0, seed = 1;
+	size_t pktsize = 1500;
+	int ch, cflag = 0;
+
+	while ((ch = getopt(argc, argv, "cn:p:s:")) != -1) {
+		switch (ch) {
+		case 'c':
+			cflag = 1;
+			break;
+		case 'n':
+			iterations = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pktsize = (size_t)strtoul(optarg, NULL, 0);
+			if (pktsize == 0 || pktsize > MAXPKT)
+				usage();
+			break;
+		case 's':
+			seed = (unsigned)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	srandom(seed);
+	if (cflag)
+		return check(iterations ? iterations : 200, pktsize);
+	bench(iterations ? iterations : 5, pktsize);
+	return EXIT_SUCCESS;
+}
@@ -64,6 +64,7 @@ __KERNEL_RCSID(0, "$NetBSD: bpf.c,v 1.252 2023/07/31 17:41:18 christos Exp $");
 
 #include <sys/file.h>
 #include <sys/filedesc.h>
+#include <sys/hash.h>
 #include <sys/tty.h>
 #include <sys/uio.h>
 
@@ -163,6 +164,17 @@ static kmutex_t bpf_mtx;
 static struct psref_class	*bpf_psref_class __read_mostly;
 static pserialize_t		bpf_psz;
 
+/*
+ * Filters are shared by descriptors that set identical programs, so
+ * that daemons installing the same large filter don't each keep a copy
+ * and JIT-compile it again.  bpf_filter_mtx protects the hash table and
+ * the reference counts; it is never held while sleeping.
+ */
+#define BPF_FILTER_HASHSIZE	64
+static kmutex_t bpf_filter_mtx;
+static LIST_HEAD(, bpf_filter) *bpf_filter_hash;
+static u_long bpf_filter_hashmask;
+
 static inline void
 bpf_if_acquire(struct bpf_if *bp, struct psref *psref)
 {
@@ -242,6 +254,7 @@ static void	bpf_deliver(struct bpf_if *,
 		            void *(*cpfn)(void *, const void *, size_t),
 		            void *, u_int, u_int, const u_int);
 static void	bpf_freed(struct bpf_d *);
+static struct bpf_filter *bpf_get_filter(struct bpf_insn *, size_t);
 static void	bpf_free_filter(struct bpf_filter *);
 static void	bpf_ifname(struct ifnet *, struct ifreq *);
 static void	*bpf_mcpy(void *, const void *, size_t);
@@ -555,6 +568,9 @@ bpf_init(void)
 {
 
 	mutex_init(&bpf_mtx, MUTEX_DEFAULT, IPL_NONE);
+	mutex_init(&bpf_filter_mtx, MUTEX_DEFAULT, IPL_NONE);
+	bpf_filter_hash = hashinit(BPF_FILTER_HASHSIZE, HASH_LIST, true,
+	    &bpf_filter_hashmask);
 	bpf_psz = pserialize_create();
 	bpf_psref_class = psref_class_create("bpf", IPL_SOFTNET);
 
@@ -1366,11 +1382,9 @@ static int
 bpf_setf(struct bpf_d *d, struct bpf_program *fp, u_long cmd)
 {
 	struct bpf_insn *fcode;
-	bpfjit_func_t jcode;
 	size_t flen, size = 0;
 	struct bpf_filter *oldf, *newf, **storef;
 
-	jcode = NULL;
 	flen = fp->bf_len;
 
 	if ((fp->bf_insns == NULL && flen) || flen > BPF_MAXINSNS) {
@@ -1389,18 +1403,14 @@ bpf_setf(struct bpf_d *d, struct bpf_program *fp, u_long cmd)
 			kmem_free(fcode, size);
 			return EINVAL;
 		}
-		if (bpf_jit)
-			jcode = bpf_jit_generate(NULL, fcode, flen);
+		newf = bpf_get_filter(fcode, size);
 	} else {
-		fcode = NULL;
+		newf = kmem_zalloc(sizeof(*newf), KM_SLEEP);
+		newf->bf_refcnt = 1;
 	}
 
-	newf = kmem_alloc(sizeof(*newf), KM_SLEEP);
-	newf->bf_insn = fcode;
-	newf->bf_size = size;
-	newf->bf_jitcode = jcode;
 	if (cmd == BIOCSETF)
-		d->bd_jitcode = jcode; /* XXX just for kvm(3) users */
+		d->bd_jitcode = newf->bf_jitcode; /* XXX just for kvm(3) users */
 
 	/* Need to hold bpf_mtx for pserialize_perform */
 	mutex_enter(&bpf_mtx);
@@ -2124,11 +2134,33 @@ bpf_allocbufs(struct bpf_d *d)
 	return (0);
 }
 
-static void
-bpf_free_filter(struct bpf_filter *filter)
+/*
+ * Find a shared filter running the program fcode, with or without JIT
+ * code as requested, and take a reference to it.
+ */
+static struct bpf_filter *
+bpf_lookup_filter(const struct bpf_insn *fcode, size_t size, uint32_t hash,
+    bool jit)
 {
+	struct bpf_filter *filter;
 
-	KASSERT(filter != NULL);
+	KASSERT(mutex_owned(&bpf_filter_mtx));
+
+	LIST_FOREACH(filter, &bpf_filter_hash[hash & bpf_filter_hashmask],
+	    bf_hash) {
+		if (filter->bf_hashval == hash && filter->bf_size == size &&
+		    (filter->bf_jitcode != NULL) == jit &&
+		    memcmp(filter->bf_insn, fcode, size) == 0) {
+			filter->bf_refcnt++;
+			return filter;
+		}
+	}
+	return NULL;
+}
+
+static void
+bpf_destroy_filter(struct bpf_filter *filter)
+{
 
 	if (filter->bf_insn != NULL)
 		kmem_free(filter->bf_insn, filter->bf_size);
@@ -2137,6 +2169,76 @@ bpf_free_filter(struct bpf_filter *filter)
 	kmem_free(filter, sizeof(*filter));
 }
 
+/*
+ * Return a reference to a filter running the validated program fcode,
+ * which is size bytes long, taking over fcode.  If another descriptor
+ * has set the same program, share its filter, and with it the code
+ * the JIT compiler generated for it.
+ */
+static struct bpf_filter *
+bpf_get_filter(struct bpf_insn *fcode, size_t size)
+{
+	struct bpf_filter *filter, *newf;
+	uint32_t hash;
+	bool jit;
+
+	jit = bpf_jit &&
+	    atomic_load_relaxed(&bpfjit_module_ops.bj_generate_code) != NULL;
+	hash = hash32_buf(fcode, size, HASH32_BUF_INIT);
+
+	mutex_enter(&bpf_filter_mtx);
+	filter = bpf_lookup_filter(fcode, size, hash, jit);
+	mutex_exit(&bpf_filter_mtx);
+	if (filter != NULL) {
+		kmem_free(fcode, size);
+		return filter;
+	}
+
+	newf = kmem_alloc(sizeof(*newf), KM_SLEEP);
+	newf->bf_insn = fcode;
+	newf->bf_size = size;
+	newf->bf_jitcode = jit ?
+	    bpf_jit_generate(NULL, fcode, size / sizeof(*fcode)) : NULL;
+	newf->bf_hashval = hash;
+	newf->bf_refcnt = 1;
+
+	/* Someone may have set the same program meanwhile. */
+	mutex_enter(&bpf_filter_mtx);
+	filter = bpf_lookup_filter(fcode, size, hash,
+	    newf->bf_jitcode != NULL);
+	if (filter == NULL)
+		LIST_INSERT_HEAD(&bpf_filter_hash[hash & bpf_filter_hashmask],
+		    newf, bf_hash);
+	mutex_exit(&bpf_filter_mtx);
+	if (filter != NULL) {
+		bpf_destroy_filter(newf);
+		return filter;
+	}
+	return newf;
+}
+
+/*
+ * Drop a reference to a filter, freeing it with the last one.
+ */
+static void
+bpf_free_filter(struct bpf_filter *filter)
+{
+
+	KASSERT(filter != NULL);
+
+	mutex_enter(&bpf_filter_mtx);
+	KASSERT(filter->bf_refcnt > 0);
+	if (--filter->bf_refcnt > 0) {
+		mutex_exit(&bpf_filter_mtx);
+		return;
+	}
+	if (filter->bf_insn != NULL)
+		LIST_REMOVE(filter, bf_hash);
+	mutex_exit(&bpf_filter_mtx);
+
+	bpf_destroy_filter(filter);
+}
+
 /*
  * Free buffers currently in use by a descriptor.
  * Called on close.
@@ -56,6 +56,12 @@ struct bpf_filter {
 	struct bpf_insn *bf_insn; 	/* filter code */
 	size_t		bf_size;
 	bpfjit_func_t	bf_jitcode;	/* compiled filter program */
+#ifdef _KERNEL
+	/* Descriptors with identical programs share a filter */
+	LIST_ENTRY(bpf_filter) bf_hash;
+	uint32_t	bf_hashval;
+	u_int		bf_refcnt;
+#endif
 };
 
 /*
@@ -122,9 +122,7 @@ ether_sw_offload_tx(struct ifnet *ifp, struct mbuf *m)
 
 	if (flags & (M_CSUM_TSOv4 | M_CSUM_TSOv6)) {
 		/*
-		 * tcp[46]_segment() assume that size of payloads is
-		 * a multiple of MSS. Further, tcp6_segment() assumes
-		 * no extension headers.
+		 * tcp6_segment() assumes no extension headers.
 		 *
 		 * XXX Do we need some KASSERT's?
 		 */
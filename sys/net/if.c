@@ -3823,6 +3823,65 @@ if_transmit_lock(struct ifnet *ifp, struct mbuf *m)
 	return error;
 }
 
+/*
+ * Hand an array of packets to an interface.  Drivers which queue on
+ * if_snd get the whole array enqueued under a single acquisition of
+ * the queue lock and are started once; other drivers, and any when
+ * ALTQ is in use, have their if_transmit called per packet.  Every
+ * packet is consumed.  Returns the number of packets accepted.
+ */
+u_int
+if_transmit_lock_vec(struct ifnet *ifp, struct mbuf **mv, u_int n)
+{
+	struct ifqueue *ifq = &ifp->if_snd;
+	uint64_t obytes = 0, omcasts = 0;
+	u_int i, sent = 0;
+	int s;
+
+#ifndef ALTQ
+	if (ifp->if_transmit == if_transmit) {
+		s = splnet();
+		mutex_enter(ifq->ifq_lock);
+		for (i = 0; i < n; i++) {
+			struct mbuf *m = mv[i];
+
+			kmsan_check_mbuf(m);
+			if (IF_QFULL(ifq)) {
+				ifq->ifq_drops++;
+				m_freem(m);
+				continue;
+			}
+			obytes += m->m_pkthdr.len;
+			if (m->m_flags & M_MCAST)
+				omcasts++;
+			IF_ENQUEUE(ifq, m);
+			sent++;
+		}
+		mutex_exit(ifq->ifq_lock);
+
+		if (sent > 0) {
+			net_stat_ref_t nsr = IF_STAT_GETREF(ifp);
+			if_statadd_ref(nsr, if_obytes, obytes);
+			if_statadd_ref(nsr, if_omcasts, omcasts);
+			IF_STAT_PUTREF(ifp);
+
+			if ((ifp->if_flags & IFF_OACTIVE) == 0)
+				if_start_lock(ifp);
+		}
+		splx(s);
+
+		return sent;
+	}
+#endif /* !ALTQ */
+
+	for (i = 0; i < n; i++) {
+		if (if_transmit_lock(ifp, mv[i]) == 0)
+			sent++;
+	}
+
+	return sent;
+}
+
 /*
  * Queue message on interface, and start output if interface
  * not yet active.
@@ -1242,6 +1242,7 @@ void	if_clone_attach(struct if_clone *);
 void	if_clone_detach(struct if_clone *);
 
 int	if_transmit_lock(struct ifnet *, struct mbuf *);
+u_int	if_transmit_lock_vec(struct ifnet *, struct mbuf **, u_int);
 
 int	ifq_enqueue(struct ifnet *, struct mbuf *);
 int	ifq_enqueue2(struct ifnet *, struct ifqueue *, struct mbuf *);
@@ -161,6 +161,7 @@ do {									\
 struct mii_data;
 
 struct ethercom;
+struct vlan_vidtab;
 
 typedef int (*ether_cb_t)(struct ethercom *);
 typedef int (*ether_vlancb_t)(struct ethercom *, uint16_t, bool);
@@ -183,6 +184,12 @@ struct ethercom {
 
 	int	ec_nvlans;			/* # VLANs on this interface */
 	SIMPLEQ_HEAD(, vlanid_list) ec_vids;	/* list of VLAN IDs */
+	/*
+	 * vlan(4) interfaces on this interface indexed by VLAN ID, for
+	 * 802.1Q and 802.1ad tags.  Private to if_vlan.c.
+	 */
+	struct vlan_vidtab			*ec_vlantab;
+	struct vlan_vidtab			*ec_qinqtab;
 	/* The device handle for the MII bus child device. */
 	struct mii_data				*ec_mii;
 	struct ifmedia				*ec_ifmedia;
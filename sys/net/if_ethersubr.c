@@ -778,6 +778,25 @@ ether_input(struct ifnet *ifp, struct mbuf *m)
 	 * to ether_input().
 	 */
 
+#if NVLAN > 0
+	/*
+	 * 802.1ad service-tagged frames are handed over with the tag
+	 * still in place; vlan_input() strips it once it has found an
+	 * interface for it.
+	 */
+	if (__predict_false(etype == ETHERTYPE_QINQ) && !vlan_has_tag(m) &&
+	    ec->ec_nvlans > 0) {
+		m = vlan_input(ifp, m);
+
+		/* vlan_input() called ether_input() recursively */
+		if (m == NULL)
+			return;
+
+		/* drop service frames not for this port. */
+		goto noproto;
+	}
+#endif
+
 	if (vlan_has_tag(m)) {
 		if (EVL_VLANOFTAG(vlan_get_tag(m)) == 0) {
 			if (etype == ETHERTYPE_VLAN ||
@@ -1061,6 +1080,8 @@ ether_ifattach(struct ifnet *ifp, const uint8_t *lla)
 
 	LIST_INIT(&ec->ec_multiaddrs);
 	SIMPLEQ_INIT(&ec->ec_vids);
+	ec->ec_vlantab = NULL;
+	ec->ec_qinqtab = NULL;
 	ec->ec_lock = mutex_obj_alloc(MUTEX_DEFAULT, IPL_NET);
 	ec->ec_flags = 0;
 	ifp->if_broadcastaddr = etherbroadcastaddr;
@@ -1102,6 +1123,8 @@ ether_ifdetach(struct ifnet *ifp)
 
 	ETHER_LOCK(ec);
 	KASSERT(ec->ec_nvlans == 0);
+	KASSERT(ec->ec_vlantab == NULL);
+	KASSERT(ec->ec_qinqtab == NULL);
 	while ((enm = LIST_FIRST(&ec->ec_multiaddrs)) != NULL) {
 		LIST_REMOVE(enm, enm_list);
 		kmem_free(enm, sizeof(*enm));
@@ -1867,7 +1890,8 @@ ether_strip_vlantag(struct mbuf *m)
 	}
 
 	evl = mtod(m, struct ether_vlan_header *);
-	KASSERT(ntohs(evl->evl_encap_proto) == ETHERTYPE_VLAN);
+	KASSERT(ntohs(evl->evl_encap_proto) == ETHERTYPE_VLAN ||
+	    ntohs(evl->evl_encap_proto) == ETHERTYPE_QINQ);
 
 	vlan_set_tag(m, ntohs(evl->evl_tag));
 
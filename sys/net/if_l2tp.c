@@ -101,16 +101,33 @@ static struct {
 
 
 #if !defined(L2TP_ID_HASH_SIZE)
-#define L2TP_ID_HASH_SIZE 64
+#define L2TP_ID_HASH_SIZE 1024
 #endif
 static struct {
 	kmutex_t lock;
 	struct pslist_head *lists;
 	u_long mask;
+	u_int gen;		/* bumped whenever an entry is removed */
 } l2tp_hash __cacheline_aligned = {
 	.lists = NULL,
+	.gen = 1,
 };
 
+/*
+ * Per-CPU cache of recent input session lookups, direct-mapped by
+ * (outer source, session ID).  See the locking notes in if_l2tp.h.
+ */
+#if !defined(L2TP_SCACHE_SIZE)
+#define L2TP_SCACHE_SIZE 256	/* must be a power of 2 */
+#endif
+struct l2tp_scache_entry {
+	u_int se_gen;
+	uint32_t se_id;
+	uint32_t se_src;
+	struct l2tp_softc *se_sc;
+};
+static percpu_t *l2tp_scache_percpu __read_mostly;
+
 pserialize_t l2tp_psz __read_mostly;
 struct psref_class *lv_psref_class __read_mostly;
 
@@ -141,8 +158,11 @@ static int	l2tp_set_tunnel(struct ifnet *, struct sockaddr *,
 static void	l2tp_delete_tunnel(struct ifnet *);
 
 static int	id_hash_func(uint32_t, u_long);
+static struct l2tp_variant *
+		l2tp_lookup_session(uint32_t);
 
 static void	l2tp_variant_update(struct l2tp_softc *, struct l2tp_variant *);
+static void	l2tp_variant_hdr_init(struct l2tp_variant *);
 static int	l2tp_set_session(struct l2tp_softc *, uint32_t, uint32_t);
 static int	l2tp_clear_session(struct l2tp_softc *);
 static int	l2tp_set_cookie(struct l2tp_softc *, uint64_t, u_int, uint64_t, u_int);
@@ -202,6 +222,8 @@ l2tpinit(void)
 	LIST_INIT(&l2tp_softcs.list);
 
 	mutex_init(&l2tp_hash.lock, MUTEX_DEFAULT, IPL_NONE);
+	l2tp_scache_percpu = percpu_alloc(sizeof(struct l2tp_scache_entry) *
+	    L2TP_SCACHE_SIZE);
 	l2tp_psz = pserialize_create();
 	lv_psref_class = psref_class_create("l2tpvar", IPL_SOFTNET);
 	if_clone_attach(&l2tp_cloner);
@@ -228,6 +250,8 @@ l2tpdetach(void)
 	if_clone_detach(&l2tp_cloner);
 	psref_class_destroy(lv_psref_class);
 	pserialize_destroy(l2tp_psz);
+	percpu_free(l2tp_scache_percpu, sizeof(struct l2tp_scache_entry) *
+	    L2TP_SCACHE_SIZE);
 	mutex_destroy(&l2tp_hash.lock);
 
 	mutex_destroy(&l2tp_softcs.lock);
@@ -453,43 +477,58 @@ end:
 	return error;
 }
 
+/*
+ * Send a batch of frames linked through m_nextpkt.  The address family's
+ * output routine encapsulates them from the variant's header template,
+ * looks up the route once for the whole batch and does the output
+ * accounting.
+ */
 static void
 l2tp_sendit(struct l2tp_variant *var, struct mbuf *m)
 {
-	int len;
-	int error;
 	struct l2tp_softc *sc;
 	struct ifnet *ifp;
+	struct mbuf *n;
 
 	KASSERT(psref_held(&var->lv_psref, lv_psref_class));
 
 	sc = var->lv_softc;
 	ifp = &sc->l2tp_ec.ec_if;
 
-	len = m->m_pkthdr.len;
-	m->m_flags &= ~(M_BCAST|M_MCAST);
-	bpf_mtap(ifp, m, BPF_D_OUT);
+	for (n = m; n != NULL; n = n->m_nextpkt) {
+		n->m_flags &= ~(M_BCAST|M_MCAST);
+		bpf_mtap(ifp, n, BPF_D_OUT);
+	}
 
 	switch (var->lv_psrc->sa_family) {
 #ifdef INET
 	case AF_INET:
-		error = in_l2tp_output(var, m);
+		(void)in_l2tp_output(var, m);
 		break;
 #endif
 #ifdef INET6
 	case AF_INET6:
-		error = in6_l2tp_output(var, m);
+		(void)in6_l2tp_output(var, m);
 		break;
 #endif
 	default:
-		m_freem(m);
-		error = ENETDOWN;
+		l2tp_freem_batch(ifp, m);
 		break;
 	}
-	if (error) {
+}
+
+/*
+ * Free a batch of frames that could not be sent.
+ */
+void
+l2tp_freem_batch(struct ifnet *ifp, struct mbuf *m)
+{
+	struct mbuf *n;
+
+	for (; m != NULL; m = n) {
+		n = m->m_nextpkt;
+		m_freem(m);
 		if_statinc(ifp, if_oerrors);
-	} else {
-		if_statadd2(ifp, if_opackets, 1, if_obytes, len);
 	}
 }
 
@@ -498,7 +537,7 @@ l2tpintr(struct l2tp_variant *var)
 {
 	struct l2tp_softc *sc;
 	struct ifnet *ifp;
-	struct mbuf *m;
+	struct mbuf *m, *head, **tailp;
 	struct ifqueue *ifq;
 	u_int cpuid = cpu_index(curcpu());
 
@@ -517,26 +556,36 @@ l2tpintr(struct l2tp_variant *var)
 		return;
 	}
 
+	/*
+	 * Drain the queues into one batch, so that it is encapsulated
+	 * and routed in one go.
+	 */
+	head = NULL;
+	tailp = &head;
+
 	/* Currently, l2tpintr() is always called in softint context. */
 	ifq = l2tp_ifq_percpu_getref(sc->l2tp_ifq_percpu);
 	for (;;) {
 		IF_DEQUEUE(ifq, m);
-		if (m != NULL)
-			l2tp_sendit(var, m);
-		else
+		if (m == NULL)
 			break;
+		*tailp = m;
+		tailp = &m->m_nextpkt;
 	}
 	l2tp_ifq_percpu_putref(sc->l2tp_ifq_percpu);
 
 	if (cpuid == 0) {
 		for (;;) {
 			IFQ_DEQUEUE(&ifp->if_snd, m);
-			if (m != NULL)
-				l2tp_sendit(var, m);
-			else
+			if (m == NULL)
 				break;
+			*tailp = m;
+			tailp = &m->m_nextpkt;
 		}
 	}
+
+	if (head != NULL)
+		l2tp_sendit(var, head);
 }
 
 static void
@@ -1169,6 +1218,8 @@ l2tp_set_session(struct l2tp_softc *sc, uint32_t my_sess_id,
 	mutex_enter(&l2tp_hash.lock);
 	if (ovar->lv_my_sess_id > 0 && ovar->lv_peer_sess_id > 0) {
 		PSLIST_WRITER_REMOVE(sc, l2tp_hash);
+		/* invalidate the session lookup caches */
+		atomic_store_release(&l2tp_hash.gen, l2tp_hash.gen + 1);
 		pserialize_perform(l2tp_psz);
 	}
 	mutex_exit(&l2tp_hash.lock);
@@ -1209,6 +1260,8 @@ l2tp_clear_session(struct l2tp_softc *sc)
 	mutex_enter(&l2tp_hash.lock);
 	if (ovar->lv_my_sess_id > 0 && ovar->lv_peer_sess_id > 0) {
 		PSLIST_WRITER_REMOVE(sc, l2tp_hash);
+		/* invalidate the session lookup caches */
+		atomic_store_release(&l2tp_hash.gen, l2tp_hash.gen + 1);
 		pserialize_perform(l2tp_psz);
 	}
 	mutex_exit(&l2tp_hash.lock);
@@ -1219,16 +1272,18 @@ l2tp_clear_session(struct l2tp_softc *sc)
 	return 0;
 }
 
-struct l2tp_variant *
-l2tp_lookup_session_ref(uint32_t id, struct psref *psref)
+/*
+ * Find the variant whose local session ID is id.  The caller must be in
+ * a pserialize read section.
+ */
+static struct l2tp_variant *
+l2tp_lookup_session(uint32_t id)
 {
 	int idx;
-	int s;
 	struct l2tp_softc *sc;
 
 	idx = id_hash_func(id, l2tp_hash.mask);
 
-	s = pserialize_read_enter();
 	PSLIST_READER_FOREACH(sc, &l2tp_hash.lists[idx], struct l2tp_softc,
 	    l2tp_hash) {
 		struct l2tp_variant *var = atomic_load_consume(&sc->l2tp_var);
@@ -1236,12 +1291,66 @@ l2tp_lookup_session_ref(uint32_t id, struct psref *psref)
 			continue;
 		if (var->lv_my_sess_id != id)
 			continue;
+		return var;
+	}
+	return NULL;
+}
+
+struct l2tp_variant *
+l2tp_lookup_session_ref(uint32_t id, struct psref *psref)
+{
+	struct l2tp_variant *var;
+	int s;
+
+	s = pserialize_read_enter();
+	var = l2tp_lookup_session(id);
+	if (var != NULL)
 		psref_acquire(psref, &var->lv_psref, lv_psref_class);
+	pserialize_read_exit(s);
+	return var;
+}
+
+/*
+ * Like l2tp_lookup_session_ref(), for the input path: try this CPU's
+ * cache of recent lookups before the hash.  src is a digest of the
+ * outer source address.
+ */
+struct l2tp_variant *
+l2tp_lookup_session_cached_ref(uint32_t id, uint32_t src, struct psref *psref)
+{
+	struct l2tp_scache_entry *se;
+	struct l2tp_variant *var;
+	u_int gen;
+	int s;
+
+	s = pserialize_read_enter();
+	gen = atomic_load_acquire(&l2tp_hash.gen);
+	se = percpu_getref(l2tp_scache_percpu);
+	se += id_hash_func(id ^ src, L2TP_SCACHE_SIZE - 1);
+
+	if (se->se_sc != NULL && se->se_gen == gen && se->se_id == id &&
+	    se->se_src == src) {
+		/* The session ID may have been changed in place. */
+		var = atomic_load_consume(&se->se_sc->l2tp_var);
+		if (var != NULL && var->lv_my_sess_id == id)
+			goto found;
+	}
+
+	var = l2tp_lookup_session(id);
+	if (var == NULL) {
+		percpu_putref(l2tp_scache_percpu);
 		pserialize_read_exit(s);
-		return var;
+		return NULL;
 	}
+	se->se_gen = gen;
+	se->se_id = id;
+	se->se_src = src;
+	se->se_sc = var->lv_softc;
+found:
+	psref_acquire(psref, &var->lv_psref, lv_psref_class);
+	percpu_putref(l2tp_scache_percpu);
 	pserialize_read_exit(s);
-	return NULL;
+	return var;
 }
 
 /*
@@ -1260,6 +1369,8 @@ l2tp_variant_update(struct l2tp_softc *sc, struct l2tp_variant *nvar)
 
 	KASSERT(mutex_owned(&sc->l2tp_lock));
 
+	if (nvar != NULL)
+		l2tp_variant_hdr_init(nvar);
 	atomic_store_release(&sc->l2tp_var, nvar);
 	pserialize_perform(sc->l2tp_psz);
 	psref_target_destroy(&ovar->lv_psref, lv_psref_class);
@@ -1272,6 +1383,57 @@ l2tp_variant_update(struct l2tp_softc *sc, struct l2tp_variant *nvar)
 	}
 }
 
+/*
+ * Build the encapsulation header template of a variant that is about
+ * to be published.  It stays empty until both tunnel addresses are set.
+ */
+static void
+l2tp_variant_hdr_init(struct l2tp_variant *var)
+{
+	uint8_t *cp = var->lv_hdr;
+	uint32_t sess_id, cookie_32;
+	uint64_t cookie_64;
+
+	var->lv_hdrlen = 0;
+	if (var->lv_psrc == NULL || var->lv_pdst == NULL)
+		return;
+
+	switch (var->lv_psrc->sa_family) {
+#ifdef INET
+	case AF_INET:
+		cp += in_l2tp_hdr_init(var, cp);
+		break;
+#endif
+#ifdef INET6
+	case AF_INET6:
+		cp += in6_l2tp_hdr_init(var, cp);
+		break;
+#endif
+	default:
+		return;
+	}
+
+	/* session-ID */
+	sess_id = htonl(var->lv_peer_sess_id);
+	memcpy(cp, &sess_id, sizeof(sess_id));
+	cp += sizeof(sess_id);
+
+	/* session cookie */
+	if (var->lv_use_cookie == L2TP_COOKIE_ON) {
+		if (var->lv_peer_cookie_len == 4) {
+			cookie_32 = htonl((uint32_t)var->lv_peer_cookie);
+			memcpy(cp, &cookie_32, sizeof(cookie_32));
+		} else {
+			cookie_64 = htobe64(var->lv_peer_cookie);
+			memcpy(cp, &cookie_64, sizeof(cookie_64));
+		}
+		cp += var->lv_peer_cookie_len;
+	}
+
+	var->lv_hdrlen = cp - var->lv_hdr;
+	KASSERT(var->lv_hdrlen <= sizeof(var->lv_hdr));
+}
+
 static int
 l2tp_set_cookie(struct l2tp_softc *sc, uint64_t my_cookie, u_int my_cookie_len,
     uint64_t peer_cookie, u_int peer_cookie_len)
@@ -70,6 +70,9 @@ struct l2tp_req {
 #ifdef _KERNEL
 extern struct psref_class *lv_psref_class;
 
+/* IPv6 header + session ID + 64bit cookie */
+#define	L2TP_HDR_MAX	(40 + sizeof(uint32_t) + sizeof(uint64_t))
+
 struct l2tp_variant {
 	struct l2tp_softc *lv_softc;
 
@@ -88,6 +91,14 @@ struct l2tp_variant {
 	uint64_t lv_my_cookie;		/* my cookie */
 	uint64_t lv_peer_cookie;	/* peer cookie */
 
+	/*
+	 * Encapsulation header template, rebuilt by l2tp_variant_update():
+	 * the outer IP header with everything but the length filled in,
+	 * then the peer session ID and cookie.
+	 */
+	u_int lv_hdrlen;
+	uint8_t lv_hdr[L2TP_HDR_MAX];
+
 	struct psref_target lv_psref;
 };
 
@@ -166,7 +177,10 @@ void l2tp_input(struct mbuf *, struct ifnet *);
 int l2tp_ioctl(struct ifnet *, u_long, void *);
 
 struct l2tp_variant *l2tp_lookup_session_ref(uint32_t, struct psref *);
+struct l2tp_variant *l2tp_lookup_session_cached_ref(uint32_t, uint32_t,
+    struct psref *);
 int l2tp_check_nesting(struct ifnet *, struct mbuf *);
+void l2tp_freem_batch(struct ifnet *, struct mbuf *);
 
 /* TODO IP_TCPMSS support */
 #ifdef IP_TCPMSS
@@ -184,6 +198,10 @@ struct mbuf *l2tp_tcpmss_clamp(struct ifnet *, struct mbuf *);
  *   - pserialize for reader
  *       l2tp_hashed_list is hashed list of all l2tp_softcs, and it is used by
  *       input processing to find appropriate softc.
+ * + the per-CPU session lookup cache is only accessed by its own CPU with
+ *   preemption disabled.  Its entries are valid as long as the generation
+ *   number of l2tp_hashed_list they were made in is current, which the
+ *   writer bumps before pserialize_perform() on every removal.
  * + l2tp_softc->l2tp_var is protected by
  *   - l2tp_softc->l2tp_lock (an adaptive mutex) for writer
  *   - l2tp_var->lv_psref for reader
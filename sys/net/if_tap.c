@@ -37,6 +37,7 @@ __KERNEL_RCSID(0, "$NetBSD: if_tap.c,v 1.132 2024/04/17 18:52:54 riastradh Exp $
 
 #if defined(_KERNEL_OPT)
 
+#include "opt_inet.h"
 #include "opt_modular.h"
 #endif
 
@@ -67,6 +68,20 @@ __KERNEL_RCSID(0, "$NetBSD: if_tap.c,v 1.132 2024/04/17 18:52:54 riastradh Exp $
 #include <net/if_ether.h>
 #include <net/if_tap.h>
 #include <net/bpf.h>
+#include <net/ether_sw_offload.h>
+#include <net/rss_config.h>
+#include <net/toeplitz.h>
+
+#include <netinet/in.h>
+#include <netinet/in_offload.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+#ifdef INET6
+#include <netinet/ip6.h>
+#include <netinet6/in6_offload.h>
+#endif
 
 #include "ioconf.h"
 
@@ -88,22 +103,47 @@ static int	tap_node;
 static int	tap_sysctl_handler(SYSCTLFN_PROTO);
 static void	sysctl_tap_setup(struct sysctllog **);
 
+/*
+ * Every descriptor reading from the device has a queue.  Queue 0 belongs
+ * to whoever opened or cloned the device, and reads straight off if_snd
+ * as long as it is alone.  Further queues are handed out by TAPADDQUEUE;
+ * once there are any, tap_start() spreads if_snd over all of them by
+ * RSS hash.  tq_ready holds frames that have already been through bpf
+ * and pfil, e.g. the tail of a software-segmented TSO frame.
+ */
+struct tap_queue {
+	struct tap_softc *tq_sc;
+	struct ifqueue	tq_q;		/* frames steered to this queue */
+	struct ifqueue	tq_ready;	/* frames ready to be read */
+	kcondvar_t	tq_cv;
+	struct selinfo	tq_rsel;
+	file_t		*tq_fp;		/* owning descriptor, for queues > 0 */
+	int		tq_flags;
+#define	TAPQ_ATTACHED	0x00000001	/* queue has a reader */
+#define	TAPQ_NBIO	0x00000002	/* user wants calls to avoid blocking */
+};
+
+#define	TAP_MAXQUEUES	16
+
 struct tap_softc {
 	device_t	sc_dev;
 	struct ethercom	sc_ec;
 	int		sc_flags;
 #define	TAP_INUSE	0x00000001	/* tap device can only be opened once */
 #define TAP_ASYNCIO	0x00000002	/* user is using async I/O (SIGIO) on the device */
-#define TAP_NBIO	0x00000004	/* user wants calls to avoid blocking */
 #define TAP_GOING	0x00000008	/* interface is being destroyed */
-	struct selinfo	sc_rsel;
+	int		sc_uflags;	/* TAP_F_* set by TAPSFLAGS */
 	pid_t		sc_pgid; /* For async. IO */
 	kmutex_t	sc_lock;
-	kcondvar_t	sc_cv;
 	void		*sc_sih;
 	struct timespec sc_atime;
 	struct timespec sc_mtime;
 	struct timespec sc_btime;
+	struct tap_queue sc_queues[TAP_MAXQUEUES];
+	u_int		sc_qmap[TAP_MAXQUEUES];	/* attached queues */
+	u_int		sc_nqueues;
+	u_int		sc_busy;	/* threads in tap_dev_read/write */
+	kcondvar_t	sc_busycv;
 };
 
 /* autoconf(9) glue */
@@ -117,12 +157,16 @@ CFATTACH_DECL_NEW(tap, sizeof(struct tap_softc),
 extern struct cfdriver tap_cd;
 
 /* Real device access routines */
+static struct tap_softc *tap_lookup(int, file_t *, struct tap_queue **);
 static void	tap_dev_close(struct tap_softc *);
-static int	tap_dev_read(int, struct uio *, int);
-static int	tap_dev_write(int, struct uio *, int);
-static int	tap_dev_ioctl(int, u_long, void *, struct lwp *);
-static int	tap_dev_poll(int, int, struct lwp *);
-static int	tap_dev_kqfilter(int, struct knote *);
+static int	tap_dev_read(struct tap_softc *, struct tap_queue *,
+    struct uio *, int);
+static int	tap_dev_write(struct tap_softc *, struct uio *, int);
+static int	tap_dev_ioctl(struct tap_softc *, struct tap_queue *, u_long,
+    void *, struct lwp *);
+static int	tap_dev_poll(struct tap_softc *, struct tap_queue *, int,
+    struct lwp *);
+static int	tap_dev_kqfilter(struct tap_queue *, struct knote *);
 
 /* Fileops access routines */
 static int	tap_fops_close(file_t *);
@@ -177,6 +221,14 @@ const struct cdevsw tap_cdevsw = {
 
 #define TAP_CLONER	0xfffff		/* Maximal minor value */
 
+/*
+ * Descriptors for additional queues carry the queue index above the
+ * unit number in f_devunit.
+ */
+#define	TAP_UNIT(devunit)	((devunit) & TAP_CLONER)
+#define	TAP_QUEUE(devunit)	((u_int)(devunit) >> 20)
+#define	TAP_DEVUNIT(unit, q)	((unit) | ((q) << 20))
+
 /* kqueue-related routines */
 static void	tap_kqdetach(struct knote *);
 static int	tap_kqread(struct knote *, long);
@@ -194,6 +246,29 @@ static int	tap_ioctl(struct ifnet *, u_long, void *);
 /* Internal functions */
 static int	tap_lifaddr(struct ifnet *, u_long, struct ifaliasreq *);
 static void	tap_softintr(void *);
+static void	tap_wakeup(struct tap_softc *, struct tap_queue *);
+static u_int	tap_select_queue(struct tap_softc *, struct mbuf *);
+static int	tap_enter(struct tap_softc *);
+static void	tap_exit(struct tap_softc *);
+static void	tap_queue_remap(struct tap_softc *);
+static void	tap_queue_attach(struct tap_softc *, struct tap_queue *,
+    file_t *);
+static void	tap_queue_detach(struct tap_softc *, struct tap_queue *);
+static int	tap_queue_add(struct tap_softc *, int *);
+static int	tap_queue_peek(struct tap_softc *, struct tap_queue *);
+static void	tap_requeue(struct tap_softc *, struct tap_queue *,
+    struct mbuf *);
+static int	tap_dequeue(struct tap_softc *, struct tap_queue *,
+    struct mbuf **);
+static int	tap_copyout(struct tap_softc *, struct mbuf *, struct uio *);
+static int	tap_read_batch(struct tap_softc *, struct tap_queue *,
+    struct uio *);
+static int	tap_write_frame(struct tap_softc *, struct uio *, size_t);
+static int	tap_parse(struct mbuf *, uint16_t *, uint8_t *, int *);
+static void	tap_vnet_hdr_encode(struct ifnet *, struct mbuf *,
+    struct tap_vnet_hdr *);
+static int	tap_vnet_hdr_decode(struct ifnet *, const struct tap_vnet_hdr *,
+    struct mbuf **);
 
 /*
  * tap is a clonable interface, although it is highly unrealistic for
@@ -287,9 +362,11 @@ void
 tap_attach(device_t parent, device_t self, void *aux)
 {
 	struct tap_softc *sc = device_private(self);
+	struct tap_queue *tq;
 	struct ifnet *ifp;
 	const struct sysctlnode *node;
 	int error;
+	u_int q;
 	uint8_t enaddr[ETHER_ADDR_LEN] =
 	    { 0xf2, 0x0b, 0xa4, 0xff, 0xff, 0xff };
 	char enaddrstr[3 * ETHER_ADDR_LEN];
@@ -299,9 +376,19 @@ tap_attach(device_t parent, device_t self, void *aux)
 	getnanotime(&sc->sc_btime);
 	sc->sc_atime = sc->sc_mtime = sc->sc_btime;
 	sc->sc_flags = 0;
-	selinit(&sc->sc_rsel);
+	sc->sc_uflags = 0;
+	for (q = 0; q < TAP_MAXQUEUES; q++) {
+		tq = &sc->sc_queues[q];
+		tq->tq_sc = sc;
+		tq->tq_q.ifq_maxlen = ifqmaxlen;
+		tq->tq_ready.ifq_maxlen = ifqmaxlen;
+		selinit(&tq->tq_rsel);
+		cv_init(&tq->tq_cv, "tapread");
+	}
+	sc->sc_nqueues = 0;
+	sc->sc_busy = 0;
 
-	cv_init(&sc->sc_cv, "tapread");
+	cv_init(&sc->sc_busycv, "tapbusy");
 	mutex_init(&sc->sc_lock, MUTEX_DEFAULT, IPL_NET);
 
 	if (!pmf_device_register(self, NULL, NULL))
@@ -336,6 +423,17 @@ tap_attach(device_t parent, device_t self, void *aux)
 
 	sc->sc_ec.ec_capabilities = ETHERCAP_VLAN_MTU | ETHERCAP_JUMBO_MTU;
 
+	/*
+	 * Offloads are handed to readers using TAP_F_VNETHDR and done in
+	 * software for everybody else; see tap_dequeue().
+	 */
+	ifp->if_capabilities =
+	    IFCAP_CSUM_TCPv4_Tx | IFCAP_CSUM_TCPv4_Rx |
+	    IFCAP_CSUM_UDPv4_Tx | IFCAP_CSUM_UDPv4_Rx |
+	    IFCAP_CSUM_TCPv6_Tx | IFCAP_CSUM_TCPv6_Rx |
+	    IFCAP_CSUM_UDPv6_Tx | IFCAP_CSUM_UDPv6_Rx |
+	    IFCAP_TSOv4 | IFCAP_TSOv6;
+
 	/* Those steps are mandatory for an Ethernet driver. */
 	if_initialize(ifp);
 	ifp->if_percpuq = if_percpuq_create(ifp);
@@ -377,12 +475,20 @@ tap_detach(device_t self, int flags)
 {
 	struct tap_softc *sc = device_private(self);
 	struct ifnet *ifp = &sc->sc_ec.ec_if;
+	struct tap_queue *tq;
 	int error;
+	u_int q;
 
 	sc->sc_flags |= TAP_GOING;
 	tap_stop(ifp, 1);
 	if_down(ifp);
 
+	/* Wait for the readers woken up by tap_stop to leave. */
+	mutex_enter(&sc->sc_lock);
+	while (sc->sc_busy != 0)
+		cv_wait(&sc->sc_busycv, &sc->sc_lock);
+	mutex_exit(&sc->sc_lock);
+
 	if (sc->sc_sih != NULL) {
 		softint_disestablish(sc->sc_sih);
 		sc->sc_sih = NULL;
@@ -399,9 +505,15 @@ tap_detach(device_t self, int flags)
 		    "sysctl_destroyv returned %d, ignoring\n", error);
 	ether_ifdetach(ifp);
 	if_detach(ifp);
-	seldestroy(&sc->sc_rsel);
+	for (q = 0; q < TAP_MAXQUEUES; q++) {
+		tq = &sc->sc_queues[q];
+		IF_PURGE(&tq->tq_q);
+		IF_PURGE(&tq->tq_ready);
+		seldestroy(&tq->tq_rsel);
+		cv_destroy(&tq->tq_cv);
+	}
 	mutex_destroy(&sc->sc_lock);
-	cv_destroy(&sc->sc_cv);
+	cv_destroy(&sc->sc_busycv);
 
 	pmf_device_deregister(self);
 
@@ -439,7 +551,10 @@ static void
 tap_start(struct ifnet *ifp)
 {
 	struct tap_softc *sc = (struct tap_softc *)ifp->if_softc;
+	struct tap_queue *tq;
 	struct mbuf *m0;
+	uint32_t pending;
+	u_int q;
 
 	mutex_enter(&sc->sc_lock);
 	if ((sc->sc_flags & TAP_INUSE) == 0) {
@@ -454,20 +569,103 @@ tap_start(struct ifnet *ifp)
 
 			m_freem(m0);
 		}
+	} else if (sc->sc_nqueues > 1) {
+		/*
+		 * With several readers, steer each frame to a queue
+		 * right away, the way a multiqueue NIC would.
+		 */
+		ifp->if_flags &= ~IFF_OACTIVE;
+		pending = 0;
+		for (;;) {
+			IFQ_DEQUEUE(&ifp->if_snd, m0);
+			if (m0 == NULL)
+				break;
+
+			q = tap_select_queue(sc, m0);
+			tq = &sc->sc_queues[q];
+			if (IF_QFULL(&tq->tq_q)) {
+				IF_DROP(&tq->tq_q);
+				if_statinc(ifp, if_oerrors);
+				m_freem(m0);
+				continue;
+			}
+			IF_ENQUEUE(&tq->tq_q, m0);
+			pending |= __BIT(q);
+		}
+		for (q = 0; pending != 0; q++, pending >>= 1) {
+			if (pending & 1)
+				tap_wakeup(sc, &sc->sc_queues[q]);
+		}
 	} else if (!IFQ_IS_EMPTY(&ifp->if_snd)) {
 		ifp->if_flags |= IFF_OACTIVE;
-		cv_broadcast(&sc->sc_cv);
-		selnotify(&sc->sc_rsel, 0, 1);
-		if (sc->sc_flags & TAP_ASYNCIO) {
-			kpreempt_disable();
-			softint_schedule(sc->sc_sih);
-			kpreempt_enable();
-		}
+		tap_wakeup(sc, &sc->sc_queues[0]);
 	}
 done:
 	mutex_exit(&sc->sc_lock);
 }
 
+/*
+ * Let the reader(s) of a queue know there is something to read.  Called
+ * with sc_lock held.
+ */
+static void
+tap_wakeup(struct tap_softc *sc, struct tap_queue *tq)
+{
+
+	KASSERT(mutex_owned(&sc->sc_lock));
+
+	cv_broadcast(&tq->tq_cv);
+	selnotify(&tq->tq_rsel, 0, 1);
+	if (sc->sc_flags & TAP_ASYNCIO) {
+		kpreempt_disable();
+		softint_schedule(sc->sc_sih);
+		kpreempt_enable();
+	}
+}
+
+/*
+ * Pick the queue for an outgoing frame the way an RSS capable NIC
+ * would: Toeplitz hash of the addresses and, for TCP and UDP, the
+ * ports.  Everything else goes to the first queue.
+ */
+static u_int
+tap_select_queue(struct tap_softc *sc, struct mbuf *m)
+{
+	uint8_t key[RSS_KEYSIZE];
+	uint8_t buf[2 * sizeof(struct in6_addr) + 2 * sizeof(uint16_t)];
+	uint16_t etype;
+	uint8_t proto;
+	size_t len;
+	int off, l4off;
+
+	KASSERT(sc->sc_nqueues > 0);
+
+	if ((off = tap_parse(m, &etype, &proto, &l4off)) < 0)
+		return sc->sc_qmap[0];
+
+#ifdef INET6
+	if (etype == ETHERTYPE_IPV6) {
+		len = 2 * sizeof(struct in6_addr);
+		m_copydata(m, off + offsetof(struct ip6_hdr, ip6_src), len,
+		    buf);
+	} else
+#endif
+	{
+		len = 2 * sizeof(struct in_addr);
+		m_copydata(m, off + offsetof(struct ip, ip_src), len, buf);
+	}
+
+	if ((proto == IPPROTO_TCP || proto == IPPROTO_UDP) &&
+	    m->m_pkthdr.len >= l4off + 2 * sizeof(uint16_t)) {
+		m_copydata(m, l4off, 2 * sizeof(uint16_t), buf + len);
+		len += 2 * sizeof(uint16_t);
+	}
+
+	rss_getkey(key);
+	return sc->sc_qmap[toeplitz_vhash(key, sizeof(key), buf, len, NULL) %
+	    sc->sc_nqueues];
+}
+
 static void
 tap_softintr(void *cookie)
 {
@@ -565,11 +763,16 @@ static void
 tap_stop(struct ifnet *ifp, int disable)
 {
 	struct tap_softc *sc = (struct tap_softc *)ifp->if_softc;
+	struct tap_queue *tq;
+	u_int q;
 
 	mutex_enter(&sc->sc_lock);
 	ifp->if_flags &= ~IFF_RUNNING;
-	cv_broadcast(&sc->sc_cv);
-	selnotify(&sc->sc_rsel, 0, 1);
+	for (q = 0; q < TAP_MAXQUEUES; q++) {
+		tq = &sc->sc_queues[q];
+		cv_broadcast(&tq->tq_cv);
+		selnotify(&tq->tq_rsel, 0, 1);
+	}
 	if (sc->sc_flags & TAP_ASYNCIO) {
 		kpreempt_disable();
 		softint_schedule(sc->sc_sih);
@@ -684,6 +887,9 @@ tap_cdev_open(dev_t dev, int flags, int fmt, struct lwp *l)
 	if (sc->sc_flags & TAP_INUSE)
 		return EBUSY;
 	sc->sc_flags |= TAP_INUSE;
+	mutex_enter(&sc->sc_lock);
+	tap_queue_attach(sc, &sc->sc_queues[0], NULL);
+	mutex_exit(&sc->sc_lock);
 	if_link_state_change(&sc->sc_ec.ec_if, LINK_STATE_UP);
 
 	return 0;
@@ -727,6 +933,9 @@ tap_dev_cloner(struct lwp *l)
 	}
 
 	sc->sc_flags |= TAP_INUSE;
+	mutex_enter(&sc->sc_lock);
+	tap_queue_attach(sc, &sc->sc_queues[0], NULL);
+	mutex_exit(&sc->sc_lock);
 	if_link_state_change(&sc->sc_ec.ec_if, LINK_STATE_UP);
 
 	return fd_clone(fp, fd, FREAD | FWRITE, &tap_fileops,
@@ -765,8 +974,21 @@ static int
 tap_fops_close(file_t *fp)
 {
 	struct tap_softc *sc;
+	struct tap_queue *tq;
 	int unit = fp->f_devunit;
 
+	/* Closing an additional queue leaves the device alone. */
+	if (TAP_QUEUE(unit) != 0) {
+		sc = tap_lookup(unit, fp, &tq);
+		if (sc != NULL) {
+			mutex_enter(&sc->sc_lock);
+			if (tq->tq_fp == fp)
+				tap_queue_detach(sc, tq);
+			mutex_exit(&sc->sc_lock);
+		}
+		return 0;
+	}
+
 	sc = device_lookup_private(&tap_cd, unit);
 	if (sc == NULL)
 		return ENXIO;
@@ -790,8 +1012,17 @@ static void
 tap_dev_close(struct tap_softc *sc)
 {
 	struct ifnet *ifp;
+	u_int q;
 	int s;
 
+	/* Additional queues go away with the device's own descriptor. */
+	mutex_enter(&sc->sc_lock);
+	for (q = 0; q < TAP_MAXQUEUES; q++) {
+		if (sc->sc_queues[q].tq_flags & TAPQ_ATTACHED)
+			tap_queue_detach(sc, &sc->sc_queues[q]);
+	}
+	mutex_exit(&sc->sc_lock);
+
 	s = splnet();
 	/* Let tap_start handle packets again */
 	ifp = &sc->sc_ec.ec_if;
@@ -821,91 +1052,420 @@ tap_dev_close(struct tap_softc *sc)
 	if_link_state_change(ifp, LINK_STATE_DOWN);
 }
 
+/*
+ * Find the device and queue behind a descriptor; the cdevsw interface
+ * only ever uses queue 0.  A descriptor for an additional queue stops
+ * working once its queue has been torn down by tap_dev_close.
+ */
+static struct tap_softc *
+tap_lookup(int devunit, file_t *fp, struct tap_queue **tqp)
+{
+	struct tap_softc *sc;
+	u_int q = TAP_QUEUE(devunit);
+
+	if (q >= TAP_MAXQUEUES)
+		return NULL;
+	sc = device_lookup_private(&tap_cd, TAP_UNIT(devunit));
+	if (sc == NULL)
+		return NULL;
+	if (q != 0 && sc->sc_queues[q].tq_fp != fp)
+		return NULL;
+
+	*tqp = &sc->sc_queues[q];
+	return sc;
+}
+
+/*
+ * Readers and writers are counted in sc_busy, so that tap_detach can
+ * wait for them to leave before the softc goes away.
+ */
 static int
-tap_cdev_read(dev_t dev, struct uio *uio, int flags)
+tap_enter(struct tap_softc *sc)
+{
+
+	mutex_enter(&sc->sc_lock);
+	if (sc->sc_flags & TAP_GOING) {
+		mutex_exit(&sc->sc_lock);
+		return ENXIO;
+	}
+	sc->sc_busy++;
+	mutex_exit(&sc->sc_lock);
+	return 0;
+}
+
+static void
+tap_exit(struct tap_softc *sc)
 {
 
-	return tap_dev_read(minor(dev), uio, flags);
+	mutex_enter(&sc->sc_lock);
+	if (--sc->sc_busy == 0)
+		cv_broadcast(&sc->sc_busycv);
+	mutex_exit(&sc->sc_lock);
 }
 
+/*
+ * Queue management.  The following are called with sc_lock held.
+ */
+static void
+tap_queue_remap(struct tap_softc *sc)
+{
+	u_int q;
+
+	KASSERT(mutex_owned(&sc->sc_lock));
+
+	sc->sc_nqueues = 0;
+	for (q = 0; q < TAP_MAXQUEUES; q++) {
+		if (sc->sc_queues[q].tq_flags & TAPQ_ATTACHED)
+			sc->sc_qmap[sc->sc_nqueues++] = q;
+	}
+}
+
+static void
+tap_queue_attach(struct tap_softc *sc, struct tap_queue *tq, file_t *fp)
+{
+
+	KASSERT(mutex_owned(&sc->sc_lock));
+	KASSERT((tq->tq_flags & TAPQ_ATTACHED) == 0);
+
+	tq->tq_fp = fp;
+	tq->tq_flags = TAPQ_ATTACHED;
+	tap_queue_remap(sc);
+}
+
+static void
+tap_queue_detach(struct tap_softc *sc, struct tap_queue *tq)
+{
+
+	KASSERT(mutex_owned(&sc->sc_lock));
+
+	tq->tq_fp = NULL;
+	tq->tq_flags = 0;
+	IF_PURGE(&tq->tq_q);
+	IF_PURGE(&tq->tq_ready);
+	cv_broadcast(&tq->tq_cv);
+	selnotify(&tq->tq_rsel, 0, 1);
+	tap_queue_remap(sc);
+}
+
+/*
+ * Length of the next frame a queue would return, or 0.  Without
+ * sc_lock held, the answer may be stale by the time it is used.
+ */
 static int
-tap_fops_read(file_t *fp, off_t *offp, struct uio *uio,
-    kauth_cred_t cred, int flags)
+tap_queue_peek(struct tap_softc *sc, struct tap_queue *tq)
 {
-	int error;
+	struct mbuf *m;
 
-	KERNEL_LOCK(1, NULL);
-	error = tap_dev_read(fp->f_devunit, uio, flags);
-	KERNEL_UNLOCK_ONE(NULL);
+	IF_POLL(&tq->tq_ready, m);
+	if (m == NULL)
+		IF_POLL(&tq->tq_q, m);
+	if (m == NULL && sc->sc_nqueues <= 1)
+		IFQ_POLL(&sc->sc_ec.ec_if.if_snd, m);
+
+	return m == NULL ? 0 : m->m_pkthdr.len;
+}
+
+/*
+ * TAPADDQUEUE: hand out a new descriptor with its own queue on the
+ * device.  It can be used like the original one, except that closing
+ * it only removes the queue.
+ */
+static int
+tap_queue_add(struct tap_softc *sc, int *fdp)
+{
+	file_t *fp;
+	int error, fd;
+	u_int q;
+
+	if ((error = fd_allocfile(&fp, &fd)) != 0)
+		return error;
+
+	mutex_enter(&sc->sc_lock);
+	if ((sc->sc_flags & (TAP_INUSE | TAP_GOING)) != TAP_INUSE) {
+		error = ENXIO;
+		goto fail;
+	}
+	for (q = 1; q < TAP_MAXQUEUES; q++) {
+		if ((sc->sc_queues[q].tq_flags & TAPQ_ATTACHED) == 0)
+			break;
+	}
+	if (q == TAP_MAXQUEUES) {
+		error = ENOSPC;
+		goto fail;
+	}
+	tap_queue_attach(sc, &sc->sc_queues[q], fp);
+	mutex_exit(&sc->sc_lock);
+
+	fp->f_flag = FREAD | FWRITE;
+	fp->f_type = DTYPE_MISC;
+	fp->f_ops = &tap_fileops;
+	fp->f_devunit = TAP_DEVUNIT(device_unit(sc->sc_dev), q);
+	fd_affix(curproc, fp, fd);
+	*fdp = fd;
+
+	/* Spread out whatever is already waiting in if_snd. */
+	tap_start(&sc->sc_ec.ec_if);
+	return 0;
+
+fail:
+	mutex_exit(&sc->sc_lock);
+	fd_abort(curproc, fp, fd);
 	return error;
 }
 
+/*
+ * Put frames that have already been through tap_dequeue back at the
+ * head of a queue, in order.
+ */
+static void
+tap_requeue(struct tap_softc *sc, struct tap_queue *tq, struct mbuf *m)
+{
+	struct mbuf *last;
+	int len;
+
+	mutex_enter(&sc->sc_lock);
+	if ((tq->tq_flags & TAPQ_ATTACHED) == 0) {
+		mutex_exit(&sc->sc_lock);
+		for (; m != NULL; m = last) {
+			last = m->m_nextpkt;
+			m_freem(m);
+		}
+		return;
+	}
+
+	for (last = m, len = 1; last->m_nextpkt != NULL; last = last->m_nextpkt)
+		len++;
+	last->m_nextpkt = tq->tq_ready.ifq_head;
+	if (tq->tq_ready.ifq_tail == NULL)
+		tq->tq_ready.ifq_tail = last;
+	tq->tq_ready.ifq_head = m;
+	tq->tq_ready.ifq_len += len;
+	mutex_exit(&sc->sc_lock);
+}
+
+/*
+ * Does the stack expect an offload on this frame that tap(4) agreed
+ * to?  Then the reader, or tap_dequeue on its behalf, has to do it.
+ */
+#define	TAP_CSUM_TX	(M_CSUM_TCPv4 | M_CSUM_UDPv4 | M_CSUM_TCPv6 | \
+			 M_CSUM_UDPv6 | M_CSUM_TSOv4 | M_CSUM_TSOv6)
+#define	TAP_NEEDS_OFFLOAD(ifp, m)					\
+	(((m)->m_pkthdr.csum_flags & TAP_CSUM_TX) != 0 &&		\
+	 TX_OFFLOAD_SUPPORTED((ifp)->if_csum_flags_tx, (m)->m_pkthdr.csum_flags))
+
+/*
+ * Take the next frame for a queue and run it past bpf(4) and pfil(9),
+ * unless it is on tq_ready and has been already.  Returns EWOULDBLOCK
+ * when there is nothing to read; *mp is left NULL if a filter ate the
+ * frame.
+ */
 static int
-tap_dev_read(int unit, struct uio *uio, int flags)
+tap_dequeue(struct tap_softc *sc, struct tap_queue *tq, struct mbuf **mp)
 {
-	struct tap_softc *sc = device_lookup_private(&tap_cd, unit);
-	struct ifnet *ifp;
+	struct ifnet *ifp = &sc->sc_ec.ec_if;
 	struct mbuf *m, *n;
+	bool ready;
+	int error;
+
+	*mp = NULL;
+
+	mutex_enter(&sc->sc_lock);
+	IF_DEQUEUE(&tq->tq_ready, m);
+	ready = (m != NULL);
+	if (m == NULL)
+		IF_DEQUEUE(&tq->tq_q, m);
+	mutex_exit(&sc->sc_lock);
+
+	if (m == NULL && sc->sc_nqueues <= 1)
+		IFQ_DEQUEUE(&ifp->if_snd, m);
+
+	ifp->if_flags &= ~IFF_OACTIVE;
+	if (m == NULL)
+		return EWOULDBLOCK;
+
+	if (!ready) {
+		if_statadd2(ifp, if_opackets, 1, if_obytes, m->m_pkthdr.len);
+		bpf_mtap(ifp, m, BPF_D_OUT);
+		error = pfil_run_hooks(ifp->if_pfil, &m, ifp, PFIL_OUT);
+		if (error != 0 || m == NULL)
+			return error;
+	}
+
+	/*
+	 * Unless the reader takes a struct tap_vnet_hdr, do the checksum
+	 * and segmentation offloads here.  TSO turns the frame into
+	 * several; the rest wait on tq_ready.
+	 */
+	if ((sc->sc_uflags & TAP_F_VNETHDR) == 0 &&
+	    TAP_NEEDS_OFFLOAD(ifp, m)) {
+		m = ether_sw_offload_tx(ifp, m);
+		if (m == NULL)
+			return 0;
+		if ((n = m->m_nextpkt) != NULL) {
+			m->m_nextpkt = NULL;
+			tap_requeue(sc, tq, n);
+		}
+	}
+
+	*mp = m;
+	return 0;
+}
+
+/*
+ * Copy a frame out to the user, preceded by its struct tap_vnet_hdr in
+ * TAP_F_VNETHDR mode, truncating it to the space available.  The frame
+ * is freed.
+ */
+static int
+tap_copyout(struct tap_softc *sc, struct mbuf *m, struct uio *uio)
+{
+	struct tap_vnet_hdr vh;
 	int error = 0;
 
-	if (sc == NULL)
+	if (sc->sc_uflags & TAP_F_VNETHDR) {
+		tap_vnet_hdr_encode(&sc->sc_ec.ec_if, m, &vh);
+		error = uiomove(&vh, uimin(sizeof(vh), uio->uio_resid), uio);
+	}
+
+	while (m != NULL && uio->uio_resid > 0 && error == 0) {
+		error = uiomove(mtod(m, void *),
+		    uimin(m->m_len, uio->uio_resid), uio);
+		m = m_free(m);
+	}
+
+	if (m != NULL)
+		m_freem(m);
+	return error;
+}
+
+/*
+ * TAP_F_BATCH read: as many frames as fit, each behind a struct
+ * tap_batch_hdr.  The first frame is truncated if it does not fit, as
+ * it would be by a plain read; later ones are left for the next call.
+ */
+static int
+tap_read_batch(struct tap_softc *sc, struct tap_queue *tq, struct uio *uio)
+{
+	static const uint8_t pad[TAP_ALIGNMENT];
+	struct tap_batch_hdr tb;
+	struct mbuf *m;
+	size_t hlen, len;
+	int error, nframes;
+
+	hlen = (sc->sc_uflags & TAP_F_VNETHDR) ?
+	    sizeof(struct tap_vnet_hdr) : 0;
+
+	for (nframes = 0; uio->uio_resid > sizeof(tb);) {
+		error = tap_dequeue(sc, tq, &m);
+		if (error == EWOULDBLOCK)
+			break;
+		if (error != 0 || m == NULL)
+			continue;
+
+		len = hlen + m->m_pkthdr.len;
+		if (sizeof(tb) + len > uio->uio_resid) {
+			if (nframes > 0) {
+				tap_requeue(sc, tq, m);
+				break;
+			}
+			len = uio->uio_resid - sizeof(tb);
+		}
+
+		tb.tb_len = len;
+		if ((error = uiomove(&tb, sizeof(tb), uio)) != 0) {
+			m_freem(m);
+			return error;
+		}
+		if ((error = tap_copyout(sc, m, uio)) != 0)
+			return error;
+		nframes++;
+
+		len = TAP_WORDALIGN(len) - len;
+		if (len + sizeof(tb) >= uio->uio_resid)
+			break;
+		if (len > 0 &&
+		    (error = uiomove(__UNCONST(pad), len, uio)) != 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int
+tap_cdev_read(dev_t dev, struct uio *uio, int flags)
+{
+	struct tap_softc *sc;
+	struct tap_queue *tq;
+
+	if ((sc = tap_lookup(minor(dev), NULL, &tq)) == NULL)
+		return ENXIO;
+
+	return tap_dev_read(sc, tq, uio, flags);
+}
+
+static int
+tap_fops_read(file_t *fp, off_t *offp, struct uio *uio,
+    kauth_cred_t cred, int flags)
+{
+	struct tap_softc *sc;
+	struct tap_queue *tq;
+
+	if ((sc = tap_lookup(fp->f_devunit, fp, &tq)) == NULL)
 		return ENXIO;
 
+	return tap_dev_read(sc, tq, uio, flags);
+}
+
+static int
+tap_dev_read(struct tap_softc *sc, struct tap_queue *tq, struct uio *uio,
+    int flags)
+{
+	struct ifnet *ifp;
+	struct mbuf *m;
+	int error = 0;
+
 	getnanotime(&sc->sc_atime);
 
 	ifp = &sc->sc_ec.ec_if;
 	if ((ifp->if_flags & IFF_UP) == 0)
 		return EHOSTDOWN;
 
+	if ((error = tap_enter(sc)) != 0)
+		return error;
+
 	mutex_enter(&sc->sc_lock);
-	if (IFQ_IS_EMPTY(&ifp->if_snd)) {
+	if (tap_queue_peek(sc, tq) == 0) {
 		ifp->if_flags &= ~IFF_OACTIVE;
-		if (sc->sc_flags & TAP_NBIO)
+		if (tq->tq_flags & TAPQ_NBIO)
 			error = EWOULDBLOCK;
 		else
-			error = cv_wait_sig(&sc->sc_cv, &sc->sc_lock);
+			error = cv_wait_sig(&tq->tq_cv, &sc->sc_lock);
 
-		if (error != 0) {
-			mutex_exit(&sc->sc_lock);
-			return error;
-		}
 		/* The device might have been downed */
-		if ((ifp->if_flags & IFF_UP) == 0) {
-			mutex_exit(&sc->sc_lock);
-			return EHOSTDOWN;
-		}
+		if (error == 0 && ((ifp->if_flags & IFF_UP) == 0 ||
+		    (tq->tq_flags & TAPQ_ATTACHED) == 0))
+			error = EHOSTDOWN;
 	}
-
-	IFQ_DEQUEUE(&ifp->if_snd, m);
 	mutex_exit(&sc->sc_lock);
-
-	ifp->if_flags &= ~IFF_OACTIVE;
-	if (m == NULL) {
-		error = 0;
+	if (error != 0)
 		goto out;
-	}
 
-	if_statadd2(ifp, if_opackets, 1,
-	    if_obytes, m->m_len);		/* XXX only first in chain */
-	bpf_mtap(ifp, m, BPF_D_OUT);
-	if ((error = pfil_run_hooks(ifp->if_pfil, &m, ifp, PFIL_OUT)) != 0)
-		goto out;
-	if (m == NULL)
+	if (sc->sc_uflags & TAP_F_BATCH) {
+		error = tap_read_batch(sc, tq, uio);
 		goto out;
+	}
 
 	/*
 	 * One read is one packet.
 	 */
-	do {
-		error = uiomove(mtod(m, void *),
-		    uimin(m->m_len, uio->uio_resid), uio);
-		m = n = m_free(m);
-	} while (m != NULL && uio->uio_resid > 0 && error == 0);
-
-	if (m != NULL)
-		m_freem(m);
+	error = tap_dequeue(sc, tq, &m);
+	if (error == EWOULDBLOCK)
+		error = 0;
+	else if (error == 0 && m != NULL)
+		error = tap_copyout(sc, m, uio);
 
 out:
+	tap_exit(sc);
 	return error;
 }
 
@@ -914,7 +1474,7 @@ tap_fops_stat(file_t *fp, struct stat *st)
 {
 	int error = 0;
 	struct tap_softc *sc;
-	int unit = fp->f_devunit;
+	int unit = TAP_UNIT(fp->f_devunit);
 
 	(void)memset(st, 0, sizeof(*st));
 
@@ -939,48 +1499,107 @@ out:
 static int
 tap_cdev_write(dev_t dev, struct uio *uio, int flags)
 {
+	struct tap_softc *sc;
+	struct tap_queue *tq;
+
+	if ((sc = tap_lookup(minor(dev), NULL, &tq)) == NULL)
+		return ENXIO;
 
-	return tap_dev_write(minor(dev), uio, flags);
+	return tap_dev_write(sc, uio, flags);
 }
 
 static int
 tap_fops_write(file_t *fp, off_t *offp, struct uio *uio,
     kauth_cred_t cred, int flags)
 {
-	int error;
+	struct tap_softc *sc;
+	struct tap_queue *tq;
 
-	KERNEL_LOCK(1, NULL);
-	error = tap_dev_write(fp->f_devunit, uio, flags);
-	KERNEL_UNLOCK_ONE(NULL);
-	return error;
+	if ((sc = tap_lookup(fp->f_devunit, fp, &tq)) == NULL)
+		return ENXIO;
+
+	return tap_dev_write(sc, uio, flags);
 }
 
 static int
-tap_dev_write(int unit, struct uio *uio, int flags)
+tap_dev_write(struct tap_softc *sc, struct uio *uio, int flags)
 {
-	struct tap_softc *sc =
-	    device_lookup_private(&tap_cd, unit);
-	struct ifnet *ifp;
-	struct mbuf *m, **mp;
-	size_t len = 0;
-	int error = 0;
-
-	if (sc == NULL)
-		return ENXIO;
+	struct tap_batch_hdr tb;
+	uint8_t pad[TAP_ALIGNMENT];
+	size_t len;
+	int error;
 
 	getnanotime(&sc->sc_mtime);
-	ifp = &sc->sc_ec.ec_if;
+
+	if ((error = tap_enter(sc)) != 0)
+		return error;
 
 	/* One write, one packet, that's the rule */
+	if ((sc->sc_uflags & TAP_F_BATCH) == 0) {
+		error = tap_write_frame(sc, uio, uio->uio_resid);
+		goto out;
+	}
+
+	/* ... unless the user asked for TAP_F_BATCH. */
+	while (uio->uio_resid > 0) {
+		if (uio->uio_resid < sizeof(tb)) {
+			error = EINVAL;
+			break;
+		}
+		if ((error = uiomove(&tb, sizeof(tb), uio)) != 0)
+			break;
+		if (tb.tb_len > uio->uio_resid) {
+			error = EINVAL;
+			break;
+		}
+		if ((error = tap_write_frame(sc, uio, tb.tb_len)) != 0)
+			break;
+
+		len = uimin(TAP_WORDALIGN(tb.tb_len) - tb.tb_len,
+		    uio->uio_resid);
+		if (len > 0 && (error = uiomove(pad, len, uio)) != 0)
+			break;
+	}
+
+out:
+	tap_exit(sc);
+	return error;
+}
+
+/*
+ * Turn the next len bytes of user data, starting with a struct
+ * tap_vnet_hdr in TAP_F_VNETHDR mode, into a frame and pass it to the
+ * stack.
+ */
+static int
+tap_write_frame(struct tap_softc *sc, struct uio *uio, size_t len)
+{
+	struct ifnet *ifp = &sc->sc_ec.ec_if;
+	struct tap_vnet_hdr vh;
+	struct mbuf *m, *n, **mp;
+	int error = 0, error1;
+
+	if (sc->sc_uflags & TAP_F_VNETHDR) {
+		if (len < sizeof(vh))
+			error = EINVAL;
+		else
+			error = uiomove(&vh, sizeof(vh), uio);
+		if (error) {
+			if_statinc(ifp, if_ierrors);
+			return error;
+		}
+		len -= sizeof(vh);
+	}
+
 	MGETHDR(m, M_DONTWAIT, MT_DATA);
 	if (m == NULL) {
 		if_statinc(ifp, if_ierrors);
 		return ENOBUFS;
 	}
-	m->m_pkthdr.len = uio->uio_resid;
+	m->m_pkthdr.len = len;
 
 	mp = &m;
-	while (error == 0 && uio->uio_resid > 0) {
+	while (error == 0 && len > 0) {
 		if (*mp != m) {
 			MGET(*mp, M_DONTWAIT, MT_DATA);
 			if (*mp == NULL) {
@@ -988,8 +1607,10 @@ tap_dev_write(int unit, struct uio *uio, int flags)
 				break;
 			}
 		}
-		(*mp)->m_len = uimin(MHLEN, uio->uio_resid);
-		len += (*mp)->m_len;
+		if (len >= MINCLSIZE)
+			MCLGET(*mp, M_DONTWAIT);
+		(*mp)->m_len = uimin(M_TRAILINGSPACE(*mp), len);
+		len -= (*mp)->m_len;
 		error = uiomove(mtod(*mp, void *), (*mp)->m_len, uio);
 		mp = &(*mp)->m_next;
 	}
@@ -999,59 +1620,290 @@ tap_dev_write(int unit, struct uio *uio, int flags)
 		return error;
 	}
 
-	m_set_rcvif(m, ifp);
-
-	if_statadd2(ifp, if_ipackets, 1, if_ibytes, len);
-	bpf_mtap(ifp, m, BPF_D_IN);
-	if ((error = pfil_run_hooks(ifp->if_pfil, &m, ifp, PFIL_IN)) != 0)
+	if ((sc->sc_uflags & TAP_F_VNETHDR) != 0 &&
+	    (error = tap_vnet_hdr_decode(ifp, &vh, &m)) != 0) {
+		if_statinc(ifp, if_ierrors);
 		return error;
-	if (m == NULL)
+	}
+
+	/* A GSO frame comes back as a list of segments. */
+	for (; m != NULL; m = n) {
+		n = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+
+		m_set_rcvif(m, ifp);
+
+		if_statadd2(ifp, if_ipackets, 1, if_ibytes, m->m_pkthdr.len);
+		bpf_mtap(ifp, m, BPF_D_IN);
+		error1 = pfil_run_hooks(ifp->if_pfil, &m, ifp, PFIL_IN);
+		if (error1 != 0) {
+			if (error == 0)
+				error = error1;
+			continue;
+		}
+		if (m == NULL)
+			continue;
+
+		if_percpuq_enqueue(ifp->if_percpuq, m);
+	}
+
+	return error;
+}
+
+/*
+ * Find the network and transport protocol of a frame.  Returns the
+ * offset of the IPv4 or IPv6 header, or -1 if there is none.  IPv4
+ * fragments report no transport protocol.
+ */
+static int
+tap_parse(struct mbuf *m, uint16_t *etypep, uint8_t *protop, int *l4offp)
+{
+	uint16_t etype;
+	int off;
+
+	off = ETHER_HDR_LEN;
+	if (m->m_pkthdr.len < off)
+		return -1;
+	m_copydata(m, off - sizeof(etype), sizeof(etype), &etype);
+	if (ntohs(etype) == ETHERTYPE_VLAN) {
+		off += ETHER_VLAN_ENCAP_LEN;
+		if (m->m_pkthdr.len < off)
+			return -1;
+		m_copydata(m, off - sizeof(etype), sizeof(etype), &etype);
+	}
+	etype = ntohs(etype);
+
+	switch (etype) {
+	case ETHERTYPE_IP:
+	    {
+		struct ip ip;
+
+		if (m->m_pkthdr.len < off + sizeof(ip))
+			return -1;
+		m_copydata(m, off, sizeof(ip), &ip);
+		if (ip.ip_v != IPVERSION || (ip.ip_hl << 2) < sizeof(ip))
+			return -1;
+		*protop = (ntohs(ip.ip_off) & (IP_MF | IP_OFFMASK)) ?
+		    0 : ip.ip_p;
+		*l4offp = off + (ip.ip_hl << 2);
+		break;
+	    }
+#ifdef INET6
+	case ETHERTYPE_IPV6:
+	    {
+		struct ip6_hdr ip6;
+
+		if (m->m_pkthdr.len < off + sizeof(ip6))
+			return -1;
+		m_copydata(m, off, sizeof(ip6), &ip6);
+		if ((ip6.ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION)
+			return -1;
+		*protop = ip6.ip6_nxt;
+		*l4offp = off + sizeof(ip6);
+		break;
+	    }
+#endif
+	default:
+		return -1;
+	}
+
+	*etypep = etype;
+	return off;
+}
+
+/*
+ * Describe the offloads a frame still needs in a struct tap_vnet_hdr.
+ * The stack leaves the pseudo-header sum in the checksum field as
+ * virtio expects, but for TSO without the length; add it here.
+ */
+static void
+tap_vnet_hdr_encode(struct ifnet *ifp, struct mbuf *m,
+    struct tap_vnet_hdr *vh)
+{
+	struct tcphdr th;
+	uint16_t etype;
+	int flags, off, iphl;
+	bool v6;
+
+	memset(vh, 0, sizeof(*vh));
+
+	if (!TAP_NEEDS_OFFLOAD(ifp, m))
+		return;
+	flags = m->m_pkthdr.csum_flags;
+	v6 = (flags & (M_CSUM_TCPv6 | M_CSUM_UDPv6 | M_CSUM_TSOv6)) != 0;
+
+	/* Same framing as ether_sw_offload_tx() accepts. */
+	m_copydata(m, offsetof(struct ether_header, ether_type),
+	    sizeof(etype), &etype);
+	off = ETHER_HDR_LEN;
+	if (ntohs(etype) == ETHERTYPE_VLAN)
+		off += ETHER_VLAN_ENCAP_LEN;
+	iphl = v6 ? M_CSUM_DATA_IPv6_IPHL(m->m_pkthdr.csum_data) :
+	    M_CSUM_DATA_IPv4_IPHL(m->m_pkthdr.csum_data);
+	off += iphl;
+
+	vh->tv_flags = TAP_VNET_HDR_F_NEEDS_CSUM;
+	vh->tv_csum_start = off;
+	vh->tv_csum_offset = v6 ?
+	    M_CSUM_DATA_IPv6_OFFSET(m->m_pkthdr.csum_data) :
+	    M_CSUM_DATA_IPv4_OFFSET(m->m_pkthdr.csum_data);
+
+	if ((flags & (M_CSUM_TSOv4 | M_CSUM_TSOv6)) == 0)
+		return;
+
+	m_copydata(m, off, sizeof(th), &th);
+	th.th_sum = in_cksum_addword(th.th_sum,
+	    htons(m->m_pkthdr.len - off));
+	m_copyback(m, off + offsetof(struct tcphdr, th_sum),
+	    sizeof(th.th_sum), &th.th_sum);
+
+	vh->tv_gso_type = v6 ?
+	    TAP_VNET_HDR_GSO_TCPV6 : TAP_VNET_HDR_GSO_TCPV4;
+	vh->tv_gso_size = m->m_pkthdr.segsz;
+	vh->tv_hdr_len = off + th.th_off * 4;
+}
+
+/*
+ * Apply a struct tap_vnet_hdr to a frame written by the user.  The
+ * stack has no notion of a partial checksum on input, so NEEDS_CSUM is
+ * completed here and GSO frames are cut into segments; all that is
+ * left for the stack is to not verify the result again.  The frame is
+ * freed on error.
+ */
+static int
+tap_vnet_hdr_decode(struct ifnet *ifp, const struct tap_vnet_hdr *vh,
+    struct mbuf **mp)
+{
+	struct mbuf *m = *mp, *n;
+	struct tcphdr th;
+	uint16_t etype, sum;
+	uint8_t proto;
+	int off, l4off, start, csum;
+
+	off = tap_parse(m, &etype, &proto, &l4off);
+
+	switch (vh->tv_gso_type & ~TAP_VNET_HDR_GSO_ECN) {
+	case TAP_VNET_HDR_GSO_NONE:
+		break;
+	case TAP_VNET_HDR_GSO_TCPV4:
+		if (off < 0 || etype != ETHERTYPE_IP)
+			goto bad;
+		csum = M_CSUM_TSOv4;
+		goto gso;
+#ifdef INET6
+	case TAP_VNET_HDR_GSO_TCPV6:
+		if (off < 0 || etype != ETHERTYPE_IPV6)
+			goto bad;
+		csum = M_CSUM_TSOv6;
+		goto gso;
+#endif
+	default:
+		/* No UDP fragmentation offload */
+		goto bad;
+	}
+
+	if (vh->tv_flags & TAP_VNET_HDR_F_NEEDS_CSUM) {
+		start = vh->tv_csum_start;
+		if (start + vh->tv_csum_offset + sizeof(sum) >
+		    m->m_pkthdr.len)
+			goto bad;
+
+		/* The field holds the pseudo-header sum already. */
+		sum = cpu_in_cksum(m, m->m_pkthdr.len - start, start, 0);
+		if (sum == 0 && proto == IPPROTO_UDP && start == l4off)
+			sum = 0xffff;
+		m_copyback(m, start + vh->tv_csum_offset, sizeof(sum), &sum);
+
+		/* Unless it was some other checksum... */
+		if (start != l4off)
+			return 0;
+	} else if ((vh->tv_flags & TAP_VNET_HDR_F_DATA_VALID) == 0)
 		return 0;
 
-	if_percpuq_enqueue(ifp->if_percpuq, m);
+	if (off < 0)
+		return 0;
+	if (proto == IPPROTO_TCP)
+		csum = (etype == ETHERTYPE_IP) ? M_CSUM_TCPv4 : M_CSUM_TCPv6;
+	else if (proto == IPPROTO_UDP)
+		csum = (etype == ETHERTYPE_IP) ? M_CSUM_UDPv4 : M_CSUM_UDPv6;
+	else
+		return 0;
+	m->m_pkthdr.csum_flags = csum & ifp->if_csum_flags_rx;
+	return 0;
 
+gso:
+	/* Check what tcp[46]_segment() would assert on. */
+	if (proto != IPPROTO_TCP || vh->tv_gso_size == 0 ||
+	    m->m_pkthdr.len < l4off + sizeof(th))
+		goto bad;
+	m_copydata(m, l4off, sizeof(th), &th);
+	if (th.th_off * 4 < sizeof(th) ||
+	    l4off + th.th_off * 4 >= m->m_pkthdr.len ||
+	    l4off + th.th_off * 4 > MHLEN)
+		goto bad;
+
+	m->m_pkthdr.csum_flags = csum;
+	m->m_pkthdr.segsz = vh->tv_gso_size;
+#ifdef INET6
+	if (csum == M_CSUM_TSOv6) {
+		m = tcp6_segment(m, off);
+		csum = M_CSUM_TCPv6;
+	} else
+#endif
+	{
+		m = tcp4_segment(m, off);
+		csum = M_CSUM_TCPv4;
+	}
+	*mp = m;
+	if (m == NULL)
+		return ENOBUFS;
+
+	/* The segments come with their checksums computed. */
+	for (n = m; n != NULL; n = n->m_nextpkt)
+		n->m_pkthdr.csum_flags = csum & ifp->if_csum_flags_rx;
 	return 0;
+
+bad:
+	m_freem(m);
+	*mp = NULL;
+	return EINVAL;
 }
 
 static int
 tap_cdev_ioctl(dev_t dev, u_long cmd, void *data, int flags, struct lwp *l)
 {
+	struct tap_softc *sc;
+	struct tap_queue *tq;
+
+	if ((sc = tap_lookup(minor(dev), NULL, &tq)) == NULL)
+		return ENXIO;
 
-	return tap_dev_ioctl(minor(dev), cmd, data, l);
+	return tap_dev_ioctl(sc, tq, cmd, data, l);
 }
 
 static int
 tap_fops_ioctl(file_t *fp, u_long cmd, void *data)
 {
+	struct tap_softc *sc;
+	struct tap_queue *tq;
+
+	if ((sc = tap_lookup(fp->f_devunit, fp, &tq)) == NULL)
+		return ENXIO;
 
-	return tap_dev_ioctl(fp->f_devunit, cmd, data, curlwp);
+	return tap_dev_ioctl(sc, tq, cmd, data, curlwp);
 }
 
 static int
-tap_dev_ioctl(int unit, u_long cmd, void *data, struct lwp *l)
+tap_dev_ioctl(struct tap_softc *sc, struct tap_queue *tq, u_long cmd,
+    void *data, struct lwp *l)
 {
-	struct tap_softc *sc = device_lookup_private(&tap_cd, unit);
-
-	if (sc == NULL)
-		return ENXIO;
 
 	switch (cmd) {
 	case FIONREAD:
-		{
-			struct ifnet *ifp = &sc->sc_ec.ec_if;
-			struct mbuf *m;
-			int s;
-
-			s = splnet();
-			IFQ_POLL(&ifp->if_snd, m);
-
-			if (m == NULL)
-				*(int *)data = 0;
-			else
-				*(int *)data = m->m_pkthdr.len;
-			splx(s);
-			return 0;
-		}
+		mutex_enter(&sc->sc_lock);
+		*(int *)data = tap_queue_peek(sc, tq);
+		mutex_exit(&sc->sc_lock);
+		return 0;
 	case TIOCSPGRP:
 	case FIOSETOWN:
 		return fsetown(&sc->sc_pgid, cmd, data);
@@ -1076,10 +1928,12 @@ tap_dev_ioctl(int unit, u_long cmd, void *data, struct lwp *l)
 		}
 		return 0;
 	case FIONBIO:
+		mutex_enter(&sc->sc_lock);
 		if (*(int *)data)
-			sc->sc_flags |= TAP_NBIO;
+			tq->tq_flags |= TAPQ_NBIO;
 		else
-			sc->sc_flags &= ~TAP_NBIO;
+			tq->tq_flags &= ~TAPQ_NBIO;
+		mutex_exit(&sc->sc_lock);
 		return 0;
 	case TAPGIFNAME:
 		{
@@ -1089,6 +1943,16 @@ tap_dev_ioctl(int unit, u_long cmd, void *data, struct lwp *l)
 			strlcpy(ifr->ifr_name, ifp->if_xname, IFNAMSIZ);
 			return 0;
 		}
+	case TAPGFLAGS:
+		*(int *)data = sc->sc_uflags;
+		return 0;
+	case TAPSFLAGS:
+		if (*(int *)data & ~(TAP_F_VNETHDR | TAP_F_BATCH))
+			return EINVAL;
+		sc->sc_uflags = *(int *)data;
+		return 0;
+	case TAPADDQUEUE:
+		return tap_queue_add(sc, (int *)data);
 	default:
 		return ENOTTY;
 	}
@@ -1097,42 +1961,40 @@ tap_dev_ioctl(int unit, u_long cmd, void *data, struct lwp *l)
 static int
 tap_cdev_poll(dev_t dev, int events, struct lwp *l)
 {
+	struct tap_softc *sc;
+	struct tap_queue *tq;
 
-	return tap_dev_poll(minor(dev), events, l);
+	if ((sc = tap_lookup(minor(dev), NULL, &tq)) == NULL)
+		return POLLERR;
+
+	return tap_dev_poll(sc, tq, events, l);
 }
 
 static int
 tap_fops_poll(file_t *fp, int events)
 {
+	struct tap_softc *sc;
+	struct tap_queue *tq;
 
-	return tap_dev_poll(fp->f_devunit, events, curlwp);
+	if ((sc = tap_lookup(fp->f_devunit, fp, &tq)) == NULL)
+		return POLLERR;
+
+	return tap_dev_poll(sc, tq, events, curlwp);
 }
 
 static int
-tap_dev_poll(int unit, int events, struct lwp *l)
+tap_dev_poll(struct tap_softc *sc, struct tap_queue *tq, int events,
+    struct lwp *l)
 {
-	struct tap_softc *sc = device_lookup_private(&tap_cd, unit);
 	int revents = 0;
 
-	if (sc == NULL)
-		return POLLERR;
-
 	if (events & (POLLIN | POLLRDNORM)) {
-		struct ifnet *ifp = &sc->sc_ec.ec_if;
-		struct mbuf *m;
-		int s;
-
-		s = splnet();
-		IFQ_POLL(&ifp->if_snd, m);
-
-		if (m != NULL)
+		mutex_spin_enter(&sc->sc_lock);
+		if (tap_queue_peek(sc, tq) != 0)
 			revents |= events & (POLLIN | POLLRDNORM);
-		else {
-			mutex_spin_enter(&sc->sc_lock);
-			selrecord(l, &sc->sc_rsel);
-			mutex_spin_exit(&sc->sc_lock);
-		}
-		splx(s);
+		else
+			selrecord(l, &tq->tq_rsel);
+		mutex_spin_exit(&sc->sc_lock);
 	}
 	revents |= events & (POLLOUT | POLLWRNORM);
 
@@ -1149,32 +2011,39 @@ static struct filterops tap_read_filterops = {
 static int
 tap_cdev_kqfilter(dev_t dev, struct knote *kn)
 {
+	struct tap_softc *sc;
+	struct tap_queue *tq;
 
-	return tap_dev_kqfilter(minor(dev), kn);
+	if ((sc = tap_lookup(minor(dev), NULL, &tq)) == NULL)
+		return ENXIO;
+
+	return tap_dev_kqfilter(tq, kn);
 }
 
 static int
 tap_fops_kqfilter(file_t *fp, struct knote *kn)
 {
+	struct tap_softc *sc;
+	struct tap_queue *tq;
 
-	return tap_dev_kqfilter(fp->f_devunit, kn);
+	if ((sc = tap_lookup(fp->f_devunit, fp, &tq)) == NULL)
+		return ENXIO;
+
+	return tap_dev_kqfilter(tq, kn);
 }
 
 static int
-tap_dev_kqfilter(int unit, struct knote *kn)
+tap_dev_kqfilter(struct tap_queue *tq, struct knote *kn)
 {
-	struct tap_softc *sc = device_lookup_private(&tap_cd, unit);
-
-	if (sc == NULL)
-		return ENXIO;
+	struct tap_softc *sc = tq->tq_sc;
 
 	switch(kn->kn_filter) {
 	case EVFILT_READ:
 		kn->kn_fop = &tap_read_filterops;
-		kn->kn_hook = sc;
+		kn->kn_hook = tq;
 		KERNEL_LOCK(1, NULL);
 		mutex_spin_enter(&sc->sc_lock);
-		selrecord_knote(&sc->sc_rsel, kn);
+		selrecord_knote(&tq->tq_rsel, kn);
 		mutex_spin_exit(&sc->sc_lock);
 		KERNEL_UNLOCK_ONE(NULL);
 		break;
@@ -1193,11 +2062,12 @@ tap_dev_kqfilter(int unit, struct knote *kn)
 static void
 tap_kqdetach(struct knote *kn)
 {
-	struct tap_softc *sc = (struct tap_softc *)kn->kn_hook;
+	struct tap_queue *tq = (struct tap_queue *)kn->kn_hook;
+	struct tap_softc *sc = tq->tq_sc;
 
 	KERNEL_LOCK(1, NULL);
 	mutex_spin_enter(&sc->sc_lock);
-	selremove_knote(&sc->sc_rsel, kn);
+	selremove_knote(&tq->tq_rsel, kn);
 	mutex_spin_exit(&sc->sc_lock);
 	KERNEL_UNLOCK_ONE(NULL);
 }
@@ -1205,19 +2075,12 @@ tap_kqdetach(struct knote *kn)
 static int
 tap_kqread(struct knote *kn, long hint)
 {
-	struct tap_softc *sc = (struct tap_softc *)kn->kn_hook;
-	struct ifnet *ifp = &sc->sc_ec.ec_if;
-	struct mbuf *m;
+	struct tap_queue *tq = (struct tap_queue *)kn->kn_hook;
 	int s, rv;
 
 	KERNEL_LOCK(1, NULL);
 	s = splnet();
-	IFQ_POLL(&ifp->if_snd, m);
-
-	if (m == NULL)
-		kn->kn_data = 0;
-	else
-		kn->kn_data = m->m_pkthdr.len;
+	kn->kn_data = tap_queue_peek(tq->tq_sc, tq);
 	splx(s);
 	rv = (kn->kn_data != 0 ? 1 : 0);
 	KERNEL_UNLOCK_ONE(NULL);
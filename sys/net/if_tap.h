@@ -29,10 +29,53 @@
 #ifndef _NET_IF_TAP_H_
 #define _NET_IF_TAP_H_
 
+#include <sys/types.h>
 #include <sys/ioccom.h>
 
 /* 'e' comes from former name 'ethfoo' */
 #define TAPGIFNAME	_IOR('e', 0, struct ifreq)
+#define TAPGFLAGS	_IOR('e', 1, int)
+#define TAPSFLAGS	_IOW('e', 2, int)
+#define TAPADDQUEUE	_IOR('e', 3, int)
+
+/* Flags for TAPGFLAGS/TAPSFLAGS */
+#define TAP_F_VNETHDR	0x00000001	/* frames carry a struct tap_vnet_hdr */
+#define TAP_F_BATCH	0x00000002	/* several frames per read/write */
+
+/*
+ * With TAP_F_VNETHDR, every frame read from or written to the device
+ * is preceded by this header.  Its layout and values match the legacy
+ * struct virtio_net_hdr, in host byte order, so that a hypervisor can
+ * pass it through to a guest's virtio-net device unchanged.
+ */
+struct tap_vnet_hdr {
+	uint8_t		tv_flags;
+#define TAP_VNET_HDR_F_NEEDS_CSUM	0x01	/* csum_start/offset valid */
+#define TAP_VNET_HDR_F_DATA_VALID	0x02	/* checksum already verified */
+	uint8_t		tv_gso_type;
+#define TAP_VNET_HDR_GSO_NONE		0x00
+#define TAP_VNET_HDR_GSO_TCPV4		0x01
+#define TAP_VNET_HDR_GSO_UDP		0x03
+#define TAP_VNET_HDR_GSO_TCPV6		0x04
+#define TAP_VNET_HDR_GSO_ECN		0x80
+	uint16_t	tv_hdr_len;	/* Ethernet + IP + TCP header length */
+	uint16_t	tv_gso_size;	/* MSS */
+	uint16_t	tv_csum_start;	/* where to start checksumming */
+	uint16_t	tv_csum_offset;	/* where to store it, from csum_start */
+} __packed;
+
+/*
+ * With TAP_F_BATCH, a read returns as many queued frames as fit in the
+ * buffer and a write may carry several frames.  Each frame (including
+ * its struct tap_vnet_hdr, if any) is preceded by this header, and the
+ * next header starts at the following TAP_WORDALIGN() boundary.
+ */
+struct tap_batch_hdr {
+	uint32_t	tb_len;		/* length of the frame that follows */
+};
+
+#define TAP_ALIGNMENT	sizeof(uint32_t)
+#define TAP_WORDALIGN(x) (((x) + (TAP_ALIGNMENT - 1)) & ~(TAP_ALIGNMENT - 1))
 
 #endif /* !_NET_IF_TAP_H_ */
 
@@ -101,10 +101,10 @@ __KERNEL_RCSID(0, "$NetBSD: if_vlan.c,v 1.171 2023/11/02 09:48:29 yamaguchi Exp
 #include <sys/cpu.h>
 #include <sys/pserialize.h>
 #include <sys/psref.h>
-#include <sys/pslist.h>
 #include <sys/atomic.h>
 #include <sys/device.h>
 #include <sys/module.h>
+#include <sys/xcall.h>
 
 #include <net/bpf.h>
 #include <net/if.h>
@@ -161,13 +161,27 @@ struct ifvlan {
 	void *ifv_ifdetach_hook;
 
 	LIST_HEAD(__vlan_mchead, vlan_mc_entry) ifv_mc_listhead;
-	struct pslist_entry ifv_hash;
 	int ifv_flags;
 	bool ifv_stopping;
 };
 
 #define	IFVF_PROMISC	0x01		/* promiscuous mode enabled */
 
+/*
+ * The vlan interfaces configured on a parent, indexed directly by
+ * VLAN ID.  A parent has one table for 802.1Q and one for 802.1ad
+ * tags, each allocated when the first vlan using it is configured.
+ */
+#define	VLAN_NVIDS	4096
+
+struct vlan_vidtab {
+	struct ifvlan	*vt_ifv[VLAN_NVIDS];
+	u_int		vt_count;	/* # of non-NULL vt_ifv entries */
+};
+
+/* Number of packets vlan_start() hands to the parent at once. */
+#define	VLAN_TXBATCH	32
+
 #define	ifv_if		ifv_ec.ec_if
 
 #define	ifv_msw		ifv_mib.ifvm_msw
@@ -202,7 +216,8 @@ const struct vlan_multisw vlan_nothing_multisw = {
 
 static int	vlan_clone_create(struct if_clone *, int);
 static int	vlan_clone_destroy(struct ifnet *);
-static int	vlan_config(struct ifvlan *, struct ifnet *, uint16_t);
+static int	vlan_config(struct ifvlan *, struct ifnet *, uint16_t,
+		    uint16_t);
 static int	vlan_ioctl(struct ifnet *, u_long, void *);
 static void	vlan_start(struct ifnet *);
 static int	vlan_transmit(struct ifnet *, struct mbuf *);
@@ -210,28 +225,17 @@ static void	vlan_link_state_changed(void *);
 static void	vlan_ifdetach(void *);
 static void	vlan_unconfig(struct ifnet *);
 static int	vlan_unconfig_locked(struct ifvlan *, struct ifvlan_linkmib *);
-static void	vlan_hash_init(void);
-static int	vlan_hash_fini(void);
-static int	vlan_tag_hash(uint16_t, u_long);
 static struct ifvlan_linkmib*
 		vlan_getref_linkmib(struct ifvlan *, struct psref *);
 static void	vlan_putref_linkmib(struct ifvlan_linkmib *, struct psref *);
 static void	vlan_linkmib_update(struct ifvlan *, struct ifvlan_linkmib *);
-static struct ifvlan_linkmib*
-		vlan_lookup_tag_psref(struct ifnet *, uint16_t,
-		    struct psref *);
+static struct ifvlan *
+		vlan_lookup_vid(struct ifnet *, uint16_t, uint16_t);
+static int	vlan_vidtab_insert(struct ifnet *, uint16_t, uint16_t,
+		    struct ifvlan *);
+static void	vlan_vidtab_remove(struct ifnet *, uint16_t, uint16_t);
 
-#if !defined(VLAN_TAG_HASH_SIZE)
-#define VLAN_TAG_HASH_SIZE 32
-#endif
-static struct {
-	kmutex_t lock;
-	struct pslist_head *lists;
-	u_long mask;
-} ifv_hash __cacheline_aligned = {
-	.lists = NULL,
-	.mask = 0,
-};
+static kmutex_t vlan_vidtab_lock __cacheline_aligned;
 
 pserialize_t vlan_psz __read_mostly;
 static struct psref_class *ifvm_psref_class __read_mostly;
@@ -280,31 +284,25 @@ vlaninit(void)
 {
 	nvlanifs = 0;
 
-	mutex_init(&ifv_hash.lock, MUTEX_DEFAULT, IPL_NONE);
+	mutex_init(&vlan_vidtab_lock, MUTEX_DEFAULT, IPL_NONE);
 	vlan_psz = pserialize_create();
 	ifvm_psref_class = psref_class_create("vlanlinkmib", IPL_SOFTNET);
 	if_clone_attach(&vlan_cloner);
 
-	vlan_hash_init();
 	MODULE_HOOK_SET(if_vlan_vlan_input_hook, vlan_input);
 }
 
 static int
 vlandetach(void)
 {
-	int error;
 
 	if (nvlanifs > 0)
 		return EBUSY;
 
-	error = vlan_hash_fini();
-	if (error != 0)
-		return error;
-
 	if_clone_detach(&vlan_cloner);
 	psref_class_destroy(ifvm_psref_class);
 	pserialize_destroy(vlan_psz);
-	mutex_destroy(&ifv_hash.lock);
+	mutex_destroy(&vlan_vidtab_lock);
 
 	MODULE_HOOK_UNSET(if_vlan_vlan_input_hook);
 	return 0;
@@ -398,24 +396,25 @@ vlan_clone_destroy(struct ifnet *ifp)
 }
 
 /*
- * Configure a VLAN interface.
+ * Configure a VLAN interface.  proto is the encapsulation ethertype,
+ * ETHERTYPE_VLAN for an 802.1Q customer tag or ETHERTYPE_QINQ for an
+ * 802.1ad service tag.  The parent may itself be a vlan interface,
+ * so that customer vlans can be stacked on a service vlan.
  */
 static int
-vlan_config(struct ifvlan *ifv, struct ifnet *p, uint16_t tag)
+vlan_config(struct ifvlan *ifv, struct ifnet *p, uint16_t tag, uint16_t proto)
 {
 	struct ifnet *ifp = &ifv->ifv_if;
 	struct ifvlan_linkmib *nmib = NULL;
 	struct ifvlan_linkmib *omib = NULL;
-	struct ifvlan_linkmib *checkmib;
 	struct psref_target *nmib_psref = NULL;
 	struct ethercom *ec;
 	const uint16_t vid = EVL_VLANOFTAG(tag);
 	const uint8_t *lla;
 	u_char ifv_iftype;
 	int error = 0;
-	int idx;
+	bool claimed = false;
 	bool omib_cleanup = false;
-	struct psref psref;
 
 	/* VLAN ID 0 and 4095 are reserved in the spec */
 	if ((vid == 0) || (vid == 0xfff))
@@ -430,14 +429,6 @@ vlan_config(struct ifvlan *ifv, struct ifnet *p, uint16_t tag)
 		goto done;
 	}
 
-	/* Duplicate check */
-	checkmib = vlan_lookup_tag_psref(p, vid, &psref);
-	if (checkmib != NULL) {
-		vlan_putref_linkmib(checkmib, &psref);
-		error = EEXIST;
-		goto done;
-	}
-
 	*nmib = *omib;
 	nmib_psref = &nmib->ifvm_psref;
 
@@ -473,6 +464,16 @@ vlan_config(struct ifvlan *ifv, struct ifnet *p, uint16_t tag)
 		goto done;
 	}
 
+	/*
+	 * Claim the VLAN ID on the parent, which fails if another
+	 * vlan has it.  Until we set IFF_RUNNING vlan_input() drops
+	 * what it finds for us.
+	 */
+	error = vlan_vidtab_insert(p, proto, vid, ifv);
+	if (error != 0)
+		goto done;
+	claimed = true;
+
 	error = ether_add_vlantag(p, tag, NULL);
 	if (error != 0)
 		goto done;
@@ -497,7 +498,8 @@ vlan_config(struct ifvlan *ifv, struct ifnet *p, uint16_t tag)
 	 * assisted checksumming flags and tcp segmentation
 	 * offload.
 	 */
-	if (ec->ec_capabilities & ETHERCAP_VLAN_HWTAGGING) {
+	if (proto == ETHERTYPE_VLAN &&
+	    (ec->ec_capabilities & ETHERCAP_VLAN_HWTAGGING)) {
 		ifp->if_capabilities = p->if_capabilities &
 		    (IFCAP_TSOv4 | IFCAP_TSOv6 |
 			IFCAP_CSUM_IPv4_Tx  | IFCAP_CSUM_IPv4_Rx |
@@ -511,21 +513,16 @@ vlan_config(struct ifvlan *ifv, struct ifnet *p, uint16_t tag)
 	ifp->if_hdrlen = sizeof(struct ether_vlan_header); /* XXX? */
 
 	nmib->ifvm_p = p;
+	nmib->ifvm_proto = proto;
 	nmib->ifvm_tag = vid;
 	ifv->ifv_if.if_mtu = p->if_mtu - nmib->ifvm_mtufudge;
-	ifv->ifv_if.if_flags = p->if_flags &
-	    (IFF_UP | IFF_BROADCAST | IFF_SIMPLEX | IFF_MULTICAST);
+	ifv->ifv_if.if_flags = (p->if_flags &
+	    (IFF_UP | IFF_BROADCAST | IFF_SIMPLEX | IFF_MULTICAST)) |
+	    (ifv->ifv_if.if_flags & IFF_LINK0);
 
 	/*XXX need to update the if_type in if_sadl if it is changed */
 	ifv->ifv_if.if_type = ifv_iftype;
 
-	PSLIST_ENTRY_INIT(ifv, ifv_hash);
-	idx = vlan_tag_hash(vid, ifv_hash.mask);
-
-	mutex_enter(&ifv_hash.lock);
-	PSLIST_WRITER_INSERT_HEAD(&ifv_hash.lists[idx], ifv, ifv_hash);
-	mutex_exit(&ifv_hash.lock);
-
 	vlan_linkmib_update(ifv, nmib);
 	nmib = NULL;
 	nmib_psref = NULL;
@@ -542,6 +539,8 @@ vlan_config(struct ifvlan *ifv, struct ifnet *p, uint16_t tag)
 	if_link_state_change(&ifv->ifv_if, p->if_link_state);
 
 done:
+	if (error != 0 && claimed)
+		vlan_vidtab_remove(p, proto, vid);
 	mutex_exit(&ifv->ifv_lock);
 
 	if (nmib_psref)
@@ -619,6 +618,15 @@ vlan_unconfig_locked(struct ifvlan *ifv, struct ifvlan_linkmib *nmib)
 	    p->if_type == IFT_L2TP);
 	(void)ether_del_vlantag(p, nmib->ifvm_tag);
 
+	/*
+	 * Stop vlan_input() from finding us.  It holds no reference
+	 * to us once past the lookup, so, as if_detach() does, wait
+	 * with a barrier for the softints which may still be handing
+	 * packets to us before tearing the interface down.
+	 */
+	vlan_vidtab_remove(p, nmib->ifvm_proto, nmib->ifvm_tag);
+	xc_barrier(0);
+
 	/* XXX ether_ifdetach must not be called with IFNET_LOCK */
 	ifv->ifv_stopping = true;
 	mutex_exit(&ifv->ifv_lock);
@@ -639,11 +647,6 @@ vlan_unconfig_locked(struct ifvlan *ifv, struct ifvlan_linkmib *nmib)
 	ifv->ifv_if.if_mtu = 0;
 	ifv->ifv_flags = 0;
 
-	mutex_enter(&ifv_hash.lock);
-	PSLIST_WRITER_REMOVE(ifv, ifv_hash);
-	pserialize_perform(vlan_psz);
-	mutex_exit(&ifv_hash.lock);
-	PSLIST_ENTRY_DESTROY(ifv, ifv_hash);
 	if_linkstate_change_disestablish(p,
 	    ifv->ifv_linkstate_hook, NULL);
 
@@ -678,53 +681,6 @@ done:
 	return error;
 }
 
-static void
-vlan_hash_init(void)
-{
-
-	ifv_hash.lists = hashinit(VLAN_TAG_HASH_SIZE, HASH_PSLIST, true,
-	    &ifv_hash.mask);
-}
-
-static int
-vlan_hash_fini(void)
-{
-	int i;
-
-	mutex_enter(&ifv_hash.lock);
-
-	for (i = 0; i < ifv_hash.mask + 1; i++) {
-		if (PSLIST_WRITER_FIRST(&ifv_hash.lists[i], struct ifvlan,
-		    ifv_hash) != NULL) {
-			mutex_exit(&ifv_hash.lock);
-			return EBUSY;
-		}
-	}
-
-	for (i = 0; i < ifv_hash.mask + 1; i++)
-		PSLIST_DESTROY(&ifv_hash.lists[i]);
-
-	mutex_exit(&ifv_hash.lock);
-
-	hashdone(ifv_hash.lists, HASH_PSLIST, ifv_hash.mask);
-
-	ifv_hash.lists = NULL;
-	ifv_hash.mask = 0;
-
-	return 0;
-}
-
-static int
-vlan_tag_hash(uint16_t tag, u_long mask)
-{
-	uint32_t hash;
-
-	hash = (tag >> 8) ^ tag;
-	hash = (hash >> 2) ^ hash;
-
-	return hash & mask;
-}
-
 static struct ifvlan_linkmib *
 vlan_getref_linkmib(struct ifvlan *sc, struct psref *psref)
 {
@@ -751,32 +707,91 @@ vlan_putref_linkmib(struct ifvlan_linkmib *mib, struct psref *psref)
 	psref_release(psref, &mib->ifvm_psref, ifvm_psref_class);
 }
 
-static struct ifvlan_linkmib *
-vlan_lookup_tag_psref(struct ifnet *ifp, uint16_t tag, struct psref *psref)
+/*
+ * Find the vlan interface configured on parent p for the given
+ * encapsulation and VLAN ID.  The caller must be in a pserialize read
+ * section of vlan_psz.
+ */
+static struct ifvlan *
+vlan_lookup_vid(struct ifnet *p, uint16_t proto, uint16_t vid)
 {
-	int idx;
-	int s;
-	struct ifvlan *sc;
+	struct ethercom *ec = (struct ethercom *)p;
+	struct vlan_vidtab *vt;
 
-	idx = vlan_tag_hash(tag, ifv_hash.mask);
+	KASSERT(vid < VLAN_NVIDS);
 
-	s = pserialize_read_enter();
-	PSLIST_READER_FOREACH(sc, &ifv_hash.lists[idx], struct ifvlan,
-	    ifv_hash) {
-		struct ifvlan_linkmib *mib = atomic_load_consume(&sc->ifv_mib);
-		if (mib == NULL)
-			continue;
-		if (mib->ifvm_tag != tag)
-			continue;
-		if (mib->ifvm_p != ifp)
-			continue;
+	vt = atomic_load_consume(proto == ETHERTYPE_QINQ ?
+	    &ec->ec_qinqtab : &ec->ec_vlantab);
+	if (vt == NULL)
+		return NULL;
 
-		psref_acquire(psref, &mib->ifvm_psref, ifvm_psref_class);
-		pserialize_read_exit(s);
-		return mib;
+	return atomic_load_consume(&vt->vt_ifv[vid]);
+}
+
+static int
+vlan_vidtab_insert(struct ifnet *p, uint16_t proto, uint16_t vid,
+    struct ifvlan *ifv)
+{
+	struct ethercom *ec = (struct ethercom *)p;
+	struct vlan_vidtab **vtp, *vt, *nvt = NULL;
+	int error = 0;
+
+	vtp = (proto == ETHERTYPE_QINQ) ? &ec->ec_qinqtab : &ec->ec_vlantab;
+
+again:
+	/* The table is big; allocate it before taking the lock. */
+	if (nvt == NULL && atomic_load_relaxed(vtp) == NULL)
+		nvt = kmem_zalloc(sizeof(*nvt), KM_SLEEP);
+
+	mutex_enter(&vlan_vidtab_lock);
+	vt = *vtp;
+	if (vt == NULL) {
+		if (nvt == NULL) {
+			/* Freed since we looked. */
+			mutex_exit(&vlan_vidtab_lock);
+			goto again;
+		}
+		vt = nvt;
+		nvt = NULL;
+		vt->vt_ifv[vid] = ifv;
+		vt->vt_count = 1;
+		atomic_store_release(vtp, vt);
+	} else if (vt->vt_ifv[vid] != NULL) {
+		error = EEXIST;
+	} else {
+		atomic_store_release(&vt->vt_ifv[vid], ifv);
+		vt->vt_count++;
 	}
-	pserialize_read_exit(s);
-	return NULL;
+	mutex_exit(&vlan_vidtab_lock);
+
+	if (nvt != NULL)
+		kmem_free(nvt, sizeof(*nvt));
+
+	return error;
+}
+
+static void
+vlan_vidtab_remove(struct ifnet *p, uint16_t proto, uint16_t vid)
+{
+	struct ethercom *ec = (struct ethercom *)p;
+	struct vlan_vidtab **vtp, *vt;
+
+	vtp = (proto == ETHERTYPE_QINQ) ? &ec->ec_qinqtab : &ec->ec_vlantab;
+
+	mutex_enter(&vlan_vidtab_lock);
+	vt = *vtp;
+	KASSERT(vt != NULL);
+	KASSERT(vt->vt_ifv[vid] != NULL);
+	atomic_store_relaxed(&vt->vt_ifv[vid], NULL);
+	if (--vt->vt_count == 0)
+		atomic_store_relaxed(vtp, NULL);
+	else
+		vt = NULL;
+	pserialize_perform(vlan_psz);
+	mutex_exit(&vlan_vidtab_lock);
+
+	if (vt != NULL)
+		kmem_free(vt, sizeof(*vt));
 }
 
 static void
@@ -927,7 +942,13 @@ vlan_ioctl(struct ifnet *ifp, u_long cmd, void *data)
 			break;
 		}
 
-		error = vlan_config(ifv, pr, vlr.vlr_tag);
+		/*
+		 * link0 selects 802.1ad service tags; it takes effect
+		 * when the vlan is (re)attached to its parent.
+		 */
+		error = vlan_config(ifv, pr, vlr.vlr_tag,
+		    (ifp->if_flags & IFF_LINK0) ?
+		    ETHERTYPE_QINQ : ETHERTYPE_VLAN);
 		if (error != 0)
 			break;
 
@@ -1223,17 +1244,86 @@ vlan_multi_nothing(struct ifvlan *v __unused)
 	/* do nothing */
 }
 
+/*
+ * Frames handed to a vlan may not already be encapsulated with its own
+ * ethertype.  An 802.1ad vlan accepts 802.1Q tagged frames, which it
+ * stacks its service tag on top of.
+ */
+static inline bool
+vlan_encap_ok(const struct ifvlan_linkmib *mib, const struct mbuf *m)
+{
+	const struct ether_header *eh = mtod(m, const struct ether_header *);
+
+	return ntohs(eh->ether_type) != mib->ifvm_proto;
+}
+
+/*
+ * Tag a frame for the parent.  Returns non-zero, with the mbuf freed,
+ * if there was no room for the tag.
+ */
+static int
+vlan_encap(struct ifvlan_linkmib *mib, struct mbuf **mp)
+{
+	struct ifnet *p = mib->ifvm_p;
+	struct ethercom *ec = (void *)p;
+	int error;
+
+	/*
+	 * If the parent can insert the tag itself, just mark
+	 * the tag in the mbuf header.  Hardware only knows
+	 * about 802.1Q tags.
+	 */
+	if (mib->ifvm_proto == ETHERTYPE_VLAN &&
+	    (ec->ec_capenable & ETHERCAP_VLAN_HWTAGGING)) {
+		vlan_set_tag(*mp, mib->ifvm_tag);
+		return 0;
+	}
+
+	/*
+	 * insert the tag ourselves
+	 */
+	KASSERT(
+	    p->if_type == IFT_ETHER ||
+	    p->if_type == IFT_L2TP);
+	error = ether_inject_vlantag(mp, mib->ifvm_proto, mib->ifvm_tag);
+	if (error != 0) {
+		KASSERT(*mp == NULL);
+		printf("%s: unable to inject VLAN tag\n", p->if_xname);
+	}
+	return error;
+}
+
+/*
+ * Hand a batch of tagged frames to the parent.
+ */
+static void
+vlan_flush(struct ifnet *ifp, struct ifnet *p, struct mbuf **mv, u_int n)
+{
+	u_int sent;
+
+	if (n == 0)
+		return;
+
+	sent = if_transmit_lock_vec(p, mv, n);
+	/* mbufs are already freed */
+
+	net_stat_ref_t nsr = IF_STAT_GETREF(ifp);
+	if_statadd_ref(nsr, if_opackets, sent);
+	if_statadd_ref(nsr, if_oerrors, n - sent);
+	IF_STAT_PUTREF(ifp);
+}
+
 static void
 vlan_start(struct ifnet *ifp)
 {
 	struct ifvlan *ifv = ifp->if_softc;
 	struct ifnet *p;
-	struct ethercom *ec;
-	struct mbuf *m;
+	struct mbuf *m, *mv[VLAN_TXBATCH];
 	struct ifvlan_linkmib *mib;
 	struct psref psref;
 	struct ether_header *eh;
-	int error, bound;
+	u_int n;
+	int bound;
 
 	bound = curlwp_bind();
 	mib = vlan_getref_linkmib(ifv, &psref);
@@ -1249,10 +1339,15 @@ vlan_start(struct ifnet *ifp)
 	}
 
 	p = mib->ifvm_p;
-	ec = (void *)mib->ifvm_p;
 
 	ifp->if_flags |= IFF_OACTIVE;
 
+	/*
+	 * Tag up to VLAN_TXBATCH frames at a time and pass them to
+	 * the parent together, so that it takes its queue lock and
+	 * is started once per batch rather than once per frame.
+	 */
+	n = 0;
 	for (;;) {
 		IFQ_DEQUEUE(&ifp->if_snd, m);
 		if (m == NULL)
@@ -1266,8 +1361,7 @@ vlan_start(struct ifnet *ifp)
 			}
 		}
 
-		eh = mtod(m, struct ether_header *);
-		if (ntohs(eh->ether_type) == ETHERTYPE_VLAN) {
+		if (!vlan_encap_ok(mib, m)) {
 			m_freem(m);
 			if_statinc(ifp, if_noproto);
 			continue;
@@ -1295,41 +1389,22 @@ vlan_start(struct ifnet *ifp)
 #endif /* ALTQ */
 
 		bpf_mtap(ifp, m, BPF_D_OUT);
-		/*
-		 * If the parent can insert the tag itself, just mark
-		 * the tag in the mbuf header.
-		 */
-		if (ec->ec_capenable & ETHERCAP_VLAN_HWTAGGING) {
-			vlan_set_tag(m, mib->ifvm_tag);
-		} else {
-			/*
-			 * insert the tag ourselves
-			 */
-			KASSERT(
-			    p->if_type == IFT_ETHER ||
-			    p->if_type == IFT_L2TP);
-			(void)ether_inject_vlantag(&m,
-			    ETHERTYPE_VLAN, mib->ifvm_tag);
-			if (m == NULL) {
-				printf("%s: unable to inject VLAN tag",
-				    p->if_xname);
-				continue;
-			}
-		}
+
+		if (vlan_encap(mib, &m) != 0)
+			continue;
 
 		if ((p->if_flags & IFF_RUNNING) == 0) {
 			m_freem(m);
 			continue;
 		}
 
-		error = if_transmit_lock(p, m);
-		if (error) {
-			/* mbuf is already freed */
-			if_statinc(ifp, if_oerrors);
-			continue;
+		mv[n++] = m;
+		if (n == VLAN_TXBATCH) {
+			vlan_flush(ifp, p, mv, n);
+			n = 0;
 		}
-		if_statinc(ifp, if_opackets);
 	}
+	vlan_flush(ifp, p, mv, n);
 
 	ifp->if_flags &= ~IFF_OACTIVE;
 
@@ -1343,7 +1418,6 @@ vlan_transmit(struct ifnet *ifp, struct mbuf *m)
 {
 	struct ifvlan *ifv = ifp->if_softc;
 	struct ifnet *p;
-	struct ethercom *ec;
 	struct ifvlan_linkmib *mib;
 	struct psref psref;
 	struct ether_header *eh;
@@ -1359,13 +1433,6 @@ vlan_transmit(struct ifnet *ifp, struct mbuf *m)
 		}
 	}
 
-	eh = mtod(m, struct ether_header *);
-	if (ntohs(eh->ether_type) == ETHERTYPE_VLAN) {
-		m_freem(m);
-		if_statinc(ifp, if_noproto);
-		return EPROTONOSUPPORT;
-	}
-
 	bound = curlwp_bind();
 	mib = vlan_getref_linkmib(ifv, &psref);
 	if (mib == NULL) {
@@ -1381,8 +1448,14 @@ vlan_transmit(struct ifnet *ifp, struct mbuf *m)
 		return ENETDOWN;
 	}
 
+	if (!vlan_encap_ok(mib, m)) {
+		m_freem(m);
+		if_statinc(ifp, if_noproto);
+		error = EPROTONOSUPPORT;
+		goto out;
+	}
+
 	p = mib->ifvm_p;
-	ec = (void *)mib->ifvm_p;
 
 	bpf_mtap(ifp, m, BPF_D_OUT);
 
@@ -1391,28 +1464,9 @@ vlan_transmit(struct ifnet *ifp, struct mbuf *m)
 	if (m == NULL)
 		goto out;
 
-	/*
-	 * If the parent can insert the tag itself, just mark
-	 * the tag in the mbuf header.
-	 */
-	if (ec->ec_capenable & ETHERCAP_VLAN_HWTAGGING) {
-		vlan_set_tag(m, mib->ifvm_tag);
-	} else {
-		/*
-		 * insert the tag ourselves
-		 */
-		KASSERT(
-		    p->if_type == IFT_ETHER ||
-		    p->if_type == IFT_L2TP);
-		error = ether_inject_vlantag(&m,
-		    ETHERTYPE_VLAN, mib->ifvm_tag);
-		if (error != 0) {
-			KASSERT(m == NULL);
-			printf("%s: unable to inject VLAN tag",
-			    p->if_xname);
-			goto out;
-		}
-	}
+	error = vlan_encap(mib, &m);
+	if (error != 0)
+		goto out;
 
 	if ((p->if_flags & IFF_RUNNING) == 0) {
 		m_freem(m);
@@ -1445,30 +1499,47 @@ out:
  * Given an Ethernet frame, find a valid vlan interface corresponding to the
  * given source interface and tag, then run the real packet through the
  * parent's input routine.
+ *
+ * 802.1Q frames arrive with the tag already in the mbuf header;
+ * 802.1ad frames arrive with the service tag still in the frame.
+ *
+ * The vlan is looked up in the parent's VLAN ID table in a pserialize
+ * read section and used without taking a reference: we run in the
+ * parent's input softint, and vlan_unconfig_locked() waits for that to
+ * drain after removing the vlan from the table.
  */
 struct mbuf *
 vlan_input(struct ifnet *ifp, struct mbuf *m)
 {
 	struct ifvlan *ifv;
-	uint16_t vid;
-	struct ifvlan_linkmib *mib;
-	struct psref psref;
+	uint16_t proto, vid;
+	int s;
 
-	KASSERT(vlan_has_tag(m));
+	if (vlan_has_tag(m)) {
+		proto = ETHERTYPE_VLAN;
+	} else {
+		m = ether_strip_vlantag(m);
+		if (m == NULL) {
+			if_statinc(ifp, if_ierrors);
+			return NULL;
+		}
+		proto = ETHERTYPE_QINQ;
+	}
 	vid = EVL_VLANOFTAG(vlan_get_tag(m));
-	KASSERT(vid != 0);
+	KASSERT(vid != 0 || proto == ETHERTYPE_QINQ);
 
-	mib = vlan_lookup_tag_psref(ifp, vid, &psref);
-	if (mib == NULL) {
+	s = pserialize_read_enter();
+	ifv = vlan_lookup_vid(ifp, proto, vid);
+	pserialize_read_exit(s);
+	if (ifv == NULL) {
 		return m;
 	}
 
-	ifv = mib->ifvm_ifvlan;
 	if ((ifv->ifv_if.if_flags & (IFF_UP | IFF_RUNNING)) !=
 	    (IFF_UP | IFF_RUNNING)) {
 		m_freem(m);
 		if_statinc(ifp, if_noproto);
-		goto out;
+		return NULL;
 	}
 
 	/*
@@ -1492,21 +1563,19 @@ vlan_input(struct ifnet *ifp, struct mbuf *m)
 		    eh->ether_dhost, ETHER_ADDR_LEN) != 0) {
 			m_freem(m);
 			if_statinc(&ifv->ifv_if, if_ierrors);
-			goto out;
+			return NULL;
 		}
 	}
 
 	m_set_rcvif(m, &ifv->ifv_if);
 
 	if (pfil_run_hooks(ifp->if_pfil, &m, ifp, PFIL_IN) != 0)
-		goto out;
+		return NULL;
 	if (m == NULL)
-		goto out;
+		return NULL;
 
 	m->m_flags &= ~M_PROMISC;
 	if_input(&ifv->ifv_if, m);
-out:
-	vlan_putref_linkmib(mib, &psref);
 	return NULL;
 }
 
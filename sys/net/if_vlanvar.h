@@ -88,11 +88,11 @@ struct mbuf *	vlan_input(struct ifnet *, struct mbuf *);
  * + ifv_list.list is protected by ifv_list.lock (an adaptive mutex)
  *     ifv_list.list is list of all ifvlans, and it is used to avoid
  *     unload while busy.
- * + ifv_hash.lists is protected by
- *   - ifv_hash.lock (an adaptive mutex) for writer
- *   - pserialize for reader
- *     ifv_hash.lists is hashed list of all configured
- *     vlan interface, and it is used to avoid unload while busy.
+ * + ethercom->ec_vlantab and ec_qinqtab of a parent are protected by
+ *   - vlan_vidtab_lock (an adaptive mutex) for writer
+ *   - pserialize (vlan_psz) for reader
+ *     they index the vlan interfaces configured on the parent by
+ *     VLAN ID, for 802.1Q and 802.1ad tags respectively.
  * + ifvlan->ifv_linkmib is protected by
  *   - ifvlan->ifv_lock (an adaptive mutex) for writer
  *   - ifv_linkmib->ifvm_psref for reader
@@ -101,7 +101,7 @@ struct mbuf *	vlan_input(struct ifnet *, struct mbuf *);
  *
  * Locking order:
  *     - ifv_list.lock => struct ifvlan->ifv_lock
- *     - struct ifvlan->ifv_lock => ifv_hash.lock
+ *     - struct ifvlan->ifv_lock => vlan_vidtab_lock
  * Other mutexes must not hold simultaneously
  *
  *   NOTICE
@@ -46,12 +46,13 @@ __KERNEL_RCSID(0, "$NetBSD: pfil.c,v 1.42 2022/08/16 04:35:57 knakahara Exp $");
 
 #define	MAX_HOOKS	8
 
-/* Func is either pfil_func_t or pfil_ifunc_t. */
+/* Func is either pfil_func_t, pfil_vfunc_t or pfil_ifunc_t. */
 typedef void		(*pfil_polyfunc_t)(void);
 
 typedef struct {
 	pfil_polyfunc_t pfil_func;
 	void *		pfil_arg;
+	bool		pfil_vector;	/* func is pfil_vfunc_t */
 } pfil_hook_t;
 
 typedef struct {
@@ -180,8 +181,8 @@ pfil_hook_get(int dir, pfil_head_t *ph)
 }
 
 static int
-pfil_list_add(pfil_listset_t *phlistset, pfil_polyfunc_t func, void *arg,
-              int flags)
+pfil_list_add(pfil_listset_t *phlistset, pfil_polyfunc_t func, bool vector,
+              void *arg, int flags)
 {
 	u_int nhooks;
 	pfil_list_t *newlist, *oldlist;
@@ -235,6 +236,7 @@ pfil_list_add(pfil_listset_t *phlistset, pfil_polyfunc_t func, void *arg,
 
 	pfh->pfil_func = func;
 	pfh->pfil_arg  = arg;
+	pfh->pfil_vector = vector;
 
 	/* switch from oldlist to newlist */
 	atomic_store_release(&phlistset->active, newlist);
@@ -251,16 +253,12 @@ pfil_list_add(pfil_listset_t *phlistset, pfil_polyfunc_t func, void *arg,
 	return 0;
 }
 
-/*
- * pfil_add_hook: add a function (hook) to the packet filter head.
- * The possible flags are:
- *
- *	PFIL_IN		call on incoming packets
- *	PFIL_OUT	call on outgoing packets
- *	PFIL_ALL	call on all of the above
- */
-int
-pfil_add_hook(pfil_func_t func, void *arg, int flags, pfil_head_t *ph)
+static int	pfil_remove_packet_hook(pfil_polyfunc_t, void *, int,
+		    pfil_head_t *);
+
+static int
+pfil_add_packet_hook(pfil_polyfunc_t func, bool vector, void *arg, int flags,
+    pfil_head_t *ph)
 {
 	int error = 0;
 
@@ -277,17 +275,48 @@ pfil_add_hook(pfil_func_t func, void *arg, int flags, pfil_head_t *ph)
 			continue;
 		}
 		phlistset = pfil_hook_get(fcase, ph);
-		error = pfil_list_add(phlistset, (pfil_polyfunc_t)func, arg,
-		    flags);
+		error = pfil_list_add(phlistset, func, vector, arg, flags);
 		if (error && (error != EEXIST))
 			break;
 	}
 	if (error && (error != EEXIST)) {
-		pfil_remove_hook(func, arg, flags, ph);
+		pfil_remove_packet_hook(func, arg, flags, ph);
 	}
 	return error;
 }
 
+/*
+ * pfil_add_hook: add a function (hook) to the packet filter head.
+ * The possible flags are:
+ *
+ *	PFIL_IN		call on incoming packets
+ *	PFIL_OUT	call on outgoing packets
+ *	PFIL_ALL	call on all of the above
+ */
+int
+pfil_add_hook(pfil_func_t func, void *arg, int flags, pfil_head_t *ph)
+{
+
+	return pfil_add_packet_hook((pfil_polyfunc_t)func, false, arg, flags,
+	    ph);
+}
+
+/*
+ * pfil_add_vhook: add a function (hook) which takes an array of packets
+ * to the packet filter head.  The flags are as for pfil_add_hook().
+ * The hook is given all packets of a pfil_run_hooks_vec() call at once,
+ * and a single-element array by pfil_run_hooks().  It drops or consumes
+ * a packet by setting its slot to NULL, and must skip slots which are
+ * NULL on entry.
+ */
+int
+pfil_add_vhook(pfil_vfunc_t func, void *arg, int flags, pfil_head_t *ph)
+{
+
+	return pfil_add_packet_hook((pfil_polyfunc_t)func, true, arg, flags,
+	    ph);
+}
+
 /*
  * pfil_add_ihook: add an interface-event function (hook) to the packet
  * filter head.  The possible flags are:
@@ -306,7 +335,8 @@ pfil_add_ihook(pfil_ifunc_t func, void *arg, int flags, pfil_head_t *ph)
 	ASSERT_SLEEPABLE();
 
 	phlistset = pfil_hook_get(flags, ph);
-	return pfil_list_add(phlistset, (pfil_polyfunc_t)func, arg, flags);
+	return pfil_list_add(phlistset, (pfil_polyfunc_t)func, false, arg,
+	    flags);
 }
 
 /*
@@ -361,11 +391,9 @@ pfil_list_remove(pfil_listset_t *phlistset, pfil_polyfunc_t func, void *arg)
 	return ENOENT;
 }
 
-/*
- * pfil_remove_hook: remove the hook from the packet filter head.
- */
-int
-pfil_remove_hook(pfil_func_t func, void *arg, int flags, pfil_head_t *ph)
+static int
+pfil_remove_packet_hook(pfil_polyfunc_t func, void *arg, int flags,
+    pfil_head_t *ph)
 {
 	KASSERT((flags & ~PFIL_ALL) == 0);
 
@@ -379,11 +407,31 @@ pfil_remove_hook(pfil_func_t func, void *arg, int flags, pfil_head_t *ph)
 			continue;
 		}
 		pflistset = pfil_hook_get(fcase, ph);
-		(void)pfil_list_remove(pflistset, (pfil_polyfunc_t)func, arg);
+		(void)pfil_list_remove(pflistset, func, arg);
 	}
 	return 0;
 }
 
+/*
+ * pfil_remove_hook: remove the hook from the packet filter head.
+ */
+int
+pfil_remove_hook(pfil_func_t func, void *arg, int flags, pfil_head_t *ph)
+{
+
+	return pfil_remove_packet_hook((pfil_polyfunc_t)func, arg, flags, ph);
+}
+
+/*
+ * pfil_remove_vhook: remove the hook added by pfil_add_vhook().
+ */
+int
+pfil_remove_vhook(pfil_vfunc_t func, void *arg, int flags, pfil_head_t *ph)
+{
+
+	return pfil_remove_packet_hook((pfil_polyfunc_t)func, arg, flags, ph);
+}
+
 int
 pfil_remove_ihook(pfil_ifunc_t func, void *arg, int flags, pfil_head_t *ph)
 {
@@ -434,9 +482,16 @@ pfil_run_hooks(pfil_head_t *ph, struct mbuf **mp, ifnet_t *ifp, int dir)
 	pserialize_read_exit(s);
 	for (u_int i = 0; i < phlist->nhooks; i++) {
 		pfil_hook_t *pfh = &phlist->hooks[i];
-		pfil_func_t func = (pfil_func_t)pfh->pfil_func;
 
-		ret = (*func)(pfh->pfil_arg, &m, ifp, dir);
+		if (pfh->pfil_vector) {
+			pfil_vfunc_t vfunc = (pfil_vfunc_t)pfh->pfil_func;
+
+			(*vfunc)(pfh->pfil_arg, &m, 1, ifp, dir);
+		} else {
+			pfil_func_t func = (pfil_func_t)pfh->pfil_func;
+
+			ret = (*func)(pfh->pfil_arg, &m, ifp, dir);
+		}
 		if (m == NULL || ret)
 			break;
 	}
@@ -449,6 +504,76 @@ pfil_run_hooks(pfil_head_t *ph, struct mbuf **mp, ifnet_t *ifp, int dir)
 	return ret;
 }
 
+/*
+ * pfil_run_hooks_vec: run the specified packet filter hooks over an
+ * array of packets which all pass the same interface in the same
+ * direction.  Each hook sees every remaining packet before the next
+ * hook runs, so that hooks added by pfil_add_vhook() can amortise their
+ * lookups over the batch.  A packet dropped or consumed by a hook has
+ * its slot set to NULL; slots which are NULL on entry are skipped.
+ */
+void
+pfil_run_hooks_vec(pfil_head_t *ph, struct mbuf **mv, u_int n, ifnet_t *ifp,
+    int dir)
+{
+	pfil_listset_t *phlistset;
+	pfil_list_t *phlist;
+	struct psref psref;
+	u_int live;
+	int s, bound;
+
+	KASSERT(dir == PFIL_IN || dir == PFIL_OUT);
+	KASSERT(!cpu_intr_p());
+
+	if (ph == NULL || n == 0) {
+		return;
+	}
+
+	if (__predict_false((phlistset = pfil_hook_get(dir, ph)) == NULL)) {
+		return;
+	}
+
+	bound = curlwp_bind();
+	s = pserialize_read_enter();
+	phlist = atomic_load_consume(&phlistset->active);
+	if (phlist->nhooks == 0) {
+		pserialize_read_exit(s);
+		curlwp_bindx(bound);
+		return;
+	}
+	psref_acquire(&psref, &phlist->psref, pfil_psref_class);
+	pserialize_read_exit(s);
+	for (u_int i = 0; i < phlist->nhooks; i++) {
+		pfil_hook_t *pfh = &phlist->hooks[i];
+
+		live = 0;
+		if (pfh->pfil_vector) {
+			pfil_vfunc_t vfunc = (pfil_vfunc_t)pfh->pfil_func;
+
+			(*vfunc)(pfh->pfil_arg, mv, n, ifp, dir);
+			for (u_int j = 0; j < n; j++) {
+				if (mv[j] != NULL)
+					live++;
+			}
+		} else {
+			pfil_func_t func = (pfil_func_t)pfh->pfil_func;
+
+			for (u_int j = 0; j < n; j++) {
+				if (mv[j] == NULL)
+					continue;
+				if ((*func)(pfh->pfil_arg, &mv[j], ifp, dir))
+					mv[j] = NULL;
+				else if (mv[j] != NULL)
+					live++;
+			}
+		}
+		if (live == 0)
+			break;
+	}
+	psref_release(&psref, &phlist->psref, pfil_psref_class);
+	curlwp_bindx(bound);
+}
+
 static void
 pfil_run_arg(pfil_listset_t *phlistset, u_long cmd, void *arg)
 {
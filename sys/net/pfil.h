@@ -40,6 +40,8 @@ struct ifaddr;
  * possibly intercept the packet.
  */
 typedef int (*pfil_func_t)(void *, struct mbuf **, struct ifnet *, int);
+typedef void (*pfil_vfunc_t)(void *, struct mbuf **, u_int, struct ifnet *,
+    int);
 typedef void (*pfil_ifunc_t)(void *, unsigned long, void *);
 
 #define PFIL_IN		0x00000001
@@ -61,12 +63,17 @@ typedef struct pfil_head	pfil_head_t;
 
 void	pfil_init(void);
 int	pfil_run_hooks(pfil_head_t *, struct mbuf **, struct ifnet *, int);
+void	pfil_run_hooks_vec(pfil_head_t *, struct mbuf **, u_int,
+	    struct ifnet *, int);
 void	pfil_run_addrhooks(pfil_head_t *, unsigned long, struct ifaddr *);
 void	pfil_run_ifhooks(pfil_head_t *, unsigned long, struct ifnet *);
 
 int	pfil_add_hook(pfil_func_t, void *, int, pfil_head_t *);
 int	pfil_remove_hook(pfil_func_t, void *, int, pfil_head_t *);
 
+int	pfil_add_vhook(pfil_vfunc_t, void *, int, pfil_head_t *);
+int	pfil_remove_vhook(pfil_vfunc_t, void *, int, pfil_head_t *);
+
 int	pfil_add_ihook(pfil_ifunc_t, void *, int, pfil_head_t *);
 int	pfil_remove_ihook(pfil_ifunc_t, void *, int, pfil_head_t *);
 
@@ -975,20 +975,19 @@ rn_walkfirst(struct radix_node *rn, rn_printer_t printer, void *arg)
 	return rn;
 }
 
-int
-rn_walktree(
-	struct radix_node_head *h,
+static int
+rn_walkleaves(
+	struct radix_node *rn,
 	int (*f)(struct radix_node *, void *),
 	void *w)
 {
 	int error;
-	struct radix_node *base, *next, *rn;
+	struct radix_node *base, *next;
 	/*
 	 * This gets complicated because we may delete the node
 	 * while applying the function f to it, so we need to calculate
 	 * the successor node in advance.
 	 */
-	rn = rn_walkfirst(h->rnh_treetop, NULL, NULL);
 	for (;;) {
 		base = rn;
 		next = rn_walknext(rn, NULL, NULL);
@@ -1005,6 +1004,78 @@ rn_walktree(
 	/* NOTREACHED */
 }
 
+int
+rn_walktree(
+	struct radix_node_head *h,
+	int (*f)(struct radix_node *, void *),
+	void *w)
+{
+
+	return rn_walkleaves(rn_walkfirst(h->rnh_treetop, NULL, NULL), f, w);
+}
+
+/*
+ * Like rn_walktree(), but only visit the leaves whose keys come after
+ * v_arg in the order of the walk, i.e. resume a walk that stopped after
+ * visiting the leaves with key v_arg.  The key need not be in the tree
+ * any longer: the position it would take is found the way rn_insert()
+ * does.
+ */
+int
+rn_walktree_from(
+	struct radix_node_head *h,
+	const void *v_arg,
+	int (*f)(struct radix_node *, void *),
+	void *w)
+{
+	struct radix_node *top = h->rnh_treetop;
+	struct radix_node *t = rn_search(v_arg, top);
+	struct radix_node *x;
+	const char *v = v_arg;
+	const char *cp = v + top->rn_off;
+	const char *cp2 = t->rn_key + top->rn_off;
+	const char *cplim = v + *(const u_char *)v;
+	int b, cmp_res;
+
+	/*
+	 * Find first bit at which v and t->rn_key differ
+	 */
+	while (cp < cplim)
+		if (*cp2++ != *cp++)
+			goto on1;
+	/*
+	 * The key is in the tree: skip it and its duplicates.  The last
+	 * leaf is its own successor.
+	 */
+	if ((x = rn_walknext(t, NULL, NULL)) == t)
+		return 0;
+	return rn_walkleaves(x, f, w);
+on1:
+	cmp_res = (cp[-1] ^ cp2[-1]) & 0xff;
+	for (b = (cp - v) << 3; cmp_res; b--)
+		cmp_res >>= 1;
+
+	/*
+	 * Find the subtree of the keys that agree with v on the bits
+	 * before b.  They all come before v if v has bit b set, and
+	 * after it otherwise.
+	 */
+	x = top;
+	do {
+		if (v[x->rn_off] & x->rn_bmask)
+			x = x->rn_r;
+		else
+			x = x->rn_l;
+	} while (b > (unsigned) x->rn_b); /* x->rn_b < b && x->rn_b >= 0 */
+
+	if ((v[b >> 3] & (0x80 >> (b & 7))) == 0)
+		return rn_walkleaves(rn_walkfirst(x, NULL, NULL), f, w);
+
+	while (x->rn_b >= 0)
+		x = x->rn_r;
+	return rn_walkleaves(rn_walknext(x, NULL, NULL), f, w);
+}
+
 struct radix_node *
 rn_search_matched(struct radix_node_head *h,
     int (*matcher)(struct radix_node *, void *), void *w)
@@ -139,6 +139,9 @@ int	rn_refines(const void *, const void *);
 int	rn_walktree(struct radix_node_head *,
 	            int (*)(struct radix_node *, void *),
 		    void *);
+int	rn_walktree_from(struct radix_node_head *, const void *,
+	            int (*)(struct radix_node *, void *),
+		    void *);
 struct radix_node *
 	rn_search_matched(struct radix_node_head *,
 	                  int (*)(struct radix_node *, void *),
@@ -2418,6 +2418,24 @@ rt_walktree(sa_family_t family, int (*f)(struct rtentry *, void *), void *v)
 	return error;
 }
 
+/*
+ * Like rt_walktree(), but start after the entries whose destination is
+ * key, so that a walk can be resumed across calls without holding the
+ * table lock.
+ */
+int
+rt_walktree_from(sa_family_t family, const struct sockaddr *key,
+    int (*f)(struct rtentry *, void *), void *v)
+{
+	int error;
+
+	RT_RLOCK();
+	error = rtbl_walktree_from(family, key, f, v);
+	RT_UNLOCK();
+
+	return error;
+}
+
 #ifdef DDB
 
 #include <machine/db_machdep.h>
@@ -387,6 +387,8 @@ struct rt_walkarg {
 	int	w_tmemsize;
 	int	w_tmemneeded;
 	void *	w_tmem;
+	void *	w_grpstart;	/* NET_RT_DUMPFROM: start of current key */
+	const struct sockaddr *w_lastkey;
 };
 
 #if 0
@@ -467,6 +469,8 @@ void	rt_delete_matched_entries(sa_family_t,
 void	rt_replace_ifa_matched_entries(sa_family_t,
 	    int (*)(struct rtentry *, void *), void *, struct ifaddr *);
 int	rt_walktree(sa_family_t, int (*)(struct rtentry *, void *), void *);
+int	rt_walktree_from(sa_family_t, const struct sockaddr *,
+	    int (*)(struct rtentry *, void *), void *);
 
 static __inline void
 rt_assert_referenced(const struct rtentry *rt)
@@ -574,6 +578,8 @@ struct rtentry *
 	rt_matchaddr(rtbl_t *, const struct sockaddr *);
 int	rt_refines(const struct sockaddr *, const struct sockaddr *);
 int	rtbl_walktree(sa_family_t, int (*)(struct rtentry *, void *), void *);
+int	rtbl_walktree_from(sa_family_t, const struct sockaddr *,
+	    int (*)(struct rtentry *, void *), void *);
 struct rtentry *
 	rtbl_search_matched_entry(sa_family_t,
 	    int (*)(struct rtentry *, void *), void *);
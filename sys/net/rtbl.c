@@ -202,6 +202,22 @@ rtbl_walktree(sa_family_t family, int (*f)(struct rtentry *, void *), void *v)
 	return rn_walktree(&t->t_rnh, rt_walktree_visitor, &rw);
 }
 
+int
+rtbl_walktree_from(sa_family_t family, const struct sockaddr *key,
+    int (*f)(struct rtentry *, void *), void *v)
+{
+	rtbl_t *t = rt_tables[family];
+	struct rtwalk rw;
+
+	if (t == NULL)
+		return 0;
+
+	rw.rw_f = f;
+	rw.rw_v = v;
+
+	return rn_walktree_from(&t->t_rnh, key, rt_walktree_visitor, &rw);
+}
+
 struct rtentry *
 rtbl_search_matched_entry(sa_family_t family,
     int (*f)(struct rtentry *, void *), void *v)
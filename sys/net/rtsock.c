@@ -193,6 +193,9 @@ sysctl_dumpentry(struct rtentry *rt, void *v)
 
 	if (w->w_op == NET_RT_FLAGS && !(rt->rt_flags & w->w_arg))
 		return 0;
+	if (w->w_op == NET_RT_DUMPFROM && w->w_arg != 0 &&
+	    !(rt->rt_flags & w->w_arg))
+		return 0;
 	memset(&info, 0, sizeof(info));
 	info.rti_info[RTAX_DST] = rt_getkey(rt);
 	info.rti_info[RTAX_GATEWAY] = rt->rt_gateway;
@@ -230,6 +233,31 @@ sysctl_dumpentry(struct rtentry *rt, void *v)
 	return error;
 }
 
+/*
+ * NET_RT_DUMPFROM: dump entries until the user buffer is full, then
+ * back out the entries sharing the key of the one that did not fit, so
+ * that the caller can resume after the last key it got in full.
+ */
+static int
+sysctl_dumpfrom_entry(struct rtentry *rt, void *v)
+{
+	struct rt_walkarg *w = v;
+	const struct sockaddr *key = rt_getkey(rt);
+	int error;
+
+	if (w->w_lastkey == NULL || sockaddr_cmp(key, w->w_lastkey) != 0)
+		w->w_grpstart = w->w_where;
+	w->w_lastkey = key;
+
+	if ((error = sysctl_dumpentry(rt, w)) != 0)
+		return error;
+	if (w->w_where != NULL && w->w_needed > 0) {
+		w->w_where = w->w_grpstart;
+		return EJUSTRETURN;
+	}
+	return 0;
+}
+
 static int
 sysctl_iflist_if(struct ifnet *ifp, struct rt_walkarg *w,
     struct rt_addrinfo *info, size_t len)
@@ -406,15 +434,33 @@ sysctl_rtable(SYSCTLFN_ARGS)
 	int	i, error = EINVAL;
 	u_char  af;
 	struct	rt_walkarg w;
+	struct	sockaddr_storage from;
 
 	if (namelen == 1 && name[0] == CTL_QUERY)
 		return sysctl_query(SYSCTLFN_CALL(rnode));
 
-	if (newp)
+	if (newp && (namelen != 3 || name[1] != NET_RT_DUMPFROM))
 		return EPERM;
 	if (namelen != 3)
 		return EINVAL;
 	af = name[0];
+	if (name[1] == NET_RT_DUMPFROM) {
+		/* The cursor is the last destination the caller got. */
+		if (af == 0 || af > AF_MAX)
+			return EINVAL;
+		if (newp != NULL) {
+			if (newlen < offsetof(struct sockaddr, sa_data) ||
+			    newlen > sizeof(from))
+				return EINVAL;
+			/* The walk may look past what the caller gave us. */
+			memset(&from, 0, sizeof(from));
+			error = sysctl_copyin(l, newp, &from, newlen);
+			if (error)
+				return error;
+			if (from.ss_len != newlen || from.ss_family != af)
+				return EINVAL;
+		}
+	}
 	w.w_tmemneeded = 0;
 	w.w_tmemsize = 0;
 	w.w_tmem = NULL;
@@ -430,6 +476,8 @@ again:
 	w.w_given = *given;
 	w.w_needed = 0 - w.w_given;
 	w.w_where = where;
+	w.w_grpstart = where;
+	w.w_lastkey = NULL;
 
 	KERNEL_LOCK_UNLESS_NET_MPSAFE();
 	const int s = splsoftnet();
@@ -470,6 +518,17 @@ again:
 		}
 		break;
 
+	case NET_RT_DUMPFROM:
+		/* ARP/NDP entries are not part of the table walk. */
+		if (newp != NULL)
+			error = rt_walktree_from(af, (struct sockaddr *)&from,
+			    sysctl_dumpfrom_entry, &w);
+		else
+			error = rt_walktree(af, sysctl_dumpfrom_entry, &w);
+		if (error == EJUSTRETURN)
+			error = 0;
+		break;
+
 	case NET_RT_OOOIFLIST:		/* compat_14 */
 	case NET_RT_OOIFLIST:		/* compat_50 */
 	case NET_RT_OIFLIST:		/* compat_70 */
@@ -487,7 +546,12 @@ again:
 	if (w.w_tmem)
 		kmem_free(w.w_tmem, w.w_tmemsize);
 	w.w_needed += w.w_given;
-	if (where) {
+	if (where && w.w_op == NET_RT_DUMPFROM) {
+		/* A short result is fine as long as it is not empty. */
+		*given = (char *)w.w_where - (char *)where;
+		if (*given == 0 && w.w_needed > w.w_given)
+			return ENOMEM;
+	} else if (where) {
 		*given = (char *)w.w_where - (char *)where;
 		if (*given < w.w_needed)
 			return ENOMEM;
@@ -509,8 +573,9 @@ sysctl_net_route_setup(struct sysctllog **clog, int pf, const char *name)
 		       NULL, 0, NULL, 0,
 		       CTL_NET, pf, CTL_EOL);
 
+	/* Anyone may pass a NET_RT_DUMPFROM cursor. */
 	sysctl_createv(clog, 0, NULL, NULL,
-		       CTLFLAG_PERMANENT,
+		       CTLFLAG_PERMANENT|CTLFLAG_ANYWRITE,
 		       CTLTYPE_NODE, "rtable",
 		       SYSCTL_DESCR("Routing table information"),
 		       sysctl_rtable, 0, NULL, 0,
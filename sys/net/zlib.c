@@ -10,6 +10,9 @@
  * - added Z_PACKET_FLUSH (see zlib.h for details)
  * - added inflateIncomp and deflateOutputPending
  * - allow strm->next_out to be NULL, meaning discard the output
+ * - added Z_RLE and fast paths for Z_HUFFMAN_ONLY, from zlib-1.2
+ * - compare a word at a time in longest_match(), vectorizable hash
+ *   sliding, and zlib-1.2's adler32()
  *
  * $Id: zlib.c,v 1.38 2022/04/12 20:51:42 andvar Exp $
  */
@@ -686,6 +689,9 @@ local void fill_window(deflate_state *s);
 local block_state deflate_stored(deflate_state *s, int flush);
 local block_state deflate_fast(deflate_state *s, int flush);
 local block_state deflate_slow(deflate_state *s, int flush);
+local block_state deflate_rle(deflate_state *s, int flush);
+local block_state deflate_huff(deflate_state *s, int flush);
+local void slide_hash(Posf *table, unsigned n, uInt wsize);
 local void lm_init(deflate_state *s);
 local void putShortMSB(deflate_state *s, uInt b);
 local void flush_pending(z_streamp strm);
@@ -848,7 +854,7 @@ int ZEXPORT deflateInit2_(z_streamp strm,
     }
     if (memLevel < 1 || memLevel > MAX_MEM_LEVEL || method != Z_DEFLATED ||
         windowBits < 9 || windowBits > 15 || level < 0 || level > 9 ||
-	strategy < 0 || strategy > Z_HUFFMAN_ONLY) {
+	strategy < 0 || strategy > Z_RLE) {
         return Z_STREAM_ERROR;
     }
     s = (deflate_state *) ZALLOC(strm, 1, sizeof(deflate_state));
@@ -983,7 +989,7 @@ int ZEXPORT deflateParams(strm, level, strategy)
     if (level == Z_DEFAULT_COMPRESSION) {
 	level = 6;
     }
-    if (level < 0 || level > 9 || strategy < 0 || strategy > Z_HUFFMAN_ONLY) {
+    if (level < 0 || level > 9 || strategy < 0 || strategy > Z_RLE) {
 	return Z_STREAM_ERROR;
     }
     func = configuration_table[s->level].func;
@@ -1120,7 +1126,14 @@ int ZEXPORT deflate (z_streamp strm, int flush)
         (flush != Z_NO_FLUSH && s->status != FINISH_STATE)) {
         block_state bstate;
 
-	bstate = (*(configuration_table[s->level].func))(s, flush);
+	/* Z_HUFFMAN_ONLY and Z_RLE don't need the hash chains at all,
+	 * so they have their own much cheaper loops. */
+	if (s->level != 0 && s->strategy == Z_HUFFMAN_ONLY)
+	    bstate = deflate_huff(s, flush);
+	else if (s->level != 0 && s->strategy == Z_RLE)
+	    bstate = deflate_rle(s, flush);
+	else
+	    bstate = (*(configuration_table[s->level].func))(s, flush);
 
         if (bstate == finish_started || bstate == finish_done) {
             s->status = FINISH_STATE;
@@ -1333,6 +1346,42 @@ local void lm_init (deflate_state *s)
 #endif
 }
 
+#if !defined(ASMV) && !defined(UNALIGNED_OK) && defined(__GNUC__)
+/* ===========================================================================
+ * Return the number of leading bytes, at most MAX_MATCH, that the strings
+ * at scan and match have in common. A machine word is compared at a time
+ * and the first differing byte is located with a bit scan, which is
+ * several times faster than comparing byte by byte on long matches.
+ */
+#define WORD_MATCH
+
+typedef unsigned long match_word;
+
+local inline unsigned compare_match(const Bytef *scan, const Bytef *match)
+{
+    unsigned len = 0;
+    match_word sw, mw, diff;
+
+    while (len + sizeof(match_word) <= MAX_MATCH) {
+        __builtin_memcpy(&sw, scan + len, sizeof(sw));
+        __builtin_memcpy(&mw, match + len, sizeof(mw));
+        diff = sw ^ mw;
+        if (diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return len + (unsigned)__builtin_ctzl(diff) / 8;
+#else
+            return len + (unsigned)__builtin_clzl(diff) / 8;
+#endif
+        }
+        len += sizeof(match_word);
+    }
+    /* MAX_MATCH isn't a multiple of the word size. */
+    while (len < MAX_MATCH && scan[len] == match[len])
+        len++;
+    return len;
+}
+#endif
+
 /* ===========================================================================
  * Set match_start to the longest match starting at the given string and
  * return its length. Matches shorter or equal to prev_length are discarded,
@@ -1372,7 +1421,9 @@ local uInt longest_match(deflate_state *s,
     ush scan_start = *(ushf*)scan;
     ush scan_end   = *(ushf*)(scan+best_len-1);
 #else
+#ifndef WORD_MATCH
     Bytef *strend = s->window + s->strstart + MAX_MATCH;
+#endif
     Byte scan_end1  = scan[best_len-1];
     Byte scan_end   = scan[best_len];
 #endif
@@ -1440,6 +1491,10 @@ local uInt longest_match(deflate_state *s,
             *match            != *scan     ||
             *++match          != scan[1])      continue;
 
+#ifdef WORD_MATCH
+        /* Never reads beyond strstart+MAX_MATCH, like the loop below. */
+        len = (int)compare_match(scan, s->window + cur_match);
+#else
         /* The check at best_len-1 can be removed because it will be made
          * again later. (This heuristic is not always a win.)
          * It is not necessary to compare scan[2] and match[2] since they
@@ -1463,6 +1518,7 @@ local uInt longest_match(deflate_state *s,
 
         len = MAX_MATCH - (int)(strend - scan);
         scan = strend - MAX_MATCH;
+#endif /* WORD_MATCH */
 
 #endif /* UNALIGNED_OK */
 
@@ -1571,6 +1627,23 @@ local void check_match(s, start, match, length)
 #  define check_match(s, start, match, length)
 #endif
 
+/* ===========================================================================
+ * Slide a hash table by wsize positions. This is written as a plain
+ * forward loop without a data-dependent branch so that the compiler can
+ * vectorize it; the hash table is rewritten in full every time the window
+ * slides, which costs as much as compressing a few KB of input.
+ */
+local void slide_hash(Posf *table, unsigned n, uInt wsize)
+{
+    unsigned i;
+    unsigned m;
+
+    for (i = 0; i < n; i++) {
+        m = table[i];
+        table[i] = (Pos)(m >= wsize ? m - wsize : NIL);
+    }
+}
+
 /* ===========================================================================
  * Fill the window when the lookahead becomes insufficient.
  * Updates strstart and lookahead.
@@ -1583,8 +1656,7 @@ local void check_match(s, start, match, length)
  */
 local void fill_window(deflate_state *s)
 {
-    unsigned n, m;
-    Posf *p;
+    unsigned n;
     unsigned more;    /* Amount of free space at the end of the window. */
     uInt wsize = s->w_size;
 
@@ -1617,23 +1689,12 @@ local void fill_window(deflate_state *s)
                later. (Using level 0 permanently is not an optimal usage of
                zlib, so we don't care about this pathological case.)
              */
-	    n = s->hash_size;
-	    p = &s->head[n];
-	    do {
-		m = *--p;
-		*p = (Pos)(m >= wsize ? m-wsize : NIL);
-	    } while (--n);
-
-	    n = wsize;
+	    slide_hash(s->head, s->hash_size, wsize);
 #ifndef FASTEST
-	    p = &s->prev[n];
-	    do {
-		m = *--p;
-		*p = (Pos)(m >= wsize ? m-wsize : NIL);
-		/* If n is not on any hash chain, prev[n] is garbage but
-		 * its value will never be used.
-		 */
-	    } while (--n);
+	    /* If n is not on any hash chain, prev[n] is garbage but
+	     * its value will never be used.
+	     */
+	    slide_hash(s->prev, wsize, wsize);
 #endif
             more += wsize;
         }
@@ -1964,6 +2025,103 @@ local block_state deflate_slow(deflate_state *s, int flush)
     FLUSH_BLOCK(s, flush == Z_FINISH);
     return flush == Z_FINISH ? finish_done : block_done;
 }
+
+/* ===========================================================================
+ * For Z_RLE, simply look for runs of bytes, generate matches only of
+ * distance one. Do not maintain a hash table. (It will be regenerated if
+ * this run of deflate switches away from Z_RLE.)
+ */
+local block_state deflate_rle(deflate_state *s, int flush)
+{
+    int bflush;             /* set if current block must be flushed */
+    uInt prev;              /* byte at distance one to match */
+    Bytef *scan, *strend;   /* scan goes up to strend for length of run */
+
+    for (;;) {
+        /* Make sure that we always have enough lookahead, except
+         * at the end of the input file. We need MAX_MATCH bytes
+         * for the longest run, plus one for the unrolled loop.
+         */
+        if (s->lookahead <= MAX_MATCH) {
+            fill_window(s);
+            if (s->lookahead <= MAX_MATCH && flush == Z_NO_FLUSH) {
+                return need_more;
+            }
+            if (s->lookahead == 0) break; /* flush the current block */
+        }
+
+        /* See how many times the previous byte repeats */
+        s->match_length = 0;
+        if (s->lookahead >= MIN_MATCH && s->strstart > 0) {
+            scan = s->window + s->strstart - 1;
+            prev = *scan;
+            if (prev == *++scan && prev == *++scan && prev == *++scan) {
+                strend = s->window + s->strstart + MAX_MATCH;
+                do {
+                } while (prev == *++scan && prev == *++scan &&
+                         prev == *++scan && prev == *++scan &&
+                         prev == *++scan && prev == *++scan &&
+                         prev == *++scan && prev == *++scan &&
+                         scan < strend);
+                s->match_length = MAX_MATCH - (uInt)(strend - scan);
+                if (s->match_length > s->lookahead)
+                    s->match_length = s->lookahead;
+            }
+            Assert(scan <= s->window+(uInt)(s->window_size-1), "wild scan");
+        }
+
+        /* Emit match if have run of MIN_MATCH or longer, else emit literal */
+        if (s->match_length >= MIN_MATCH) {
+            check_match(s, s->strstart, s->strstart - 1, s->match_length);
+
+            _tr_tally_dist(s, 1, s->match_length - MIN_MATCH, bflush);
+
+            s->lookahead -= s->match_length;
+            s->strstart += s->match_length;
+            s->match_length = 0;
+        } else {
+            /* No match, output a literal byte */
+            Tracevv((stderr,"%c", s->window[s->strstart]));
+            _tr_tally_lit (s, s->window[s->strstart], bflush);
+            s->lookahead--;
+            s->strstart++;
+        }
+        if (bflush) FLUSH_BLOCK(s, 0);
+    }
+    FLUSH_BLOCK(s, flush == Z_FINISH);
+    return flush == Z_FINISH ? finish_done : block_done;
+}
+
+/* ===========================================================================
+ * For Z_HUFFMAN_ONLY, do not look for matches. Do not maintain a hash table.
+ * (It will be regenerated if this run of deflate switches away from Huffman.)
+ */
+local block_state deflate_huff(deflate_state *s, int flush)
+{
+    int bflush;             /* set if current block must be flushed */
+
+    for (;;) {
+        /* Make sure that we have a literal to write. */
+        if (s->lookahead == 0) {
+            fill_window(s);
+            if (s->lookahead == 0) {
+                if (flush == Z_NO_FLUSH)
+                    return need_more;
+                break;      /* flush the current block */
+            }
+        }
+
+        /* Output a literal byte */
+        s->match_length = 0;
+        Tracevv((stderr,"%c", s->window[s->strstart]));
+        _tr_tally_lit (s, s->window[s->strstart], bflush);
+        s->lookahead--;
+        s->strstart++;
+        if (bflush) FLUSH_BLOCK(s, 0);
+    }
+    FLUSH_BLOCK(s, flush == Z_FINISH);
+    return flush == Z_FINISH ? finish_done : block_done;
+}
 /* --- deflate.c */
 
 /* +++ trees.c */
@@ -5832,22 +5990,46 @@ uLong ZEXPORT adler32(uLong adler, const Bytef *buf, uInt len)
 {
     unsigned long s1 = adler & 0xffff;
     unsigned long s2 = (adler >> 16) & 0xffff;
-    int k;
+    unsigned n;
 
     if (buf == Z_NULL) return 1L;
 
-    while (len > 0) {
-        k = len < NMAX ? len : NMAX;
-        len -= k;
-        while (k >= 16) {
+    /* Short inputs, such as the headers of small packets, can't overflow
+     * the sums, and need no more than a subtraction to reduce them. */
+    if (len < 16) {
+        while (len--) {
+            s1 += *buf++;
+            s2 += s1;
+        }
+        if (s1 >= BASE)
+            s1 -= BASE;
+        s2 %= BASE;
+        return (s2 << 16) | s1;
+    }
+
+    /* Do length NMAX blocks -- requires just one modulo operation each. */
+    while (len >= NMAX) {
+        len -= NMAX;
+        n = NMAX / 16;          /* NMAX is divisible by 16 */
+        do {
+            DO16(buf);
+            buf += 16;
+        } while (--n);
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    /* Do the remaining bytes (less than NMAX, still just one modulo). */
+    if (len) {
+        while (len >= 16) {
+            len -= 16;
             DO16(buf);
-	    buf += 16;
-            k -= 16;
+            buf += 16;
         }
-        if (k != 0) do {
+        while (len--) {
             s1 += *buf++;
-	    s2 += s1;
-        } while (--k);
+            s2 += s1;
+        }
         s1 %= BASE;
         s2 %= BASE;
     }
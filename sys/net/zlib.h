@@ -445,6 +445,7 @@ typedef z_stream FAR *z_streamp;
 
 #define Z_FILTERED            1
 #define Z_HUFFMAN_ONLY        2
+#define Z_RLE                 3
 #define Z_DEFAULT_STRATEGY    0
 /* compression strategy; see deflateInit2() below for details */
 
@@ -726,8 +727,11 @@ ZEXTERN int ZEXPORT deflateInit2(z_streamp, int, int, int, int, int);
 
      The strategy parameter is used to tune the compression algorithm. Use the
    value Z_DEFAULT_STRATEGY for normal data, Z_FILTERED for data produced by a
-   filter (or predictor), or Z_HUFFMAN_ONLY to force Huffman encoding only (no
-   string match).  Filtered data consists mostly of small values with a
+   filter (or predictor), Z_HUFFMAN_ONLY to force Huffman encoding only (no
+   string match), or Z_RLE to limit match distances to one (run-length
+   encoding).  Z_RLE is designed to be almost as fast as Z_HUFFMAN_ONLY,
+   but to give better compression on data with runs of repeated bytes.
+   Filtered data consists mostly of small values with a
    somewhat random distribution. In this case, the compression algorithm is
    tuned to compress them better. The effect of Z_FILTERED is to force more
    Huffman coding and less string matching; it is somewhat intermediate
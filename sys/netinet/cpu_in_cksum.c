@@ -36,10 +36,13 @@ __KERNEL_RCSID(0, "$NetBSD: cpu_in_cksum.c,v 1.2 2018/08/28 07:28:01 rin Exp $")
 #include <sys/mbuf.h>
 #ifdef _KERNEL
 #include <sys/systm.h>
+#include <sys/cpu.h>
+#include <sys/uio.h>
 #else
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #define KASSERT(x) assert(x)
 #endif
@@ -50,8 +53,267 @@ __KERNEL_RCSID(0, "$NetBSD: cpu_in_cksum.c,v 1.2 2018/08/28 07:28:01 rin Exp $")
 
 #ifndef _KERNEL
 int	cpu_in_cksum(struct mbuf*, int, int, uint32_t);
+uint32_t cpu_in_cksum_copy(const void *, void *, size_t, uint32_t);
+const char *cpu_in_cksum_select(const char *);
 #endif
 
+/*
+ * Vector implementations of the inner loop.  They are compiled with a
+ * function target attribute rather than for the whole kernel, and one
+ * is picked at the first checksum from what the CPU supports.  In the
+ * kernel they run between fpu_kern_enter() and fpu_kern_leave(), which
+ * only pays off for larger blocks, and never from hard interrupts.
+ *
+ * NEON is only used where the file is built with it enabled: AArch64
+ * kernels are normally built with -mgeneral-regs-only.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define IN_CKSUM_X86
+#ifdef _KERNEL
+#include <x86/cpu.h>
+#include <x86/fpu.h>
+#include <x86/specialreg.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define IN_CKSUM_NEON
+#ifdef _KERNEL
+#include <arm/fpu.h>
+#endif
+#endif
+
+#if defined(IN_CKSUM_X86) || defined(IN_CKSUM_NEON)
+#define IN_CKSUM_VECTOR
+
+/* Blocks handed to the vector code are multiples of this. */
+#define IN_CKSUM_VEC_UNIT	128
+
+/* Smaller blocks are not worth saving the FPU state for. */
+#ifdef _KERNEL
+#define IN_CKSUM_VEC_MIN	512
+#else
+#define IN_CKSUM_VEC_MIN	IN_CKSUM_VEC_UNIT
+#endif
+
+struct in_cksum_impl {
+	const char	*ci_name;
+	bool		(*ci_probe)(void);
+	/* Sum (and copy, if dst != NULL) len bytes, len % UNIT == 0. */
+	uint64_t	(*ci_sum)(const uint8_t *, uint8_t *, size_t);
+};
+
+/*
+ * Each 32-bit lane of the accumulators gathers the two 16-bit words
+ * stored in it, so it grows by at most 0x1fffe per vector and is
+ * flushed into the 64-bit sum well before it could overflow.  Words
+ * are summed in memory order, exactly as the scalar loops do.
+ */
+#define IN_CKSUM_VEC_FLUSH	8192	/* iterations between flushes */
+
+#define IN_CKSUM_VEC_BODY(vtype, src, dst, len, sum) do {		\
+	const size_t vsz = sizeof(vtype);				\
+	const size_t step = 4 * vsz;					\
+	vtype a0, a1, v0, v1, v2, v3;					\
+	size_t i, n;							\
+									\
+	KASSERT((len) % step == 0);					\
+	while ((len) > 0) {						\
+		memset(&a0, 0, vsz);					\
+		memset(&a1, 0, vsz);					\
+		n = MIN((len) / step, IN_CKSUM_VEC_FLUSH);		\
+		for (i = 0; i < n; i++) {				\
+			memcpy(&v0, (src), vsz);			\
+			memcpy(&v1, (src) + vsz, vsz);			\
+			memcpy(&v2, (src) + 2 * vsz, vsz);		\
+			memcpy(&v3, (src) + 3 * vsz, vsz);		\
+			if ((dst) != NULL) {				\
+				memcpy((dst), &v0, vsz);		\
+				memcpy((dst) + vsz, &v1, vsz);		\
+				memcpy((dst) + 2 * vsz, &v2, vsz);	\
+				memcpy((dst) + 3 * vsz, &v3, vsz);	\
+				(dst) += step;				\
+			}						\
+			a0 += (v0 & 0xffff) + (v0 >> 16);		\
+			a1 += (v1 & 0xffff) + (v1 >> 16);		\
+			a0 += (v2 & 0xffff) + (v2 >> 16);		\
+			a1 += (v3 & 0xffff) + (v3 >> 16);		\
+			(src) += step;					\
+		}							\
+		(len) -= n * step;					\
+		for (i = 0; i < vsz / sizeof(uint32_t); i++)		\
+			(sum) += (uint64_t)a0[i] + a1[i];		\
+	}								\
+} while (/*CONSTCOND*/0)
+
+#ifdef IN_CKSUM_X86
+typedef uint32_t in_cksum_v4si __attribute__((__vector_size__(16)));
+typedef uint32_t in_cksum_v8si __attribute__((__vector_size__(32)));
+
+static uint64_t __attribute__((__target__("sse2")))
+in_cksum_sse2(const uint8_t *src, uint8_t *dst, size_t len)
+{
+	uint64_t sum = 0;
+
+	IN_CKSUM_VEC_BODY(in_cksum_v4si, src, dst, len, sum);
+	return sum;
+}
+
+static uint64_t __attribute__((__target__("avx2")))
+in_cksum_avx2(const uint8_t *src, uint8_t *dst, size_t len)
+{
+	uint64_t sum = 0;
+
+	IN_CKSUM_VEC_BODY(in_cksum_v8si, src, dst, len, sum);
+	return sum;
+}
+
+static bool
+in_cksum_sse2_probe(void)
+{
+#ifdef _KERNEL
+	return (cpu_feature[0] & CPUID_SSE2) != 0;
+#else
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool
+in_cksum_avx2_probe(void)
+{
+#ifdef _KERNEL
+	return (cpu_feature[5] & CPUID_SEF_AVX2) != 0 &&
+	    (x86_xsave_features & XCR0_YMM_Hi128) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static const struct in_cksum_impl in_cksum_avx2_impl = {
+	.ci_name = "avx2",
+	.ci_probe = in_cksum_avx2_probe,
+	.ci_sum = in_cksum_avx2,
+};
+
+static const struct in_cksum_impl in_cksum_sse2_impl = {
+	.ci_name = "sse2",
+	.ci_probe = in_cksum_sse2_probe,
+	.ci_sum = in_cksum_sse2,
+};
+#endif /* IN_CKSUM_X86 */
+
+#ifdef IN_CKSUM_NEON
+typedef uint32_t in_cksum_v4si __attribute__((__vector_size__(16)));
+
+static uint64_t
+in_cksum_neon(const uint8_t *src, uint8_t *dst, size_t len)
+{
+	uint64_t sum = 0;
+
+	IN_CKSUM_VEC_BODY(in_cksum_v4si, src, dst, len, sum);
+	return sum;
+}
+
+static bool
+in_cksum_neon_probe(void)
+{
+
+	return true;
+}
+
+static const struct in_cksum_impl in_cksum_neon_impl = {
+	.ci_name = "neon",
+	.ci_probe = in_cksum_neon_probe,
+	.ci_sum = in_cksum_neon,
+};
+#endif /* IN_CKSUM_NEON */
+
+/* In order of preference. */
+static const struct in_cksum_impl *const in_cksum_impls[] = {
+#ifdef IN_CKSUM_X86
+	&in_cksum_avx2_impl,
+	&in_cksum_sse2_impl,
+#endif
+#ifdef IN_CKSUM_NEON
+	&in_cksum_neon_impl,
+#endif
+};
+
+static const struct in_cksum_impl *in_cksum_impl;
+static bool in_cksum_impl_selected;
+#endif /* IN_CKSUM_X86 || IN_CKSUM_NEON */
+
+/*
+ * cpu_in_cksum_select: choose the implementation of the inner loop by
+ * name, or the fastest one the CPU supports if name is NULL.  Returns
+ * the name of the one chosen, "portable" for plain C, or NULL if the
+ * named one is unknown or unsupported.  Called on the first checksum;
+ * calling it later is only meant for testing.
+ */
+const char *
+cpu_in_cksum_select(const char *name)
+{
+#ifdef IN_CKSUM_VECTOR
+	const struct in_cksum_impl *impl = NULL;
+	size_t i;
+
+	for (i = 0; i < __arraycount(in_cksum_impls); i++) {
+		if (name != NULL && strcmp(name, in_cksum_impls[i]->ci_name))
+			continue;
+		if ((*in_cksum_impls[i]->ci_probe)()) {
+			impl = in_cksum_impls[i];
+			break;
+		}
+	}
+	if (impl == NULL && name != NULL && strcmp(name, "portable") != 0)
+		return NULL;
+	in_cksum_impl = impl;
+	in_cksum_impl_selected = true;
+	return impl != NULL ? impl->ci_name : "portable";
+#else
+	if (name != NULL && strcmp(name, "portable") != 0)
+		return NULL;
+	return "portable";
+#endif
+}
+
+#ifdef IN_CKSUM_VECTOR
+/*
+ * Sum, and copy to dst if it is not NULL, the largest multiple of
+ * IN_CKSUM_VEC_UNIT bytes of src up to len with the vector code, if
+ * any is usable.  Returns the number of bytes done and adds their sum,
+ * folded to 32 bits, to *sump.
+ */
+static size_t
+in_cksum_vec(const uint8_t *src, uint8_t *dst, size_t len, uint32_t *sump)
+{
+	const struct in_cksum_impl *impl;
+	uint64_t sum;
+
+	if (len < IN_CKSUM_VEC_MIN)
+		return 0;
+	if (__predict_false(!in_cksum_impl_selected))
+		(void)cpu_in_cksum_select(NULL);
+	if ((impl = in_cksum_impl) == NULL)
+		return 0;
+#ifdef _KERNEL
+	if (cpu_intr_p())
+		return 0;
+#endif
+
+	len -= len % IN_CKSUM_VEC_UNIT;
+#ifdef _KERNEL
+	fpu_kern_enter();
+#endif
+	sum = (*impl->ci_sum)(src, dst, len);
+#ifdef _KERNEL
+	fpu_kern_leave();
+#endif
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	*sump = sum;
+	return len;
+}
+#endif /* IN_CKSUM_VECTOR */
+
 /*
  * Checksum routine for Internet Protocol family headers (Portable Version).
  *
@@ -91,6 +353,8 @@ cpu_in_cksum(struct mbuf *m, int len, int off, uint32_t initial_sum)
 	sum = (initial_sum >> 16) + (initial_sum & 0xffff);
 
 	for (;;) {
+		if (len == 0)
+			break;
 		if (__predict_false(m == NULL)) {
 			printf("in_cksum: out of data\n");
 			return -1;
@@ -102,8 +366,6 @@ cpu_in_cksum(struct mbuf *m, int len, int off, uint32_t initial_sum)
 			goto post_initial_offset;
 		}
 		off -= mlen;
-		if (len == 0)
-			break;
 		m = m->m_next;
 	}
 
@@ -134,6 +396,19 @@ cpu_in_cksum(struct mbuf *m, int len, int off, uint32_t initial_sum)
 			--mlen;
 		}
 		needs_swap = started_on_odd;
+#ifdef IN_CKSUM_VECTOR
+		if (mlen >= IN_CKSUM_VEC_MIN) {
+			uint32_t vsum;
+			size_t done;
+
+			done = in_cksum_vec(data, NULL, mlen, &vsum);
+			if (done > 0) {
+				partial += (vsum >> 16) + (vsum & 0xffff);
+				data += done;
+				mlen -= done;
+			}
+		}
+#endif
 		while (mlen >= 32) {
 			__builtin_prefetch(data + 32);
 			partial += *(uint16_t *)data;
@@ -235,6 +510,8 @@ cpu_in_cksum(struct mbuf *m, int len, int off, uint32_t initial_sum)
 	sum = initial_sum;
 
 	for (;;) {
+		if (len == 0)
+			break;
 		if (__predict_false(m == NULL)) {
 			printf("in_cksum: out of data\n");
 			return -1;
@@ -246,8 +523,6 @@ cpu_in_cksum(struct mbuf *m, int len, int off, uint32_t initial_sum)
 			goto post_initial_offset;
 		}
 		off -= mlen;
-		if (len == 0)
-			break;
 		m = m->m_next;
 	}
 
@@ -285,6 +560,19 @@ cpu_in_cksum(struct mbuf *m, int len, int off, uint32_t initial_sum)
 			data += 2;
 			mlen -= 2;
 		}
+#ifdef IN_CKSUM_VECTOR
+		if (mlen >= IN_CKSUM_VEC_MIN) {
+			uint32_t vsum;
+			size_t done;
+
+			done = in_cksum_vec(data, NULL, mlen, &vsum);
+			if (done > 0) {
+				partial += vsum;
+				data += done;
+				mlen -= done;
+			}
+		}
+#endif
 		while (mlen >= 64) {
 			__builtin_prefetch(data + 32);
 			__builtin_prefetch(data + 64);
@@ -375,3 +663,87 @@ cpu_in_cksum(struct mbuf *m, int len, int off, uint32_t initial_sum)
 	return ~final_acc & 0xffff;
 }
 #endif
+
+/*
+ * cpu_in_cksum_copy: copy len bytes from src to dst, unless dst is NULL,
+ * and return the 16-bit ones' complement sum of them plus initial_sum,
+ * not inverted.  Words are taken in memory order from src, so sums of
+ * consecutive pieces can be chained through initial_sum as long as all
+ * but the last piece are of even length.
+ */
+uint32_t
+cpu_in_cksum_copy(const void *src0, void *dst0, size_t len,
+    uint32_t initial_sum)
+{
+	const uint8_t *src = src0;
+	uint8_t *dst = dst0;
+	uint64_t sum = initial_sum;
+	uint16_t w;
+
+#ifdef IN_CKSUM_VECTOR
+	{
+		uint32_t vsum;
+		size_t done;
+
+		done = in_cksum_vec(src, dst, len, &vsum);
+		if (done > 0) {
+			sum += vsum;
+			src += done;
+			if (dst != NULL)
+				dst += done;
+			len -= done;
+		}
+	}
+#endif
+	if (dst != NULL)
+		memcpy(dst, src, len);
+	for (; len >= 2; len -= 2, src += 2) {
+		memcpy(&w, src, sizeof(w));
+		sum += w;
+	}
+	if (len > 0) {
+#if _BYTE_ORDER == _LITTLE_ENDIAN
+		sum += *src;
+#else
+		sum += *src << 8;
+#endif
+	}
+
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	return sum;
+}
+
+#ifdef _KERNEL
+/*
+ * in_cksum_uiomove: uiomove(9) n bytes between buf and uio and add
+ * their checksum, as by cpu_in_cksum_copy(), to *sump.  The data is
+ * moved in pieces and summed while still in the cache rather than in
+ * a second pass over the whole buffer.
+ */
+int
+in_cksum_uiomove(void *buf, size_t n, struct uio *uio, uint32_t *sump)
+{
+	const size_t chunk = 2048;	/* even, and fits in L1 */
+	uint8_t *p = buf;
+	uint32_t sum = *sump;
+	size_t len;
+	int error = 0;
+
+	while (n > 0 && uio->uio_resid > 0) {
+		len = MIN(MIN(n, chunk), uio->uio_resid);
+		if (uio->uio_rw == UIO_READ)
+			sum = cpu_in_cksum_copy(p, NULL, len, sum);
+		if ((error = uiomove(p, len, uio)) != 0)
+			break;
+		if (uio->uio_rw == UIO_WRITE)
+			sum = cpu_in_cksum_copy(p, NULL, len, sum);
+		p += len;
+		n -= len;
+	}
+	*sump = sum;
+	return error;
+}
+#endif /* _KERNEL */
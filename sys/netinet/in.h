@@ -427,6 +427,8 @@ in_cksum_addword(u_int16_t a, u_int16_t b)
 	return (sum);
 }
 
+struct uio;
+
 extern	struct in_addr zeroin_addr;
 extern	u_char	ip_protox[];
 extern const struct sockaddr_in in_any;
@@ -435,6 +437,9 @@ int	in_broadcast(struct in_addr, struct ifnet *);
 int	in_direct(struct in_addr, struct ifnet *);
 int	in_canforward(struct in_addr);
 int	cpu_in_cksum(struct mbuf *, int, int, uint32_t);
+uint32_t cpu_in_cksum_copy(const void *, void *, size_t, uint32_t);
+const char *cpu_in_cksum_select(const char *);
+int	in_cksum_uiomove(void *, size_t, struct uio *, uint32_t *);
 int	in_cksum(struct mbuf *, int);
 int	in4_cksum(struct mbuf *, u_int8_t, int, int);
 int	in_localaddr(struct in_addr);
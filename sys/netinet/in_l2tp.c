@@ -82,6 +82,32 @@ static const struct encapsw in_l2tp_encapsw = {
 
 static int in_l2tp_match(struct mbuf *, int, int, void *);
 
+/*
+ * Fill in the outer IP header of a variant's encapsulation header
+ * template.  ip_len is set per packet by in_l2tp_output().
+ */
+size_t
+in_l2tp_hdr_init(struct l2tp_variant *var, void *hdr)
+{
+	struct ip iphdr;
+
+	memset(&iphdr, 0, sizeof(iphdr));
+	iphdr.ip_src = satosin(var->lv_psrc)->sin_addr;
+	iphdr.ip_dst = satosin(var->lv_pdst)->sin_addr;
+	iphdr.ip_p = IPPROTO_L2TP;
+	/* version will be set in ip_output() */
+	iphdr.ip_ttl = ip_l2tp_ttl;
+	memcpy(hdr, &iphdr, sizeof(iphdr));
+
+	return sizeof(iphdr);
+}
+
+/*
+ * Encapsulate and send a batch of frames linked through m_nextpkt.  The
+ * headers are copied from the variant's template and the route is
+ * looked up once for the whole batch.  The output counters of the l2tp
+ * interface are updated here.
+ */
 int
 in_l2tp_output(struct l2tp_variant *var, struct mbuf *m)
 {
@@ -89,35 +115,29 @@ in_l2tp_output(struct l2tp_variant *var, struct mbuf *m)
 	struct ifnet *ifp;
 	struct sockaddr_in *sin_src = satosin(var->lv_psrc);
 	struct sockaddr_in *sin_dst = satosin(var->lv_pdst);
-	struct ip iphdr;	/* capsule IP header, host byte ordered */
+	struct mbuf *n, *head, **tailp;
 	struct rtentry *rt;
 	struct route *ro_pc;
 	kmutex_t *lock_pc;
-
-	int error;
-	uint32_t sess_id;
+	u_int hlen;
+	int error, len;
 
 	KASSERT(var != NULL);
 	KASSERT(l2tp_heldref_variant(var));
 	KASSERT(sin_src != NULL && sin_dst != NULL);
 	KASSERT(sin_src->sin_family == AF_INET
 	    && sin_dst->sin_family == AF_INET);
+	KASSERT(var->lv_hdrlen >= sizeof(struct ip));
 
 	sc = var->lv_softc;
 	ifp = &sc->l2tp_ec.ec_if;
-	error = l2tp_check_nesting(ifp, m);
-	if (error) {
-		m_freem(m);
-		goto looped;
-	}
 
 	/* bidirectional configured tunnel mode */
 	if (sin_dst->sin_addr.s_addr == INADDR_ANY) {
-		m_freem(m);
+		l2tp_freem_batch(ifp, m);
 		if ((ifp->if_flags & IFF_DEBUG) != 0)
 			log(LOG_DEBUG, "%s: ENETUNREACH\n", __func__);
-		error = ENETUNREACH;
-		goto out;
+		return ENETUNREACH;
 	}
 
 #ifdef NOTYET
@@ -127,115 +147,88 @@ in_l2tp_output(struct l2tp_variant *var, struct mbuf *m)
 #endif
 #endif
 
-	memset(&iphdr, 0, sizeof(iphdr));
-	iphdr.ip_src = sin_src->sin_addr;
-	iphdr.ip_dst = sin_dst->sin_addr;
-	iphdr.ip_p = IPPROTO_L2TP;
-	/* version will be set in ip_output() */
-	iphdr.ip_ttl = ip_l2tp_ttl;
-	/* outer IP header length */
-	iphdr.ip_len = sizeof(struct ip);
-	/* session-id length */
-	iphdr.ip_len += sizeof(uint32_t);
-	if (var->lv_use_cookie == L2TP_COOKIE_ON) {
-		/* cookie length */
-		iphdr.ip_len += var->lv_peer_cookie_len;
-	}
+	hlen = var->lv_hdrlen;
+	head = NULL;
+	tailp = &head;
+	error = 0;
+	for (; m != NULL; m = n) {
+		n = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+
+		error = l2tp_check_nesting(ifp, m);
+		if (error) {
+			m_freem(m);
+			if_statinc(ifp, if_oerrors);
+			continue;
+		}
 
 /* TODO: IP_TCPMSS support */
 #ifdef IP_TCPMSS
-	m = l2tp_tcpmss_clamp(ifp, m);
-	if (m == NULL) {
-		error = EINVAL;
-		goto out;
-	}
+		m = l2tp_tcpmss_clamp(ifp, m);
+		if (m == NULL) {
+			error = EINVAL;
+			if_statinc(ifp, if_oerrors);
+			continue;
+		}
 #endif
 
-	/*
-	 * Payload length.
-	 *
-	 * NOTE: payload length may be changed in ip_tcpmss(). Typical case
-	 * is missing of TCP mss option in original TCP header.
-	 */
-	iphdr.ip_len += m->m_pkthdr.len;
-	HTONS(iphdr.ip_len);
-
-	if (var->lv_use_cookie == L2TP_COOKIE_ON) {
-		/* prepend session cookie */
-		uint32_t cookie_32;
-		uint64_t cookie_64;
-		M_PREPEND(m, var->lv_peer_cookie_len, M_DONTWAIT);
-		if (m && m->m_len < var->lv_peer_cookie_len)
-			m = m_pullup(m, var->lv_peer_cookie_len);
+		/* prepend IP header, session-ID and cookie in one go */
+		M_PREPEND(m, hlen, M_DONTWAIT);
+		if (m && m->m_len < hlen)
+			m = m_pullup(m, hlen);
 		if (m == NULL) {
 			error = ENOBUFS;
-			goto out;
+			if_statinc(ifp, if_oerrors);
+			continue;
 		}
-		if (var->lv_peer_cookie_len == 4) {
-			cookie_32 = htonl((uint32_t)var->lv_peer_cookie);
-			memcpy(mtod(m, void *), &cookie_32, sizeof(uint32_t));
-		} else {
-			cookie_64 = htobe64(var->lv_peer_cookie);
-			memcpy(mtod(m, void *), &cookie_64, sizeof(uint64_t));
+		memcpy(mtod(m, void *), var->lv_hdr, hlen);
+		if (M_GET_ALIGNED_HDR(&m, struct ip, false) != 0) {
+			error = ENOBUFS;
+			if_statinc(ifp, if_oerrors);
+			continue;
 		}
-	}
+		mtod(m, struct ip *)->ip_len = htons(m->m_pkthdr.len);
 
-	/* prepend session-ID */
-	sess_id = htonl(var->lv_peer_sess_id);
-	M_PREPEND(m, sizeof(uint32_t), M_DONTWAIT);
-	if (m && m->m_len < sizeof(uint32_t))
-		m = m_pullup(m, sizeof(uint32_t));
-	if (m == NULL) {
-		error = ENOBUFS;
-		goto out;
-	}
-	memcpy(mtod(m, uint32_t *), &sess_id, sizeof(uint32_t));
+		/*
+		 * To avoid inappropriate rewrite of checksum,
+		 * clear csum flags.
+		 */
+		m->m_pkthdr.csum_flags  = 0;
 
-	/* prepend new IP header */
-	M_PREPEND(m, sizeof(struct ip), M_DONTWAIT);
-	if (m == NULL) {
-		error = ENOBUFS;
-		goto out;
-	}
-	if (M_GET_ALIGNED_HDR(&m, struct ip, false) != 0) {
-		error = ENOBUFS;
-		goto out;
+		*tailp = m;
+		tailp = &m->m_nextpkt;
 	}
-	memcpy(mtod(m, struct ip *), &iphdr, sizeof(struct ip));
+	if (head == NULL)
+		return error;
 
 	if_tunnel_get_ro(sc->l2tp_ro_percpu, &ro_pc, &lock_pc);
 	if ((rt = rtcache_lookup(ro_pc, var->lv_pdst)) == NULL) {
 		if_tunnel_put_ro(sc->l2tp_ro_percpu, lock_pc);
-		m_freem(m);
-		error = ENETUNREACH;
-		goto out;
+		l2tp_freem_batch(ifp, head);
+		return ENETUNREACH;
 	}
 
 	if (rt->rt_ifp == ifp) {
 		rtcache_unref(rt, ro_pc);
 		rtcache_free(ro_pc);
 		if_tunnel_put_ro(sc->l2tp_ro_percpu, lock_pc);
-		m_freem(m);
-		error = ENETUNREACH;	/*XXX*/
-		goto out;
+		l2tp_freem_batch(ifp, head);
+		return ENETUNREACH;	/*XXX*/
 	}
 	rtcache_unref(rt, ro_pc);
 
-	/*
-	 * To avoid inappropriate rewrite of checksum,
-	 * clear csum flags.
-	 */
-	m->m_pkthdr.csum_flags  = 0;
-
-	error = ip_output(m, NULL, ro_pc, 0, NULL, NULL);
+	for (m = head; m != NULL; m = n) {
+		n = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+		len = m->m_pkthdr.len - hlen;
+		error = ip_output(m, NULL, ro_pc, 0, NULL, NULL);
+		if (error)
+			if_statinc(ifp, if_oerrors);
+		else
+			if_statadd2(ifp, if_opackets, 1, if_obytes, len);
+	}
 	if_tunnel_put_ro(sc->l2tp_ro_percpu, lock_pc);
-	return error;
-
-looped:
-	if (error)
-		if_statinc(ifp, if_oerrors);
 
-out:
 	return error;
 }
 
@@ -274,7 +267,8 @@ in_l2tp_input(struct mbuf *m, int off, int proto, void *eparg __unused)
 		return;
 	}
 
-	var = l2tp_lookup_session_ref(sess_id, &psref);
+	var = l2tp_lookup_session_cached_ref(sess_id,
+	    mtod(m, struct ip *)->ip_src.s_addr, &psref);
 	if (var == NULL) {
 		m_freem(m);
 		ip_statinc(IP_STAT_NOL2TP);
@@ -35,6 +35,7 @@
 #define	L2TP_TTL	64
 
 int in_l2tp_output(struct l2tp_variant *, struct mbuf *);
+size_t in_l2tp_hdr_init(struct l2tp_variant *, void *);
 int in_l2tp_attach(struct l2tp_variant *);
 int in_l2tp_detach(struct l2tp_variant *);
 
@@ -43,18 +43,20 @@ __KERNEL_RCSID(0, "$NetBSD: in_offload.c,v 1.14 2020/03/27 16:34:58 jdolecek Exp
 
 /*
  * Handle M_CSUM_TSOv4 in software. Split the TCP payload in chunks of
- * size MSS, and return mbuf chain consists of them.
+ * size MSS, the last one possibly shorter, and return mbuf chain
+ * consists of them.
  */
 struct mbuf *
 tcp4_segment(struct mbuf *m, int off)
 {
 	int mss;
 	int iphlen, thlen;
-	int hlen, len;
+	int hlen, len, seglen;
 	struct ip *ip;
 	struct tcphdr *th;
 	uint16_t ipid, phsum;
 	uint32_t tcpseq;
+	uint8_t thflags;
 	struct mbuf *hdr = NULL;
 	struct mbuf *m0 = NULL;
 	struct mbuf *prev = NULL;
@@ -90,6 +92,7 @@ tcp4_segment(struct mbuf *m, int off)
 	}
 	th = (void *)(mtod(m, char *) + off + iphlen);
 	tcpseq = ntohl(th->th_seq);
+	thflags = th->th_flags;
 	thlen = th->th_off * 4;
 	hlen = off + iphlen + thlen;
 
@@ -104,20 +107,24 @@ tcp4_segment(struct mbuf *m, int off)
 	m = t;
 
 	len -= hlen;
-	KASSERT(len % mss == 0);
 
-	ip = (void *)(mtod(hdr, char *) + off);
-	ip->ip_len = htons(iphlen + thlen + mss);
-	phsum = in_cksum_phdr(ip->ip_src.s_addr, ip->ip_dst.s_addr,
-	    htons((uint16_t)(thlen + mss) + IPPROTO_TCP));
+	/*
+	 * Only the first segment keeps CWR, and only the last one FIN
+	 * and PSH.
+	 */
+	th = (void *)(mtod(hdr, char *) + off + iphlen);
+	th->th_flags &= ~(TH_FIN | TH_PUSH);
 
-	for (nsegs = len / mss; nsegs > 0; nsegs--) {
+	for (nsegs = howmany(len, mss); nsegs > 0; nsegs--) {
 		if (nsegs > 1) {
 			n = m_dup(hdr, 0, hlen, M_NOWAIT);
 			if (n == NULL)
 				goto quit;
-		} else
+			seglen = mss;
+		} else {
 			n = hdr;
+			seglen = len;
+		}
 		KASSERT(n->m_len == hlen); /* XXX */
 
 		if (nsegs > 1) {
@@ -130,6 +137,7 @@ tcp4_segment(struct mbuf *m, int off)
 			t = m;
 		m_cat(n, m);
 		m = t;
+		len -= seglen;
 
 		KASSERT(n->m_len >= hlen); /* XXX */
 
@@ -139,20 +147,27 @@ tcp4_segment(struct mbuf *m, int off)
 		if (prev != NULL)
 			prev->m_nextpkt = n;
 
-		n->m_pkthdr.len = hlen + mss;
+		n->m_pkthdr.len = hlen + seglen;
 		n->m_nextpkt = NULL;	/* XXX */
 
 		ip = (void *)(mtod(n, char *) + off);
+		ip->ip_len = htons(iphlen + thlen + seglen);
 		ip->ip_id = htons(ipid);
 		ip->ip_sum = 0;
 		ip->ip_sum = in4_cksum(n, 0, off, iphlen);
 
 		th = (void *)(mtod(n, char *) + off + iphlen);
 		th->th_seq = htonl(tcpseq);
+		if (n != m0)
+			th->th_flags &= ~TH_CWR;
+		if (nsegs == 1)
+			th->th_flags |= thflags & (TH_FIN | TH_PUSH);
+		phsum = in_cksum_phdr(ip->ip_src.s_addr, ip->ip_dst.s_addr,
+		    htons((uint16_t)(thlen + seglen) + IPPROTO_TCP));
 		th->th_sum = phsum;
-		th->th_sum = in4_cksum(n, 0, off + iphlen, thlen + mss);
+		th->th_sum = in4_cksum(n, 0, off + iphlen, thlen + seglen);
 
-		tcpseq += mss;
+		tcpseq += seglen;
 		ipid++;
 		prev = n;
 	}
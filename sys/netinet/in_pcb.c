@@ -664,6 +664,7 @@ inpcb_disconnect(void *v)
 	if (inp->inp_af != AF_INET)
 		return;
 
+	portalgo_release(inp);
 	in4p_faddr(inp) = zeroin_addr;
 	inp->inp_fport = 0;
 	inpcb_set_state(inp, INP_BOUND);
@@ -691,6 +692,7 @@ inpcb_destroy(void *v)
 	if (ipsec_enabled)
 		ipsec_delete_pcbpolicy(inp);
 #endif
+	portalgo_release(inp);
 	so->so_pcb = NULL;
 
 	s = splsoftnet();
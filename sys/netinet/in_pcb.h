@@ -76,6 +76,7 @@ typedef int (*pcb_overudp_cb_t)(struct mbuf **, int, struct socket *,
 
 struct ip_moptions;
 struct mbuf;
+struct portalgo_dest;
 struct icmp6_filter;
 
 /*
@@ -97,6 +98,7 @@ struct inpcb {
 #define	INP_BOUND		1
 #define	INP_CONNECTED		2
 	int       inp_portalgo;
+	struct	  portalgo_dest *inp_portalgo_dest; /* port from algo_bitmap */
 	struct	  socket *inp_socket;	/* back pointer to socket */
 	struct	  inpcbtable *inp_table;
 	struct	  inpcbpolicy *inp_sp;	/* security policy */
@@ -241,8 +241,13 @@ struct mowner ip_rx_mowner = MOWNER_INIT("internet", "rx");
 struct mowner ip_tx_mowner = MOWNER_INIT("internet", "tx");
 #endif
 
+/* Packets handed to the input filters at once */
+#define	IP_INPUT_BATCH	16
+
 static void		ipintr(void *);
-static void		ip_input(struct mbuf *, struct ifnet *);
+static struct mbuf *	ip_input_check(struct mbuf *, struct ifnet *);
+static void		ip_input_filter(struct mbuf **, u_int, struct ifnet *);
+static void		ip_input_finish(struct mbuf *, struct ifnet *, int);
 static void		ip_forward(struct mbuf *, int, struct ifnet *);
 static bool		ip_dooptions(struct mbuf *);
 static struct in_ifaddr *ip_rtaddr(struct in_addr, struct psref *);
@@ -386,17 +391,22 @@ matched:
 }
 
 /*
- * IP software interrupt routine.
+ * IP software interrupt routine.  Packets are taken off the queue in
+ * runs received on the same interface, up to IP_INPUT_BATCH of them,
+ * so that the input filters can look at them together.
  */
 static void
 ipintr(void *arg __unused)
 {
+	struct mbuf *mv[IP_INPUT_BATCH];
 	struct mbuf *m;
+	u_int n;
 
 	KASSERT(cpu_softintr_p());
 
 	SOFTNET_KERNEL_LOCK_UNLESS_NET_MPSAFE();
-	while ((m = pktq_dequeue(ip_pktq)) != NULL) {
+	m = pktq_dequeue(ip_pktq);
+	while (m != NULL) {
 		struct ifnet *ifp;
 		struct psref psref;
 
@@ -404,10 +414,19 @@ ipintr(void *arg __unused)
 		if (__predict_false(ifp == NULL)) {
 			IP_STATINC(IP_STAT_IFDROP);
 			m_freem(m);
+			m = pktq_dequeue(ip_pktq);
 			continue;
 		}
 
-		ip_input(m, ifp);
+		n = 0;
+		do {
+			if ((m = ip_input_check(m, ifp)) != NULL)
+				mv[n++] = m;
+			m = pktq_dequeue(ip_pktq);
+		} while (m != NULL && n < __arraycount(mv) &&
+		    m->m_pkthdr.rcvif_index == ifp->if_index);
+
+		ip_input_filter(mv, n, ifp);
 
 		m_put_rcvif_psref(ifp, &psref);
 	}
@@ -415,18 +434,14 @@ ipintr(void *arg __unused)
 }
 
 /*
- * IP input routine.  Checksum and byte swap header.  If fragmented
- * try to reassemble.  Process options.  Pass to next level.
+ * IP input routine, first part.  Checksum and sanity check the header.
+ * Returns the packet, or NULL if it was dropped.
  */
-static void
-ip_input(struct mbuf *m, struct ifnet *ifp)
+static struct mbuf *
+ip_input_check(struct mbuf *m, struct ifnet *ifp)
 {
 	struct ip *ip = NULL;
-	struct in_ifaddr *ia = NULL;
 	int hlen = 0, len;
-	int downmatch;
-	int srcrt = 0;
-	int s;
 
 	KASSERTMSG(cpu_softintr_p(), "ip_input: not in the software "
 	    "interrupt handler; synchronization assumptions violated");
@@ -554,6 +569,29 @@ ip_input(struct mbuf *m, struct ifnet *ifp)
 	 * based on this packet.
 	 */
 	m->m_flags |= M_CANFASTFWD;
+	return m;
+
+out:
+	if (m != NULL)
+		m_freem(m);
+	return NULL;
+}
+
+/*
+ * IP input routine, second part.  Run a batch of checked packets from
+ * one interface through the input filters and pass the survivors on.
+ */
+static void
+ip_input_filter(struct mbuf **mv, u_int n, struct ifnet *ifp)
+{
+	struct mbuf *unfiltered[IP_INPUT_BATCH];
+	struct in_addr odst[IP_INPUT_BATCH];
+	struct mbuf *m;
+	struct ip *ip;
+	int hlen;
+	u_int i;
+
+	KASSERT(n <= IP_INPUT_BATCH);
 
 	/*
 	 * Run through list of hooks for input packets.  If there are any
@@ -565,37 +603,46 @@ ip_input(struct mbuf *m, struct ifnet *ifp)
 	 * Don't call hooks if the packet has already been processed by
 	 * IPsec (encapsulated, tunnel mode).
 	 */
+	for (i = 0; i < n; i++) {
+		unfiltered[i] = NULL;
 #if defined(IPSEC)
-	if (!ipsec_used || !ipsec_skip_pfil(m))
-#else
-	if (1)
+		if (ipsec_used && ipsec_skip_pfil(mv[i])) {
+			unfiltered[i] = mv[i];
+			mv[i] = NULL;
+			continue;
+		}
 #endif
-	{
-		struct in_addr odst = ip->ip_dst;
-		bool freed;
+		odst[i] = mtod(mv[i], struct ip *)->ip_dst;
+	}
 
-		freed = pfil_run_hooks(inet_pfil_hook, &m, ifp, PFIL_IN) != 0;
-		if (freed || m == NULL) {
-			m = NULL;
+	pfil_run_hooks_vec(inet_pfil_hook, mv, n, ifp, PFIL_IN);
+
+	for (i = 0; i < n; i++) {
+		if (unfiltered[i] != NULL) {
+			ip_input_finish(unfiltered[i], ifp, 0);
+			continue;
+		}
+		if ((m = mv[i]) == NULL) {
 			IP_STATINC(IP_STAT_PFILDROP_IN);
-			goto out;
+			continue;
 		}
 		if (__predict_false(m->m_len < sizeof(struct ip))) {
 			if ((m = m_pullup(m, sizeof(struct ip))) == NULL) {
 				IP_STATINC(IP_STAT_TOOSMALL);
-				goto out;
+				continue;
 			}
 		}
 		ip = mtod(m, struct ip *);
 		hlen = ip->ip_hl << 2;
 		if (hlen < sizeof(struct ip)) {	/* minimum header length */
 			IP_STATINC(IP_STAT_BADHLEN);
-			goto out;
+			m_freem(m);
+			continue;
 		}
 		if (hlen > m->m_len) {
 			if ((m = m_pullup(m, hlen)) == NULL) {
 				IP_STATINC(IP_STAT_BADHLEN);
-				goto out;
+				continue;
 			}
 			ip = mtod(m, struct ip *);
 		}
@@ -614,8 +661,22 @@ ip_input(struct mbuf *m, struct ifnet *ifp)
 		 * One might argue whether or not this kind of network config.
 		 * should be supported in this manner...
 		 */
-		srcrt = (odst.s_addr != ip->ip_dst.s_addr);
+		ip_input_finish(m, ifp, odst[i].s_addr != ip->ip_dst.s_addr);
 	}
+}
+
+/*
+ * IP input routine, last part.  If fragmented try to reassemble.
+ * Process options.  Pass to next level.
+ */
+static void
+ip_input_finish(struct mbuf *m, struct ifnet *ifp, int srcrt)
+{
+	struct ip *ip = mtod(m, struct ip *);
+	struct in_ifaddr *ia = NULL;
+	int hlen = ip->ip_hl << 2;
+	int downmatch;
+	int s;
 
 #ifdef ALTQ
 	/* XXX Temporary until ALTQ is changed to use a pfil hook */
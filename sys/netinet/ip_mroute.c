@@ -115,6 +115,7 @@ __KERNEL_RCSID(0, "$NetBSD: ip_mroute.c,v 1.165 2022/03/15 21:39:59 andvar Exp $
 #include <sys/time.h>
 #include <sys/kernel.h>
 #include <sys/kmem.h>
+#include <sys/percpu.h>
 #include <sys/ioctl.h>
 #include <sys/syslog.h>
 
@@ -157,13 +158,22 @@ __KERNEL_RCSID(0, "$NetBSD: ip_mroute.c,v 1.165 2022/03/15 21:39:59 andvar Exp $
 struct socket  *ip_mrouter  = NULL;
 int		ip_mrtproto = IGMP_DVMRP;    /* for netstat only */
 
-#define	MFCHASH(a, g)							\
+#define	MFCHASH_MASK(a, g, mask)					\
 	((((a).s_addr >> 20) ^ ((a).s_addr >> 10) ^ (a).s_addr ^	\
-	  ((g).s_addr >> 20) ^ ((g).s_addr >> 10) ^ (g).s_addr) & mfchash)
+	  ((g).s_addr >> 20) ^ ((g).s_addr >> 10) ^ (g).s_addr) & (mask))
+#define	MFCHASH(a, g)	MFCHASH_MASK(a, g, mfchash)
 LIST_HEAD(mfchashhdr, mfc) *mfchashtbl;
 u_long	mfchash;
 
-u_char		nexpire[MFCTBLSIZ];
+/*
+ * The hash starts with MFCTBLSIZ buckets and is doubled by add_mfc()
+ * whenever it holds more than MFC_LOADFACTOR entries per bucket, up to
+ * MFCTBLSIZ_MAX buckets.  nexpire[] has one counter per bucket.
+ */
+#define	MFC_LOADFACTOR	2
+static u_int	mfc_count;	/* # of entries in mfchashtbl */
+
+u_char		*nexpire;
 struct vif	viftable[MAXVIFS];
 struct mrtstat	mrtstat;
 u_int		mrtdebug = 0;	/* debug level */
@@ -190,6 +200,7 @@ static const struct encapsw vif_encapsw = {
 
 #define		EXPIRE_TIMEOUT	(hz / 4)	/* 4x / second */
 #define		UPCALL_EXPIRE	6		/* number of timeouts */
+#define		STATS_SYNC	4		/* timeouts between syncs */
 
 /*
  * Define the token bucket filter structures
@@ -204,8 +215,10 @@ static int set_assert(int);
 static int add_vif(struct vifctl *);
 static int del_vif(vifi_t *);
 static void update_mfc_params(struct mfc *, struct mfcctl2 *);
-static void init_mfc_params(struct mfc *, struct mfcctl2 *);
+static void init_mfc_params(struct mfc *, struct mfcctl2 *,
+    struct percpu **);
 static void expire_mfc(struct mfc *);
+static void mfc_grow(void);
 static int add_mfc(struct sockopt *);
 #ifdef UPCALL_TIMING
 static void collate(struct timeval *);
@@ -215,7 +228,7 @@ static int set_api_config(struct sockopt *); /* chose API capabilities */
 static int socket_send(struct socket *, struct mbuf *, struct sockaddr_in *);
 static void expire_upcalls(void *);
 static int ip_mdq(struct mbuf *, struct ifnet *, struct mfc *);
-static void phyint_send(struct ip *, struct vif *, struct mbuf *);
+static void phyint_send(struct ip *, struct vif **, u_int, struct mbuf *);
 static void encap_send(struct ip *, struct vif *, struct mbuf *);
 static void tbf_control(struct vif *, struct mbuf *, struct ip *, u_int32_t);
 static void tbf_queue(struct vif *, struct mbuf *);
@@ -535,6 +548,42 @@ mrt_ioctl(struct socket *so, u_long cmd, void *data)
 	return error;
 }
 
+static void
+mfc_stats_sum_cb(void *p, void *arg, struct cpu_info *ci __unused)
+{
+	const struct mfc_stats *ms = p;
+	struct mfc_stats *sum = arg;
+
+	sum->ms_pkt_cnt += ms->ms_pkt_cnt;
+	sum->ms_byte_cnt += ms->ms_byte_cnt;
+	sum->ms_wrong_if += ms->ms_wrong_if;
+}
+
+static void
+mfc_stats_zero_cb(void *p, void *arg __unused, struct cpu_info *ci __unused)
+{
+
+	memset(p, 0, sizeof(struct mfc_stats));
+}
+
+/*
+ * Sum up the per-CPU counters of an entry, and leave the result in the
+ * entry for the benefit of netstat(1).
+ */
+static void
+mfc_stats_sync(struct mfc *rt)
+{
+	struct mfc_stats sum;
+
+	if (rt->mfc_stats == NULL)
+		return;
+	memset(&sum, 0, sizeof(sum));
+	percpu_foreach(rt->mfc_stats, mfc_stats_sum_cb, &sum);
+	rt->mfc_pkt_cnt = sum.ms_pkt_cnt;
+	rt->mfc_byte_cnt = sum.ms_byte_cnt;
+	rt->mfc_wrong_if = sum.ms_wrong_if;
+}
+
 /*
  * returns the packet, byte, rpf-failure count for the source group provided
  */
@@ -551,6 +600,8 @@ get_sg_cnt(struct sioc_sg_req *req)
 		req->pktcnt = req->bytecnt = req->wrong_if = 0xffffffff;
 		return EADDRNOTAVAIL;
 	}
+
+	mfc_stats_sync(rt);
 	req->pktcnt = rt->mfc_pkt_cnt;
 	req->bytecnt = rt->mfc_byte_cnt;
 	req->wrong_if = rt->mfc_wrong_if;
@@ -602,7 +653,8 @@ ip_mrouter_init(struct socket *so, int v)
 	ip_mrouter = so;
 
 	mfchashtbl = hashinit(MFCTBLSIZ, HASH_LIST, true, &mfchash);
-	memset((void *)nexpire, 0, sizeof(nexpire));
+	nexpire = kmem_zalloc(mfchash + 1, KM_SLEEP);
+	mfc_count = 0;
 
 	pim_assert = 0;
 
@@ -632,7 +684,7 @@ ip_mrouter_done(void)
 {
 	vifi_t vifi;
 	struct vif *vifp;
-	int i;
+	u_long i;
 	int s;
 
 	s = splsoftnet();
@@ -648,14 +700,13 @@ ip_mrouter_done(void)
 	pim_assert = 0;
 	mrt_api_config = 0;
 
-	callout_stop(&expire_upcalls_ch);
 	callout_stop(&bw_upcalls_ch);
 	callout_stop(&bw_meter_ch);
 
 	/*
 	 * Free all multicast forwarding cache entries.
 	 */
-	for (i = 0; i < MFCTBLSIZ; i++) {
+	for (i = 0; i <= mfchash; i++) {
 		struct mfc *rt, *nrt;
 
 		for (rt = LIST_FIRST(&mfchashtbl[i]); rt; rt = nrt) {
@@ -665,10 +716,19 @@ ip_mrouter_done(void)
 		}
 	}
 
-	memset((void *)nexpire, 0, sizeof(nexpire));
+	kmem_free(nexpire, mfchash + 1);
+	nexpire = NULL;
 	hashdone(mfchashtbl, HASH_LIST, mfchash);
 	mfchashtbl = NULL;
 
+	/*
+	 * expire_upcalls() may be blocked on softnet_lock, which we
+	 * hold.  Halt it only now that nexpire is NULL, so that if it
+	 * runs while we wait it returns without rescheduling itself.
+	 */
+	KASSERT(mutex_owned(softnet_lock));
+	callout_halt(&expire_upcalls_ch, softnet_lock);
+
 	bw_upcalls_n = 0;
 	memset(bw_meter_timers, 0, sizeof(bw_meter_timers));
 
@@ -687,7 +747,8 @@ ip_mrouter_done(void)
 void
 ip_mrouter_detach(struct ifnet *ifp)
 {
-	int vifi, i;
+	int vifi;
+	u_long i;
 	struct vif *vifp;
 	struct mfc *rt;
 	struct rtdetq *rte;
@@ -698,7 +759,9 @@ ip_mrouter_detach(struct ifnet *ifp)
 		if (vifp->v_ifp == ifp)
 			reset_vif(vifp);
 	}
-	for (i = 0; i < MFCTBLSIZ; i++) {
+	if (mfchashtbl == NULL)
+		return;
+	for (i = 0; i <= mfchash; i++) {
 		if (nexpire[i] == 0)
 			continue;
 		LIST_FOREACH(rt, &mfchashtbl[i], mfc_hash) {
@@ -727,7 +790,7 @@ static int
 set_api_config(struct sockopt *sopt)
 {
 	u_int32_t apival;
-	int i, error;
+	int error;
 
 	/*
 	 * We can set the API capabilities only if it is the first operation
@@ -743,10 +806,8 @@ set_api_config(struct sockopt *sopt)
 		return EPERM;
 	if (pim_assert)
 		return EPERM;
-	for (i = 0; i < MFCTBLSIZ; i++) {
-		if (LIST_FIRST(&mfchashtbl[i]) != NULL)
-			return EPERM;
-	}
+	if (mfc_count != 0)
+		return EPERM;
 
 	mrt_api_config = apival & mrt_api_support;
 	return 0;
@@ -979,10 +1040,13 @@ update_mfc_params(struct mfc *rt, struct mfcctl2 *mfccp)
 	int i;
 
 	rt->mfc_parent = mfccp->mfcc_parent;
+	rt->mfc_noifs = 0;
 	for (i = 0; i < numvifs; i++) {
 		rt->mfc_ttls[i] = mfccp->mfcc_ttls[i];
 		rt->mfc_flags[i] = mfccp->mfcc_flags[i] & mrt_api_config &
 			MRT_MFC_FLAGS_ALL;
+		if (rt->mfc_ttls[i] > 0)
+			rt->mfc_oifs[rt->mfc_noifs++] = i;
 	}
 	/* set the RP address */
 	if (mrt_api_config & MRT_MFC_RP)
@@ -992,10 +1056,11 @@ update_mfc_params(struct mfc *rt, struct mfcctl2 *mfccp)
 }
 
 /*
- * fully initialize an mfc entry from the parameter.
+ * fully initialize an mfc entry from the parameter.  An entry that has
+ * no per-CPU counters yet takes the ones preallocated in *statsp.
  */
 static void
-init_mfc_params(struct mfc *rt, struct mfcctl2 *mfccp)
+init_mfc_params(struct mfc *rt, struct mfcctl2 *mfccp, struct percpu **statsp)
 {
 	rt->mfc_origin     = mfccp->mfcc_origin;
 	rt->mfc_mcastgrp   = mfccp->mfcc_mcastgrp;
@@ -1003,6 +1068,12 @@ init_mfc_params(struct mfc *rt, struct mfcctl2 *mfccp)
 	update_mfc_params(rt, mfccp);
 
 	/* initialize pkt counters per src-grp */
+	if (rt->mfc_stats == NULL) {
+		KASSERT(*statsp != NULL);
+		rt->mfc_stats = *statsp;
+		*statsp = NULL;
+	} else
+		percpu_foreach(rt->mfc_stats, mfc_stats_zero_cb, NULL);
 	rt->mfc_pkt_cnt    = 0;
 	rt->mfc_byte_cnt   = 0;
 	rt->mfc_wrong_if   = 0;
@@ -1023,9 +1094,61 @@ expire_mfc(struct mfc *rt)
 	}
 
 	LIST_REMOVE(rt, mfc_hash);
+	mfc_count--;
+	if (rt->mfc_stats != NULL)
+		percpu_free(rt->mfc_stats, sizeof(struct mfc_stats));
 	free(rt, M_MRTABLE);
 }
 
+/*
+ * Double the size of the MFC hash if it has become too crowded.  This
+ * allocates with KM_SLEEP, so it must be called before splsoftnet();
+ * the caller holds softnet_lock, which keeps the table from changing
+ * size under us.
+ */
+static void
+mfc_grow(void)
+{
+	struct mfchashhdr *ntbl, *otbl;
+	u_char *nexp, *oexp;
+	u_long nmask, omask, i, hash;
+	struct mfc *rt;
+	int s;
+
+	if (mfc_count <= MFC_LOADFACTOR * (mfchash + 1) ||
+	    mfchash + 1 >= MFCTBLSIZ_MAX)
+		return;
+
+	ntbl = hashinit(2 * (mfchash + 1), HASH_LIST, true, &nmask);
+	nexp = kmem_zalloc(nmask + 1, KM_SLEEP);
+
+	s = splsoftnet();
+	otbl = mfchashtbl;
+	omask = mfchash;
+	oexp = nexpire;
+	for (i = 0; i <= omask; i++) {
+		while ((rt = LIST_FIRST(&otbl[i])) != NULL) {
+			LIST_REMOVE(rt, mfc_hash);
+			hash = MFCHASH_MASK(rt->mfc_origin, rt->mfc_mcastgrp,
+			    nmask);
+			LIST_INSERT_HEAD(&ntbl[hash], rt, mfc_hash);
+			if (rt->mfc_expire != 0)
+				nexp[hash]++;
+		}
+	}
+	mfchashtbl = ntbl;
+	mfchash = nmask;
+	nexpire = nexp;
+	splx(s);
+
+	hashdone(otbl, HASH_LIST, omask);
+	kmem_free(oexp, omask + 1);
+
+	if (mrtdebug & DEBUG_MFC)
+		log(LOG_DEBUG, "mfc_grow: %lu buckets for %u entries\n",
+		    nmask + 1, mfc_count);
+}
+
 /*
  * Add an mfc entry
  */
@@ -1034,7 +1157,8 @@ add_mfc(struct sockopt *sopt)
 {
 	struct mfcctl2 mfcctl2;
 	struct mfcctl2 *mfccp;
-	struct mfc *rt;
+	struct mfc *rt, *nrt, *srt;
+	struct percpu *stats;
 	u_int32_t hash = 0;
 	struct rtdetq *rte, *nrte;
 	u_short nstl;
@@ -1055,6 +1179,13 @@ add_mfc(struct sockopt *sopt)
 	if (error)
 		return error;
 
+	/*
+	 * The per-CPU counters of a new entry and a bigger hash table
+	 * can't be allocated at splsoftnet, so take care of them first.
+	 */
+	mfc_grow();
+	stats = percpu_alloc(sizeof(struct mfc_stats));
+
 	s = splsoftnet();
 	rt = mfc_find(&mfccp->mfcc_origin, &mfccp->mfcc_mcastgrp);
 
@@ -1069,15 +1200,19 @@ add_mfc(struct sockopt *sopt)
 		update_mfc_params(rt, mfccp);
 
 		splx(s);
+		percpu_free(stats, sizeof(struct mfc_stats));
 		return 0;
 	}
 
 	/*
-	 * Find the entry for which the upcall was made and update
+	 * Find the entry for which the upcall was made and update.  Should
+	 * there be several of them, the first one is kept and the packets
+	 * queued on the others are forwarded through it.
 	 */
 	nstl = 0;
+	srt = NULL;
 	hash = MFCHASH(mfccp->mfcc_origin, mfccp->mfcc_mcastgrp);
-	LIST_FOREACH(rt, &mfchashtbl[hash], mfc_hash) {
+	LIST_FOREACH_SAFE(rt, &mfchashtbl[hash], mfc_hash, nrt) {
 		if (in_hosteq(rt->mfc_origin, mfccp->mfcc_origin) &&
 		    in_hosteq(rt->mfc_mcastgrp, mfccp->mfcc_mcastgrp) &&
 		    rt->mfc_stall != NULL) {
@@ -1095,7 +1230,10 @@ add_mfc(struct sockopt *sopt)
 				    mfccp->mfcc_parent, rt->mfc_stall);
 
 			rte = rt->mfc_stall;
-			init_mfc_params(rt, mfccp);
+			if (srt == NULL) {
+				init_mfc_params(rt, mfccp, &stats);
+				srt = rt;
+			}
 			rt->mfc_stall = NULL;
 
 			rt->mfc_expire = 0; /* Don't clean this guy up */
@@ -1105,7 +1243,7 @@ add_mfc(struct sockopt *sopt)
 			for (; rte != NULL; rte = nrte) {
 				nrte = rte->next;
 				if (rte->ifp) {
-					ip_mdq(rte->m, rte->ifp, rt);
+					ip_mdq(rte->m, rte->ifp, srt);
 				}
 				m_freem(rte->m);
 #ifdef UPCALL_TIMING
@@ -1113,6 +1251,9 @@ add_mfc(struct sockopt *sopt)
 #endif /* UPCALL_TIMING */
 				free(rte, M_MRTABLE);
 			}
+
+			if (rt != srt)
+				expire_mfc(rt);
 		}
 	}
 
@@ -1132,7 +1273,7 @@ add_mfc(struct sockopt *sopt)
 		LIST_FOREACH(rt, &mfchashtbl[hash], mfc_hash) {
 			if (in_hosteq(rt->mfc_origin, mfccp->mfcc_origin) &&
 			    in_hosteq(rt->mfc_mcastgrp, mfccp->mfcc_mcastgrp)) {
-				init_mfc_params(rt, mfccp);
+				init_mfc_params(rt, mfccp, &stats);
 				if (rt->mfc_expire)
 					nexpire[hash]--;
 				rt->mfc_expire = 0;
@@ -1143,20 +1284,25 @@ add_mfc(struct sockopt *sopt)
 			rt = malloc(sizeof(*rt), M_MRTABLE, M_NOWAIT);
 			if (rt == NULL) {
 				splx(s);
+				percpu_free(stats, sizeof(struct mfc_stats));
 				return ENOBUFS;
 			}
 
-			init_mfc_params(rt, mfccp);
+			rt->mfc_stats = NULL;
+			init_mfc_params(rt, mfccp, &stats);
 			rt->mfc_expire	= 0;
 			rt->mfc_stall	= NULL;
 			rt->mfc_bw_meter = NULL;
 
 			/* insert new entry at head of hash chain */
 			LIST_INSERT_HEAD(&mfchashtbl[hash], rt, mfc_hash);
+			mfc_count++;
 		}
 	}
 
 	splx(s);
+	if (stats != NULL)
+		percpu_free(stats, sizeof(struct mfc_stats));
 	return 0;
 }
 
@@ -1233,9 +1379,11 @@ del_mfc(struct sockopt *sopt)
 	rt->mfc_bw_meter = NULL;
 
 	LIST_REMOVE(rt, mfc_hash);
-	free(rt, M_MRTABLE);
-
+	mfc_count--;
 	splx(s);
+
+	percpu_free(rt->mfc_stats, sizeof(struct mfc_stats));
+	free(rt, M_MRTABLE);
 	return 0;
 }
 
@@ -1460,6 +1608,7 @@ ip_mforward_real(struct mbuf *m, struct ifnet *ifp)
 			/* insert new entry at head of hash chain */
 			rt->mfc_origin = ip->ip_src;
 			rt->mfc_mcastgrp = ip->ip_dst;
+			rt->mfc_stats = NULL;	/* allocated by add_mfc() */
 			rt->mfc_pkt_cnt = 0;
 			rt->mfc_byte_cnt = 0;
 			rt->mfc_wrong_if = 0;
@@ -1469,6 +1618,7 @@ ip_mforward_real(struct mbuf *m, struct ifnet *ifp)
 				rt->mfc_ttls[i] = 0;
 				rt->mfc_flags[i] = 0;
 			}
+			rt->mfc_noifs = 0;
 			rt->mfc_parent = -1;
 
 			/* clear the RP address */
@@ -1478,6 +1628,7 @@ ip_mforward_real(struct mbuf *m, struct ifnet *ifp)
 
 			/* link into table */
 			LIST_INSERT_HEAD(&mfchashtbl[hash], rt, mfc_hash);
+			mfc_count++;
 			/* Add this entry to the end of the queue */
 			rt->mfc_stall = rte;
 		} else {
@@ -1521,21 +1672,35 @@ ip_mforward_real(struct mbuf *m, struct ifnet *ifp)
 static void
 expire_upcalls(void *v)
 {
-	int i;
+	static u_int ntimeouts;
+	u_long i;
+	bool sync;
 
 	/* XXX NOMPSAFE still need softnet_lock */
 	mutex_enter(softnet_lock);
 	KERNEL_LOCK(1, NULL);
 
-	for (i = 0; i < MFCTBLSIZ; i++) {
+	/* Multicast routing has been disabled meanwhile. */
+	if (nexpire == NULL)
+		goto out;
+
+	/*
+	 * The counters netstat(1) reads are otherwise only brought up
+	 * to date by SIOCGETSGCNT.
+	 */
+	sync = ++ntimeouts % STATS_SYNC == 0;
+
+	for (i = 0; i <= mfchash; i++) {
 		struct mfc *rt, *nrt;
 
-		if (nexpire[i] == 0)
+		if (nexpire[i] == 0 && !sync)
 			continue;
 
 		for (rt = LIST_FIRST(&mfchashtbl[i]); rt; rt = nrt) {
 			nrt = LIST_NEXT(rt, mfc_hash);
 
+			if (sync)
+				mfc_stats_sync(rt);
 			if (rt->mfc_expire == 0 || --rt->mfc_expire > 0)
 				continue;
 			nexpire[i]--;
@@ -1563,21 +1728,11 @@ expire_upcalls(void *v)
 
 	callout_reset(&expire_upcalls_ch, EXPIRE_TIMEOUT,
 	    expire_upcalls, NULL);
-
+out:
 	KERNEL_UNLOCK_ONE(NULL);
 	mutex_exit(softnet_lock);
 }
 
-/*
- * Macro to send packet on vif.
- */
-#define MC_SEND(ip, vifp, m) do {					\
-	if ((vifp)->v_flags & VIFF_TUNNEL)				\
-		encap_send((ip), (vifp), (m));				\
-	else								\
-		phyint_send((ip), (vifp), (m));				\
-} while (/*CONSTCOND*/ 0)
-
 /*
  * Packet forwarding routine once entry in the cache is made
  */
@@ -1587,8 +1742,11 @@ ip_mdq(struct mbuf *m, struct ifnet *ifp, struct mfc *rt)
 	struct ip *ip = mtod(m, struct ip *);
 	vifi_t vifi;
 	struct vif *vifp;
+	struct vif *phyvifs[MAXVIFS];
+	struct mfc_stats *ms;
 	struct sockaddr_in sin;
 	const int plen = ntohs(ip->ip_len) - (ip->ip_hl << 2);
+	u_int i, nphy;
 
 	/*
 	 * Don't forward if it didn't arrive from the parent vif for its origin.
@@ -1601,7 +1759,9 @@ ip_mdq(struct mbuf *m, struct ifnet *ifp, struct mfc *rt)
 			    ifp, vifi,
 			    vifi >= numvifs ? 0 : viftable[vifi].v_ifp);
 		++mrtstat.mrts_wrong_if;
-		++rt->mfc_wrong_if;
+		ms = percpu_getref(rt->mfc_stats);
+		ms->ms_wrong_if++;
+		percpu_putref(rt->mfc_stats);
 
 		/*
 		 * If we are doing PIM assert processing, send a message
@@ -1679,28 +1839,39 @@ ip_mdq(struct mbuf *m, struct ifnet *ifp, struct mfc *rt)
 		viftable[vifi].v_pkt_in++;
 		viftable[vifi].v_bytes_in += plen;
 	}
-	rt->mfc_pkt_cnt++;
-	rt->mfc_byte_cnt += plen;
+	ms = percpu_getref(rt->mfc_stats);
+	ms->ms_pkt_cnt++;
+	ms->ms_byte_cnt += plen;
+	percpu_putref(rt->mfc_stats);
 
 	/*
 	 * For each vif, decide if a copy of the packet should be forwarded.
 	 * Forward if:
 	 *  - the ttl exceeds the vif's threshold
 	 *  - there are group members downstream on interface
+	 * Only the vifs with a non-zero threshold are looked at.  Copies
+	 * for physical vifs are made together by phyint_send().
 	 */
-	for (vifp = viftable, vifi = 0; vifi < numvifs; vifp++, vifi++) {
-		if ((rt->mfc_ttls[vifi] > 0) &&
-			(ip->ip_ttl > rt->mfc_ttls[vifi])) {
-			vifp->v_pkt_out++;
-			vifp->v_bytes_out += plen;
+	nphy = 0;
+	for (i = 0; i < rt->mfc_noifs; i++) {
+		vifi = rt->mfc_oifs[i];
+		if (vifi >= numvifs || ip->ip_ttl <= rt->mfc_ttls[vifi])
+			continue;
+		vifp = &viftable[vifi];
+		vifp->v_pkt_out++;
+		vifp->v_bytes_out += plen;
 #ifdef PIM
-			if (vifp->v_flags & VIFF_REGISTER)
-				pim_register_send(ip, vifp, m, rt);
-			else
+		if (vifp->v_flags & VIFF_REGISTER)
+			pim_register_send(ip, vifp, m, rt);
+		else
 #endif
-			MC_SEND(ip, vifp, m);
-		}
+		if (vifp->v_flags & VIFF_TUNNEL)
+			encap_send(ip, vifp, m);
+		else
+			phyvifs[nphy++] = vifp;
 	}
+	if (nphy > 0)
+		phyint_send(ip, phyvifs, nphy, m);
 
 	/*
 	 * Perform upcall-related bw measuring.
@@ -1717,27 +1888,45 @@ ip_mdq(struct mbuf *m, struct ifnet *ifp, struct mfc *rt)
 	return 0;
 }
 
+/*
+ * Send the packet on each of the n physical vifs in vifv.
+ */
 static void
-phyint_send(struct ip *ip, struct vif *vifp, struct mbuf *m)
+phyint_send(struct ip *ip, struct vif **vifv, u_int n, struct mbuf *m)
 {
-	struct mbuf *mb_copy;
+	struct vif *vifp;
+	struct mbuf *base, *mb_copy;
 	const int hlen = ip->ip_hl << 2;
+	u_int i;
 
 	/*
 	 * Make a new reference to the packet; make sure that
 	 * the IP header is actually copied, not just referenced,
 	 * so that ip_output() only scribbles on the copy.
+	 *
+	 * The header of this copy then sits in an mbuf of its own, so
+	 * m_copypacket() duplicates the header and shares the payload
+	 * when cloning it for every vif but the last, which gets the
+	 * copy itself.
 	 */
-	mb_copy = m_copypacket(m, M_DONTWAIT);
-	M_PULLUP(mb_copy, hlen);
-	if (mb_copy == NULL)
+	base = m_copypacket(m, M_DONTWAIT);
+	M_PULLUP(base, hlen);
+	if (base == NULL)
 		return;
 
-	if (vifp->v_rate_limit <= 0)
-		tbf_send_packet(vifp, mb_copy);
-	else
-		tbf_control(vifp, mb_copy, mtod(mb_copy, struct ip *),
-		    ntohs(ip->ip_len));
+	for (i = 0; i < n; i++) {
+		vifp = vifv[i];
+		if (i == n - 1)
+			mb_copy = base;
+		else if ((mb_copy = m_copypacket(base, M_DONTWAIT)) == NULL)
+			continue;
+
+		if (vifp->v_rate_limit <= 0)
+			tbf_send_packet(vifp, mb_copy);
+		else
+			tbf_control(vifp, mb_copy, mtod(mb_copy, struct ip *),
+			    ntohs(ip->ip_len));
+	}
 }
 
 static void
@@ -256,6 +256,9 @@ struct mfc {
 	struct	 in_addr mfc_mcastgrp;  	/* multicast group associated */
 	vifi_t	 mfc_parent;			/* incoming vif */
 	u_int8_t mfc_ttls[MAXVIFS]; 		/* forwarding ttls on vifs */
+	u_int8_t mfc_noifs;			/* # of vifs in mfc_oifs */
+	vifi_t	 mfc_oifs[MAXVIFS];		/* vifs with a non-zero ttl */
+	struct	 percpu *mfc_stats;		/* struct mfc_stats per CPU */
 	u_long	 mfc_pkt_cnt;			/* pkt count for src-grp */
 	u_long	 mfc_byte_cnt;			/* byte count for src-grp */
 	u_long	 mfc_wrong_if;			/* wrong if for src-grp	*/
@@ -267,6 +270,17 @@ struct mfc {
 	struct	 bw_meter *mfc_bw_meter;	/* list of bandwidth meters  */
 };
 
+/*
+ * Per-CPU counters of a forwarding cache entry.  Their sums are stored
+ * in mfc_pkt_cnt, mfc_byte_cnt and mfc_wrong_if by SIOCGETSGCNT, and
+ * by expire_upcalls() once a second.
+ */
+struct mfc_stats {
+	u_long	ms_pkt_cnt;
+	u_long	ms_byte_cnt;
+	u_long	ms_wrong_if;
+};
+
 /*
  * Structure used to communicate from kernel to multicast router.
  * (Note the convenient similarity to an IP packet.)
@@ -300,7 +314,8 @@ struct rtdetq {
 	struct	rtdetq *next;
 };
 
-#define	MFCTBLSIZ	256
+#define	MFCTBLSIZ	256		/* initial size of the MFC hash */
+#define	MFCTBLSIZ_MAX	65536		/* the MFC hash grows up to this */
 #define	MAX_UPQ		4		/* max. no of pkts in upcall Q */
 
 /*
@@ -47,6 +47,9 @@ __KERNEL_RCSID(0, "$NetBSD: portalgo.c,v 1.15 2022/11/04 09:01:53 ozaki-r Exp $"
 #include <sys/md5.h>
 #include <sys/cprng.h>
 #include <sys/bitops.h>
+#include <sys/hash.h>
+#include <sys/kmem.h>
+#include <sys/queue.h>
 
 #include <net/if.h>
 
@@ -114,6 +117,7 @@ static int algo_random_pick(int, uint16_t *, struct inpcb *, kauth_cred_t);
 static int algo_hash(int, uint16_t *, struct inpcb *, kauth_cred_t);
 static int algo_doublehash(int, uint16_t *, struct inpcb *, kauth_cred_t);
 static int algo_randinc(int, uint16_t *, struct inpcb *, kauth_cred_t);
+static int algo_bitmap(int, uint16_t *, struct inpcb *, kauth_cred_t);
 
 static const portalgo_algorithm_t algos[] = {
 	{
@@ -139,6 +143,10 @@ static const portalgo_algorithm_t algos[] = {
 	{
 		.name = "randinc",
 		.func = algo_randinc
+	},
+	{
+		.name = "bitmap",
+		.func = algo_bitmap
 	}
 };
 
@@ -742,6 +750,350 @@ algo_randinc(int algo, uint16_t *port, struct inpcb *inp,
 	return EINVAL;
 }
 
+/*
+ * Per-destination allocator.  Like algo_hash, the port only has to be
+ * unique for the (laddr, faddr, fport) tuple, but instead of probing
+ * the pcb tables for every candidate it remembers which ports it has
+ * handed out towards each destination in a bitmap, with a second level
+ * marking full words, and takes the next clear bit after the last one
+ * it used.  A candidate still has to pass check_suitable_tuple(), which
+ * only fails for ports taken by some other means (an explicit bind, a
+ * connection that is in TIME_WAIT, ...), so the cost of picking a port
+ * no longer grows with the number of connections.
+ *
+ * The state lives as long as some pcb holds a port from it and is
+ * protected by softnet_lock like the rest of the pcb tables.  If it
+ * cannot be allocated we fall back to algo_hash.
+ */
+#define PORTALGO_DEST_HASHSIZE	64
+#define PORTALGO_DEST_MAX	256
+
+struct portalgo_dest {
+	LIST_ENTRY(portalgo_dest) pd_hash;
+	int		pd_af;
+	in_port_t	pd_fport;
+	union {
+		struct in_addr	v4;
+		struct in6_addr	v6;
+	}		pd_laddr, pd_faddr;
+	u_int		pd_inuse;	/* ports currently handed out */
+	uint16_t	pd_cursor;	/* where to start looking next */
+	uint64_t	pd_full[0x10000 / 64 / 64]; /* pd_used[i] == ~0 */
+	uint64_t	pd_used[0x10000 / 64];
+};
+
+static LIST_HEAD(, portalgo_dest) portalgo_dests[PORTALGO_DEST_HASHSIZE];
+static u_int portalgo_ndests;
+
+static bool
+portalgo_dest_match(const struct portalgo_dest *pd, const struct portalgo_dest *key)
+{
+
+	return pd->pd_af == key->pd_af && pd->pd_fport == key->pd_fport &&
+	    memcmp(&pd->pd_laddr, &key->pd_laddr, sizeof(pd->pd_laddr)) == 0 &&
+	    memcmp(&pd->pd_faddr, &key->pd_faddr, sizeof(pd->pd_faddr)) == 0;
+}
+
+/* Find or create the state for the destination of inp. */
+static struct portalgo_dest *
+portalgo_dest_get(const struct inpcb *inp)
+{
+	struct portalgo_dest key, *pd;
+	uint32_t hash;
+
+	memset(&key, 0, offsetof(struct portalgo_dest, pd_inuse));
+	key.pd_af = inp->inp_af;
+	key.pd_fport = inp->inp_fport;
+	switch (inp->inp_af) {
+#ifdef INET
+	case AF_INET:
+		key.pd_laddr.v4 = const_in4p_laddr(inp);
+		key.pd_faddr.v4 = const_in4p_faddr(inp);
+		break;
+#endif
+#ifdef INET6
+	case AF_INET6:
+		key.pd_laddr.v6 = const_in6p_laddr(inp);
+		key.pd_faddr.v6 = const_in6p_faddr(inp);
+		break;
+#endif
+	default:
+		return NULL;
+	}
+
+	hash = hash32_buf(&key.pd_faddr, sizeof(key.pd_faddr),
+	    hash32_buf(&key.pd_fport, sizeof(key.pd_fport), HASH32_BUF_INIT));
+	hash %= PORTALGO_DEST_HASHSIZE;
+	LIST_FOREACH(pd, &portalgo_dests[hash], pd_hash) {
+		if (portalgo_dest_match(pd, &key))
+			return pd;
+	}
+
+	if (portalgo_ndests >= PORTALGO_DEST_MAX)
+		return NULL;
+	pd = kmem_zalloc(sizeof(*pd), KM_NOSLEEP);
+	if (pd == NULL)
+		return NULL;
+	memcpy(pd, &key, offsetof(struct portalgo_dest, pd_inuse));
+	pd->pd_cursor = cprng_fast32() & 0xffff;
+	LIST_INSERT_HEAD(&portalgo_dests[hash], pd, pd_hash);
+	portalgo_ndests++;
+	return pd;
+}
+
+static void
+portalgo_dest_put(struct portalgo_dest *pd)
+{
+
+	if (pd->pd_inuse > 0)
+		return;
+	LIST_REMOVE(pd, pd_hash);
+	portalgo_ndests--;
+	kmem_free(pd, sizeof(*pd));
+}
+
+/* Return the first port in [lo, hi] not in use, or -1. */
+static int
+portalgo_dest_next(const struct portalgo_dest *pd, u_int lo, u_int hi)
+{
+	uint64_t bits;
+	u_int w, s;
+
+	while (lo <= hi) {
+		w = lo / 64;
+		bits = ~pd->pd_used[w] & (~(uint64_t)0 << (lo % 64));
+		if (bits != 0) {
+			lo = w * 64 + ffs64(bits) - 1;
+			return lo <= hi ? (int)lo : -1;
+		}
+		/* skip the full words that follow */
+		if (++w >= __arraycount(pd->pd_used))
+			return -1;
+		s = w / 64;
+		bits = ~pd->pd_full[s] & (~(uint64_t)0 << (w % 64));
+		while (bits == 0) {
+			if (++s >= __arraycount(pd->pd_full))
+				return -1;
+			bits = ~pd->pd_full[s];
+		}
+		lo = (s * 64 + ffs64(bits) - 1) * 64;
+	}
+	return -1;
+}
+
+static void
+portalgo_dest_set(struct portalgo_dest *pd, uint16_t port)
+{
+	const u_int w = port / 64;
+
+	pd->pd_used[w] |= (uint64_t)1 << (port % 64);
+	if (pd->pd_used[w] == ~(uint64_t)0)
+		pd->pd_full[w / 64] |= (uint64_t)1 << (w % 64);
+	pd->pd_inuse++;
+}
+
+static void
+portalgo_dest_clear(struct portalgo_dest *pd, uint16_t port)
+{
+	const u_int w = port / 64;
+
+	KASSERT(pd->pd_used[w] & ((uint64_t)1 << (port % 64)));
+	pd->pd_used[w] &= ~((uint64_t)1 << (port % 64));
+	pd->pd_full[w / 64] &= ~((uint64_t)1 << (w % 64));
+	pd->pd_inuse--;
+}
+
+/*
+ * Check whether inp may use the port towards its destination.  Unlike
+ * check_suitable_port() the port may be shared with connections to
+ * other destinations, but not with a socket that is only bound to it,
+ * and the tuple must not be in use or lingering in TIME_WAIT.
+ */
+static bool
+check_suitable_tuple(uint16_t port, struct inpcb *inp, kauth_cred_t cred)
+{
+	struct inpcbtable * const table = inp->inp_table;
+	vestigial_inpcb_t vestigial;
+	const in_port_t lport = htons(port);
+	enum kauth_network_req req;
+	int error;
+
+	DPRINTF("%s called for argument %d\n", __func__, port);
+
+	switch (inp->inp_af) {
+#ifdef INET
+	case AF_INET: { /* IPv4 */
+		struct sockaddr_in sin;
+
+		if (__BITMAP_ISSET(port, &inet4_reserve))
+			return false;
+		if (inpcb_lookup_local(table, in4p_laddr(inp), lport, 0,
+		    NULL) != NULL ||
+		    inpcb_lookup_local(table, zeroin_addr, lport, 0,
+		    NULL) != NULL)
+			return false;
+		if (inpcb_lookup(table, in4p_faddr(inp), inp->inp_fport,
+		    in4p_laddr(inp), lport, &vestigial) != NULL ||
+		    vestigial.valid)
+			return false;
+
+		if (inp->inp_flags & INP_LOWPORT) {
+#ifndef IPNOPRIVPORTS
+			req = KAUTH_REQ_NETWORK_BIND_PRIVPORT;
+#else
+			req = KAUTH_REQ_NETWORK_BIND_PORT;
+#endif
+		} else
+			req = KAUTH_REQ_NETWORK_BIND_PORT;
+
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_len = sizeof(sin);
+		sin.sin_family = AF_INET;
+		sin.sin_addr = in4p_laddr(inp);
+		sin.sin_port = port;
+		error = kauth_authorize_network(cred, KAUTH_NETWORK_BIND,
+		    req, inp->inp_socket, &sin, NULL);
+		break;
+	}
+#endif
+#ifdef INET6
+	case AF_INET6: { /* IPv6 */
+		struct sockaddr_in6 sin6;
+		struct in6_addr any = in6addr_any;
+
+		if (__BITMAP_ISSET(port, &inet6_reserve))
+			return false;
+#ifdef INET
+		if (IN6_IS_ADDR_V4MAPPED(&in6p_laddr(inp))) {
+			struct in_addr laddr4, faddr4;
+
+			memcpy(&laddr4, &in6p_laddr(inp).s6_addr32[3],
+			    sizeof(laddr4));
+			memcpy(&faddr4, &in6p_faddr(inp).s6_addr32[3],
+			    sizeof(faddr4));
+			if (inpcb_lookup_local(table, laddr4, lport, 0,
+			    NULL) != NULL ||
+			    inpcb_lookup_local(table, zeroin_addr, lport, 0,
+			    NULL) != NULL)
+				return false;
+			if (inpcb_lookup(table, faddr4, inp->inp_fport,
+			    laddr4, lport, &vestigial) != NULL ||
+			    vestigial.valid)
+				return false;
+		} else
+#endif
+		{
+			if (in6pcb_lookup_local(table, &in6p_laddr(inp), lport,
+			    0, NULL) != NULL ||
+			    in6pcb_lookup_local(table, &any, lport, 0,
+			    NULL) != NULL)
+				return false;
+			if (in6pcb_lookup(table, &in6p_faddr(inp),
+			    inp->inp_fport, &in6p_laddr(inp), lport, 0,
+			    &vestigial) != NULL || vestigial.valid)
+				return false;
+		}
+
+		if (inp->inp_flags & IN6P_LOWPORT) {
+#ifndef IPNOPRIVPORTS
+			req = KAUTH_REQ_NETWORK_BIND_PRIVPORT;
+#else
+			req = KAUTH_REQ_NETWORK_BIND_PORT;
+#endif
+		} else
+			req = KAUTH_REQ_NETWORK_BIND_PORT;
+
+		memset(&sin6, 0, sizeof(sin6));
+		sin6.sin6_len = sizeof(sin6);
+		sin6.sin6_family = AF_INET6;
+		sin6.sin6_addr = in6p_laddr(inp);
+		sin6.sin6_port = port;
+		error = kauth_authorize_network(cred, KAUTH_NETWORK_BIND,
+		    req, inp->inp_socket, &sin6, NULL);
+		break;
+	}
+#endif
+	default:
+		DPRINTF("%s unknown address family\n", __func__);
+		return false;
+	}
+
+	DPRINTF("%s kauth_authorize_network returned %d\n", __func__, error);
+	return error == 0;
+}
+
+static int
+algo_bitmap(int algo, uint16_t *port, struct inpcb *inp,
+    kauth_cred_t cred)
+{
+	struct portalgo_dest *pd;
+	uint16_t mymin, mymax, lastport;
+	uint16_t *next_ephemeral;
+	u_int count, cur;
+	int error, myport;
+
+	DPRINTF("%s called\n", __func__);
+
+	error = pcb_getports(inp, &lastport, &mymin, &mymax,
+	    &next_ephemeral, algo);
+	if (error)
+		return error;
+
+	if (!iscompletetuple(inp)) {
+		*port = 0;
+		return 0;
+	}
+
+	pd = portalgo_dest_get(inp);
+	if (pd == NULL) {
+		DPRINTF("%s no destination state, using hash\n", __func__);
+		return algo_hash(algo, port, inp, cred);
+	}
+
+	cur = pd->pd_cursor;
+	if (cur < mymin || cur > mymax)
+		cur = mymin;
+	for (count = mymax - mymin + 1; count > 0; count--) {
+		myport = portalgo_dest_next(pd, cur, mymax);
+		if (myport == -1 && cur > mymin)
+			myport = portalgo_dest_next(pd, mymin, cur - 1);
+		if (myport == -1)
+			break;		/* every port to there is taken */
+		cur = myport == mymax ? mymin : myport + 1;
+
+		if (check_suitable_tuple(myport, inp, cred)) {
+			portalgo_dest_set(pd, myport);
+			pd->pd_cursor = cur;
+			inp->inp_portalgo_dest = pd;
+			*port = myport;
+			DPRINTF("%s returning port %d\n", __func__, *port);
+			return 0;
+		}
+	}
+	pd->pd_cursor = cur;
+	portalgo_dest_put(pd);
+
+	DPRINTF("%s returning EINVAL\n", __func__);
+
+	return EINVAL;
+}
+
+/*
+ * Called when inp gives up its destination (disconnect or destroy), to
+ * return a port handed out by algo_bitmap.
+ */
+void
+portalgo_release(struct inpcb *inp)
+{
+	struct portalgo_dest *pd = inp->inp_portalgo_dest;
+
+	if (pd == NULL)
+		return;
+	inp->inp_portalgo_dest = NULL;
+	portalgo_dest_clear(pd, ntohs(inp->inp_lport));
+	portalgo_dest_put(pd);
+}
+
 /* The generic function called in order to pick a port. */
 int
 portalgo_randport(uint16_t *port, struct inpcb *inp, kauth_cred_t cred)
@@ -35,6 +35,7 @@
 
 struct inpcb;
 int portalgo_randport(uint16_t *, struct inpcb *, kauth_cred_t);
+void portalgo_release(struct inpcb *);
 int sysctl_portalgo_selected4(SYSCTLFN_ARGS);
 int sysctl_portalgo_selected6(SYSCTLFN_ARGS);
 int sysctl_portalgo_reserve4(SYSCTLFN_ARGS);
@@ -55,5 +56,6 @@ int portalgo_algo_index_select(struct inpcb *, int);
 #define	PORTALGO_HASH			3
 #define	PORTALGO_DOUBLEHASH		4
 #define	PORTALGO_RANDINC		5
+#define	PORTALGO_BITMAP			6
 
 #endif /* !_NETINET_PORTALGO_H_ */
@@ -41,9 +41,26 @@ __KERNEL_RCSID(0, "$NetBSD: sctp_crc32.c,v 1.3 2019/08/13 19:55:40 rjs Exp $");
 #endif /* _KERNEL_OPT */
 
 #include <sys/param.h>
+#include <sys/endian.h>
+#ifdef _KERNEL
+#include <sys/systm.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#endif
 #include <netinet/sctp_crc32.h>
 
+#ifndef _KERNEL
+void		sctp_crc32_init(void);
+const char *	sctp_crc32c_select(const char *);
+uint32_t	sctp_crc32c_combine(uint32_t, uint32_t, size_t);
+u_int32_t	update_crc32(u_int32_t, unsigned char *, unsigned int);
+#endif
+
 #define SCTP_CRC32C_POLY 0x1EDC6F41
+#define SCTP_CRC32C_RPOLY 0x82F63B78	/* bit-reflected SCTP_CRC32C_POLY */
 #define SCTP_CRC32C(c, d) (c = ((c) >> 8) ^ sctp_crc_c[((c) ^ (d)) & 0xFF])
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
@@ -133,12 +150,10 @@ const unsigned long  sctp_crc_c[256] = {
 	0xBE2DA0A5L, 0x4C4623A6L, 0x5F16D052L, 0xAD7D5351L,
 };
 
-u_int32_t
-update_crc32(u_int32_t crc32c,
-	     unsigned char *buffer,
-	     unsigned int length)
+static uint32_t
+sctp_crc32c_byte(uint32_t crc32c, const uint8_t *buffer, size_t length)
 {
-	unsigned int i;
+	size_t i;
 
 	for (i = 0; i < length; i++) {
 		SCTP_CRC32C(crc32c, buffer[i]);
@@ -146,6 +161,321 @@ update_crc32(u_int32_t crc32c,
 	return (crc32c);
 }
 
+/*
+ * Slicing-by-8: sctp_crc_sb8[k][b] is the CRC register after feeding
+ * byte b followed by k zero bytes, so eight bytes are folded in with
+ * eight independent lookups.  Built by sctp_crc32_init().
+ */
+static uint32_t sctp_crc_sb8[8][256];
+
+static uint32_t
+sctp_crc32c_sb8(uint32_t crc32c, const uint8_t *buffer, size_t length)
+{
+	uint32_t lo, hi;
+
+	while (length > 0 && ((uintptr_t)buffer & 3) != 0) {
+		crc32c = (crc32c >> 8) ^
+		    sctp_crc_sb8[0][(crc32c ^ *buffer++) & 0xff];
+		length--;
+	}
+	for (; length >= 8; buffer += 8, length -= 8) {
+		lo = le32dec(buffer) ^ crc32c;
+		hi = le32dec(buffer + 4);
+		crc32c = sctp_crc_sb8[7][lo & 0xff] ^
+		    sctp_crc_sb8[6][(lo >> 8) & 0xff] ^
+		    sctp_crc_sb8[5][(lo >> 16) & 0xff] ^
+		    sctp_crc_sb8[4][lo >> 24] ^
+		    sctp_crc_sb8[3][hi & 0xff] ^
+		    sctp_crc_sb8[2][(hi >> 8) & 0xff] ^
+		    sctp_crc_sb8[1][(hi >> 16) & 0xff] ^
+		    sctp_crc_sb8[0][hi >> 24];
+	}
+	while (length-- > 0) {
+		crc32c = (crc32c >> 8) ^
+		    sctp_crc_sb8[0][(crc32c ^ *buffer++) & 0xff];
+	}
+	return (crc32c);
+}
+
+/*
+ * Polynomial arithmetic modulo the CRC polynomial, bit-reflected, for
+ * combining the CRCs of adjacent pieces of data.  sctp_crc_x2n[n] is
+ * x^(2^n) mod P.
+ */
+static uint32_t sctp_crc_x2n[32];
+
+static uint32_t
+sctp_crc32c_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m, p;
+
+	p = 0;
+	for (m = 1U << 31; m != 0; m >>= 1) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		b = (b & 1) ? (b >> 1) ^ SCTP_CRC32C_RPOLY : b >> 1;
+	}
+	return (p);
+}
+
+/* x^(n * 2^k) mod P */
+static uint32_t
+sctp_crc32c_x2nmodp(size_t n, unsigned int k)
+{
+	uint32_t p;
+
+	p = 1U << 31;		/* x^0 */
+	for (; n != 0; n >>= 1, k++) {
+		if (n & 1)
+			p = sctp_crc32c_multmodp(sctp_crc_x2n[k & 31], p);
+	}
+	return (p);
+}
+
+/*
+ * sctp_crc32c_combine: given the CRC register crc1 after some data and
+ * crc2 after the len2 bytes that follow it, the latter computed from an
+ * initial register of 0, return the register after both, as if
+ * update_crc32() had been run over them in one go.
+ */
+uint32_t
+sctp_crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+
+	return (sctp_crc32c_multmodp(sctp_crc32c_x2nmodp(len2, 3), crc1) ^
+	    crc2);
+}
+
+/*
+ * The CRC instructions have a latency of several cycles but can start
+ * one every cycle, so large buffers are done as three interleaved
+ * streams of SCTP_CRC32C_BLOCK bytes whose registers are then merged.
+ * Moving a register over a block is linear in its bits, and
+ * sctp_crc_shift[k][b] holds the result for byte b in position k.
+ */
+#define SCTP_CRC32C_BLOCK	256
+static uint32_t sctp_crc_shift[4][256];
+
+static inline uint32_t
+sctp_crc32c_shift(uint32_t crc32c)
+{
+
+	return (sctp_crc_shift[0][crc32c & 0xff] ^
+	    sctp_crc_shift[1][(crc32c >> 8) & 0xff] ^
+	    sctp_crc_shift[2][(crc32c >> 16) & 0xff] ^
+	    sctp_crc_shift[3][crc32c >> 24]);
+}
+
+/*
+ * Body of the hardware implementations: word_t is the widest word the
+ * CRC instruction takes, CRCW and CRCB apply it to a word and a byte.
+ */
+#define SCTP_CRC32C_HW_BODY(word_t, CRCW, CRCB) do {			\
+	const size_t blk = SCTP_CRC32C_BLOCK;				\
+	word_t c0, c1, c2, w0, w1, w2;					\
+	size_t i;							\
+									\
+	while (length > 0 && ((uintptr_t)buffer & (sizeof(word_t) - 1))) { \
+		crc32c = CRCB(crc32c, *buffer++);			\
+		length--;						\
+	}								\
+	for (; length >= 3 * blk; buffer += 3 * blk, length -= 3 * blk) { \
+		c0 = crc32c;						\
+		c1 = c2 = 0;						\
+		for (i = 0; i < blk; i += sizeof(word_t)) {		\
+			memcpy(&w0, buffer + i, sizeof(w0));		\
+			memcpy(&w1, buffer + blk + i, sizeof(w1));	\
+			memcpy(&w2, buffer + 2 * blk + i, sizeof(w2));	\
+			c0 = CRCW(c0, w0);				\
+			c1 = CRCW(c1, w1);				\
+			c2 = CRCW(c2, w2);				\
+		}							\
+		crc32c = sctp_crc32c_shift(c0) ^ (uint32_t)c1;		\
+		crc32c = sctp_crc32c_shift(crc32c) ^ (uint32_t)c2;	\
+	}								\
+	for (; length >= sizeof(word_t); buffer += sizeof(word_t),	\
+	    length -= sizeof(word_t)) {					\
+		memcpy(&w0, buffer, sizeof(w0));			\
+		crc32c = CRCW(crc32c, w0);				\
+	}								\
+	while (length-- > 0)						\
+		crc32c = CRCB(crc32c, *buffer++);			\
+} while (/*CONSTCOND*/0)
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SCTP_CRC32C_SSE42
+#ifdef _KERNEL
+#include <x86/cpu.h>
+#include <x86/specialreg.h>
+#endif
+
+#ifdef __x86_64__
+#define SCTP_CRC32C_SSE42_W(c, w)	__builtin_ia32_crc32di((c), (w))
+typedef uint64_t sctp_crc32c_sse42_word_t;
+#else
+#define SCTP_CRC32C_SSE42_W(c, w)	__builtin_ia32_crc32si((c), (w))
+typedef uint32_t sctp_crc32c_sse42_word_t;
+#endif
+#define SCTP_CRC32C_SSE42_B(c, b)	__builtin_ia32_crc32qi((c), (b))
+
+static uint32_t __attribute__((__target__("crc32")))
+sctp_crc32c_sse42(uint32_t crc32c, const uint8_t *buffer, size_t length)
+{
+
+	SCTP_CRC32C_HW_BODY(sctp_crc32c_sse42_word_t, SCTP_CRC32C_SSE42_W,
+	    SCTP_CRC32C_SSE42_B);
+	return (crc32c);
+}
+
+static bool
+sctp_crc32c_sse42_probe(void)
+{
+#ifdef _KERNEL
+	return ((cpu_feature[1] & CPUID2_SSE42) != 0);
+#else
+	return (__builtin_cpu_supports("sse4.2"));
+#endif
+}
+#endif /* x86 */
+
+#if defined(__aarch64__) && defined(__GNUC__) && !defined(__clang__)
+#define SCTP_CRC32C_ARMV8
+#ifdef _KERNEL
+#include <aarch64/armreg.h>
+#endif
+
+#define SCTP_CRC32C_ARMV8_W(c, w)	__builtin_aarch64_crc32cx((c), (w))
+#define SCTP_CRC32C_ARMV8_B(c, b)	__builtin_aarch64_crc32cb((c), (b))
+
+static uint32_t __attribute__((__target__("+crc")))
+sctp_crc32c_armv8(uint32_t crc32c, const uint8_t *buffer, size_t length)
+{
+
+	SCTP_CRC32C_HW_BODY(uint64_t, SCTP_CRC32C_ARMV8_W,
+	    SCTP_CRC32C_ARMV8_B);
+	return (crc32c);
+}
+
+static bool
+sctp_crc32c_armv8_probe(void)
+{
+#ifdef _KERNEL
+	return (__SHIFTOUT(reg_id_aa64isar0_el1_read(),
+	    ID_AA64ISAR0_EL1_CRC32) >= ID_AA64ISAR0_EL1_CRC32_CRC32X);
+#elif defined(__ARM_FEATURE_CRC32)
+	return (true);
+#else
+	return (false);
+#endif
+}
+#endif /* aarch64 */
+
+static bool
+sctp_crc32c_always(void)
+{
+
+	return (true);
+}
+
+static const struct sctp_crc32c_impl {
+	const char	*name;
+	bool		(*probe)(void);
+	uint32_t	(*update)(uint32_t, const uint8_t *, size_t);
+} sctp_crc32c_impls[] = {	/* in order of preference */
+#ifdef SCTP_CRC32C_SSE42
+	{ "sse4.2",	sctp_crc32c_sse42_probe,	sctp_crc32c_sse42 },
+#endif
+#ifdef SCTP_CRC32C_ARMV8
+	{ "armv8",	sctp_crc32c_armv8_probe,	sctp_crc32c_armv8 },
+#endif
+	{ "sb8",	sctp_crc32c_always,		sctp_crc32c_sb8 },
+	{ "byte",	sctp_crc32c_always,		sctp_crc32c_byte },
+};
+
+/* Usable before sctp_crc32_init(), which needs no tables. */
+static uint32_t (*sctp_crc32c_update)(uint32_t, const uint8_t *, size_t) =
+    sctp_crc32c_byte;
+
+/*
+ * sctp_crc32c_select: use the named implementation, or the fastest one
+ * that works if name is NULL, and return its name.  Returns NULL if the
+ * named one is unknown or unsupported.  Each candidate must compute the
+ * check value of the CRC before it is used.
+ */
+const char *
+sctp_crc32c_select(const char *name)
+{
+	static const char check[] = "123456789";
+	const struct sctp_crc32c_impl *impl;
+	uint32_t crc32c;
+	size_t i;
+
+	for (i = 0; i < __arraycount(sctp_crc32c_impls); i++) {
+		impl = &sctp_crc32c_impls[i];
+		if (name != NULL && strcmp(name, impl->name) != 0)
+			continue;
+		if (!(*impl->probe)())
+			continue;
+		crc32c = (*impl->update)(0xffffffff,
+		    (const uint8_t *)check, sizeof(check) - 1);
+		if (~crc32c != 0xE3069283) {
+			printf("sctp: crc32c %s self-test failed\n",
+			    impl->name);
+			continue;
+		}
+		sctp_crc32c_update = impl->update;
+		return (impl->name);
+	}
+	return (NULL);
+}
+
+void
+sctp_crc32_init(void)
+{
+	uint32_t c, p;
+	int i, k;
+
+	/* Slicing tables, the first of which is sctp_crc_c. */
+	for (i = 0; i < 256; i++)
+		sctp_crc_sb8[0][i] = sctp_crc_c[i];
+	for (i = 0; i < 256; i++) {
+		c = sctp_crc_sb8[0][i];
+		for (k = 1; k < 8; k++) {
+			c = (c >> 8) ^ sctp_crc_sb8[0][c & 0xff];
+			sctp_crc_sb8[k][i] = c;
+		}
+	}
+
+	/* Powers of x for combining. */
+	p = 1U << 30;		/* x^1 */
+	sctp_crc_x2n[0] = p;
+	for (i = 1; i < 32; i++)
+		sctp_crc_x2n[i] = p = sctp_crc32c_multmodp(p, p);
+
+	/* Moving a register over SCTP_CRC32C_BLOCK zero bytes. */
+	p = sctp_crc32c_x2nmodp(SCTP_CRC32C_BLOCK, 3);
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < 256; i++) {
+			sctp_crc_shift[k][i] = sctp_crc32c_multmodp(p,
+			    (uint32_t)i << (8 * k));
+		}
+	}
+
+	(void)sctp_crc32c_select(NULL);
+}
+
+u_int32_t
+update_crc32(u_int32_t crc32c,
+	     unsigned char *buffer,
+	     unsigned int length)
+{
+
+	return ((*sctp_crc32c_update)(crc32c, buffer, length));
+}
+
 
 u_int32_t
 sctp_csum_finalize(u_int32_t crc32c)
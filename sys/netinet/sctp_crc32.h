@@ -39,7 +39,10 @@
 #include <sys/types.h>
 
 #if defined(_KERNEL)
+void sctp_crc32_init(void);
+const char *sctp_crc32c_select(const char *);
 u_int32_t update_crc32(u_int32_t, unsigned char *, unsigned int);
+uint32_t sctp_crc32c_combine(uint32_t, uint32_t, size_t);
 
 u_int32_t sctp_csum_finalize(u_int32_t);
 
@@ -54,6 +54,10 @@ __KERNEL_RCSID(0, "$NetBSD: sctp_pcb.c,v 1.26 2022/10/15 21:53:21 andvar Exp $")
 #include <sys/kernel.h>
 #include <sys/sysctl.h>
 #include <sys/callout.h>
+#include <sys/atomic.h>
+#include <sys/pserialize.h>
+#include <sys/thmap.h>
+#include <sys/workqueue.h>
 
 #include <machine/limits.h>
 #include <machine/cpu.h>
@@ -89,19 +93,12 @@ __KERNEL_RCSID(0, "$NetBSD: sctp_pcb.c,v 1.26 2022/10/15 21:53:21 andvar Exp $")
 #include <netinet/sctp_output.h>
 #include <netinet/sctp_timer.h>
 
-#ifndef SCTP_PCBHASHSIZE
-/* default number of association hash buckets in each endpoint */
-#define SCTP_PCBHASHSIZE 256
-#endif
-
 #ifdef SCTP_DEBUG
 u_int32_t sctp_debug_on = SCTP_DEBUG_ALL;
 #endif /* SCTP_DEBUG */
 
 u_int32_t sctp_pegs[SCTP_NUMBER_OF_PEGS];
 
-int sctp_pcbtblsize = SCTP_PCBHASHSIZE;
-
 struct sctp_epinfo sctppcbinfo;
 
 /* FIX: we don't handle multiple link local scopes */
@@ -118,6 +115,127 @@ SCTP6_ARE_ADDR_EQUAL(const struct in6_addr *a, const struct in6_addr *b)
 	return (IN6_ARE_ADDR_EQUAL(&tmp_a, &tmp_b));
 }
 
+/*
+ * Map of all associations, keyed by the full (local port, remote port,
+ * remote address) tuple.  Every remote address of an association has
+ * an entry, so a lookup costs the same whether an endpoint has one
+ * association or tens of thousands of them sharing a remote port, as
+ * is usual for SIGTRAN.  The map is a thmap(9): it grows on its own
+ * and lookups only need pserialize(9).  The associations themselves
+ * are still protected by softnet_lock (and the TCB lock where it is
+ * compiled in); pserialize only covers the map's internal nodes,
+ * which are reclaimed from a workqueue since associations are freed
+ * from callouts.
+ *
+ * A remote address can end up without an entry if it is shared with
+ * another association (two endpoints bound to different addresses on
+ * the same port) or if thmap_put fails.  sctp_asocmap_unhashed counts
+ * those, and while it is non-zero a miss falls back to a linear walk.
+ *
+ * The key an entry was added under is kept in its sctp_nets, as the
+ * destination in net->ro may be freed (sctp_delete_ip_address) or
+ * replaced before the entry is removed.
+ */
+CTASSERT(sizeof(((struct sctp_asockey *)0)->sk_addr) >=
+    sizeof(struct in6_addr));
+
+static thmap_t *sctp_asocmap __read_mostly;
+static pserialize_t sctp_asocmap_psz __read_mostly;
+static struct workqueue *sctp_asocmap_wq __read_mostly;
+static struct work sctp_asocmap_wk;
+static volatile unsigned int sctp_asocmap_gc_pending;
+static unsigned int sctp_asocmap_unhashed;
+
+static bool
+sctp_asockey_init(struct sctp_asockey *key, uint16_t lport, uint16_t rport,
+    const struct sockaddr *sa)
+{
+	struct in6_addr in6;
+
+	memset(key, 0, sizeof(*key));
+	key->sk_lport = lport;
+	key->sk_rport = rport;
+	key->sk_family = sa->sa_family;
+	switch (sa->sa_family) {
+	case AF_INET:
+		memcpy(key->sk_addr, &((const struct sockaddr_in *)sa)->sin_addr,
+		    sizeof(struct in_addr));
+		return true;
+	case AF_INET6:
+		/* match SCTP6_ARE_ADDR_EQUAL(), which ignores the scope */
+		in6 = ((const struct sockaddr_in6 *)sa)->sin6_addr;
+		in6_clearscope(&in6);
+		memcpy(key->sk_addr, &in6, sizeof(in6));
+		return true;
+	default:
+		return false;
+	}
+}
+
+static struct sctp_tcb *
+sctp_asocmap_lookup(uint16_t lport, uint16_t rport, const struct sockaddr *sa)
+{
+	struct sctp_asockey key;
+	struct sctp_tcb *stcb;
+	int s;
+
+	if (!sctp_asockey_init(&key, lport, rport, sa))
+		return NULL;
+	s = pserialize_read_enter();
+	stcb = thmap_get(sctp_asocmap, &key, sizeof(key));
+	pserialize_read_exit(s);
+	return stcb;
+}
+
+static void
+sctp_asocmap_insert(struct sctp_tcb *stcb, struct sctp_nets *net)
+{
+	struct sctp_asockey *key = &net->asockey;
+	const struct sockaddr *sa;
+
+	KASSERT(!net->in_asocmap);
+	sa = rtcache_getdst(&net->ro);
+	if (sa == NULL ||
+	    !sctp_asockey_init(key, stcb->sctp_ep->sctp_lport, stcb->rport,
+	    sa) ||
+	    thmap_get(sctp_asocmap, key, sizeof(*key)) != NULL ||
+	    thmap_put(sctp_asocmap, key, sizeof(*key), stcb) != stcb) {
+		sctp_asocmap_unhashed++;
+		return;
+	}
+	net->in_asocmap = 1;
+}
+
+static void
+sctp_asocmap_remove(struct sctp_tcb *stcb, struct sctp_nets *net)
+{
+	struct sctp_tcb *ostcb __diagused;
+
+	if (!net->in_asocmap) {
+		KASSERT(sctp_asocmap_unhashed > 0);
+		sctp_asocmap_unhashed--;
+		return;
+	}
+	net->in_asocmap = 0;
+	ostcb = thmap_del(sctp_asocmap, &net->asockey, sizeof(net->asockey));
+	KASSERT(ostcb == stcb);
+
+	/* Readers may still be walking the old nodes; reclaim them later. */
+	if (atomic_swap_uint(&sctp_asocmap_gc_pending, 1) == 0)
+		workqueue_enqueue(sctp_asocmap_wq, &sctp_asocmap_wk, NULL);
+}
+
+static void
+sctp_asocmap_gc(struct work *wk, void *arg)
+{
+	void *garbage;
+
+	atomic_swap_uint(&sctp_asocmap_gc_pending, 0);
+	garbage = thmap_stage_gc(sctp_asocmap);
+	pserialize_perform(sctp_asocmap_psz);
+	thmap_gc(sctp_asocmap, garbage);
+}
+
 #if defined(__FreeBSD__) && __FreeBSD_version > 500000
 
 #ifndef xyzzy
@@ -218,6 +336,107 @@ sctp_fill_pcbinfo(struct sctp_pcbinfo *spcb)
  */
 
 
+/*
+ * Does the TCP model endpoint inp hold the association between "to" (my
+ * address) and "from" (the peer's)?  If so it is returned locked.
+ */
+static struct sctp_tcb *
+sctp_tcb_special_match(struct sctp_inpcb *inp, uint16_t rport,
+		       struct sockaddr *from, struct sockaddr *to,
+		       struct sctp_nets **netp)
+{
+	struct sctp_laddr *laddr;
+	struct sctp_tcb *stcb;
+	struct sctp_nets *net;
+
+	SCTP_INP_RLOCK(inp);
+	/* check to see if the ep has one of the addresses */
+	if ((inp->sctp_flags & SCTP_PCB_FLAGS_BOUNDALL) == 0) {
+		/* We are NOT bound all, so look further */
+		int match = 0;
+
+		LIST_FOREACH(laddr, &inp->sctp_addr_list, sctp_nxt_addr) {
+			if (laddr->ifa == NULL) {
+#ifdef SCTP_DEBUG
+				if (sctp_debug_on & SCTP_DEBUG_PCB1) {
+					printf("An ounce of prevention is worth a pound of cure\n");
+				}
+#endif
+				continue;
+			}
+			if (laddr->ifa->ifa_addr == NULL) {
+#ifdef SCTP_DEBUG
+				if (sctp_debug_on & SCTP_DEBUG_PCB1) {
+					printf("ifa with a NULL address\n");
+				}
+#endif
+				continue;
+			}
+			if (laddr->ifa->ifa_addr->sa_family ==
+			    to->sa_family) {
+				/* see if it matches */
+				struct sockaddr_in *intf_addr, *sin;
+				intf_addr = (struct sockaddr_in *)
+					laddr->ifa->ifa_addr;
+				sin = (struct sockaddr_in *)to;
+				if (from->sa_family == AF_INET) {
+					if (sin->sin_addr.s_addr ==
+					    intf_addr->sin_addr.s_addr) {
+						match = 1;
+						break;
+					}
+				} else {
+					struct sockaddr_in6 *intf_addr6;
+					struct sockaddr_in6 *sin6;
+					sin6 = (struct sockaddr_in6 *)
+						to;
+					intf_addr6 = (struct sockaddr_in6 *)
+						laddr->ifa->ifa_addr;
+
+					if (SCTP6_ARE_ADDR_EQUAL(&sin6->sin6_addr,
+								 &intf_addr6->sin6_addr)) {
+						match = 1;
+						break;
+					}
+				}
+			}
+		}
+		if (match == 0) {
+			/* This endpoint does not have this address */
+			SCTP_INP_RUNLOCK(inp);
+			return (NULL);
+		}
+	}
+	/*
+	 * Ok if we hit here the ep has the address, does it hold the
+	 * tcb?
+	 */
+	stcb = LIST_FIRST(&inp->sctp_asoc_list);
+	if (stcb == NULL) {
+		SCTP_INP_RUNLOCK(inp);
+		return (NULL);
+	}
+	SCTP_TCB_LOCK(stcb);
+	if (stcb->rport != rport) {
+		/* remote port does not match. */
+		SCTP_TCB_UNLOCK(stcb);
+		SCTP_INP_RUNLOCK(inp);
+		return (NULL);
+	}
+	/* Does this TCB have a matching address? */
+	net = sctp_findnet(stcb, from);
+	if (net == NULL) {
+		SCTP_TCB_UNLOCK(stcb);
+		SCTP_INP_RUNLOCK(inp);
+		return (NULL);
+	}
+	if (netp != NULL) {
+		*netp = net;
+	}
+	SCTP_INP_RUNLOCK(inp);
+	return (stcb);
+}
+
 /*
  * Given a endpoint, look and find in its association list any association
  * with the "to" address given. This can be a "from" address, too, for
@@ -242,9 +461,7 @@ sctp_tcb_special_locate(struct sctp_inpcb **inp_p, struct sockaddr *from,
 	uint16_t lport, rport;
 	struct sctppcbhead *ephead;
 	struct sctp_inpcb *inp;
-	struct sctp_laddr *laddr;
 	struct sctp_tcb *stcb;
-	struct sctp_nets *net;
 
 	if ((to == NULL) || (from == NULL)) {
 		return (NULL);
@@ -259,6 +476,26 @@ sctp_tcb_special_locate(struct sctp_inpcb **inp_p, struct sockaddr *from,
 	} else {
 		return NULL;
 	}
+
+	/*
+	 * Every connected endpoint shares the same (lport + rport) bucket
+	 * when both sides use a well known port, so go by the association
+	 * map first and only walk the bucket if the map is incomplete.
+	 */
+	stcb = sctp_asocmap_lookup(lport, rport, from);
+	if (stcb != NULL) {
+		inp = stcb->sctp_ep;
+		if ((inp->sctp_flags & SCTP_PCB_FLAGS_IN_TCPPOOL) &&
+		    (stcb = sctp_tcb_special_match(inp, rport, from, to,
+						   netp)) != NULL) {
+			*inp_p = inp;
+			return (stcb);
+		}
+	}
+	if (sctp_asocmap_unhashed == 0) {
+		return (NULL);
+	}
+
 	ephead = &sctppcbinfo.sctp_tcpephash[SCTP_PCBHASH_ALLADDR(
 						     (lport + rport), sctppcbinfo.hashtcpmark)];
 	/*
@@ -274,99 +511,12 @@ sctp_tcb_special_locate(struct sctp_inpcb **inp_p, struct sockaddr *from,
 		if (lport != inp->sctp_lport) {
 			continue;
 		}
-		SCTP_INP_RLOCK(inp);
-		/* check to see if the ep has one of the addresses */
-		if ((inp->sctp_flags & SCTP_PCB_FLAGS_BOUNDALL) == 0) {
-			/* We are NOT bound all, so look further */
-			int match = 0;
-
-			LIST_FOREACH(laddr, &inp->sctp_addr_list, sctp_nxt_addr) {
-				if (laddr->ifa == NULL) {
-#ifdef SCTP_DEBUG
-					if (sctp_debug_on & SCTP_DEBUG_PCB1) {
-						printf("An ounce of prevention is worth a pound of cure\n");
-					}
-#endif
-					continue;
-				}
-				if (laddr->ifa->ifa_addr == NULL) {
-#ifdef SCTP_DEBUG
-					if (sctp_debug_on & SCTP_DEBUG_PCB1) {
-						printf("ifa with a NULL address\n");
-					}
-#endif
-					continue;
-				}
-				if (laddr->ifa->ifa_addr->sa_family ==
-				    to->sa_family) {
-					/* see if it matches */
-					struct sockaddr_in *intf_addr, *sin;
-					intf_addr = (struct sockaddr_in *)
-						laddr->ifa->ifa_addr;
-					sin = (struct sockaddr_in *)to;
-					if (from->sa_family == AF_INET) {
-						if (sin->sin_addr.s_addr ==
-						    intf_addr->sin_addr.s_addr) {
-							match = 1;
-							SCTP_INP_RUNLOCK(inp);
-							break;
-						}
-					} else {
-						struct sockaddr_in6 *intf_addr6;
-						struct sockaddr_in6 *sin6;
-						sin6 = (struct sockaddr_in6 *)
-							to;
-						intf_addr6 = (struct sockaddr_in6 *)
-							laddr->ifa->ifa_addr;
-
-						if (SCTP6_ARE_ADDR_EQUAL(&sin6->sin6_addr,
-									 &intf_addr6->sin6_addr)) {
-							match = 1;
-							SCTP_INP_RUNLOCK(inp);
-							break;
-						}
-					}
-				}
-			}
-			if (match == 0) {
-				/* This endpoint does not have this address */
-				SCTP_INP_RUNLOCK(inp);
-				continue;
-			}
-		}
-		/*
-		 * Ok if we hit here the ep has the address, does it hold the
-		 * tcb?
-		 */
-
-		stcb = LIST_FIRST(&inp->sctp_asoc_list);
-		if (stcb == NULL) {
-			SCTP_INP_RUNLOCK(inp);
-			continue;
-		}
-		SCTP_TCB_LOCK(stcb);
-		if (stcb->rport != rport) {
-			/* remote port does not match. */
-			SCTP_TCB_UNLOCK(stcb);
-			SCTP_INP_RUNLOCK(inp);
-			continue;
-		}
-		/* Does this TCB have a matching address? */
-		TAILQ_FOREACH(net, &stcb->asoc.nets, sctp_next) {
-			if (sctp_cmpaddr(from, rtcache_getdst(&net->ro))) {
-				/* found it */
-				if (netp != NULL) {
-					*netp = net;
-				}
-				/* Update the endpoint pointer */
-				*inp_p = inp;
-				SCTP_INP_RUNLOCK(inp);
-				return (stcb);
-			}
+		stcb = sctp_tcb_special_match(inp, rport, from, to, netp);
+		if (stcb != NULL) {
+			/* Update the endpoint pointer */
+			*inp_p = inp;
+			return (stcb);
 		}
-		SCTP_TCB_UNLOCK(stcb);
-
-		SCTP_INP_RUNLOCK(inp);
 	}
 	return (NULL);
 }
@@ -481,7 +631,6 @@ struct sctp_tcb *
 sctp_findassociation_ep_addr(struct sctp_inpcb **inp_p, struct sockaddr *remote,
     struct sctp_nets **netp, struct sockaddr *local, struct sctp_tcb *locked_tcb)
 {
-	struct sctpasochead *head;
 	struct sctp_inpcb *inp;
 	struct sctp_tcb *stcb;
 	struct sctp_nets *net;
@@ -561,34 +710,37 @@ sctp_findassociation_ep_addr(struct sctp_inpcb **inp_p, struct sockaddr *remote,
 		}
 	} else {
 		SCTP_INP_WLOCK(inp);
-		head = &inp->sctp_tcbhash[SCTP_PCBHASH_ALLADDR(rport,
-							       inp->sctp_hashmark)];
-		if (head == NULL) {
-			goto null_return;
+		stcb = sctp_asocmap_lookup(inp->sctp_lport, rport, remote);
+		if (stcb != NULL && stcb->sctp_ep != inp) {
+			/* same tuple, but on an endpoint bound elsewhere */
+			stcb = NULL;
 		}
-		LIST_FOREACH(stcb, head, sctp_tcbhash) {
-			if (stcb->rport != rport) {
-				/* remote port does not match */
-				continue;
-			}
-			/* now look at the list of remote addresses */
-			SCTP_TCB_LOCK(stcb);
-			TAILQ_FOREACH(net, &stcb->asoc.nets, sctp_next) {
-				if (sctp_cmpaddr(remote, rtcache_getdst(&net->ro))) {
-					/* found it */
-					if (netp != NULL) {
-						*netp = net;
-					}
-					if (locked_tcb == NULL) {
-						SCTP_INP_DECR_REF(inp);
-					}
-					SCTP_INP_WUNLOCK(inp);
-					SCTP_INP_INFO_RUNLOCK();
-					return (stcb);
-				}
+		if (stcb == NULL && sctp_asocmap_unhashed != 0) {
+			/* not every address is in the map, do it the hard way */
+			LIST_FOREACH(stcb, &inp->sctp_asoc_list, sctp_tcblist) {
+				if (stcb->rport == rport &&
+				    sctp_findnet(stcb, remote) != NULL)
+					break;
 			}
+		}
+		if (stcb == NULL) {
+			goto null_return;
+		}
+		SCTP_TCB_LOCK(stcb);
+		net = sctp_findnet(stcb, remote);
+		if (net == NULL) {
 			SCTP_TCB_UNLOCK(stcb);
+			goto null_return;
+		}
+		if (netp != NULL) {
+			*netp = net;
 		}
+		if (locked_tcb == NULL) {
+			SCTP_INP_DECR_REF(inp);
+		}
+		SCTP_INP_WUNLOCK(inp);
+		SCTP_INP_INFO_RUNLOCK();
+		return (stcb);
 	}
  null_return:
 	/* clean up for returning null */
@@ -1403,19 +1555,6 @@ sctp_inpcb_alloc(struct socket *so)
 		SCTP_INP_INFO_WUNLOCK();
 		return (EOPNOTSUPP);
 	}
-	inp->sctp_tcbhash = SCTP_ZONE_GET(sctppcbinfo.ipi_zone_hash);
-	if (inp->sctp_tcbhash == NULL) {
-		printf("Out of SCTP-INPCB->hashinit - no resources\n");
-		SCTP_ZONE_FREE(sctppcbinfo.ipi_zone_ep, inp);
-		SCTP_INP_INFO_WUNLOCK();
-		return (ENOBUFS);
-	} else {
-		for (i = 0; i < sctp_pcbtblsize; i++)
-			LIST_INIT(&inp->sctp_tcbhash[i]);
-		for (i = 1; i < sctp_pcbtblsize; i <<= 1)
-			continue;
-		inp->sctp_hashmark = i - 1;
-	}
         /* LOCK init's */
 	SCTP_INP_LOCK_INIT(inp);
 	SCTP_ASOC_CREATE_LOCK_INIT(inp);
@@ -1513,7 +1652,6 @@ sctp_move_pcb_and_assoc(struct sctp_inpcb *old_inp, struct sctp_inpcb *new_inp,
 	lport = new_inp->sctp_lport = old_inp->sctp_lport;
 	rport = stcb->rport;
 	/* Pull the tcb from the old association */
-	LIST_REMOVE(stcb, sctp_tcbhash);
 	LIST_REMOVE(stcb, sctp_tcblist);
 
 	/* Now insert the new_inp into the TCP connected hash */
@@ -1525,18 +1663,12 @@ sctp_move_pcb_and_assoc(struct sctp_inpcb *old_inp, struct sctp_inpcb *new_inp,
 	/* Now move the tcb into the endpoint list */
 	LIST_INSERT_HEAD(&new_inp->sctp_asoc_list, stcb, sctp_tcblist);
 	/*
-	 * Question, do we even need to worry about the ep-hash since
-	 * we only have one connection? Probably not :> so lets
-	 * get rid of it and not suck up any kernel memory in that.
+	 * The association map is keyed by the local port, not the
+	 * endpoint, so its entries stay valid across the move.
 	 */
 	SCTP_INP_INFO_WUNLOCK();
 	stcb->sctp_socket = new_inp->sctp_socket;
 	stcb->sctp_ep = new_inp;
-	if (new_inp->sctp_tcbhash != NULL) {
-		SCTP_ZONE_FREE(sctppcbinfo.ipi_zone_hash,
-			      new_inp->sctp_tcbhash);
-		new_inp->sctp_tcbhash = NULL;
-	}
 	if ((new_inp->sctp_flags & SCTP_PCB_FLAGS_BOUNDALL) == 0) {
 		/* Subset bound, so copy in the laddr list from the old_inp */
 		LIST_FOREACH(oladdr, &old_inp->sctp_addr_list, sctp_nxt_addr) {
@@ -2230,12 +2362,6 @@ sctp_inpcb_free(struct sctp_inpcb *inp, int immediate)
 		sctppcbinfo.ipi_gencnt_laddr++;
 		sctppcbinfo.ipi_count_laddr--;
 	}
-
-	/* Now lets see about freeing the EP hash table. */
-	if (inp->sctp_tcbhash != NULL) {
-		SCTP_ZONE_FREE(sctppcbinfo.ipi_zone_hash, inp->sctp_tcbhash);
-		inp->sctp_tcbhash = NULL;
-	}
 	SCTP_INP_WUNLOCK(inp);
 	SCTP_ASOC_CREATE_UNLOCK(inp);
 	SCTP_INP_LOCK_DESTROY(inp);
@@ -2593,6 +2719,7 @@ sctp_add_remote_addr(struct sctp_tcb *stcb, struct sockaddr *newaddr,
 		} while (netlook != NULL);
 		rtcache_unref(netfirst_rt, &netfirst->ro);
 	}
+	sctp_asocmap_insert(stcb, net);
 	/* got to have a primary set */
 	if (stcb->asoc.primary_destination == 0) {
 		stcb->asoc.primary_destination = net;
@@ -2814,19 +2941,6 @@ sctp_aloc_assoc(struct sctp_inpcb *inp, struct sockaddr *firstaddr,
 	callout_init(&asoc->autoclose_timer.timer, 0);
 	callout_init(&asoc->delayed_event_timer.timer, 0);
 	LIST_INSERT_HEAD(&inp->sctp_asoc_list, stcb, sctp_tcblist);
-	/* now file the port under the hash as well */
-#ifdef SCTP_DEBUG
-	printf("Before hashing %ld size %d\n",
-		inp->sctp_hashmark, sctp_pcbtblsize);
-#endif
-	if (inp->sctp_tcbhash != NULL) {
-		head = &inp->sctp_tcbhash[SCTP_PCBHASH_ALLADDR(stcb->rport,
-		   inp->sctp_hashmark)];
-		LIST_INSERT_HEAD(head, stcb, sctp_tcbhash);
-	}
-#ifdef SCTP_DEBUG
-	printf("After hashing\n");
-#endif
 	SCTP_INP_WUNLOCK(inp);
 #ifdef SCTP_DEBUG
 	if (sctp_debug_on & SCTP_DEBUG_PCB1) {
@@ -2887,6 +3001,7 @@ sctp_del_remote_addr(struct sctp_tcb *stcb, struct sockaddr *remaddr)
 			/* we found the guy */
 			asoc->numnets--;
 			TAILQ_REMOVE(&asoc->nets, net, sctp_next);
+			sctp_asocmap_remove(stcb, net);
 			sctp_free_remote_addr(net);
 			if (net == asoc->primary_destination) {
 				/* Reset primary */
@@ -3056,6 +3171,8 @@ sctp_free_assoc(struct sctp_inpcb *inp, struct sctp_tcb *stcb)
 	callout_stop(&asoc->delayed_event_timer.timer);
 	callout_destroy(&asoc->delayed_event_timer.timer);
 	TAILQ_FOREACH(net, &asoc->nets, sctp_next) {
+		/* no more lookups may find it */
+		sctp_asocmap_remove(stcb, net);
 		callout_stop(&net->rxt_timer.timer);
 		callout_stop(&net->pmtu_timer.timer);
 		callout_destroy(&net->rxt_timer.timer);
@@ -3082,9 +3199,6 @@ sctp_free_assoc(struct sctp_inpcb *inp, struct sctp_tcb *stcb)
 		inp->error_on_block = ECONNRESET;
 	}
 
-	if (inp->sctp_tcbhash) {
-		LIST_REMOVE(stcb, sctp_tcbhash);
-	}
 	/* Now lets remove it from the list of ALL associations in the EP */
 	LIST_REMOVE(stcb, sctp_tcblist);
 	SCTP_INP_WUNLOCK(inp);
@@ -3817,13 +3931,10 @@ sctp_pcb_init(void)
 #if defined(__FreeBSD__)
 #if defined(__FreeBSD_cc_version) && __FreeBSD_cc_version >= 440000
 	TUNABLE_INT_FETCH("net.inet.sctp.tcbhashsize", &hashtblsize);
-	TUNABLE_INT_FETCH("net.inet.sctp.pcbhashsize", &sctp_pcbtblsize);
 	TUNABLE_INT_FETCH("net.inet.sctp.chunkscale", &sctp_chunkscale);
 #else
 	TUNABLE_INT_FETCH("net.inet.sctp.tcbhashsize", SCTP_TCBHASHSIZE,
 	    hashtblsize);
-	TUNABLE_INT_FETCH("net.inet.sctp.pcbhashsize", SCTP_PCBHASHSIZE,
-	    sctp_pcbtblsize);
 	TUNABLE_INT_FETCH("net.inet.sctp.chunkscale", SCTP_CHUNKQUEUE_SCALE,
 	    sctp_chunkscale);
 #endif
@@ -3869,8 +3980,11 @@ sctp_pcb_init(void)
 	    (sctp_max_number_of_assoc * sctp_scale_up_for_address *
 	    sctp_chunkscale));
 
-	SCTP_ZONE_INIT(sctppcbinfo.ipi_zone_hash, "sctp_hash",
-		       sizeof(void *) * sctp_pcbtblsize, maxsockets);
+	sctp_asocmap = thmap_create(0, NULL, 0);
+	sctp_asocmap_psz = pserialize_create();
+	if (workqueue_create(&sctp_asocmap_wq, "sctpgc", sctp_asocmap_gc,
+	    NULL, PRI_SOFTNET, IPL_SOFTNET, WQ_MPSAFE) != 0)
+		panic("sctp_pcb_init: workqueue_create failed");
 
         /* Master Lock INIT for info structure */
 	SCTP_INP_INFO_LOCK_INIT();
@@ -4321,6 +4435,7 @@ sctp_load_addresses_from_init(struct sctp_tcb *stcb, struct mbuf *m,
 			/* remove and free it */
 			stcb->asoc.numnets--;
 			TAILQ_REMOVE(&stcb->asoc.nets, net, sctp_next);
+			sctp_asocmap_remove(stcb, net);
 			sctp_free_remote_addr(net);
 			if (net == stcb->asoc.primary_destination) {
 				stcb->asoc.primary_destination = NULL;
@@ -169,7 +169,6 @@ struct sctp_epinfo {
 	struct pool ipi_zone_net;
 	struct pool ipi_zone_chunk;
 	struct pool ipi_zone_sockq;
-	struct pool ipi_zone_hash;
 #endif
 
 #if defined(__FreeBSD__) && __FreeBSD_version >= 503000
@@ -306,9 +305,6 @@ struct sctp_inpcb {
 	struct socket *sctp_socket;
 	uint32_t sctp_flags;			/* flag set */
 	struct sctp_pcb sctp_ep;		/* SCTP ep data */
-	/* head of the hash of all associations */
-	struct sctpasochead *sctp_tcbhash;
-	u_long sctp_hashmark;
 	/* head of the list of all associations */
 	struct sctpasochead sctp_asoc_list;
 	/* queue of TCB's waiting to stuff data up the socket */
@@ -346,7 +342,6 @@ struct sctp_inpcb {
 struct sctp_tcb {
 	struct socket *sctp_socket;		/* back pointer to socket */
 	struct sctp_inpcb *sctp_ep;		/* back pointer to ep */
-	LIST_ENTRY(sctp_tcb) sctp_tcbhash;	/* next link in hash table */
 	LIST_ENTRY(sctp_tcb) sctp_tcblist;	/* list of all of the TCB's */
 	LIST_ENTRY(sctp_tcb) sctp_asocs;
 	struct sctp_association asoc;
@@ -123,6 +123,14 @@ union sctp_sockstore {
 	struct sockaddr     sa;
 };
 
+/* key of an association in the association map (see sctp_pcb.c) */
+struct sctp_asockey {
+	u_int16_t	sk_lport;
+	u_int16_t	sk_rport;
+	u_int32_t	sk_family;
+	u_int8_t	sk_addr[16];	/* sizeof(struct in6_addr) */
+};
+
 struct sctp_nets {
 	TAILQ_ENTRY(sctp_nets) sctp_next;	/* next link */
 
@@ -197,6 +205,8 @@ struct sctp_nets {
         u_int8_t src_addr_selected;	/* if we split we move */
 	u_int8_t indx_of_eligible_next_to_use;
 	u_int8_t addr_is_local;		/* its a local address (if known) could move in split */
+	u_int8_t in_asocmap;		/* owns the association map entry for its address */
+	struct sctp_asockey asockey;	/* ... under this key */
 #ifdef SCTP_HIGH_SPEED
 	u_int8_t last_hs_used;		/* index into the last HS table entry we used */
 #endif
@@ -77,6 +77,7 @@ __KERNEL_RCSID(0, "$NetBSD: sctp_usrreq.c,v 1.24 2024/02/09 22:08:37 andvar Exp
 #include <netinet/sctp_route.h>
 #include <netinet/sctputil.h>
 #include <netinet/sctp_indata.h>
+#include <netinet/sctp_crc32.h>
 #include <netinet/sctp_asconf.h>
 #ifdef IPSEC
 #include <netipsec/ipsec.h>
@@ -143,6 +144,7 @@ sctp_init(void)
 	sysctl_net_inet_sctp_setup(NULL);
 
 	sctp_pcb_init();
+	sctp_crc32_init();
 
 	if (nmbclusters > SCTP_ASOC_MAX_CHUNKS_ON_QUEUE)
 		sctp_max_chunks_on_queue = nmbclusters;
@@ -87,6 +87,33 @@ static const struct encapsw in6_l2tp_encapsw = {
 
 static int in6_l2tp_match(struct mbuf *, int, int, void *);
 
+/*
+ * Fill in the outer IPv6 header of a variant's encapsulation header
+ * template.  ip6_plen is set per packet by in6_l2tp_output().
+ */
+size_t
+in6_l2tp_hdr_init(struct l2tp_variant *var, void *hdr)
+{
+	struct ip6_hdr ip6hdr;
+
+	memset(&ip6hdr, 0, sizeof(ip6hdr));
+	ip6hdr.ip6_src = satosin6(var->lv_psrc)->sin6_addr;
+	ip6hdr.ip6_dst = satosin6(var->lv_pdst)->sin6_addr;
+	/* unlike IPv4, IP version must be filled by caller of ip6_output() */
+	ip6hdr.ip6_vfc = 0x60;
+	ip6hdr.ip6_nxt = IPPROTO_L2TP;
+	ip6hdr.ip6_hlim = ip6_l2tp_hlim;
+	memcpy(hdr, &ip6hdr, sizeof(ip6hdr));
+
+	return sizeof(ip6hdr);
+}
+
+/*
+ * Encapsulate and send a batch of frames linked through m_nextpkt.  The
+ * headers are copied from the variant's template and the route is
+ * looked up once for the whole batch.  The output counters of the l2tp
+ * interface are updated here.
+ */
 int
 in6_l2tp_output(struct l2tp_variant *var, struct mbuf *m)
 {
@@ -97,27 +124,23 @@ in6_l2tp_output(struct l2tp_variant *var, struct mbuf *m)
 	struct ifnet *ifp;
 	struct sockaddr_in6 *sin6_src = satosin6(var->lv_psrc);
 	struct sockaddr_in6 *sin6_dst = satosin6(var->lv_pdst);
-	struct ip6_hdr ip6hdr;	/* capsule IP header, host byte ordered */
-	int error;
-	uint32_t sess_id;
+	struct mbuf *n, *head, **tailp;
+	u_int hlen;
+	int error, len;
 
 	KASSERT(var != NULL);
 	KASSERT(l2tp_heldref_variant(var));
 	KASSERT(sin6_src != NULL && sin6_dst != NULL);
 	KASSERT(sin6_src->sin6_family == AF_INET6
 	    && sin6_dst->sin6_family == AF_INET6);
+	KASSERT(var->lv_hdrlen >= sizeof(struct ip6_hdr));
 
 	sc = var->lv_softc;
 	ifp = &sc->l2tp_ec.ec_if;
-	error = l2tp_check_nesting(ifp, m);
-	if (error) {
-		m_freem(m);
-		goto looped;
-	}
 
 	/* bidirectional configured tunnel mode */
 	if (IN6_IS_ADDR_UNSPECIFIED(&sin6_dst->sin6_addr)) {
-		m_freem(m);
+		l2tp_freem_batch(ifp, m);
 		if ((ifp->if_flags & IFF_DEBUG) != 0)
 			log(LOG_DEBUG, "%s: ENETUNREACH\n", __func__);
 		return ENETUNREACH;
@@ -130,77 +153,65 @@ in6_l2tp_output(struct l2tp_variant *var, struct mbuf *m)
 #endif
 #endif
 
-	memset(&ip6hdr, 0, sizeof(ip6hdr));
-	ip6hdr.ip6_src = sin6_src->sin6_addr;
-	ip6hdr.ip6_dst = sin6_dst->sin6_addr;
-	/* unlike IPv4, IP version must be filled by caller of ip6_output() */
-	ip6hdr.ip6_vfc = 0x60;
-	ip6hdr.ip6_nxt = IPPROTO_L2TP;
-	ip6hdr.ip6_hlim = ip6_l2tp_hlim;
-	/* outer IP payload length */
-	ip6hdr.ip6_plen = 0;
-	/* session-id length */
-	ip6hdr.ip6_plen += sizeof(uint32_t);
-	if (var->lv_use_cookie == L2TP_COOKIE_ON) {
-		/* cookie length */
-		ip6hdr.ip6_plen += var->lv_peer_cookie_len;
-	}
+	hlen = var->lv_hdrlen;
+	head = NULL;
+	tailp = &head;
+	error = 0;
+	for (; m != NULL; m = n) {
+		n = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+
+		error = l2tp_check_nesting(ifp, m);
+		if (error) {
+			m_freem(m);
+			if_statinc(ifp, if_oerrors);
+			continue;
+		}
 
 /* TODO: IP_TCPMSS support */
 #ifdef IP_TCPMSS
-	m = l2tp_tcpmss_clamp(ifp, m);
-	if (m == NULL)
-		return EINVAL;
+		m = l2tp_tcpmss_clamp(ifp, m);
+		if (m == NULL) {
+			error = EINVAL;
+			if_statinc(ifp, if_oerrors);
+			continue;
+		}
 #endif
 
-	/*
-	 * Payload length.
-	 *
-	 * NOTE: payload length may be changed in ip_tcpmss(). Typical case
-	 * is missing of TCP mss option in original TCP header.
-	 */
-	ip6hdr.ip6_plen += m->m_pkthdr.len;
-	HTONS(ip6hdr.ip6_plen);
-
-	if (var->lv_use_cookie == L2TP_COOKIE_ON) {
-		/* prepend session cookie */
-		uint32_t cookie_32;
-		uint64_t cookie_64;
-		M_PREPEND(m, var->lv_peer_cookie_len, M_DONTWAIT);
-		if (m && m->m_len < var->lv_peer_cookie_len)
-			m = m_pullup(m, var->lv_peer_cookie_len);
-		if (m == NULL)
-			return ENOBUFS;
-		if (var->lv_peer_cookie_len == 4) {
-			cookie_32 = htonl((uint32_t)var->lv_peer_cookie);
-			memcpy(mtod(m, void *), &cookie_32, sizeof(uint32_t));
-		} else {
-			cookie_64 = htobe64(var->lv_peer_cookie);
-			memcpy(mtod(m, void *), &cookie_64, sizeof(uint64_t));
+		/* prepend IPv6 header, session-ID and cookie in one go */
+		M_PREPEND(m, hlen, M_DONTWAIT);
+		if (m && m->m_len < hlen)
+			m = m_pullup(m, hlen);
+		if (m == NULL) {
+			error = ENOBUFS;
+			if_statinc(ifp, if_oerrors);
+			continue;
 		}
-	}
+		memcpy(mtod(m, void *), var->lv_hdr, hlen);
+		if (M_GET_ALIGNED_HDR(&m, struct ip6_hdr, false) != 0) {
+			error = ENOBUFS;
+			if_statinc(ifp, if_oerrors);
+			continue;
+		}
+		mtod(m, struct ip6_hdr *)->ip6_plen =
+		    htons(m->m_pkthdr.len - sizeof(struct ip6_hdr));
 
-	/* prepend session-ID */
-	sess_id = htonl(var->lv_peer_sess_id);
-	M_PREPEND(m, sizeof(uint32_t), M_DONTWAIT);
-	if (m && m->m_len < sizeof(uint32_t))
-		m = m_pullup(m, sizeof(uint32_t));
-	if (m == NULL)
-		return ENOBUFS;
-	memcpy(mtod(m, uint32_t *), &sess_id, sizeof(uint32_t));
+		/*
+		 * To avoid inappropriate rewrite of checksum,
+		 * clear csum flags.
+		 */
+		m->m_pkthdr.csum_flags  = 0;
 
-	/* prepend new IP header */
-	M_PREPEND(m, sizeof(struct ip6_hdr), M_DONTWAIT);
-	if (m == NULL)
-		return ENOBUFS;
-	if (M_GET_ALIGNED_HDR(&m, struct ip6_hdr, false) != 0)
-		return ENOBUFS;
-	memcpy(mtod(m, struct ip6_hdr *), &ip6hdr, sizeof(struct ip6_hdr));
+		*tailp = m;
+		tailp = &m->m_nextpkt;
+	}
+	if (head == NULL)
+		return error;
 
 	if_tunnel_get_ro(sc->l2tp_ro_percpu, &ro_pc, &lock_pc);
 	if ((rt = rtcache_lookup(ro_pc, var->lv_pdst)) == NULL) {
 		if_tunnel_put_ro(sc->l2tp_ro_percpu, lock_pc);
-		m_freem(m);
+		l2tp_freem_batch(ifp, head);
 		return ENETUNREACH;
 	}
 
@@ -209,24 +220,22 @@ in6_l2tp_output(struct l2tp_variant *var, struct mbuf *m)
 		rtcache_unref(rt, ro_pc);
 		rtcache_free(ro_pc);
 		if_tunnel_put_ro(sc->l2tp_ro_percpu, lock_pc);
-		m_freem(m);
+		l2tp_freem_batch(ifp, head);
 		return ENETUNREACH;	/* XXX */
 	}
 	rtcache_unref(rt, ro_pc);
 
-	/*
-	 * To avoid inappropriate rewrite of checksum,
-	 * clear csum flags.
-	 */
-	m->m_pkthdr.csum_flags  = 0;
-
-	error = ip6_output(m, 0, ro_pc, 0, NULL, NULL, NULL);
+	for (m = head; m != NULL; m = n) {
+		n = m->m_nextpkt;
+		m->m_nextpkt = NULL;
+		len = m->m_pkthdr.len - hlen;
+		error = ip6_output(m, 0, ro_pc, 0, NULL, NULL, NULL);
+		if (error)
+			if_statinc(ifp, if_oerrors);
+		else
+			if_statadd2(ifp, if_opackets, 1, if_obytes, len);
+	}
 	if_tunnel_put_ro(sc->l2tp_ro_percpu, lock_pc);
-	return(error);
-
-looped:
-	if (error)
-		if_statinc(ifp, if_oerrors);
 
 	return error;
 }
@@ -244,6 +253,7 @@ in6_l2tp_input(struct mbuf **mp, int *offp, int proto, void *eparg __unused)
 	uint32_t cookie_32;
 	uint64_t cookie_64;
 	struct psref psref;
+	const struct in6_addr *src;
 
 	KASSERT((m->m_flags & M_PKTHDR) != 0);
 
@@ -270,7 +280,10 @@ in6_l2tp_input(struct mbuf **mp, int *offp, int proto, void *eparg __unused)
 		return rv;
 	}
 
-	var = l2tp_lookup_session_ref(sess_id, &psref);
+	src = &mtod(m, struct ip6_hdr *)->ip6_src;
+	var = l2tp_lookup_session_cached_ref(sess_id,
+	    src->s6_addr32[0] ^ src->s6_addr32[1] ^
+	    src->s6_addr32[2] ^ src->s6_addr32[3], &psref);
 	if (var == NULL) {
 		m_freem(m);
 		IP_STATINC(IP_STAT_NOL2TP);
@@ -33,6 +33,7 @@
 #include <net/if_l2tp.h>
 
 int in6_l2tp_output(struct l2tp_variant *, struct mbuf *);
+size_t in6_l2tp_hdr_init(struct l2tp_variant *, void *);
 int in6_l2tp_attach(struct l2tp_variant *);
 int in6_l2tp_detach(struct l2tp_variant *);
 
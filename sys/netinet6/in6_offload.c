@@ -45,7 +45,8 @@ __KERNEL_RCSID(0, "$NetBSD: in6_offload.c,v 1.12 2018/12/12 01:40:20 rin Exp $")
 
 /*
  * Handle M_CSUM_TSOv6 in software. Split the TCP payload in chunks of
- * size MSS, and return mbuf chain consists of them.
+ * size MSS, the last one possibly shorter, and return mbuf chain
+ * consists of them.
  */
 struct mbuf *
 tcp6_segment(struct mbuf *m, int off)
@@ -55,10 +56,12 @@ tcp6_segment(struct mbuf *m, int off)
 	int thlen;
 	int hlen;
 	int len;
+	int seglen;
 	struct ip6_hdr *iph;
 	struct tcphdr *th;
 	uint32_t tcpseq;
 	uint16_t phsum;
+	uint8_t thflags;
 	struct mbuf *hdr = NULL;
 	struct mbuf *m0 = NULL;
 	struct mbuf *prev = NULL;
@@ -92,6 +95,7 @@ tcp6_segment(struct mbuf *m, int off)
 	}
 	th = (void *)(mtod(m, char *) + off + iphlen);
 	tcpseq = ntohl(th->th_seq);
+	thflags = th->th_flags;
 	thlen = th->th_off * 4;
 	hlen = off + iphlen + thlen;
 
@@ -106,20 +110,24 @@ tcp6_segment(struct mbuf *m, int off)
 	m = t;
 
 	len -= hlen;
-	KASSERT(len % mss == 0);
 
-	iph = (void *)(mtod(hdr, char *) + off);
-	iph->ip6_plen = htons(thlen + mss);
-	phsum = in6_cksum_phdr(&iph->ip6_src, &iph->ip6_dst, htonl(thlen + mss),
-	    htonl(IPPROTO_TCP));
+	/*
+	 * Only the first segment keeps CWR, and only the last one FIN
+	 * and PSH.
+	 */
+	th = (void *)(mtod(hdr, char *) + off + iphlen);
+	th->th_flags &= ~(TH_FIN | TH_PUSH);
 
-	for (nsegs = len / mss; nsegs > 0; nsegs--) {
+	for (nsegs = howmany(len, mss); nsegs > 0; nsegs--) {
 		if (nsegs > 1) {
 			n = m_dup(hdr, 0, hlen, M_NOWAIT);
 			if (n == NULL)
 				goto quit;
-		} else
+			seglen = mss;
+		} else {
 			n = hdr;
+			seglen = len;
+		}
 		KASSERT(n->m_len == hlen); /* XXX */
 
 		if (nsegs > 1) {
@@ -132,6 +140,7 @@ tcp6_segment(struct mbuf *m, int off)
 			t = m;
 		m_cat(n, m);
 		m = t;
+		len -= seglen;
 
 		KASSERT(n->m_len >= hlen); /* XXX */
 
@@ -141,15 +150,24 @@ tcp6_segment(struct mbuf *m, int off)
 		if (prev != NULL)
 			prev->m_nextpkt = n;
 
-		n->m_pkthdr.len = hlen + mss;
+		n->m_pkthdr.len = hlen + seglen;
 		n->m_nextpkt = NULL;	/* XXX */
 
+		iph = (void *)(mtod(n, char *) + off);
+		iph->ip6_plen = htons(thlen + seglen);
+
 		th = (void *)(mtod(n, char *) + off + iphlen);
 		th->th_seq = htonl(tcpseq);
+		if (n != m0)
+			th->th_flags &= ~TH_CWR;
+		if (nsegs == 1)
+			th->th_flags |= thflags & (TH_FIN | TH_PUSH);
+		phsum = in6_cksum_phdr(&iph->ip6_src, &iph->ip6_dst,
+		    htonl(thlen + seglen), htonl(IPPROTO_TCP));
 		th->th_sum = phsum;
-		th->th_sum = in6_cksum(n, 0, off + iphlen, thlen + mss);
+		th->th_sum = in6_cksum(n, 0, off + iphlen, thlen + seglen);
 
-		tcpseq += mss;
+		tcpseq += seglen;
 		prev = n;
 	}
 	return m0;
@@ -550,6 +550,7 @@ in6pcb_connect(void *v, struct sockaddr_in6 *sin6, struct lwp *l)
 void
 in6pcb_disconnect(struct inpcb *inp)
 {
+	portalgo_release(inp);
 	memset((void *)&in6p_faddr(inp), 0, sizeof(in6p_faddr(inp)));
 	inp->inp_fport = 0;
 	inpcb_set_state(inp, INP_BOUND);
@@ -134,8 +134,13 @@ percpu_t *ip6stat_percpu;
 
 percpu_t *ip6_forward_rt_percpu __cacheline_aligned;
 
+/* Packets handed to the input filters at once */
+#define	IP6_INPUT_BATCH	16
+
 static void ip6intr(void *);
-static void ip6_input(struct mbuf *, struct ifnet *);
+static struct mbuf *ip6_input_check(struct mbuf *, struct ifnet *);
+static void ip6_input_filter(struct mbuf **, u_int, struct ifnet *);
+static void ip6_input_finish(struct mbuf *, struct ifnet *, int);
 static bool ip6_badaddr(struct ip6_hdr *);
 static struct m_tag *ip6_setdstifaddr(struct mbuf *, const struct in6_ifaddr *);
 
@@ -214,54 +219,59 @@ ip6_init(void)
 }
 
 /*
- * IP6 input interrupt handling. Just pass the packet to ip6_input.
+ * IP6 input interrupt handling.  Packets are taken off the queue in
+ * runs received on the same interface, up to IP6_INPUT_BATCH of them,
+ * so that the input filters can look at them together.
  */
 static void
 ip6intr(void *arg __unused)
 {
+	struct mbuf *mv[IP6_INPUT_BATCH];
 	struct mbuf *m;
+	u_int n;
 
 	SOFTNET_KERNEL_LOCK_UNLESS_NET_MPSAFE();
-	while ((m = pktq_dequeue(ip6_pktq)) != NULL) {
+	m = pktq_dequeue(ip6_pktq);
+	while (m != NULL) {
 		struct psref psref;
 		struct ifnet *rcvif = m_get_rcvif_psref(m, &psref);
 
 		if (rcvif == NULL) {
 			IP6_STATINC(IP6_STAT_IFDROP);
 			m_freem(m);
+			m = pktq_dequeue(ip6_pktq);
 			continue;
 		}
-		/*
-		 * Drop the packet if IPv6 is disabled on the interface.
-		 */
-		if ((ND_IFINFO(rcvif)->flags & ND6_IFF_IFDISABLED)) {
-			m_put_rcvif_psref(rcvif, &psref);
-			IP6_STATINC(IP6_STAT_IFDROP);
-			m_freem(m);
-			continue;
-		}
-		ip6_input(m, rcvif);
+
+		n = 0;
+		do {
+			/*
+			 * Drop the packet if IPv6 is disabled on the interface.
+			 */
+			if ((ND_IFINFO(rcvif)->flags & ND6_IFF_IFDISABLED)) {
+				IP6_STATINC(IP6_STAT_IFDROP);
+				m_freem(m);
+			} else if ((m = ip6_input_check(m, rcvif)) != NULL)
+				mv[n++] = m;
+			m = pktq_dequeue(ip6_pktq);
+		} while (m != NULL && n < __arraycount(mv) &&
+		    m->m_pkthdr.rcvif_index == rcvif->if_index);
+
+		ip6_input_filter(mv, n, rcvif);
+
 		m_put_rcvif_psref(rcvif, &psref);
 	}
 	SOFTNET_KERNEL_UNLOCK_UNLESS_NET_MPSAFE();
 }
 
-static void
-ip6_input(struct mbuf *m, struct ifnet *rcvif)
+/*
+ * Sanity check the IPv6 header.  Returns the packet, or NULL if it was
+ * dropped.
+ */
+static struct mbuf *
+ip6_input_check(struct mbuf *m, struct ifnet *rcvif)
 {
 	struct ip6_hdr *ip6;
-	int hit, off = sizeof(struct ip6_hdr), nest;
-	u_int32_t plen;
-	u_int32_t rtalert = ~0;
-	int nxt, ours = 0, rh_present = 0, frg_present;
-	struct ifnet *deliverifp = NULL;
-	int srcrt = 0;
-	struct rtentry *rt = NULL;
-	union {
-		struct sockaddr		dst;
-		struct sockaddr_in6	dst6;
-	} u;
-	struct route *ro;
 
 	KASSERT(rcvif != NULL);
 
@@ -305,7 +315,7 @@ ip6_input(struct mbuf *m, struct ifnet *rcvif)
 		/* XXXJRT new stat, please */
 		IP6_STATINC(IP6_STAT_TOOSMALL);
 		in6_ifstat_inc(rcvif, ifs6_in_hdrerr);
-		return;
+		return NULL;
 	}
 
 	ip6 = mtod(m, struct ip6_hdr *);
@@ -313,13 +323,15 @@ ip6_input(struct mbuf *m, struct ifnet *rcvif)
 	if ((ip6->ip6_vfc & IPV6_VERSION_MASK) != IPV6_VERSION) {
 		IP6_STATINC(IP6_STAT_BADVERS);
 		in6_ifstat_inc(rcvif, ifs6_in_hdrerr);
-		goto bad;
+		m_freem(m);
+		return NULL;
 	}
 
 	if (ip6_badaddr(ip6)) {
 		IP6_STATINC(IP6_STAT_BADSCOPE);
 		in6_ifstat_inc(rcvif, ifs6_in_addrerr);
-		goto bad;
+		m_freem(m);
+		return NULL;
 	}
 
 	/*
@@ -327,6 +339,23 @@ ip6_input(struct mbuf *m, struct ifnet *rcvif)
 	 * based on this packet.
 	 */
 	m->m_flags |= M_CANFASTFWD;
+	return m;
+}
+
+/*
+ * Run a batch of checked packets from one interface through the input
+ * filters and pass the survivors on.
+ */
+static void
+ip6_input_filter(struct mbuf **mv, u_int n, struct ifnet *rcvif)
+{
+	struct mbuf *unfiltered[IP6_INPUT_BATCH];
+	struct in6_addr odst[IP6_INPUT_BATCH];
+	struct mbuf *m;
+	struct ip6_hdr *ip6;
+	u_int i;
+
+	KASSERT(n <= IP6_INPUT_BATCH);
 
 	/*
 	 * Run through list of hooks for input packets.  If there are any
@@ -338,31 +367,57 @@ ip6_input(struct mbuf *m, struct ifnet *rcvif)
 	 * Don't call hooks if the packet has already been processed by
 	 * IPsec (encapsulated, tunnel mode).
 	 */
+	for (i = 0; i < n; i++) {
+		unfiltered[i] = NULL;
 #if defined(IPSEC)
-	if (!ipsec_used || !ipsec_skip_pfil(m))
-#else
-	if (1)
+		if (ipsec_used && ipsec_skip_pfil(mv[i])) {
+			unfiltered[i] = mv[i];
+			mv[i] = NULL;
+			continue;
+		}
 #endif
-	{
-		struct in6_addr odst;
-		int error;
+		odst[i] = mtod(mv[i], struct ip6_hdr *)->ip6_dst;
+	}
+
+	pfil_run_hooks_vec(inet6_pfil_hook, mv, n, rcvif, PFIL_IN);
 
-		odst = ip6->ip6_dst;
-		error = pfil_run_hooks(inet6_pfil_hook, &m, rcvif, PFIL_IN);
-		if (error != 0 || m == NULL) {
+	for (i = 0; i < n; i++) {
+		if (unfiltered[i] != NULL) {
+			ip6_input_finish(unfiltered[i], rcvif, 0);
+			continue;
+		}
+		if ((m = mv[i]) == NULL) {
 			IP6_STATINC(IP6_STAT_PFILDROP_IN);
-			return;
+			continue;
 		}
 		if (m->m_len < sizeof(struct ip6_hdr)) {
 			if ((m = m_pullup(m, sizeof(struct ip6_hdr))) == NULL) {
 				IP6_STATINC(IP6_STAT_TOOSMALL);
 				in6_ifstat_inc(rcvif, ifs6_in_hdrerr);
-				return;
+				continue;
 			}
 		}
 		ip6 = mtod(m, struct ip6_hdr *);
-		srcrt = !IN6_ARE_ADDR_EQUAL(&odst, &ip6->ip6_dst);
+		ip6_input_finish(m, rcvif,
+		    !IN6_ARE_ADDR_EQUAL(&odst[i], &ip6->ip6_dst));
 	}
+}
+
+static void
+ip6_input_finish(struct mbuf *m, struct ifnet *rcvif, int srcrt)
+{
+	struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
+	int hit, off = sizeof(struct ip6_hdr), nest;
+	u_int32_t plen;
+	u_int32_t rtalert = ~0;
+	int nxt, ours = 0, rh_present = 0, frg_present;
+	struct ifnet *deliverifp = NULL;
+	struct rtentry *rt = NULL;
+	union {
+		struct sockaddr		dst;
+		struct sockaddr_in6	dst6;
+	} u;
+	struct route *ro;
 
 	IP6_STATINC(IP6_STAT_NXTHIST + ip6->ip6_nxt);
 
@@ -134,6 +134,8 @@ __KERNEL_RCSID(0, "$NetBSD: ip6_mroute.c,v 1.132 2020/06/12 11:04:45 roy Exp $")
 #include <sys/errno.h>
 #include <sys/time.h>
 #include <sys/kernel.h>
+#include <sys/kmem.h>
+#include <sys/percpu.h>
 #include <sys/ioctl.h>
 #include <sys/sysctl.h>
 #include <sys/syslog.h>
@@ -157,7 +159,10 @@ __KERNEL_RCSID(0, "$NetBSD: ip6_mroute.c,v 1.132 2020/06/12 11:04:45 roy Exp $")
 #include <netinet6/nd6.h>
 
 static int ip6_mdq(struct mbuf *, struct ifnet *, struct mf6c *);
-static void phyint_send(struct ip6_hdr *, struct mif6 *, struct mbuf *);
+static void phyint_send(struct ip6_hdr *, struct mif6 **, u_int,
+    struct mbuf *);
+static void phyint_send1(struct ip6_hdr *, struct mif6 *, struct mbuf *,
+    struct mbuf *);
 
 static int set_pim6(int *);
 static int socket_send(struct socket *, struct mbuf *, struct sockaddr_in6 *);
@@ -175,8 +180,16 @@ struct mrt6stat	mrt6stat;
 #define NO_RTE_FOUND 	0x1
 #define RTE_FOUND	0x2
 
-struct mf6c	*mf6ctable[MF6CTBLSIZ];
-u_char		n6expire[MF6CTBLSIZ];
+/*
+ * The hash starts with MF6CTBLSIZ buckets and is doubled by add_m6fc()
+ * whenever it holds more than MF6C_LOADFACTOR entries per bucket, up to
+ * MF6CTBLSIZ_MAX buckets.  n6expire[] has one counter per bucket.
+ */
+#define	MF6C_LOADFACTOR	2
+struct mf6c	**mf6ctable;
+u_long		mf6chash;	/* mask of mf6ctable */
+u_char		*n6expire;
+static u_int	mf6c_count;	/* # of entries in mf6ctable */
 struct mif6 mif6table[MAXMIFS];
 #ifdef MRT6DEBUG
 u_int		mrt6debug = 0;	  /* debug level 	*/
@@ -194,6 +207,7 @@ u_int		mrt6debug = 0;	  /* debug level 	*/
 static void	expire_upcalls(void *);
 #define	EXPIRE_TIMEOUT	(hz / 4)	/* 4x / second */
 #define	UPCALL_EXPIRE	6		/* number of timeouts */
+#define	STATS_SYNC	4		/* timeouts between syncs */
 
 #ifdef INET
 #ifdef MROUTING
@@ -228,10 +242,12 @@ static int pim6;
 /*
  * Hash function for a source, group entry
  */
-#define MF6CHASH(a, g) MF6CHASHMOD((a).s6_addr32[0] ^ (a).s6_addr32[1] ^ \
-				   (a).s6_addr32[2] ^ (a).s6_addr32[3] ^ \
-				   (g).s6_addr32[0] ^ (g).s6_addr32[1] ^ \
-				   (g).s6_addr32[2] ^ (g).s6_addr32[3])
+#define MF6CHASH_MASK(a, g, mask) \
+			  (((a).s6_addr32[0] ^ (a).s6_addr32[1] ^ \
+			    (a).s6_addr32[2] ^ (a).s6_addr32[3] ^ \
+			    (g).s6_addr32[0] ^ (g).s6_addr32[1] ^ \
+			    (g).s6_addr32[2] ^ (g).s6_addr32[3]) & (mask))
+#define MF6CHASH(a, g) MF6CHASH_MASK(a, g, mf6chash)
 
 /*
  * Find a route for a given origin IPv6 address and Multicast group address.
@@ -407,6 +423,78 @@ mrt6_ioctl(u_long cmd, void *data)
 	}
 }
 
+static void
+mf6c_stats_sum_cb(void *p, void *arg, struct cpu_info *ci __unused)
+{
+	const struct mf6c_stats *ms = p;
+	struct mf6c_stats *sum = arg;
+
+	sum->ms_pkt_cnt += ms->ms_pkt_cnt;
+	sum->ms_byte_cnt += ms->ms_byte_cnt;
+	sum->ms_wrong_if += ms->ms_wrong_if;
+}
+
+static void
+mf6c_stats_zero_cb(void *p, void *arg __unused, struct cpu_info *ci __unused)
+{
+
+	memset(p, 0, sizeof(struct mf6c_stats));
+}
+
+/*
+ * Give a cache entry zeroed counters, taking the per-CPU ones
+ * preallocated in *statsp if it has none yet.
+ */
+static void
+mf6c_stats_init(struct mf6c *rt, percpu_t **statsp)
+{
+
+	if (rt->mf6c_stats == NULL) {
+		KASSERT(*statsp != NULL);
+		rt->mf6c_stats = *statsp;
+		*statsp = NULL;
+	} else
+		percpu_foreach(rt->mf6c_stats, mf6c_stats_zero_cb, NULL);
+	rt->mf6c_pkt_cnt    = 0;
+	rt->mf6c_byte_cnt   = 0;
+	rt->mf6c_wrong_if   = 0;
+}
+
+/*
+ * Sum up the per-CPU counters of an entry, and leave the result in the
+ * entry for the benefit of netstat(1).
+ */
+static void
+mf6c_stats_sync(struct mf6c *rt)
+{
+	struct mf6c_stats sum;
+
+	if (rt->mf6c_stats == NULL)
+		return;
+	memset(&sum, 0, sizeof(sum));
+	percpu_foreach(rt->mf6c_stats, mf6c_stats_sum_cb, &sum);
+	rt->mf6c_pkt_cnt = sum.ms_pkt_cnt;
+	rt->mf6c_byte_cnt = sum.ms_byte_cnt;
+	rt->mf6c_wrong_if = sum.ms_wrong_if;
+}
+
+/*
+ * Set an entry's outgoing interfaces, and make the list of them that
+ * ip6_mdq() walks.
+ */
+static void
+mf6c_set_ifset(struct mf6c *rt, const struct if_set *ifset)
+{
+	mifi_t mifi;
+
+	rt->mf6c_ifset = *ifset;
+	rt->mf6c_noifs = 0;
+	for (mifi = 0; mifi < MAXMIFS; mifi++) {
+		if (IF_ISSET(mifi, ifset))
+			rt->mf6c_oifs[rt->mf6c_noifs++] = mifi;
+	}
+}
+
 /*
  * returns the packet, byte, rpf-failure count for the source group provided
  */
@@ -417,13 +505,19 @@ get_sg_cnt(struct sioc_sg_req6 *req)
 	int s;
 
 	s = splsoftnet();
+	if (mf6ctable == NULL) {
+		splx(s);
+		return (ESRCH);
+	}
 	MF6CFIND(req->src.sin6_addr, req->grp.sin6_addr, rt);
-	splx(s);
 	if (rt != NULL) {
+		mf6c_stats_sync(rt);
 		req->pktcnt = rt->mf6c_pkt_cnt;
 		req->bytecnt = rt->mf6c_byte_cnt;
 		req->wrong_if = rt->mf6c_wrong_if;
-	} else
+	}
+	splx(s);
+	if (rt == NULL)
 		return (ESRCH);
 #if 0
 		req->pktcnt = req->bytecnt = req->wrong_if = 0xffffffff;
@@ -488,8 +582,10 @@ ip6_mrouter_init(struct socket *so, int v, int cmd)
 	ip6_mrouter = so;
 	ip6_mrouter_ver = cmd;
 
-	memset((void *)mf6ctable, 0, sizeof(mf6ctable));
-	memset((void *)n6expire, 0, sizeof(n6expire));
+	mf6chash = MF6CTBLSIZ - 1;
+	mf6ctable = kmem_zalloc(MF6CTBLSIZ * sizeof(*mf6ctable), KM_SLEEP);
+	n6expire = kmem_zalloc(MF6CTBLSIZ, KM_SLEEP);
+	mf6c_count = 0;
 
 	pim6 = 0;/* used for stubbing out/in pim stuff */
 
@@ -512,7 +608,7 @@ int
 ip6_mrouter_done(void)
 {
 	mifi_t mifi;
-	int i;
+	u_long i;
 	struct ifnet *ifp;
 	struct sockaddr_in6 sin6;
 	struct mf6c *rt;
@@ -553,12 +649,10 @@ ip6_mrouter_done(void)
 
 	pim6 = 0; /* used to stub out/in pim specific code */
 
-	callout_stop(&expire_upcalls_ch);
-
 	/*
 	 * Free all multicast forwarding cache entries.
 	 */
-	for (i = 0; i < MF6CTBLSIZ; i++) {
+	for (i = 0; i <= mf6chash; i++) {
 		rt = mf6ctable[i];
 		while (rt) {
 			struct mf6c *frt;
@@ -572,11 +666,26 @@ ip6_mrouter_done(void)
 			}
 			frt = rt;
 			rt = rt->mf6c_next;
+			if (frt->mf6c_stats != NULL)
+				percpu_free(frt->mf6c_stats,
+				    sizeof(struct mf6c_stats));
 			free(frt, M_MRTABLE);
 		}
 	}
 
-	memset((void *)mf6ctable, 0, sizeof(mf6ctable));
+	kmem_free(mf6ctable, (mf6chash + 1) * sizeof(*mf6ctable));
+	kmem_free(n6expire, mf6chash + 1);
+	mf6ctable = NULL;
+	n6expire = NULL;
+	mf6c_count = 0;
+
+	/*
+	 * Halt expire_upcalls() only once n6expire is NULL: it may be
+	 * blocked on softnet_lock, and must not reschedule itself if it
+	 * gets to run while we wait.
+	 */
+	KASSERT(mutex_owned(softnet_lock));
+	callout_halt(&expire_upcalls_ch, softnet_lock);
 
 	/*
 	 * Reset register interface
@@ -605,7 +714,7 @@ ip6_mrouter_detach(struct ifnet *ifp)
 	struct rtdetq *rte;
 	struct mf6c *mfc;
 	mifi_t mifi;
-	int i;
+	u_long i;
 
 	if (ip6_mrouter == NULL)
 		return;
@@ -620,7 +729,7 @@ ip6_mrouter_detach(struct ifnet *ifp)
 	/*
 	 * Clear rte->ifp of cache entries received on ifp.
 	 */
-	for (i = 0; i < MF6CTBLSIZ; i++) {
+	for (i = 0; i <= mf6chash; i++) {
 		if (n6expire[i] == 0)
 			continue;
 
@@ -757,19 +866,79 @@ del_m6if(mifi_t *mifip)
 	return 0;
 }
 
+/*
+ * Double the size of the MFC hash if it has become too crowded.  This
+ * allocates with KM_SLEEP, so it must be called before splsoftnet();
+ * the caller holds softnet_lock, which keeps the table from changing
+ * size under us.
+ */
+static void
+mf6c_grow(void)
+{
+	struct mf6c **ntbl, **otbl, *rt;
+	u_char *nexp, *oexp;
+	u_long nmask, omask, i, hash;
+	int s;
+
+	if (mf6c_count <= MF6C_LOADFACTOR * (mf6chash + 1) ||
+	    mf6chash + 1 >= MF6CTBLSIZ_MAX)
+		return;
+
+	nmask = 2 * (mf6chash + 1) - 1;
+	ntbl = kmem_zalloc((nmask + 1) * sizeof(*ntbl), KM_SLEEP);
+	nexp = kmem_zalloc(nmask + 1, KM_SLEEP);
+
+	s = splsoftnet();
+	otbl = mf6ctable;
+	omask = mf6chash;
+	oexp = n6expire;
+	for (i = 0; i <= omask; i++) {
+		while ((rt = otbl[i]) != NULL) {
+			otbl[i] = rt->mf6c_next;
+			hash = MF6CHASH_MASK(rt->mf6c_origin.sin6_addr,
+			    rt->mf6c_mcastgrp.sin6_addr, nmask);
+			rt->mf6c_next = ntbl[hash];
+			ntbl[hash] = rt;
+			if (rt->mf6c_expire != 0)
+				nexp[hash]++;
+		}
+	}
+	mf6ctable = ntbl;
+	mf6chash = nmask;
+	n6expire = nexp;
+	splx(s);
+
+	kmem_free(otbl, (omask + 1) * sizeof(*otbl));
+	kmem_free(oexp, omask + 1);
+
+#ifdef MRT6DEBUG
+	if (mrt6debug & DEBUG_MFC)
+		log(LOG_DEBUG, "mf6c_grow: %lu buckets for %u entries\n",
+		    nmask + 1, mf6c_count);
+#endif
+}
+
 /*
  * Add an mfc entry
  */
 static int
 add_m6fc(struct mf6cctl *mfccp)
 {
-	struct mf6c *rt;
+	struct mf6c *rt, *srt, **nptr;
+	percpu_t *stats;
 	u_long hash;
 	struct rtdetq *rte;
 	u_short nstl;
 	int s;
 	char ip6bufo[INET6_ADDRSTRLEN], ip6bufm[INET6_ADDRSTRLEN];
 
+	/*
+	 * The per-CPU counters of a new entry and a bigger hash table
+	 * can't be allocated at splsoftnet, so take care of them first.
+	 */
+	mf6c_grow();
+	stats = percpu_alloc(sizeof(struct mf6c_stats));
+
 	MF6CFIND(mfccp->mf6cc_origin.sin6_addr,
 		 mfccp->mf6cc_mcastgrp.sin6_addr, rt);
 
@@ -787,18 +956,23 @@ add_m6fc(struct mf6cctl *mfccp)
 
 		s = splsoftnet();
 		rt->mf6c_parent = mfccp->mf6cc_parent;
-		rt->mf6c_ifset = mfccp->mf6cc_ifset;
+		mf6c_set_ifset(rt, &mfccp->mf6cc_ifset);
 		splx(s);
+		percpu_free(stats, sizeof(struct mf6c_stats));
 		return 0;
 	}
 
 	/*
-	 * Find the entry for which the upcall was made and update
+	 * Find the entry for which the upcall was made and update.  Should
+	 * there be several of them, the first one is kept and the packets
+	 * queued on the others are forwarded through it.
 	 */
 	s = splsoftnet();
 	hash = MF6CHASH(mfccp->mf6cc_origin.sin6_addr,
 			mfccp->mf6cc_mcastgrp.sin6_addr);
-	for (rt = mf6ctable[hash], nstl = 0; rt; rt = rt->mf6c_next) {
+	srt = NULL;
+	nptr = &mf6ctable[hash];
+	for (nstl = 0; (rt = *nptr) != NULL; ) {
 		if (IN6_ARE_ADDR_EQUAL(&rt->mf6c_origin.sin6_addr,
 				       &mfccp->mf6cc_origin.sin6_addr) &&
 		    IN6_ARE_ADDR_EQUAL(&rt->mf6c_mcastgrp.sin6_addr,
@@ -826,14 +1000,15 @@ add_m6fc(struct mf6cctl *mfccp)
 				    mfccp->mf6cc_parent, rt->mf6c_stall);
 #endif
 
-			rt->mf6c_origin     = mfccp->mf6cc_origin;
-			rt->mf6c_mcastgrp   = mfccp->mf6cc_mcastgrp;
-			rt->mf6c_parent     = mfccp->mf6cc_parent;
-			rt->mf6c_ifset	    = mfccp->mf6cc_ifset;
-			/* initialize pkt counters per src-grp */
-			rt->mf6c_pkt_cnt    = 0;
-			rt->mf6c_byte_cnt   = 0;
-			rt->mf6c_wrong_if   = 0;
+			if (srt == NULL) {
+				rt->mf6c_origin     = mfccp->mf6cc_origin;
+				rt->mf6c_mcastgrp   = mfccp->mf6cc_mcastgrp;
+				rt->mf6c_parent     = mfccp->mf6cc_parent;
+				mf6c_set_ifset(rt, &mfccp->mf6cc_ifset);
+				/* initialize pkt counters per src-grp */
+				mf6c_stats_init(rt, &stats);
+				srt = rt;
+			}
 
 			rt->mf6c_expire = 0;	/* Don't clean this guy up */
 			n6expire[hash]--;
@@ -842,7 +1017,7 @@ add_m6fc(struct mf6cctl *mfccp)
 			for (rte = rt->mf6c_stall; rte != NULL; ) {
 				struct rtdetq *n = rte->next;
 				if (rte->ifp) {
-					ip6_mdq(rte->m, rte->ifp, rt);
+					ip6_mdq(rte->m, rte->ifp, srt);
 				}
 				m_freem(rte->m);
 #ifdef UPCALL_TIMING
@@ -852,7 +1027,15 @@ add_m6fc(struct mf6cctl *mfccp)
 				rte = n;
 			}
 			rt->mf6c_stall = NULL;
+
+			if (rt != srt) {
+				*nptr = rt->mf6c_next;
+				mf6c_count--;
+				free(rt, M_MRTABLE);
+				continue;
+			}
 		}
+		nptr = &rt->mf6c_next;
 	}
 
 	/*
@@ -881,15 +1064,14 @@ add_m6fc(struct mf6cctl *mfccp)
 				rt->mf6c_origin     = mfccp->mf6cc_origin;
 				rt->mf6c_mcastgrp   = mfccp->mf6cc_mcastgrp;
 				rt->mf6c_parent     = mfccp->mf6cc_parent;
-				rt->mf6c_ifset	    = mfccp->mf6cc_ifset;
+				mf6c_set_ifset(rt, &mfccp->mf6cc_ifset);
 				/* initialize pkt counters per src-grp */
-				rt->mf6c_pkt_cnt    = 0;
-				rt->mf6c_byte_cnt   = 0;
-				rt->mf6c_wrong_if   = 0;
+				mf6c_stats_init(rt, &stats);
 
 				if (rt->mf6c_expire)
 					n6expire[hash]--;
 				rt->mf6c_expire	   = 0;
+				break;
 			}
 		}
 		if (rt == NULL) {
@@ -897,6 +1079,7 @@ add_m6fc(struct mf6cctl *mfccp)
 			rt = malloc(sizeof(*rt), M_MRTABLE, M_NOWAIT);
 			if (rt == NULL) {
 				splx(s);
+				percpu_free(stats, sizeof(struct mf6c_stats));
 				return ENOBUFS;
 			}
 
@@ -904,20 +1087,22 @@ add_m6fc(struct mf6cctl *mfccp)
 			rt->mf6c_origin     = mfccp->mf6cc_origin;
 			rt->mf6c_mcastgrp   = mfccp->mf6cc_mcastgrp;
 			rt->mf6c_parent     = mfccp->mf6cc_parent;
-			rt->mf6c_ifset	    = mfccp->mf6cc_ifset;
+			mf6c_set_ifset(rt, &mfccp->mf6cc_ifset);
 			/* initialize pkt counters per src-grp */
-			rt->mf6c_pkt_cnt    = 0;
-			rt->mf6c_byte_cnt   = 0;
-			rt->mf6c_wrong_if   = 0;
+			rt->mf6c_stats = NULL;
+			mf6c_stats_init(rt, &stats);
 			rt->mf6c_expire     = 0;
 			rt->mf6c_stall = NULL;
 
 			/* link into table */
 			rt->mf6c_next  = mf6ctable[hash];
 			mf6ctable[hash] = rt;
+			mf6c_count++;
 		}
 	}
 	splx(s);
+	if (stats != NULL)
+		percpu_free(stats, sizeof(struct mf6c_stats));
 	return 0;
 }
 
@@ -992,10 +1177,13 @@ del_m6fc(struct mf6cctl *mfccp)
 	}
 
 	*nptr = rt->mf6c_next;
-	free(rt, M_MRTABLE);
+	mf6c_count--;
 
 	splx(s);
 
+	percpu_free(rt->mf6c_stats, sizeof(struct mf6c_stats));
+	free(rt, M_MRTABLE);
+
 	return 0;
 }
 
@@ -1240,6 +1428,7 @@ ip6_mforward(struct ip6_hdr *ip6, struct ifnet *ifp, struct mbuf *m)
 			/* link into table */
 			rt->mf6c_next  = mf6ctable[hash];
 			mf6ctable[hash] = rt;
+			mf6c_count++;
 			/* Add this entry to the end of the queue */
 			rt->mf6c_stall = rte;
 		} else {
@@ -1281,19 +1470,30 @@ ip6_mforward(struct ip6_hdr *ip6, struct ifnet *ifp, struct mbuf *m)
 static void
 expire_upcalls(void *unused)
 {
+	static u_int ntimeouts;
 	struct rtdetq *rte;
 	struct mf6c *mfc, **nptr;
-	int i;
+	u_long i;
+	bool sync;
 
 	/* XXX NOMPSAFE still need softnet_lock */
 	mutex_enter(softnet_lock);
 	KERNEL_LOCK(1, NULL);
 
-	for (i = 0; i < MF6CTBLSIZ; i++) {
-		if (n6expire[i] == 0)
+	/* Multicast routing has been disabled meanwhile. */
+	if (n6expire == NULL)
+		goto out;
+
+	/* Keep the counters netstat(1) reads reasonably up to date. */
+	sync = ++ntimeouts % STATS_SYNC == 0;
+
+	for (i = 0; i <= mf6chash; i++) {
+		if (n6expire[i] == 0 && !sync)
 			continue;
 		nptr = &mf6ctable[i];
 		while ((mfc = *nptr) != NULL) {
+			if (sync)
+				mf6c_stats_sync(mfc);
 			rte = mfc->mf6c_stall;
 			/*
 			 * Skip real cache entries
@@ -1329,6 +1529,7 @@ expire_upcalls(void *unused)
 				n6expire[i]--;
 
 				*nptr = mfc->mf6c_next;
+				mf6c_count--;
 				free(mfc, M_MRTABLE);
 			} else {
 				nptr = &mfc->mf6c_next;
@@ -1337,23 +1538,11 @@ expire_upcalls(void *unused)
 	}
 	callout_reset(&expire_upcalls_ch, EXPIRE_TIMEOUT,
 	    expire_upcalls, NULL);
-
+out:
 	KERNEL_UNLOCK_ONE(NULL);
 	mutex_exit(softnet_lock);
 }
 
-/*
- * Macro to send packet on mif.  Since RSVP packets don't get counted on
- * input, they shouldn't get counted on output, so statistics keeping is
- * separate.
- */
-#define MC6_SEND(ip6, mifp, m) do {				\
-	if ((mifp)->m6_flags & MIFF_REGISTER)			\
-		register_send((ip6), (mifp), (m));		\
-	else							\
-		phyint_send((ip6), (mifp), (m));		\
-} while (/*CONSTCOND*/ 0)
-
 /*
  * Packet forwarding routine once entry in the cache is made
  */
@@ -1363,6 +1552,9 @@ ip6_mdq(struct mbuf *m, struct ifnet *ifp, struct mf6c *rt)
 	struct ip6_hdr *ip6 = mtod(m, struct ip6_hdr *);
 	mifi_t mifi, iif;
 	struct mif6 *mifp;
+	struct mif6 *phymifs[MAXMIFS];
+	struct mf6c_stats *ms;
+	u_int i, nphy;
 	int plen = m->m_pkthdr.len;
 	struct in6_addr src0, dst0; /* copies for local work */
 	u_int32_t iszone, idzone, oszone, odzone;
@@ -1384,7 +1576,9 @@ ip6_mdq(struct mbuf *m, struct ifnet *ifp, struct mf6c *rt)
 			    mif6table[mifi].m6_ifp->if_index : -1);
 #endif
 		mrt6stat.mrt6s_wrong_if++;
-		rt->mf6c_wrong_if++;
+		ms = percpu_getref(rt->mf6c_stats);
+		ms->ms_wrong_if++;
+		percpu_putref(rt->mf6c_stats);
 
 		/*
 		 * If we are doing PIM processing, and we are forwarding
@@ -1474,12 +1668,15 @@ ip6_mdq(struct mbuf *m, struct ifnet *ifp, struct mf6c *rt)
 		mif6table[mifi].m6_pkt_in++;
 		mif6table[mifi].m6_bytes_in += plen;
 	}
-	rt->mf6c_pkt_cnt++;
-	rt->mf6c_byte_cnt += plen;
+	ms = percpu_getref(rt->mf6c_stats);
+	ms->ms_pkt_cnt++;
+	ms->ms_byte_cnt += plen;
+	percpu_putref(rt->mf6c_stats);
 
 	/*
 	 * For each mif, forward a copy of the packet if there are group
-	 * members downstream on the interface.
+	 * members downstream on the interface.  Copies for physical
+	 * interfaces are made together by phyint_send().
 	 */
 	src0 = ip6->ip6_src;
 	dst0 = ip6->ip6_dst;
@@ -1488,63 +1685,93 @@ ip6_mdq(struct mbuf *m, struct ifnet *ifp, struct mf6c *rt)
 		IP6_STATINC(IP6_STAT_BADSCOPE);
 		return error;
 	}
-	for (mifp = mif6table, mifi = 0; mifi < nummifs; mifp++, mifi++) {
-		if (IF_ISSET(mifi, &rt->mf6c_ifset)) {
-			if (mif6table[mifi].m6_ifp == NULL)
+	nphy = 0;
+	for (i = 0; i < rt->mf6c_noifs; i++) {
+		mifi = rt->mf6c_oifs[i];
+		if (mifi >= nummifs)
+			continue;
+		mifp = &mif6table[mifi];
+		if (mifp->m6_ifp == NULL)
+			continue;
+		/*
+		 * check if the outgoing packet is going to break
+		 * a scope boundary.
+		 * XXX: For packets through PIM register tunnel
+		 * interface, we believe the routing daemon.
+		 */
+		if ((mif6table[rt->mf6c_parent].m6_flags &
+		     MIFF_REGISTER) == 0 &&
+		    (mifp->m6_flags & MIFF_REGISTER) == 0) {
+			if (in6_setscope(&src0, mifp->m6_ifp, &oszone) ||
+			    in6_setscope(&dst0, mifp->m6_ifp, &odzone) ||
+			    iszone != oszone || idzone != odzone) {
+				IP6_STATINC(IP6_STAT_BADSCOPE);
 				continue;
-			/*
-			 * check if the outgoing packet is going to break
-			 * a scope boundary.
-			 * XXX: For packets through PIM register tunnel
-			 * interface, we believe the routing daemon.
-			 */
-			if ((mif6table[rt->mf6c_parent].m6_flags &
-			     MIFF_REGISTER) == 0 &&
-			    (mif6table[mifi].m6_flags & MIFF_REGISTER) == 0) {
-				if (in6_setscope(&src0, mif6table[mifi].m6_ifp,
-				    &oszone) ||
-				    in6_setscope(&dst0, mif6table[mifi].m6_ifp,
-				    &odzone) ||
-				    iszone != oszone || idzone != odzone) {
-					IP6_STATINC(IP6_STAT_BADSCOPE);
-					continue;
-				}
 			}
-
-			mifp->m6_pkt_out++;
-			mifp->m6_bytes_out += plen;
-			MC6_SEND(ip6, mifp, m);
 		}
+
+		mifp->m6_pkt_out++;
+		mifp->m6_bytes_out += plen;
+		if (mifp->m6_flags & MIFF_REGISTER)
+			register_send(ip6, mifp, m);
+		else
+			phymifs[nphy++] = mifp;
 	}
+	if (nphy > 0)
+		phyint_send(ip6, phymifs, nphy, m);
 
 	return 0;
 }
 
+/*
+ * Send the packet on each of the n physical mifs in mifv.
+ */
 static void
-phyint_send(struct ip6_hdr *ip6, struct mif6 *mifp, struct mbuf *m)
+phyint_send(struct ip6_hdr *ip6, struct mif6 **mifv, u_int n, struct mbuf *m)
 {
-	struct mbuf *mb_copy;
-	struct ifnet *ifp = mifp->m6_ifp;
-	int error __mrt6debugused = 0;
-	int s;
-	static struct route ro;
-	bool ingroup;
-	struct sockaddr_in6 dst6;
-
-	s = splsoftnet();
+	struct mbuf *base, *mb_copy;
+	u_int i;
 
 	/*
 	 * Make a new reference to the packet; make sure that
 	 * the IPv6 header is actually copied, not just referenced,
 	 * so that ip6_output() only scribbles on the copy.
+	 *
+	 * The header of this copy then sits in a writable mbuf of its
+	 * own, so m_copypacket() duplicates the header and shares the
+	 * payload when cloning it for every mif but the last, which gets
+	 * the copy itself.
 	 */
-	mb_copy = m_copypacket(m, M_DONTWAIT);
-	if (mb_copy && M_UNWRITABLE(mb_copy, sizeof(struct ip6_hdr)))
-		mb_copy = m_pullup(mb_copy, sizeof(struct ip6_hdr));
-	if (mb_copy == NULL) {
-		splx(s);
+	base = m_copypacket(m, M_DONTWAIT);
+	if (base && M_UNWRITABLE(base, sizeof(struct ip6_hdr)))
+		base = m_pullup(base, sizeof(struct ip6_hdr));
+	if (base == NULL)
 		return;
+
+	for (i = 0; i < n; i++) {
+		if (i == n - 1)
+			mb_copy = base;
+		else if ((mb_copy = m_copypacket(base, M_DONTWAIT)) == NULL)
+			continue;
+		phyint_send1(ip6, mifv[i], m, mb_copy);
 	}
+}
+
+/*
+ * Send mb_copy, a private copy of m, on mifp.
+ */
+static void
+phyint_send1(struct ip6_hdr *ip6, struct mif6 *mifp, struct mbuf *m,
+    struct mbuf *mb_copy)
+{
+	struct ifnet *ifp = mifp->m6_ifp;
+	int error __mrt6debugused = 0;
+	int s;
+	static struct route ro;
+	bool ingroup;
+	struct sockaddr_in6 dst6;
+
+	s = splsoftnet();
 
 	/* set MCAST flag to the outgoing packet */
 	mb_copy->m_flags |= M_MCAST;
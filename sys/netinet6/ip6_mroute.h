@@ -222,6 +222,9 @@ struct mf6c {
 	struct sockaddr_in6  mf6c_mcastgrp;	/* multicast group associated*/
 	mifi_t	    	 mf6c_parent; 		/* incoming IF               */
 	struct if_set	 mf6c_ifset;		/* set of outgoing IFs */
+	u_short		 mf6c_noifs;		/* # of mifs in mf6c_oifs */
+	mifi_t		 mf6c_oifs[MAXMIFS];	/* mifs in mf6c_ifset */
+	struct percpu	*mf6c_stats;		/* struct mf6c_stats per CPU */
 
 	u_quad_t    	mf6c_pkt_cnt;		/* pkt count for src-grp     */
 	u_quad_t    	mf6c_byte_cnt;		/* byte count for src-grp    */
@@ -234,6 +237,17 @@ struct mf6c {
 
 #define MF6C_INCOMPLETE_PARENT ((mifi_t)-1)
 
+/*
+ * Per-CPU counters of a forwarding cache entry.  Their sums are stored
+ * in mf6c_pkt_cnt, mf6c_byte_cnt and mf6c_wrong_if by SIOCGETSGCNT_IN6,
+ * and by expire_upcalls() once a second.
+ */
+struct mf6c_stats {
+	u_quad_t	ms_pkt_cnt;
+	u_quad_t	ms_byte_cnt;
+	u_quad_t	ms_wrong_if;
+};
+
 /*
  * Argument structure used for pkt info. while upcall is made
  */
@@ -248,12 +262,8 @@ struct rtdetq {		/* XXX: rtdetq is also defined in ip_mroute.h */
 };
 #endif /* _NETINET_IP_MROUTE_H_ */
 
-#define MF6CTBLSIZ	256
-#if (MF6CTBLSIZ & (MF6CTBLSIZ - 1)) == 0	  /* from sys:route.h */
-#define MF6CHASHMOD(h)	((h) & (MF6CTBLSIZ - 1))
-#else
-#define MF6CHASHMOD(h)	((h) % MF6CTBLSIZ)
-#endif
+#define MF6CTBLSIZ	256		/* initial size of the MFC hash */
+#define MF6CTBLSIZ_MAX	65536		/* the MFC hash grows up to this */
 
 #define MAX_UPQ6	4		/* max. no of pkts in upcall Q */
 
@@ -453,7 +453,7 @@ struct kinfo_pcb {
  * Three additional levels are defined:
  *	Fourth: address family, 0 is wildcard
  *	Fifth: type of info, defined below
- *	Sixth: flag(s) to mask with for NET_RT_FLAGS
+ *	Sixth: flag(s) to mask with for NET_RT_FLAGS and NET_RT_DUMPFROM
  */
 #define	NET_RT_DUMP		1	/* dump; may limit to a.f. */
 #define	NET_RT_FLAGS		2	/* by flags, e.g. RESOLVING */
@@ -461,6 +461,16 @@ struct kinfo_pcb {
 #define	NET_RT_OOIFLIST		4	/* old NET_RT_IFLIST (pre-64bit time) */
 #define	NET_RT_OIFLIST		5	/* old NET_RT_IFLIST (pre 8.0) */
 #define	NET_RT_IFLIST		6	/* survey interface list */
+#define	NET_RT_DUMPFROM		7	/* resumable dump; see below */
+
+/*
+ * NET_RT_DUMPFROM returns as many whole routes of one address family as
+ * fit in the buffer, in table order, starting after the destination
+ * passed in as the new value (or from the start if there is none).  To
+ * continue, pass the RTA_DST of the last message returned; an empty
+ * result marks the end of the table.  Routes sharing a destination are
+ * never split across calls.
+ */
 
 #endif /* _NETBSD_SOURCE */
 
@@ -0,0 +1,374 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check that pcap_compile(3) produces programs that accept the same
+ * packets with and without the optimizer, by running both on a set of
+ * generated packets that covers the hosts, ports and protocols the
+ * filters name.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <arpa/inet.h>
+
+#include <atf-c.h>
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *hosts4[] = {
+	"1.1.1.1", "2.2.2.2", "3.3.3.3", "10.0.0.1", "192.168.1.2",
+};
+
+static const char *hosts6[] = {
+	"::1", "2001:db8::1", "2001:db8::2",
+};
+
+static const unsigned ports[] = { 0, 22, 53, 80, 81, 443, 1000, 65535 };
+
+static const unsigned char protos[] = {
+	1,	/* ICMP */
+	6,	/* TCP */
+	17,	/* UDP */
+	132,	/* SCTP */
+};
+
+struct pkt {
+	unsigned char data[128];
+	unsigned len;
+};
+
+static struct pkt *pkts;
+static size_t npkts;
+
+static void
+put16(unsigned char *p, unsigned v)
+{
+
+	p[0] = (unsigned char)(v >> 8);
+	p[1] = (unsigned char)v;
+}
+
+/*
+ * Start an Ethernet frame with the given type, optionally behind an
+ * 802.1Q tag, and return the offset of the payload.
+ */
+static unsigned
+mkether(unsigned char *p, unsigned type, int vlan)
+{
+	unsigned off = 12;
+
+	memset(p, 0, 12);
+	p[0] = 0x02;
+	p[6] = 0x02;
+	p[11] = 1;
+	if (vlan) {
+		put16(p + off, 0x8100);
+		put16(p + off + 2, 5);
+		off += 4;
+	}
+	put16(p + off, type);
+	return off + 2;
+}
+
+static void
+mkl4(unsigned char *p, unsigned sport, unsigned dport)
+{
+
+	memset(p, 0, 20);
+	put16(p, sport);
+	put16(p + 2, dport);
+}
+
+static struct pkt *
+newpkt(void)
+{
+	static size_t maxpkts;
+
+	if (npkts == maxpkts) {
+		maxpkts = maxpkts ? maxpkts * 2 : 1024;
+		pkts = realloc(pkts, maxpkts * sizeof(*pkts));
+		ATF_REQUIRE(pkts != NULL);
+	}
+	return &pkts[npkts++];
+}
+
+static void
+mkpkts4(void)
+{
+	struct in_addr src, dst;
+	struct pkt *pk;
+	unsigned char *ip;
+	size_t s, d, sp, dp, pr;
+	unsigned hl, off;
+	int vlan, frag, opts;
+
+	for (s = 0; s < __arraycount(hosts4); s++)
+	for (d = 0; d < __arraycount(hosts4); d++)
+	for (pr = 0; pr < __arraycount(protos); pr++)
+	for (sp = 0; sp < __arraycount(ports); sp++)
+	for (dp = 0; dp < __arraycount(ports); dp++)
+	for (vlan = 0; vlan < 2; vlan++)
+	for (frag = 0; frag < 2; frag++)
+	for (opts = 0; opts < 2; opts++) {
+		/* Vary the rest only for a few of the addresses. */
+		if ((vlan || frag || opts) && s + d > 2)
+			continue;
+		pk = newpkt();
+		off = mkether(pk->data, 0x0800, vlan);
+		ip = pk->data + off;
+		hl = opts ? 24 : 20;
+		memset(ip, 0, hl);
+		ip[0] = 0x40 | (hl / 4);
+		put16(ip + 2, hl + 20);
+		if (frag)
+			put16(ip + 6, 0x20 | 185);
+		ip[8] = 64;
+		ip[9] = protos[pr];
+		inet_pton(AF_INET, hosts4[s], &src);
+		inet_pton(AF_INET, hosts4[d], &dst);
+		memcpy(ip + 12, &src, 4);
+		memcpy(ip + 16, &dst, 4);
+		mkl4(ip + hl, ports[sp], ports[dp]);
+		pk->len = off + hl + 20;
+	}
+}
+
+static void
+mkpkts6(void)
+{
+	struct in6_addr src, dst;
+	struct pkt *pk;
+	unsigned char *ip;
+	size_t s, d, sp, dp, pr;
+	unsigned off;
+	int vlan;
+
+	for (s = 0; s < __arraycount(hosts6); s++)
+	for (d = 0; d < __arraycount(hosts6); d++)
+	for (pr = 0; pr < __arraycount(protos); pr++)
+	for (sp = 0; sp < __arraycount(ports); sp++)
+	for (dp = 0; dp < __arraycount(ports); dp++)
+	for (vlan = 0; vlan < 2; vlan++) {
+		pk = newpkt();
+		off = mkether(pk->data, 0x86dd, vlan);
+		ip = pk->data + off;
+		memset(ip, 0, 40);
+		ip[0] = 0x60;
+		put16(ip + 4, 20);
+		ip[6] = protos[pr] == 1 ? 58 : protos[pr];
+		ip[7] = 64;
+		inet_pton(AF_INET6, hosts6[s], &src);
+		inet_pton(AF_INET6, hosts6[d], &dst);
+		memcpy(ip + 8, &src, 16);
+		memcpy(ip + 24, &dst, 16);
+		mkl4(ip + 40, ports[sp], ports[dp]);
+		pk->len = off + 60;
+	}
+}
+
+static void
+mkpkts(void)
+{
+
+	if (npkts != 0)
+		return;
+	mkpkts4();
+	mkpkts6();
+}
+
+/*
+ * Compile filter with and without the optimizer, and check that both
+ * programs accept the same packets.
+ */
+static void
+check(const char *filter)
+{
+	struct bpf_program opt, noopt;
+	struct pcap_pkthdr h;
+	unsigned a, b;
+	size_t i, nbad;
+	pcap_t *p;
+
+	mkpkts();
+	p = pcap_open_dead(DLT_EN10MB, 65535);
+	ATF_REQUIRE(p != NULL);
+	ATF_REQUIRE_MSG(pcap_compile(p, &opt, filter, 1,
+	    PCAP_NETMASK_UNKNOWN) == 0, "%s: %s", filter, pcap_geterr(p));
+	ATF_REQUIRE_MSG(pcap_compile(p, &noopt, filter, 0,
+	    PCAP_NETMASK_UNKNOWN) == 0, "%s: %s", filter, pcap_geterr(p));
+
+	nbad = 0;
+	for (i = 0; i < npkts; i++) {
+		h.caplen = h.len = pkts[i].len;
+		a = bpf_filter(opt.bf_insns, pkts[i].data, h.len, h.caplen);
+		b = bpf_filter(noopt.bf_insns, pkts[i].data, h.len, h.caplen);
+		if (a != b && nbad++ < 5)
+			fprintf(stderr, "%.60s: packet %zu: optimized %u, "
+			    "unoptimized %u\n", filter, i, a, b);
+	}
+	ATF_CHECK_MSG(nbad == 0, "%.60s: %zu of %zu packets differ",
+	    filter, nbad, npkts);
+
+	pcap_freecode(&opt);
+	pcap_freecode(&noopt);
+	pcap_close(p);
+}
+
+/*
+ * Build "<prim> v0 or <prim> v1 ..." for n port numbers, which makes
+ * pcap_compile(3) search the set rather than test the values in turn.
+ */
+static char *
+mkportlist(const char *prim, unsigned n)
+{
+	char *buf;
+	size_t len, off;
+	unsigned i;
+
+	len = n * (strlen(prim) + 16) + 1;
+	buf = malloc(len);
+	ATF_REQUIRE(buf != NULL);
+	off = 0;
+	for (i = 0; i < n; i++)
+		off += (size_t)snprintf(buf + off, len - off, "%s%s %u",
+		    i ? " or " : "", prim, i * 7 % 2000 + 1);
+	return buf;
+}
+
+ATF_TC(hosts);
+ATF_TC_HEAD(hosts, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Check optimized filters on lists of hosts");
+}
+
+ATF_TC_BODY(hosts, tc)
+{
+	static const char *filters[] = {
+		"host 1.1.1.1",
+		"host 2.2.2.2 or host 3.3.3.3",
+		"src host 2.2.2.2 or src host 3.3.3.3",
+		"dst host 2.2.2.2 or dst host 3.3.3.3 or dst host 10.0.0.1",
+		"src host 2.2.2.2 or dst host 3.3.3.3",
+		"not host 1.1.1.1 and (host 2.2.2.2 or host 3.3.3.3)",
+		"(host 2.2.2.2 or host 3.3.3.3) and not host 1.1.1.1",
+		"not (host 2.2.2.2 or host 3.3.3.3)",
+		"host 1.1.1.1 and (host 2.2.2.2 or host 3.3.3.3)",
+		"(host 1.1.1.1 or host 2.2.2.2) and "
+		    "(host 3.3.3.3 or host 10.0.0.1)",
+		"host 1.1.1.1 or host 2.2.2.2 or port 80",
+		"vlan and (host 1.1.1.1 or host 2.2.2.2)",
+		"host 1.1.1.1 or vlan and host 2.2.2.2",
+	};
+	size_t i;
+
+	for (i = 0; i < __arraycount(filters); i++)
+		check(filters[i]);
+}
+
+ATF_TC(ports);
+ATF_TC_HEAD(ports, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Check optimized filters on lists of ports");
+}
+
+ATF_TC_BODY(ports, tc)
+{
+	static const char *filters[] = {
+		"port 80",
+		"port 80 or port 81",
+		"tcp port 80 or tcp port 81",
+		"not port 22 and (tcp port 80 or tcp port 81)",
+		"(tcp port 80 or tcp port 81) and not port 22",
+		"not (port 80 or port 81)",
+		"tcp and (dst port 80 or dst port 81 or dst port 443)",
+		"src port 53 or src port 80 or dst port 81",
+		"udp port 53 or tcp port 80 or tcp port 81",
+		"(port 22 or port 80) and (port 81 or port 443)",
+		"port 80 or port 81 or host 1.1.1.1",
+		"host 1.1.1.1 and (port 80 or port 81) or port 22",
+		"ip and (port 80 or port 81)",
+		"ip6 and (port 80 or port 81)",
+		"vlan and (port 80 or port 81)",
+		"sctp port 80 or sctp port 81",
+	};
+	size_t i;
+
+	for (i = 0; i < __arraycount(filters); i++)
+		check(filters[i]);
+}
+
+ATF_TC(portsets);
+ATF_TC_HEAD(portsets, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Check optimized filters on long lists of ports");
+}
+
+ATF_TC_BODY(portsets, tc)
+{
+	char *list, *filter;
+	size_t len;
+
+	list = mkportlist("port", 600);
+	check(list);
+	len = strlen(list) + 32;
+	filter = malloc(len);
+	ATF_REQUIRE(filter != NULL);
+	snprintf(filter, len, "not port 22 and (%s)", list);
+	check(filter);
+	free(filter);
+	free(list);
+
+	list = mkportlist("dst port", 600);
+	len = strlen(list) + 32;
+	filter = malloc(len);
+	ATF_REQUIRE(filter != NULL);
+	snprintf(filter, len, "tcp and (%s)", list);
+	check(filter);
+	free(filter);
+	free(list);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, hosts);
+	ATF_TP_ADD_TC(tp, ports);
+	ATF_TP_ADD_TC(tp, portsets);
+
+	return atf_no_error();
+}
@@ -0,0 +1,349 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check that L2TPv3 frames reach the right one of many sessions, with
+ * and without 64bit cookies, and after sessions go away.  As in
+ * regress/sys/net/l2tpbench, each session of a rump kernel is tunnelled
+ * from one of a set of peer addresses on lo0 to itself, with equal
+ * local and remote session IDs and cookies, so that what it sends comes
+ * back in on it.  Frames are written to the sessions through bpf(4) and
+ * counted by the input packet counters of the sessions.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sockio.h>
+
+#include <net/bpf.h>
+#include <net/if.h>
+#include <net/if_ether.h>
+#include <net/if_l2tp.h>
+#include <netinet/in.h>
+#include <netinet/in_var.h>
+
+#include <atf-c.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rump/rump.h>
+#include <rump/rump_syscalls.h>
+
+#include "h_macros.h"
+
+#define	NSESSIONS	256
+#define	NPEERS		16
+#define	FRAMELEN	64
+#define	PEER_NET	0x0afe0000	/* 10.254.0.0/16 for the peers */
+#define	COOKIE		0x0123456789abcdefULL
+
+static int sock;
+
+static void
+l2tpname(char *buf, unsigned i)
+{
+
+	snprintf(buf, IFNAMSIZ, "l2tp%u", i);
+}
+
+static void
+peeraddr(struct sockaddr_in *sin, unsigned p)
+{
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(PEER_NET + 1 + p);
+}
+
+static void
+setup(void)
+{
+	struct in_aliasreq ifra;
+	unsigned p;
+
+	RZ(rump_init());
+	RL(sock = rump_sys_socket(AF_INET, SOCK_DGRAM, 0));
+
+	for (p = 0; p < NPEERS; p++) {
+		memset(&ifra, 0, sizeof(ifra));
+		strlcpy(ifra.ifra_name, "lo0", sizeof(ifra.ifra_name));
+		peeraddr(&ifra.ifra_addr, p);
+		ifra.ifra_mask.sin_len = sizeof(ifra.ifra_mask);
+		ifra.ifra_mask.sin_family = AF_INET;
+		ifra.ifra_mask.sin_addr.s_addr = htonl(0xffffffff);
+		RL(rump_sys_ioctl(sock, SIOCAIFADDR, &ifra));
+	}
+}
+
+/*
+ * Set the session IDs, sid both ways, and the cookies of session i; a
+ * cookie length of 0 turns them off.
+ */
+static void
+session_set(unsigned i, uint32_t sid, u_int my_len, uint64_t my_cookie,
+    u_int peer_len, uint64_t peer_cookie)
+{
+	struct l2tp_req l2tpr;
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	l2tpname(ifr.ifr_name, i);
+	memset(&l2tpr, 0, sizeof(l2tpr));
+	ifr.ifr_data = &l2tpr;
+
+	l2tpr.my_sess_id = l2tpr.peer_sess_id = sid;
+	RL(rump_sys_ioctl(sock, SIOCSL2TPSESSION, &ifr));
+	if (my_len != 0) {
+		l2tpr.my_cookie_len = my_len;
+		l2tpr.my_cookie = my_cookie;
+		l2tpr.peer_cookie_len = peer_len;
+		l2tpr.peer_cookie = peer_cookie;
+		RL(rump_sys_ioctl(sock, SIOCSL2TPCOOKIE, &ifr));
+	} else
+		RL(rump_sys_ioctl(sock, SIOCDL2TPCOOKIE, &ifr));
+}
+
+/* Create session i over peer i % NPEERS, with session ID i + 1. */
+static void
+session_create(unsigned i, bool cookies)
+{
+	struct if_laddrreq iflr;
+	struct l2tp_req l2tpr;
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	l2tpname(ifr.ifr_name, i);
+	RL(rump_sys_ioctl(sock, SIOCIFCREATE, &ifr));
+
+	memset(&iflr, 0, sizeof(iflr));
+	strlcpy(iflr.iflr_name, ifr.ifr_name, sizeof(iflr.iflr_name));
+	peeraddr((struct sockaddr_in *)&iflr.addr, i % NPEERS);
+	peeraddr((struct sockaddr_in *)&iflr.dstaddr, i % NPEERS);
+	RL(rump_sys_ioctl(sock, SIOCSLIFPHYADDR, &iflr));
+
+	if (cookies)
+		session_set(i, i + 1, 8, COOKIE + i, 8, COOKIE + i);
+	else
+		session_set(i, i + 1, 0, 0, 0, 0);
+
+	memset(&l2tpr, 0, sizeof(l2tpr));
+	l2tpr.state = L2TP_STATE_UP;
+	ifr.ifr_data = &l2tpr;
+	RL(rump_sys_ioctl(sock, SIOCSL2TPSTATE, &ifr));
+
+	RL(rump_sys_ioctl(sock, SIOCGIFFLAGS, &ifr));
+	ifr.ifr_flags |= IFF_UP;
+	RL(rump_sys_ioctl(sock, SIOCSIFFLAGS, &ifr));
+}
+
+static void
+session_destroy(unsigned i)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	l2tpname(ifr.ifr_name, i);
+	RL(rump_sys_ioctl(sock, SIOCIFDESTROY, &ifr));
+}
+
+/* The input packet counter of session i, which is then zeroed. */
+static uint64_t
+session_ipackets(unsigned i)
+{
+	struct ifdatareq ifdr;
+
+	memset(&ifdr, 0, sizeof(ifdr));
+	l2tpname(ifdr.ifdr_name, i);
+	RL(rump_sys_ioctl(sock, SIOCZIFDATA, &ifdr));
+	return ifdr.ifdr_data.ifi_ipackets;
+}
+
+/* Write n broadcast frames to session i through the bpf descriptor. */
+static void
+session_send(int bpf, unsigned i, unsigned n)
+{
+	struct ether_header *eh;
+	char frame[FRAMELEN];
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	l2tpname(ifr.ifr_name, i);
+	RL(rump_sys_ioctl(bpf, BIOCSETIF, &ifr));
+
+	memset(frame, 0, sizeof(frame));
+	eh = (void *)frame;
+	memset(eh->ether_dhost, 0xff, ETHER_ADDR_LEN);
+	eh->ether_shost[0] = 0x02;
+	/* An unassigned ethertype, so that nobody answers. */
+	eh->ether_type = htons(0x88b5);
+	while (n-- > 0)
+		ATF_REQUIRE_EQ(rump_sys_write(bpf, frame, sizeof(frame)),
+		    (ssize_t)sizeof(frame));
+}
+
+/*
+ * Send 1 + i % 3 frames on each live session i, and check that each
+ * session took in exactly what it sent.
+ */
+static void
+check_sessions(const bool *live)
+{
+	unsigned i;
+	int bpf;
+
+	for (i = 0; i < NSESSIONS; i++)
+		if (live[i])
+			(void)session_ipackets(i);
+
+	RL(bpf = rump_sys_open("/dev/bpf", O_RDWR));
+	for (i = 0; i < NSESSIONS; i++)
+		if (live[i])
+			session_send(bpf, i, 1 + i % 3);
+	RL(rump_sys_close(bpf));
+
+	/* Let the input softints catch up. */
+	usleep(100000);
+	for (i = 0; i < NSESSIONS; i++)
+		if (live[i])
+			ATF_CHECK_EQ_MSG(session_ipackets(i), 1 + i % 3,
+			    "session %u", i);
+}
+
+static void
+sessions(bool cookies)
+{
+	bool live[NSESSIONS];
+	unsigned i;
+
+	setup();
+	for (i = 0; i < NSESSIONS; i++) {
+		session_create(i, cookies);
+		live[i] = true;
+	}
+	check_sessions(live);
+	check_sessions(live);
+
+	/* Every third session goes; the rest must not notice. */
+	for (i = 0; i < NSESSIONS; i += 3) {
+		session_destroy(i);
+		live[i] = false;
+	}
+	check_sessions(live);
+
+	/* Sessions move to the IDs others had. */
+	for (i = 1; i < NSESSIONS; i += 3) {
+		if (cookies)
+			session_set(i, i, 8, COOKIE + i, 8, COOKIE + i);
+		else
+			session_set(i, i, 0, 0, 0, 0);
+	}
+	check_sessions(live);
+}
+
+ATF_TC(sessions);
+ATF_TC_HEAD(sessions, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that frames reach the right one of many sessions");
+}
+
+ATF_TC_BODY(sessions, tc)
+{
+
+	sessions(false);
+}
+
+ATF_TC(cookies);
+ATF_TC_HEAD(cookies, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that frames reach the right one of many sessions with "
+	    "64bit cookies");
+}
+
+ATF_TC_BODY(cookies, tc)
+{
+
+	sessions(true);
+}
+
+ATF_TC(cookie_mismatch);
+ATF_TC_HEAD(cookie_mismatch, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that frames with a cookie other than the session's "
+	    "are dropped");
+}
+
+ATF_TC_BODY(cookie_mismatch, tc)
+{
+	bool live[NSESSIONS];
+	int bpf;
+
+	setup();
+	memset(live, 0, sizeof(live));
+	session_create(0, true);
+	live[0] = true;
+	check_sessions(live);
+
+	RL(bpf = rump_sys_open("/dev/bpf", O_RDWR));
+
+	/* Differing in the upper half only. */
+	session_set(0, 1, 8, COOKIE, 8, COOKIE ^ (1ULL << 63));
+	session_send(bpf, 0, 1);
+	/* The same lower half, but 32 bits long. */
+	session_set(0, 1, 8, COOKIE, 4, COOKIE & 0xffffffff);
+	session_send(bpf, 0, 1);
+
+	RL(rump_sys_close(bpf));
+	usleep(100000);
+	ATF_CHECK_EQ(session_ipackets(0), 0);
+
+	session_set(0, 1, 8, COOKIE, 8, COOKIE);
+	check_sessions(live);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, sessions);
+	ATF_TP_ADD_TC(tp, cookies);
+	ATF_TP_ADD_TC(tp, cookie_mismatch);
+
+	return atf_no_error();
+}
@@ -0,0 +1,594 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check the struct tap_vnet_hdr checksum offloads, TAP_F_BATCH framing
+ * and TAPADDQUEUE of tap(4), by passing UDP datagrams between a tap
+ * interface and a UDP socket of the same rump kernel.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sockio.h>
+#include <sys/sysctl.h>
+#include <sys/uio.h>
+
+#include <net/if.h>
+#include <net/if_ether.h>
+#include <net/if_tap.h>
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include <atf-c.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rump/rump.h>
+#include <rump/rump_syscalls.h>
+
+#include "h_macros.h"
+
+#define	TAP_ADDR	"10.0.0.1"
+#define	TAP_BCAST	"10.0.0.255"
+#define	PEER_ADDR	"10.0.0.2"
+#define	PORT		5000
+#define	PAYLOAD		"tap offload test"
+#define	TIMEOUT		1000		/* ms */
+
+#define	IPOFF		ETHER_HDR_LEN
+#define	UDPOFF		(IPOFF + sizeof(struct ip))
+#define	DATAOFF		(UDPOFF + sizeof(struct udphdr))
+
+enum csum { CSUM_FULL, CSUM_PARTIAL };
+
+static char ifname[IFNAMSIZ];
+
+/* The 16 bit one's complement sum of buf, added to sum. */
+static uint32_t
+sum16(const void *buf, size_t len, uint32_t sum)
+{
+	const uint8_t *p = buf;
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (p[i] << 8) | p[i + 1];
+	if (i < len)
+		sum += p[i] << 8;
+	while (sum > 0xffff)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum;
+}
+
+/* The sum of the UDP pseudo-header of the IPv4 datagram at ip. */
+static uint32_t
+pseudo_sum(const struct ip *ip)
+{
+	uint8_t ph[12];
+
+	memcpy(&ph[0], &ip->ip_src, 4);
+	memcpy(&ph[4], &ip->ip_dst, 4);
+	ph[8] = 0;
+	ph[9] = IPPROTO_UDP;
+	ph[10] = (ntohs(ip->ip_len) - sizeof(*ip)) >> 8;
+	ph[11] = (ntohs(ip->ip_len) - sizeof(*ip)) & 0xff;
+	return sum16(ph, sizeof(ph), 0);
+}
+
+/*
+ * Build an Ethernet frame carrying a UDP datagram from PEER_ADDR to
+ * TAP_ADDR.  With CSUM_PARTIAL, leave the pseudo-header sum in the UDP
+ * checksum as a virtio-net driver would, otherwise compute it.
+ */
+static size_t
+mkframe(uint8_t *f, uint16_t sport, enum csum csum)
+{
+	struct ether_header eh;
+	struct ip ip;
+	struct udphdr uh;
+	const size_t plen = sizeof(PAYLOAD);
+
+	memset(eh.ether_dhost, 0xff, ETHER_ADDR_LEN);
+	memset(eh.ether_shost, 0, ETHER_ADDR_LEN);
+	eh.ether_shost[0] = 0x02;
+	eh.ether_shost[5] = 0x02;
+	eh.ether_type = htons(ETHERTYPE_IP);
+	memcpy(f, &eh, sizeof(eh));
+
+	memset(&ip, 0, sizeof(ip));
+	ip.ip_v = IPVERSION;
+	ip.ip_hl = sizeof(ip) >> 2;
+	ip.ip_len = htons(sizeof(ip) + sizeof(uh) + plen);
+	ip.ip_ttl = 64;
+	ip.ip_p = IPPROTO_UDP;
+	ip.ip_src.s_addr = inet_addr(PEER_ADDR);
+	ip.ip_dst.s_addr = inet_addr(TAP_ADDR);
+	ip.ip_sum = htons(~sum16(&ip, sizeof(ip), 0) & 0xffff);
+	memcpy(f + IPOFF, &ip, sizeof(ip));
+
+	uh.uh_sport = htons(sport);
+	uh.uh_dport = htons(PORT);
+	uh.uh_ulen = htons(sizeof(uh) + plen);
+	uh.uh_sum = htons(pseudo_sum(&ip));
+	memcpy(f + UDPOFF, &uh, sizeof(uh));
+	memcpy(f + DATAOFF, PAYLOAD, plen);
+
+	if (csum == CSUM_FULL) {
+		uh.uh_sum = htons(~sum16(f + UDPOFF, sizeof(uh) + plen,
+		    pseudo_sum(&ip)) & 0xffff);
+		memcpy(f + UDPOFF, &uh, sizeof(uh));
+	}
+
+	return DATAOFF + plen;
+}
+
+/*
+ * Return whether the frame f carries an IPv4 UDP datagram to PORT, and
+ * if so check that it is complete and that its checksum is right.
+ */
+static bool
+check_frame(const uint8_t *f, size_t len)
+{
+	struct ether_header eh;
+	struct ip ip;
+	struct udphdr uh;
+
+	if (len < DATAOFF)
+		return false;
+	memcpy(&eh, f, sizeof(eh));
+	memcpy(&ip, f + IPOFF, sizeof(ip));
+	memcpy(&uh, f + UDPOFF, sizeof(uh));
+	if (ntohs(eh.ether_type) != ETHERTYPE_IP || ip.ip_p != IPPROTO_UDP ||
+	    ntohs(uh.uh_dport) != PORT)
+		return false;
+
+	ATF_REQUIRE(len >= IPOFF + ntohs(ip.ip_len));
+	ATF_CHECK_MSG(uh.uh_sum != 0, "no UDP checksum");
+	ATF_CHECK_MSG(sum16(f + UDPOFF, ntohs(uh.uh_ulen), pseudo_sum(&ip)) ==
+	    0xffff, "bad UDP checksum 0x%04x", ntohs(uh.uh_sum));
+	return true;
+}
+
+/* Complete the checksum a struct tap_vnet_hdr asks for. */
+static void
+apply_vnet_hdr(const struct tap_vnet_hdr *vh, uint8_t *f, size_t len)
+{
+	uint16_t sum;
+
+	ATF_REQUIRE_EQ(vh->tv_gso_type, TAP_VNET_HDR_GSO_NONE);
+	if ((vh->tv_flags & TAP_VNET_HDR_F_NEEDS_CSUM) == 0)
+		return;
+	ATF_REQUIRE_EQ(vh->tv_csum_start, UDPOFF);
+	ATF_REQUIRE_EQ(vh->tv_csum_offset, offsetof(struct udphdr, uh_sum));
+	ATF_REQUIRE(vh->tv_csum_start + vh->tv_csum_offset + 2u <= len);
+
+	sum = htons(~sum16(f + vh->tv_csum_start, len - vh->tv_csum_start,
+	    0) & 0xffff);
+	memcpy(f + vh->tv_csum_start + vh->tv_csum_offset, &sum, sizeof(sum));
+}
+
+static bool
+readable(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	RL(rump_sys_poll(&pfd, 1, TIMEOUT));
+	return (pfd.revents & POLLIN) != 0;
+}
+
+/*
+ * Create a tap interface with TAP_ADDR, and return a descriptor for
+ * it.  No duplicate address detection, so that it can be used at
+ * once.
+ */
+static int
+tap_setup(void)
+{
+	struct ifaliasreq ifra;
+	struct ifreq ifr;
+	struct sockaddr_in *sin;
+	int fd, s, zero = 0;
+
+	RZ(rump_init());
+	RL(sysctlbyname("net.inet.ip.dad_count", NULL, NULL,
+	    &zero, sizeof(zero)));
+
+	RL(fd = rump_sys_open("/dev/tap", O_RDWR));
+	memset(&ifr, 0, sizeof(ifr));
+	RL(rump_sys_ioctl(fd, TAPGIFNAME, &ifr));
+	strlcpy(ifname, ifr.ifr_name, sizeof(ifname));
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	memset(&ifra, 0, sizeof(ifra));
+	strlcpy(ifra.ifra_name, ifname, sizeof(ifra.ifra_name));
+	sin = (struct sockaddr_in *)&ifra.ifra_addr;
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = inet_addr(TAP_ADDR);
+	sin = (struct sockaddr_in *)&ifra.ifra_mask;
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = inet_addr("255.255.255.0");
+	RL(rump_sys_ioctl(s, SIOCAIFADDR, &ifra));
+
+	RL(rump_sys_ioctl(s, SIOCGIFFLAGS, &ifr));
+	ifr.ifr_flags |= IFF_UP;
+	RL(rump_sys_ioctl(s, SIOCSIFFLAGS, &ifr));
+	RL(rump_sys_close(s));
+
+	return fd;
+}
+
+/* Turn on the UDPv4 transmit checksum offload of the interface. */
+static void
+tap_txcsum(void)
+{
+	struct ifcapreq ifcr;
+	int s;
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	memset(&ifcr, 0, sizeof(ifcr));
+	strlcpy(ifcr.ifcr_name, ifname, sizeof(ifcr.ifcr_name));
+	RL(rump_sys_ioctl(s, SIOCGIFCAP, &ifcr));
+	ATF_REQUIRE(ifcr.ifcr_capabilities & IFCAP_CSUM_UDPv4_Tx);
+	ifcr.ifcr_capenable |= IFCAP_CSUM_UDPv4_Tx;
+	RL(rump_sys_ioctl(s, SIOCSIFCAP, &ifcr));
+	RL(rump_sys_close(s));
+}
+
+/* A UDP socket bound to TAP_ADDR:PORT. */
+static int
+udp_server(void)
+{
+	struct sockaddr_in sin;
+	int s;
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(PORT);
+	sin.sin_addr.s_addr = inet_addr(TAP_ADDR);
+	RL(rump_sys_bind(s, (struct sockaddr *)&sin, sizeof(sin)));
+	return s;
+}
+
+/* Broadcast a UDP datagram to PORT out of the tap interface. */
+static void
+udp_send(int s, uint16_t sport)
+{
+	struct sockaddr_in sin;
+	int on = 1;
+
+	RL(rump_sys_setsockopt(s, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(sport);
+	sin.sin_addr.s_addr = inet_addr(TAP_ADDR);
+	(void)rump_sys_bind(s, (struct sockaddr *)&sin, sizeof(sin));
+
+	sin.sin_port = htons(PORT);
+	sin.sin_addr.s_addr = inet_addr(TAP_BCAST);
+	ATF_REQUIRE_EQ(rump_sys_sendto(s, PAYLOAD, sizeof(PAYLOAD), 0,
+	    (struct sockaddr *)&sin, sizeof(sin)), (ssize_t)sizeof(PAYLOAD));
+}
+
+/* Whether a datagram with PAYLOAD arrives on s. */
+static bool
+udp_received(int s)
+{
+	char buf[sizeof(PAYLOAD) + 1];
+	ssize_t n;
+
+	if (!readable(s))
+		return false;
+	RL(n = rump_sys_recvfrom(s, buf, sizeof(buf), 0, NULL, NULL));
+	ATF_REQUIRE_EQ(n, (ssize_t)sizeof(PAYLOAD));
+	ATF_REQUIRE(memcmp(buf, PAYLOAD, sizeof(PAYLOAD)) == 0);
+	return true;
+}
+
+/*
+ * Read frames from fd until one is the datagram udp_send() sent, and
+ * check it.  Anything else, e.g. ARP, is skipped.
+ */
+static void
+tap_recv(int fd, bool vnethdr)
+{
+	struct tap_vnet_hdr vh;
+	uint8_t buf[2048], *f;
+	size_t hlen = vnethdr ? sizeof(vh) : 0;
+	ssize_t n;
+
+	for (;;) {
+		ATF_REQUIRE_MSG(readable(fd), "no frame read from %s", ifname);
+		RL(n = rump_sys_read(fd, buf, sizeof(buf)));
+		ATF_REQUIRE((size_t)n >= hlen);
+		f = buf + hlen;
+		if (vnethdr) {
+			memcpy(&vh, buf, sizeof(vh));
+			apply_vnet_hdr(&vh, f, n - hlen);
+		}
+		if (check_frame(f, n - hlen))
+			return;
+	}
+}
+
+ATF_TC(flags);
+ATF_TC_HEAD(flags, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr", "Checks TAPSFLAGS and TAPGFLAGS");
+}
+
+ATF_TC_BODY(flags, tc)
+{
+	int fd, flags;
+
+	fd = tap_setup();
+
+	RL(rump_sys_ioctl(fd, TAPGFLAGS, &flags));
+	ATF_CHECK_EQ(flags, 0);
+
+	flags = 0x80;
+	ATF_CHECK_ERRNO(EINVAL, rump_sys_ioctl(fd, TAPSFLAGS, &flags) == -1);
+
+	flags = TAP_F_VNETHDR | TAP_F_BATCH;
+	RL(rump_sys_ioctl(fd, TAPSFLAGS, &flags));
+	flags = 0;
+	RL(rump_sys_ioctl(fd, TAPGFLAGS, &flags));
+	ATF_CHECK_EQ(flags, TAP_F_VNETHDR | TAP_F_BATCH);
+}
+
+ATF_TC(write_vnethdr);
+ATF_TC_HEAD(write_vnethdr, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that tap(4) completes the checksums that a struct "
+	    "tap_vnet_hdr of a frame written asks for");
+}
+
+ATF_TC_BODY(write_vnethdr, tc)
+{
+	struct tap_vnet_hdr vh;
+	struct iovec iov[2];
+	uint8_t f[256];
+	size_t len;
+	int fd, s, flags;
+
+	fd = tap_setup();
+	s = udp_server();
+
+	flags = TAP_F_VNETHDR;
+	RL(rump_sys_ioctl(fd, TAPSFLAGS, &flags));
+
+	memset(&vh, 0, sizeof(vh));
+	iov[0].iov_base = &vh;
+	iov[0].iov_len = sizeof(vh);
+	iov[1].iov_base = f;
+
+	/* A complete checksum needs nothing. */
+	iov[1].iov_len = mkframe(f, 1000, CSUM_FULL);
+	RL(rump_sys_writev(fd, iov, 2));
+	ATF_CHECK_MSG(udp_received(s), "complete checksum: not received");
+
+	/* Without NEEDS_CSUM, a partial checksum is just wrong. */
+	iov[1].iov_len = mkframe(f, 1001, CSUM_PARTIAL);
+	RL(rump_sys_writev(fd, iov, 2));
+	ATF_CHECK_MSG(!udp_received(s), "bad checksum: received");
+
+	vh.tv_flags = TAP_VNET_HDR_F_NEEDS_CSUM;
+	vh.tv_csum_start = UDPOFF;
+	vh.tv_csum_offset = offsetof(struct udphdr, uh_sum);
+	RL(rump_sys_writev(fd, iov, 2));
+	ATF_CHECK_MSG(udp_received(s), "NEEDS_CSUM: not received");
+
+	/* The checksum field has to be within the frame. */
+	len = iov[1].iov_len;
+	vh.tv_csum_start = len - 1;
+	ATF_CHECK_ERRNO(EINVAL, rump_sys_writev(fd, iov, 2) == -1);
+
+	/* There is no UDP fragmentation offload. */
+	vh.tv_csum_start = UDPOFF;
+	vh.tv_gso_type = TAP_VNET_HDR_GSO_UDP;
+	vh.tv_gso_size = 8;
+	ATF_CHECK_ERRNO(EINVAL, rump_sys_writev(fd, iov, 2) == -1);
+}
+
+ATF_TC(read_vnethdr);
+ATF_TC_HEAD(read_vnethdr, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that tap(4) hands the transmit checksum offload to "
+	    "readers using a struct tap_vnet_hdr, and does it in software "
+	    "for the others");
+}
+
+ATF_TC_BODY(read_vnethdr, tc)
+{
+	int fd, s, flags;
+
+	fd = tap_setup();
+	tap_txcsum();
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+
+	udp_send(s, 1000);
+	tap_recv(fd, false);
+
+	flags = TAP_F_VNETHDR;
+	RL(rump_sys_ioctl(fd, TAPSFLAGS, &flags));
+	udp_send(s, 1000);
+	tap_recv(fd, true);
+}
+
+ATF_TC(batch);
+ATF_TC_HEAD(batch, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks reading and writing several frames at a time with "
+	    "TAP_F_BATCH");
+}
+
+ATF_TC_BODY(batch, tc)
+{
+	struct tap_batch_hdr tb;
+	uint8_t buf[4096], *p;
+	size_t len, off;
+	ssize_t n;
+	int fd, s, c, flags, i, nframes;
+
+	fd = tap_setup();
+	s = udp_server();
+	RL(c = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+
+	flags = TAP_F_BATCH;
+	RL(rump_sys_ioctl(fd, TAPSFLAGS, &flags));
+
+	/* Three frames in one write, the middle one of odd length. */
+	for (off = 0, i = 0; i < 3; i++) {
+		p = buf + off + sizeof(tb);
+		len = mkframe(p, 1000 + i, CSUM_FULL);
+		if (i == 1)
+			p[len++] = 0;	/* Ethernet trailer */
+		tb.tb_len = len;
+		memcpy(buf + off, &tb, sizeof(tb));
+		off += TAP_WORDALIGN(sizeof(tb) + len);
+	}
+	ATF_REQUIRE_EQ(rump_sys_write(fd, buf, off), (ssize_t)off);
+	for (i = 0; i < 3; i++)
+		ATF_CHECK_MSG(udp_received(s), "frame %d not received", i);
+
+	/* A record running past the end of the write is refused. */
+	tb.tb_len = sizeof(buf);
+	memcpy(buf, &tb, sizeof(tb));
+	ATF_CHECK_ERRNO(EINVAL, rump_sys_write(fd, buf, 64) == -1);
+
+	/* Several datagrams queued come back in well-formed records. */
+	for (i = 0; i < 3; i++)
+		udp_send(c, 2000);
+	for (nframes = 0; nframes < 3;) {
+		ATF_REQUIRE_MSG(readable(fd), "%d frames read", nframes);
+		RL(n = rump_sys_read(fd, buf, sizeof(buf)));
+		for (off = 0; off < (size_t)n;
+		    off = TAP_WORDALIGN(off + sizeof(tb) + tb.tb_len)) {
+			ATF_REQUIRE(off + sizeof(tb) <= (size_t)n);
+			memcpy(&tb, buf + off, sizeof(tb));
+			ATF_REQUIRE(off + sizeof(tb) + tb.tb_len <= (size_t)n);
+			if (check_frame(buf + off + sizeof(tb), tb.tb_len))
+				nframes++;
+		}
+	}
+	ATF_CHECK_EQ(nframes, 3);
+}
+
+ATF_TC(queues);
+ATF_TC_HEAD(queues, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that frames are spread over the queues TAPADDQUEUE "
+	    "creates, each on exactly one of them");
+}
+
+ATF_TC_BODY(queues, tc)
+{
+	struct pollfd pfd[2];
+	uint8_t buf[2048];
+	ssize_t n;
+	int fd, s, i, nframes[2];
+	const int nflows = 32;
+
+	fd = tap_setup();
+
+	pfd[0].fd = fd;
+	RL(rump_sys_ioctl(fd, TAPADDQUEUE, &pfd[1].fd));
+	ATF_REQUIRE(pfd[1].fd >= 0 && pfd[1].fd != fd);
+
+	/* One datagram per flow, each from a socket of its own. */
+	for (i = 0; i < nflows; i++) {
+		RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+		udp_send(s, 3000 + i);
+		RL(rump_sys_close(s));
+	}
+
+	nframes[0] = nframes[1] = 0;
+	while (nframes[0] + nframes[1] < nflows) {
+		pfd[0].events = pfd[1].events = POLLIN;
+		RL(rump_sys_poll(pfd, 2, TIMEOUT));
+		ATF_REQUIRE_MSG(pfd[0].revents | pfd[1].revents,
+		    "%d frames read", nframes[0] + nframes[1]);
+		for (i = 0; i < 2; i++) {
+			if ((pfd[i].revents & POLLIN) == 0)
+				continue;
+			RL(n = rump_sys_read(pfd[i].fd, buf, sizeof(buf)));
+			if (check_frame(buf, n))
+				nframes[i]++;
+		}
+	}
+	ATF_CHECK_EQ(nframes[0] + nframes[1], nflows);
+	ATF_CHECK_MSG(nframes[0] > 0 && nframes[1] > 0,
+	    "all %d flows on one queue", nflows);
+
+	/* Nothing more, in particular no copies. */
+	pfd[0].events = pfd[1].events = POLLIN;
+	while (rump_sys_poll(pfd, 2, TIMEOUT) > 0) {
+		for (i = 0; i < 2; i++) {
+			if ((pfd[i].revents & POLLIN) == 0)
+				continue;
+			RL(n = rump_sys_read(pfd[i].fd, buf, sizeof(buf)));
+			ATF_CHECK_MSG(!check_frame(buf, n),
+			    "extra frame on queue %d", i);
+		}
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, flags);
+	ATF_TP_ADD_TC(tp, write_vnethdr);
+	ATF_TP_ADD_TC(tp, read_vnethdr);
+	ATF_TP_ADD_TC(tp, batch);
+	ATF_TP_ADD_TC(tp, queues);
+
+	return atf_no_error();
+}
@@ -0,0 +1,614 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check how vlan(4) finds the vlan a tagged frame is for, with many
+ * vlans on one tap(4) parent, with 802.1Q and 802.1ad vlans sharing
+ * VLAN IDs, and with a customer vlan stacked on a service vlan.
+ * Tagged UDP broadcasts are written into the tap device and the
+ * interface they are received on is checked with IP_RECVIF;
+ * broadcasts sent on each vlan are read back from the tap device and
+ * their tags checked.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sockio.h>
+#include <sys/sysctl.h>
+#include <sys/uio.h>
+
+#include <net/if.h>
+#include <net/if_dl.h>
+#include <net/if_ether.h>
+#include <net/if_tap.h>
+#include <net/if_vlanvar.h>
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include <atf-c.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rump/rump.h>
+#include <rump/rump_syscalls.h>
+
+#include "h_macros.h"
+
+#define	NVLANS		256
+#define	PORT		5000
+#define	PAYLOAD		"vlan demux test"
+#define	TIMEOUT		1000		/* ms */
+#define	MAXTAGS		2
+
+struct tag {
+	uint16_t	proto;		/* ETHERTYPE_VLAN or ETHERTYPE_QINQ */
+	uint16_t	vid;
+};
+
+static char parent[IFNAMSIZ];
+
+/* The 16 bit one's complement sum of buf. */
+static uint16_t
+sum16(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t sum = 0;
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (p[i] << 8) | p[i + 1];
+	if (i < len)
+		sum += p[i] << 8;
+	while (sum > 0xffff)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum;
+}
+
+/* Subnet n of 10/8: 10.n.0/24, counting from 1. */
+static in_addr_t
+net_addr(unsigned n, unsigned host)
+{
+
+	return htonl(0x0a000000 | (n << 8) | host);
+}
+
+static bool
+readable(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	RL(rump_sys_poll(&pfd, 1, TIMEOUT));
+	return (pfd.revents & POLLIN) != 0;
+}
+
+static void
+set_flags(int s, const char *name, int set)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, name, sizeof(ifr.ifr_name));
+	RL(rump_sys_ioctl(s, SIOCGIFFLAGS, &ifr));
+	ifr.ifr_flags |= set;
+	RL(rump_sys_ioctl(s, SIOCSIFFLAGS, &ifr));
+}
+
+/*
+ * Create a tap interface, up and without addresses, and return a
+ * descriptor for it.  No duplicate address detection, so that the
+ * vlans can be used at once.
+ */
+static int
+tap_setup(void)
+{
+	struct ifreq ifr;
+	int fd, s, zero = 0;
+
+	RZ(rump_init());
+	RL(sysctlbyname("net.inet.ip.dad_count", NULL, NULL,
+	    &zero, sizeof(zero)));
+
+	RL(fd = rump_sys_open("/dev/tap", O_RDWR));
+	memset(&ifr, 0, sizeof(ifr));
+	RL(rump_sys_ioctl(fd, TAPGIFNAME, &ifr));
+	strlcpy(parent, ifr.ifr_name, sizeof(parent));
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	set_flags(s, parent, IFF_UP);
+	RL(rump_sys_close(s));
+
+	return fd;
+}
+
+/*
+ * Attach vlan unit on p with the given tag, as a service vlan if qinq.
+ * Returns 0 or the errno of SIOCSETVLAN.
+ */
+static int
+vlan_attach(unsigned unit, const char *p, const struct tag *t)
+{
+	struct vlanreq vlr;
+	struct ifreq ifr;
+	int s, error = 0;
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "vlan%u", unit);
+	if (t->proto == ETHERTYPE_QINQ)
+		set_flags(s, ifr.ifr_name, IFF_LINK0);
+
+	memset(&vlr, 0, sizeof(vlr));
+	strlcpy(vlr.vlr_parent, p, sizeof(vlr.vlr_parent));
+	vlr.vlr_tag = t->vid;
+	ifr.ifr_data = &vlr;
+	if (rump_sys_ioctl(s, SIOCSETVLAN, &ifr) == -1)
+		error = errno;
+	RL(rump_sys_close(s));
+	return error;
+}
+
+/* Detach vlan unit from its parent. */
+static void
+vlan_detach(unsigned unit)
+{
+	struct vlanreq vlr;
+	struct ifreq ifr;
+	int s;
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "vlan%u", unit);
+	memset(&vlr, 0, sizeof(vlr));
+	ifr.ifr_data = &vlr;
+	RL(rump_sys_ioctl(s, SIOCSETVLAN, &ifr));
+	RL(rump_sys_close(s));
+}
+
+/*
+ * Create vlan unit on p with the given tag, give it 10.n.0.1/24 and
+ * bring it up.  Returns its interface index.
+ */
+static unsigned
+vlan_setup(unsigned unit, const char *p, const struct tag *t, unsigned n)
+{
+	struct ifaliasreq ifra;
+	struct ifreq ifr;
+	struct sockaddr_in *sin;
+	int s, error;
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "vlan%u", unit);
+	RL(rump_sys_ioctl(s, SIOCIFCREATE, &ifr));
+	error = vlan_attach(unit, p, t);
+	ATF_REQUIRE_MSG(error == 0, "vlan%u on %s: %s", unit, p,
+	    strerror(error));
+
+	memset(&ifra, 0, sizeof(ifra));
+	strlcpy(ifra.ifra_name, ifr.ifr_name, sizeof(ifra.ifra_name));
+	sin = (struct sockaddr_in *)&ifra.ifra_addr;
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = net_addr(n, 1);
+	sin = (struct sockaddr_in *)&ifra.ifra_mask;
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = inet_addr("255.255.255.0");
+	RL(rump_sys_ioctl(s, SIOCAIFADDR, &ifra));
+	set_flags(s, ifr.ifr_name, IFF_UP);
+
+	RL(rump_sys_ioctl(s, SIOCGIFINDEX, &ifr));
+	RL(rump_sys_close(s));
+	return ifr.ifr_index;
+}
+
+/* A UDP socket on PORT that reports the receiving interface. */
+static int
+udp_server(void)
+{
+	struct sockaddr_in sin;
+	int s, on = 1;
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	RL(rump_sys_setsockopt(s, IPPROTO_IP, IP_RECVIF, &on, sizeof(on)));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(PORT);
+	RL(rump_sys_bind(s, (struct sockaddr *)&sin, sizeof(sin)));
+	return s;
+}
+
+/*
+ * Write a frame with the given tags, outermost first, carrying a UDP
+ * broadcast to PORT on subnet n, into the tap device.
+ */
+static void
+tap_write(int fd, const struct tag *tags, unsigned ntags, unsigned n)
+{
+	uint8_t f[128], *p = f;
+	struct ip ip;
+	struct udphdr uh;
+	uint16_t v;
+	unsigned i;
+
+	memset(p, 0xff, ETHER_ADDR_LEN);
+	p += ETHER_ADDR_LEN;
+	memset(p, 0, ETHER_ADDR_LEN);
+	p[0] = p[5] = 0x02;
+	p += ETHER_ADDR_LEN;
+	for (i = 0; i < ntags; i++) {
+		v = htons(tags[i].proto);
+		memcpy(p, &v, 2);
+		v = htons(tags[i].vid);
+		memcpy(p + 2, &v, 2);
+		p += ETHER_VLAN_ENCAP_LEN;
+	}
+	v = htons(ETHERTYPE_IP);
+	memcpy(p, &v, 2);
+	p += 2;
+
+	memset(&ip, 0, sizeof(ip));
+	ip.ip_v = IPVERSION;
+	ip.ip_hl = sizeof(ip) >> 2;
+	ip.ip_len = htons(sizeof(ip) + sizeof(uh) + sizeof(PAYLOAD));
+	ip.ip_ttl = 64;
+	ip.ip_p = IPPROTO_UDP;
+	ip.ip_src.s_addr = net_addr(n, 2);
+	ip.ip_dst.s_addr = net_addr(n, 255);
+	ip.ip_sum = htons(~sum16(&ip, sizeof(ip)) & 0xffff);
+	memcpy(p, &ip, sizeof(ip));
+	p += sizeof(ip);
+
+	uh.uh_sport = htons(PORT);
+	uh.uh_dport = htons(PORT);
+	uh.uh_ulen = htons(sizeof(uh) + sizeof(PAYLOAD));
+	uh.uh_sum = 0;
+	memcpy(p, &uh, sizeof(uh));
+	p += sizeof(uh);
+	memcpy(p, PAYLOAD, sizeof(PAYLOAD));
+	p += sizeof(PAYLOAD);
+
+	ATF_REQUIRE_EQ(rump_sys_write(fd, f, p - f), p - f);
+}
+
+/*
+ * The index of the interface the next datagram on s was received on,
+ * or 0 if none arrives.
+ */
+static unsigned
+udp_rcvif(int s)
+{
+	union {
+		struct cmsghdr hdr;
+		uint8_t buf[CMSG_SPACE(sizeof(struct sockaddr_dl))];
+	} cmsg;
+	struct sockaddr_dl sdl;
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	struct iovec iov;
+	char buf[sizeof(PAYLOAD) + 1];
+
+	if (!readable(s))
+		return 0;
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &cmsg;
+	msg.msg_controllen = sizeof(cmsg);
+	ATF_REQUIRE_EQ(rump_sys_recvmsg(s, &msg, 0), (ssize_t)sizeof(PAYLOAD));
+
+	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+	    cm = CMSG_NXTHDR(&msg, cm)) {
+		if (cm->cmsg_level == IPPROTO_IP &&
+		    cm->cmsg_type == IP_RECVIF) {
+			memcpy(&sdl, CMSG_DATA(cm), sizeof(sdl));
+			return sdl.sdl_index;
+		}
+	}
+	atf_tc_fail("no IP_RECVIF");
+}
+
+/*
+ * Throw away what the vlans have sent so far, e.g. gratuitous ARP, so
+ * that the tap queue has room.
+ */
+static void
+tap_drain(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	uint8_t f[2048];
+
+	for (;;) {
+		RL(rump_sys_poll(&pfd, 1, 0));
+		if ((pfd.revents & POLLIN) == 0)
+			return;
+		RL(rump_sys_read(fd, f, sizeof(f)));
+	}
+}
+
+/* Broadcast a UDP datagram to PORT on subnet n. */
+static void
+udp_send(unsigned n)
+{
+	struct sockaddr_in sin;
+	int s, on = 1;
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	RL(rump_sys_setsockopt(s, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on)));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(PORT);
+	sin.sin_addr.s_addr = net_addr(n, 255);
+	ATF_REQUIRE_EQ(rump_sys_sendto(s, PAYLOAD, sizeof(PAYLOAD), 0,
+	    (struct sockaddr *)&sin, sizeof(sin)), (ssize_t)sizeof(PAYLOAD));
+	RL(rump_sys_close(s));
+}
+
+/*
+ * Read frames from the tap device until one carries the broadcast
+ * udp_send(n) sent, and check its tags.  Anything else, e.g. ARP, is
+ * skipped.
+ */
+static void
+tap_read(int fd, const struct tag *tags, unsigned ntags, unsigned n)
+{
+	uint8_t f[2048], *p;
+	struct tag t[MAXTAGS + 1];
+	struct ip ip;
+	struct udphdr uh;
+	uint16_t v;
+	unsigned i, nt;
+	ssize_t len;
+
+	for (;;) {
+		ATF_REQUIRE_MSG(readable(fd), "no frame for subnet %u", n);
+		RL(len = rump_sys_read(fd, f, sizeof(f)));
+		p = f + 2 * ETHER_ADDR_LEN;
+		for (nt = 0; nt <= MAXTAGS; nt++) {
+			if (p + ETHER_VLAN_ENCAP_LEN + 2 > f + len)
+				break;
+			memcpy(&v, p, 2);
+			if (ntohs(v) != ETHERTYPE_VLAN &&
+			    ntohs(v) != ETHERTYPE_QINQ)
+				break;
+			t[nt].proto = ntohs(v);
+			memcpy(&v, p + 2, 2);
+			t[nt].vid = EVL_VLANOFTAG(ntohs(v));
+			p += ETHER_VLAN_ENCAP_LEN;
+		}
+		if (p + 2 + sizeof(ip) + sizeof(uh) > f + len)
+			continue;
+		memcpy(&v, p, 2);
+		memcpy(&ip, p + 2, sizeof(ip));
+		memcpy(&uh, p + 2 + sizeof(ip), sizeof(uh));
+		if (ntohs(v) != ETHERTYPE_IP || ip.ip_p != IPPROTO_UDP ||
+		    ntohs(uh.uh_dport) != PORT ||
+		    ip.ip_dst.s_addr != net_addr(n, 255))
+			continue;
+
+		ATF_REQUIRE_EQ_MSG(nt, ntags, "subnet %u: %u tags", n, nt);
+		for (i = 0; i < nt; i++) {
+			ATF_CHECK_EQ_MSG(t[i].proto, tags[i].proto,
+			    "subnet %u tag %u: ethertype 0x%04x", n, i,
+			    t[i].proto);
+			ATF_CHECK_EQ_MSG(t[i].vid, tags[i].vid,
+			    "subnet %u tag %u: vid %u", n, i, t[i].vid);
+		}
+		return;
+	}
+}
+
+/* VLAN IDs spread over the whole range. */
+static uint16_t
+vid_of(unsigned i)
+{
+
+	return 1 + i * 4093 / NVLANS;
+}
+
+ATF_TC(demux);
+ATF_TC_HEAD(demux, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that tagged frames reach the right one of many vlans");
+}
+
+ATF_TC_BODY(demux, tc)
+{
+	unsigned idx[NVLANS], i;
+	struct tag t;
+	int fd, s;
+
+	fd = tap_setup();
+	t.proto = ETHERTYPE_VLAN;
+	for (i = 0; i < NVLANS; i++) {
+		t.vid = vid_of(i);
+		idx[i] = vlan_setup(i, parent, &t, i + 1);
+	}
+	s = udp_server();
+
+	for (i = 0; i < NVLANS; i++) {
+		t.vid = vid_of(i);
+		tap_write(fd, &t, 1, i + 1);
+		ATF_CHECK_EQ_MSG(udp_rcvif(s), idx[i], "vid %u", t.vid);
+	}
+
+	/* Nobody has these. */
+	t.vid = vid_of(0) + 1;
+	tap_write(fd, &t, 1, 1);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), 0, "unused vid %u received", t.vid);
+	t.proto = ETHERTYPE_QINQ;
+	t.vid = vid_of(0);
+	tap_write(fd, &t, 1, 1);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), 0, "802.1ad vid %u received", t.vid);
+}
+
+ATF_TC(tagging);
+ATF_TC_HEAD(tagging, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that frames sent on each of many vlans carry its tag");
+}
+
+ATF_TC_BODY(tagging, tc)
+{
+	unsigned i;
+	struct tag t;
+	int fd;
+
+	fd = tap_setup();
+	t.proto = ETHERTYPE_VLAN;
+	for (i = 0; i < NVLANS; i++) {
+		t.vid = vid_of(i);
+		(void)vlan_setup(i, parent, &t, i + 1);
+	}
+
+	for (i = 0; i < NVLANS; i++) {
+		t.vid = vid_of(i);
+		tap_drain(fd);
+		udp_send(i + 1);
+		tap_read(fd, &t, 1, i + 1);
+	}
+}
+
+ATF_TC(qinq);
+ATF_TC_HEAD(qinq, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks 802.1Q and 802.1ad vlans with the same VLAN ID, and a "
+	    "customer vlan stacked on a service vlan");
+}
+
+ATF_TC_BODY(qinq, tc)
+{
+	const struct tag ctag = { ETHERTYPE_VLAN, 100 };
+	const struct tag stag = { ETHERTYPE_QINQ, 100 };
+	const struct tag inner = { ETHERTYPE_VLAN, 7 };
+	const struct tag stack[2] = { stag, inner };
+	unsigned cidx, sidx, iidx;
+	int fd, s;
+
+	fd = tap_setup();
+	cidx = vlan_setup(0, parent, &ctag, 1);
+	sidx = vlan_setup(1, parent, &stag, 2);
+	iidx = vlan_setup(2, "vlan1", &inner, 3);
+	s = udp_server();
+
+	tap_write(fd, &ctag, 1, 1);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), cidx, "802.1Q");
+	tap_write(fd, &stag, 1, 2);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), sidx, "802.1ad");
+	tap_write(fd, stack, 2, 3);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), iidx, "stacked");
+
+	/* Right tags, wrong subnets: received, but not for us. */
+	tap_write(fd, &ctag, 1, 2);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), 0, "802.1Q frame for 802.1ad vlan");
+	tap_write(fd, &stag, 1, 1);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), 0, "802.1ad frame for 802.1Q vlan");
+
+	RL(rump_sys_close(s));
+	tap_drain(fd);
+	udp_send(1);
+	tap_read(fd, &ctag, 1, 1);
+	udp_send(2);
+	tap_read(fd, &stag, 1, 2);
+	udp_send(3);
+	tap_read(fd, stack, 2, 3);
+}
+
+ATF_TC(reconfig);
+ATF_TC_HEAD(reconfig, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that a VLAN ID can only be used once per parent and "
+	    "encapsulation, and can be reused once released");
+}
+
+ATF_TC_BODY(reconfig, tc)
+{
+	const struct tag ctag = { ETHERTYPE_VLAN, 100 };
+	const struct tag stag = { ETHERTYPE_QINQ, 100 };
+	unsigned idx;
+	struct ifreq ifr;
+	int fd, s;
+
+	fd = tap_setup();
+	idx = vlan_setup(0, parent, &ctag, 1);
+
+	RL(s = rump_sys_socket(PF_INET, SOCK_DGRAM, 0));
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, "vlan1", sizeof(ifr.ifr_name));
+	RL(rump_sys_ioctl(s, SIOCIFCREATE, &ifr));
+	RL(rump_sys_close(s));
+	ATF_CHECK_EQ(vlan_attach(1, parent, &ctag), EEXIST);
+
+	s = udp_server();
+	tap_write(fd, &ctag, 1, 1);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), idx, "vid 100 before detach");
+
+	/* Gone, then taken by another vlan. */
+	vlan_detach(0);
+	tap_write(fd, &ctag, 1, 1);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), 0, "vid 100 after detach");
+
+	ATF_CHECK_EQ(vlan_attach(1, parent, &ctag), 0);
+	ATF_CHECK_EQ(vlan_attach(1, parent, &stag), EBUSY);
+	idx = vlan_setup(2, parent, &stag, 2);
+	tap_write(fd, &stag, 1, 2);
+	ATF_CHECK_EQ_MSG(udp_rcvif(s), idx, "802.1ad vid 100");
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, demux);
+	ATF_TP_ADD_TC(tp, tagging);
+	ATF_TP_ADD_TC(tp, qinq);
+	ATF_TP_ADD_TC(tp, reconfig);
+
+	return atf_no_error();
+}
@@ -0,0 +1,274 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check every implementation of the MI cpu_in_cksum() that the CPU
+ * supports, and cpu_in_cksum_copy(), against a byte-at-a-time
+ * reference on random mbuf chains.  sys/netinet/cpu_in_cksum.c is
+ * built into the test as is.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/param.h>
+#include <sys/mbuf.h>
+
+#include <arpa/inet.h>
+
+#include <atf-c.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int		cpu_in_cksum(struct mbuf *, int, int, uint32_t);
+uint32_t	cpu_in_cksum_copy(const void *, void *, size_t, uint32_t);
+const char *	cpu_in_cksum_select(const char *);
+
+static const char *const impls[] = { "portable", "sse2", "avx2", "neon" };
+
+#define MAXLEN		65536
+#define MAXCHAIN	8
+#define ITERATIONS	2000
+
+/*
+ * RFC 1071, one byte at a time, plus initial, not inverted.  The
+ * result is in host byte order, as the kernel would store it.
+ */
+static uint16_t
+ref_cksum(const uint8_t *p, size_t len, uint32_t initial)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sum += (i & 1) ? p[i] : (uint32_t)p[i] << 8;
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+	sum = htons((uint16_t)sum);
+	sum += (initial >> 16) + (initial & 0xffff);
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+	return sum;
+}
+
+static void
+fill(uint8_t *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = (uint8_t)random();
+}
+
+static uint8_t *
+xmalloc(size_t len)
+{
+	uint8_t *p;
+
+	ATF_REQUIRE((p = malloc(len)) != NULL);
+	return p;
+}
+
+/*
+ * Split len bytes of buf into a chain of up to MAXCHAIN mbufs, each of
+ * them with its data at a random misalignment in a buffer of its own.
+ */
+static struct mbuf *
+mkchain(const uint8_t *buf, size_t len, struct mbuf *mv, uint8_t **bufs)
+{
+	size_t left = len, mlen;
+	unsigned i, n = 1 + (unsigned)random() % MAXCHAIN;
+
+	memset(mv, 0, MAXCHAIN * sizeof(*mv));
+	for (i = 0; i < n; i++) {
+		mlen = (i == n - 1) ? left : (size_t)random() % (left + 1);
+		mv[i].m_next = (i == n - 1) ? NULL : &mv[i + 1];
+		mv[i].m_data = (char *)bufs[i] + random() % 16;
+		mv[i].m_len = (int)mlen;
+		memcpy(mv[i].m_data, buf, mlen);
+		buf += mlen;
+		left -= mlen;
+	}
+	return &mv[0];
+}
+
+ATF_TC(select);
+ATF_TC_HEAD(select, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that the portable implementation is always available");
+}
+
+ATF_TC_BODY(select, tc)
+{
+	unsigned i;
+
+	for (i = 0; i < __arraycount(impls); i++)
+		printf("%s: %s\n", impls[i],
+		    cpu_in_cksum_select(impls[i]) ? "supported" : "unsupported");
+	ATF_CHECK(cpu_in_cksum_select("portable") != NULL);
+	ATF_CHECK(cpu_in_cksum_select("nonexistent") == NULL);
+}
+
+ATF_TC(chains);
+ATF_TC_HEAD(chains, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks cpu_in_cksum() on random mbuf chains, offsets and "
+	    "lengths");
+}
+
+ATF_TC_BODY(chains, tc)
+{
+	struct mbuf mv[MAXCHAIN];
+	uint8_t *buf, *bufs[MAXCHAIN];
+	unsigned i, j, failed = 0;
+	uint32_t initial;
+	size_t len, off, end;
+	uint16_t ref, sum;
+
+	srandom(1);
+	buf = xmalloc(MAXLEN);
+	for (i = 0; i < MAXCHAIN; i++)
+		bufs[i] = xmalloc(MAXLEN + 16);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		/* Favour the sizes around the vector thresholds. */
+		len = (size_t)random() % ((i & 1) ? 2048 : MAXLEN);
+		off = len ? (size_t)random() % len : 0;
+		end = off + (size_t)random() % (len - off + 1);
+		initial = (uint32_t)random();
+		fill(buf, len);
+		mkchain(buf, len, mv, bufs);
+		ref = ref_cksum(buf + off, end - off, initial);
+
+		for (j = 0; j < __arraycount(impls); j++) {
+			if (cpu_in_cksum_select(impls[j]) == NULL)
+				continue;
+			sum = ~cpu_in_cksum(mv, (int)(end - off), (int)off,
+			    initial);
+			if (sum != ref && failed++ < 10)
+				printf("%s: len %zu off %zu end %zu: "
+				    "0x%04x != 0x%04x\n", impls[j], len, off,
+				    end, sum, ref);
+		}
+	}
+	ATF_CHECK_EQ_MSG(failed, 0, "%u bad checksums", failed);
+
+	for (i = 0; i < MAXCHAIN; i++)
+		free(bufs[i]);
+	free(buf);
+}
+
+ATF_TC(copy);
+ATF_TC_HEAD(copy, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks the sum and the copy cpu_in_cksum_copy() makes");
+}
+
+ATF_TC_BODY(copy, tc)
+{
+	uint8_t *buf, *copy;
+	unsigned i, j, k, failed = 0;
+	size_t len, off;
+
+	srandom(2);
+	buf = xmalloc(MAXLEN);
+	copy = xmalloc(MAXLEN + 16);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		len = (size_t)random() % ((i & 1) ? 2048 : MAXLEN);
+		off = len ? (size_t)random() % 16 % len : 0;
+		fill(buf, len);
+
+		for (j = 0; j < __arraycount(impls); j++) {
+			if (cpu_in_cksum_select(impls[j]) == NULL)
+				continue;
+			k = (unsigned)random() % 16;
+			memset(copy, 0, MAXLEN + 16);
+			if ((uint16_t)cpu_in_cksum_copy(buf + off, copy + k,
+			    len - off, 0) != ref_cksum(buf + off, len - off, 0) ||
+			    memcmp(buf + off, copy + k, len - off) != 0) {
+				if (failed++ < 10)
+					printf("%s: copy of %zu bytes from "
+					    "+%zu to +%u failed\n", impls[j],
+					    len - off, off, k);
+			}
+		}
+	}
+	ATF_CHECK_EQ_MSG(failed, 0, "%u bad copies", failed);
+
+	free(copy);
+	free(buf);
+}
+
+ATF_TC(empty);
+ATF_TC_HEAD(empty, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that cpu_in_cksum() of nothing at an odd address "
+	    "returns the initial sum");
+}
+
+ATF_TC_BODY(empty, tc)
+{
+	struct mbuf m;
+	uint8_t buf[4] = { 0xff, 0xff, 0xff, 0xff };
+	unsigned j;
+
+	memset(&m, 0, sizeof(m));
+	m.m_data = (char *)buf + 1;
+	m.m_len = 2;
+
+	for (j = 0; j < __arraycount(impls); j++) {
+		if (cpu_in_cksum_select(impls[j]) == NULL)
+			continue;
+		ATF_CHECK_EQ_MSG((uint16_t)~cpu_in_cksum(&m, 0, 0, 0x1234),
+		    0x1234, "%s", impls[j]);
+		ATF_CHECK_EQ_MSG((uint16_t)~cpu_in_cksum(&m, 0, 1, 0x1234),
+		    0x1234, "%s", impls[j]);
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, select);
+	ATF_TP_ADD_TC(tp, chains);
+	ATF_TP_ADD_TC(tp, copy);
+	ATF_TP_ADD_TC(tp, empty);
+
+	return atf_no_error();
+}
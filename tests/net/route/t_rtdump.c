@@ -0,0 +1,407 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check the resumable NET_RT_DUMPFROM routing table dump against
+ * NET_RT_DUMP, in a rump kernel with a few thousand routes, some of
+ * them sharing their destination, in chunks of several sizes and from
+ * cursors that are not in the table.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+
+#include <net/if.h>
+#include <net/route.h>
+#include <netinet/in.h>
+
+#include <atf-c.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rump/rump.h>
+#include <rump/rump_syscalls.h>
+
+#include "h_macros.h"
+
+#define	NNETS		2048
+
+/* A route, by destination and netmask. */
+struct route_id {
+	struct sockaddr_in	ri_dst;
+	struct sockaddr_in	ri_mask;
+};
+
+struct routes {
+	struct route_id	*r_ids;
+	size_t		 r_count;
+};
+
+static void
+sin_set(struct sockaddr_in *sin, in_addr_t addr)
+{
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_len = sizeof(*sin);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = addr;
+}
+
+/* Add a blackhole route to 10.0.0.0 + net with the given prefix. */
+static void
+route_add(int s, uint32_t net, int plen)
+{
+	struct {
+		struct rt_msghdr	rtm;
+		struct sockaddr_in	dst;
+		struct sockaddr_in	gw;
+		struct sockaddr_in	mask;
+	} m;
+	static int seq;
+
+	memset(&m, 0, sizeof(m));
+	m.rtm.rtm_msglen = sizeof(m);
+	m.rtm.rtm_version = RTM_VERSION;
+	m.rtm.rtm_type = RTM_ADD;
+	m.rtm.rtm_flags = RTF_UP | RTF_STATIC | RTF_BLACKHOLE;
+	m.rtm.rtm_addrs = RTA_DST | RTA_GATEWAY | RTA_NETMASK;
+	m.rtm.rtm_seq = ++seq;
+	sin_set(&m.dst, htonl(0x0a000000 | net));
+	sin_set(&m.gw, htonl(INADDR_LOOPBACK));
+	sin_set(&m.mask, htonl(0xffffffffU << (32 - plen)));
+	ATF_REQUIRE_EQ_MSG(rump_sys_write(s, &m, sizeof(m)),
+	    (ssize_t)sizeof(m), "RTM_ADD 10.%u.%u.%u/%d: %s",
+	    (net >> 16) & 0xff, (net >> 8) & 0xff, net & 0xff, plen,
+	    strerror(errno));
+}
+
+/*
+ * Fill the table: a /24 for each of NNETS networks, and for some of
+ * them a /25 or a /16 with the same destination.
+ */
+static void
+routes_setup(void)
+{
+	int s, off = 0;
+	unsigned i;
+
+	RZ(rump_init());
+	RL(s = rump_sys_socket(PF_ROUTE, SOCK_RAW, 0));
+	RL(rump_sys_setsockopt(s, SOL_SOCKET, SO_USELOOPBACK, &off,
+	    sizeof(off)));
+	for (i = 0; i < NNETS; i++) {
+		route_add(s, i << 8, 24);
+		if (i % 7 == 0)
+			route_add(s, i << 8, 25);
+		if (i % 256 == 0)
+			route_add(s, i << 8, 16);
+	}
+	RL(rump_sys_close(s));
+}
+
+static const struct sockaddr *
+rtm_addr(const struct rt_msghdr *rtm, int which)
+{
+	const char *cp = (const char *)(rtm + 1);
+	const struct sockaddr *sa;
+	int i;
+
+	for (i = 0; i < RTAX_MAX; i++) {
+		if ((rtm->rtm_addrs & (1 << i)) == 0)
+			continue;
+		sa = (const struct sockaddr *)cp;
+		if (i == which)
+			return sa;
+		RT_ADVANCE(cp, sa);
+	}
+	return NULL;
+}
+
+/* Append the routes in the len bytes of messages at buf to r. */
+static void
+routes_add(struct routes *r, const char *buf, size_t len)
+{
+	const struct rt_msghdr *rtm;
+	const struct sockaddr *dst, *mask;
+	struct route_id *ri;
+	const char *cp;
+
+	for (cp = buf; cp < buf + len; cp += rtm->rtm_msglen) {
+		rtm = (const struct rt_msghdr *)cp;
+		ATF_REQUIRE(rtm->rtm_msglen >= sizeof(*rtm));
+		ATF_REQUIRE_EQ(rtm->rtm_version, RTM_VERSION);
+		if (rtm->rtm_flags & RTF_LLDATA)
+			continue;
+		r->r_ids = realloc(r->r_ids,
+		    (r->r_count + 1) * sizeof(*r->r_ids));
+		ATF_REQUIRE(r->r_ids != NULL);
+		ri = &r->r_ids[r->r_count++];
+		memset(ri, 0, sizeof(*ri));
+		ATF_REQUIRE((dst = rtm_addr(rtm, RTAX_DST)) != NULL);
+		ATF_REQUIRE_EQ(dst->sa_family, AF_INET);
+		memcpy(&ri->ri_dst, dst, MIN(dst->sa_len, sizeof(ri->ri_dst)));
+		if ((mask = rtm_addr(rtm, RTAX_NETMASK)) != NULL)
+			memcpy(&ri->ri_mask, mask,
+			    MIN(mask->sa_len, sizeof(ri->ri_mask)));
+	}
+}
+
+static void
+dump_full(struct routes *r)
+{
+	int mib[6] = { CTL_NET, PF_ROUTE, 0, AF_INET, NET_RT_DUMP, 0 };
+	char *buf;
+	size_t len;
+
+	memset(r, 0, sizeof(*r));
+	RL(rump_sys___sysctl(mib, __arraycount(mib), NULL, &len, NULL, 0));
+	len += len / 2;
+	ATF_REQUIRE((buf = malloc(len)) != NULL);
+	RL(rump_sys___sysctl(mib, __arraycount(mib), buf, &len, NULL, 0));
+	routes_add(r, buf, len);
+	free(buf);
+}
+
+/*
+ * One NET_RT_DUMPFROM request into a buffer of *lenp bytes, after
+ * cursor if not NULL.  Returns 0 or the errno.
+ */
+static int
+dump_from(const struct sockaddr_in *cursor, char *buf, size_t *lenp)
+{
+	int mib[6] = { CTL_NET, PF_ROUTE, 0, AF_INET, NET_RT_DUMPFROM, 0 };
+
+	if (rump_sys___sysctl(mib, __arraycount(mib), buf, lenp, cursor,
+	    cursor ? cursor->sin_len : 0) == -1)
+		return errno;
+	return 0;
+}
+
+/*
+ * Dump the table in chunks of the given size, from after cursor if not
+ * NULL, checking that no destination is split across chunks.  The
+ * chunks grow when the routes of one destination do not fit.
+ */
+static void
+dump_chunked(const struct sockaddr_in *from, size_t chunk, struct routes *r,
+    unsigned *nreqs)
+{
+	struct sockaddr_in cursor;
+	const struct sockaddr *first;
+	char *buf;
+	size_t len, done;
+	int error;
+
+	memset(r, 0, sizeof(*r));
+	if (from != NULL)
+		cursor = *from;
+	ATF_REQUIRE((buf = malloc(chunk)) != NULL);
+	for (*nreqs = 0;; ++*nreqs) {
+		ATF_REQUIRE_MSG(*nreqs <= 4 * NNETS, "no end of the table");
+		len = chunk;
+		error = dump_from(from ? &cursor : NULL, buf, &len);
+		if (error == ENOMEM) {
+			chunk *= 2;
+			ATF_REQUIRE((buf = realloc(buf, chunk)) != NULL);
+			continue;
+		}
+		ATF_REQUIRE_EQ_MSG(error, 0, "%s", strerror(error));
+		if (len == 0)
+			break;
+		first = rtm_addr((const struct rt_msghdr *)buf, RTAX_DST);
+		ATF_REQUIRE(first != NULL);
+		ATF_CHECK_MSG(from == NULL ||
+		    memcmp(first, &cursor, sizeof(cursor)) != 0,
+		    "destination split across chunks");
+
+		done = r->r_count;
+		routes_add(r, buf, len);
+		ATF_REQUIRE(r->r_count > done);
+		cursor = r->r_ids[r->r_count - 1].ri_dst;
+		from = &cursor;
+	}
+	free(buf);
+}
+
+static void
+routes_compare(const struct routes *a, const struct routes *b, size_t off,
+    const char *what)
+{
+	size_t i;
+
+	ATF_REQUIRE_EQ_MSG(a->r_count - off, b->r_count,
+	    "%s: %zu routes, expected %zu", what, b->r_count,
+	    a->r_count - off);
+	for (i = 0; i < b->r_count; i++)
+		ATF_REQUIRE_MSG(memcmp(&a->r_ids[off + i], &b->r_ids[i],
+		    sizeof(b->r_ids[i])) == 0, "%s: route %zu differs",
+		    what, i);
+}
+
+ATF_TC(chunks);
+ATF_TC_HEAD(chunks, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that NET_RT_DUMPFROM in chunks returns what "
+	    "NET_RT_DUMP does");
+}
+
+ATF_TC_BODY(chunks, tc)
+{
+	static const size_t chunks[] = { 256, 1000, 4096, 65536, 1 << 20 };
+	struct routes full, chunked;
+	unsigned i, nreqs;
+	char what[32];
+
+	routes_setup();
+	dump_full(&full);
+	ATF_REQUIRE(full.r_count > NNETS);
+
+	for (i = 0; i < __arraycount(chunks); i++) {
+		dump_chunked(NULL, chunks[i], &chunked, &nreqs);
+		snprintf(what, sizeof(what), "%zu byte chunks", chunks[i]);
+		routes_compare(&full, &chunked, 0, what);
+		printf("%s: %zu routes in %u requests\n", what,
+		    chunked.r_count, nreqs);
+		free(chunked.r_ids);
+	}
+	free(full.r_ids);
+}
+
+ATF_TC(cursor);
+ATF_TC_HEAD(cursor, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that NET_RT_DUMPFROM resumes after a cursor whether "
+	    "or not it is in the table");
+}
+
+ATF_TC_BODY(cursor, tc)
+{
+	struct routes full, chunked;
+	struct sockaddr_in cursor;
+	unsigned nreqs;
+	size_t i, j;
+
+	routes_setup();
+	dump_full(&full);
+
+	/* Routes come in destination order. */
+	for (i = 1; i < full.r_count; i++)
+		ATF_REQUIRE_MSG(memcmp(&full.r_ids[i - 1].ri_dst,
+		    &full.r_ids[i].ri_dst, sizeof(cursor)) <= 0,
+		    "route %zu out of order", i);
+
+	for (i = 0; i < full.r_count; i += 97) {
+		/* A destination in the table, then one just past it. */
+		for (j = 0; j < 2; j++) {
+			cursor = full.r_ids[i].ri_dst;
+			cursor.sin_addr.s_addr =
+			    htonl(ntohl(cursor.sin_addr.s_addr) + j);
+			dump_chunked(&cursor, 4096, &chunked, &nreqs);
+			routes_compare(&full, &chunked,
+			    full.r_count - chunked.r_count, "from cursor");
+			if (chunked.r_count > 0)
+				ATF_CHECK(memcmp(&chunked.r_ids[0].ri_dst,
+				    &cursor, sizeof(cursor)) > 0);
+			if (chunked.r_count < full.r_count)
+				ATF_CHECK(memcmp(&full.r_ids[full.r_count -
+				    chunked.r_count - 1].ri_dst, &cursor,
+				    sizeof(cursor)) <= 0);
+			free(chunked.r_ids);
+		}
+	}
+	free(full.r_ids);
+}
+
+ATF_TC(errors);
+ATF_TC_HEAD(errors, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks the errors of NET_RT_DUMPFROM and that other ops "
+	    "still take no new value");
+}
+
+ATF_TC_BODY(errors, tc)
+{
+	int mib[6] = { CTL_NET, PF_ROUTE, 0, AF_INET, NET_RT_DUMPFROM, 0 };
+	struct sockaddr_in cursor;
+	char buf[8192];
+	size_t len;
+
+	routes_setup();
+	sin_set(&cursor, htonl(0x0a000000));
+
+	/* Too small for one route. */
+	len = sizeof(struct rt_msghdr);
+	ATF_CHECK_EQ(dump_from(&cursor, buf, &len), ENOMEM);
+
+	/* Past the end. */
+	len = sizeof(buf);
+	cursor.sin_addr.s_addr = INADDR_BROADCAST;
+	ATF_CHECK_EQ(dump_from(&cursor, buf, &len), 0);
+	ATF_CHECK_EQ(len, 0);
+
+	/* Cursors not of the family, or of the wrong length. */
+	len = sizeof(buf);
+	cursor.sin_family = AF_INET6;
+	ATF_CHECK_EQ(dump_from(&cursor, buf, &len), EINVAL);
+	cursor.sin_family = AF_INET;
+	cursor.sin_len = sizeof(cursor) - 1;
+	ATF_CHECK_ERRNO(EINVAL, rump_sys___sysctl(mib, __arraycount(mib),
+	    buf, &len, &cursor, sizeof(cursor)) == -1);
+	cursor.sin_len = sizeof(cursor);
+	ATF_CHECK_ERRNO(EINVAL, rump_sys___sysctl(mib, __arraycount(mib),
+	    buf, &len, &cursor, 1) == -1);
+
+	/* Only NET_RT_DUMPFROM takes a new value. */
+	mib[4] = NET_RT_DUMP;
+	len = sizeof(buf);
+	ATF_CHECK_ERRNO(EPERM, rump_sys___sysctl(mib, __arraycount(mib),
+	    buf, &len, &cursor, sizeof(cursor)) == -1);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, chunks);
+	ATF_TP_ADD_TC(tp, cursor);
+	ATF_TP_ADD_TC(tp, errors);
+
+	return atf_no_error();
+}
@@ -0,0 +1,224 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check every CRC32C implementation in sys/netinet/sctp_crc32.c that
+ * the CPU supports, and sctp_crc32c_combine(), against a bit-at-a-time
+ * reference on random buffers and alignments.  sctp_crc32.c is built
+ * into the test as is.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/param.h>
+
+#include <atf-c.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void		sctp_crc32_init(void);
+const char *	sctp_crc32c_select(const char *);
+uint32_t	sctp_crc32c_combine(uint32_t, uint32_t, size_t);
+uint32_t	update_crc32(uint32_t, unsigned char *, unsigned int);
+
+static const char *const impls[] = { "byte", "sb8", "sse4.2", "armv8" };
+
+#define MAXLEN		65536
+#define ITERATIONS	2000
+
+/* Reflected CRC32C, one bit at a time, neither seeded nor inverted. */
+static uint32_t
+ref_crc32c(uint32_t crc, const uint8_t *p, size_t len)
+{
+	size_t i;
+	int k;
+
+	for (i = 0; i < len; i++) {
+		crc ^= p[i];
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+	}
+	return crc;
+}
+
+static void
+fill(uint8_t *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = (uint8_t)random();
+}
+
+static uint8_t *
+xmalloc(size_t len)
+{
+	uint8_t *p;
+
+	ATF_REQUIRE((p = malloc(len)) != NULL);
+	return p;
+}
+
+ATF_TC(select);
+ATF_TC_HEAD(select, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that the table implementations are always available");
+}
+
+ATF_TC_BODY(select, tc)
+{
+	unsigned i;
+
+	sctp_crc32_init();
+	for (i = 0; i < __arraycount(impls); i++)
+		printf("%s: %s\n", impls[i],
+		    sctp_crc32c_select(impls[i]) ? "supported" : "unsupported");
+	ATF_CHECK(sctp_crc32c_select("byte") != NULL);
+	ATF_CHECK(sctp_crc32c_select("sb8") != NULL);
+	ATF_CHECK(sctp_crc32c_select("nonexistent") == NULL);
+	ATF_CHECK(sctp_crc32c_select(NULL) != NULL);
+}
+
+ATF_TC(check);
+ATF_TC_HEAD(check, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks the CRC32C of \"123456789\" with every implementation");
+}
+
+ATF_TC_BODY(check, tc)
+{
+	unsigned char check[] = "123456789";
+	unsigned j;
+
+	sctp_crc32_init();
+	ATF_REQUIRE_EQ(~ref_crc32c(0xffffffff, check, 9), 0xE3069283);
+	for (j = 0; j < __arraycount(impls); j++) {
+		if (sctp_crc32c_select(impls[j]) == NULL)
+			continue;
+		ATF_CHECK_EQ_MSG(~update_crc32(0xffffffff, check, 9),
+		    0xE3069283, "%s", impls[j]);
+	}
+}
+
+ATF_TC(buffers);
+ATF_TC_HEAD(buffers, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks update_crc32() on random buffers, alignments and "
+	    "lengths");
+}
+
+ATF_TC_BODY(buffers, tc)
+{
+	uint8_t *buf;
+	unsigned i, j, failed = 0;
+	uint32_t crc, ref, seed;
+	size_t len, off;
+
+	srandom(1);
+	sctp_crc32_init();
+	buf = xmalloc(MAXLEN + 16);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		/* Favour the short and the unaligned ones. */
+		len = (size_t)random() % ((i & 1) ? 256 : MAXLEN);
+		off = (size_t)random() % 16;
+		seed = (i & 2) ? (uint32_t)random() : 0xffffffff;
+		fill(buf + off, len);
+		ref = ref_crc32c(seed, buf + off, len);
+
+		for (j = 0; j < __arraycount(impls); j++) {
+			if (sctp_crc32c_select(impls[j]) == NULL)
+				continue;
+			crc = update_crc32(seed, buf + off, (unsigned)len);
+			if (crc != ref && failed++ < 10)
+				printf("%s: len %zu off %zu: 0x%08x != 0x%08x\n",
+				    impls[j], len, off, crc, ref);
+		}
+	}
+	ATF_CHECK_EQ_MSG(failed, 0, "%u bad CRCs", failed);
+
+	free(buf);
+}
+
+ATF_TC(combine);
+ATF_TC_HEAD(combine, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that sctp_crc32c_combine() of the CRCs of two halves "
+	    "gives the CRC of the whole");
+}
+
+ATF_TC_BODY(combine, tc)
+{
+	uint8_t *buf;
+	unsigned i, failed = 0;
+	uint32_t crc, crc1, crc2, ref;
+	size_t len, split;
+
+	srandom(2);
+	sctp_crc32_init();
+	buf = xmalloc(MAXLEN);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		len = (size_t)random() % ((i & 1) ? 256 : MAXLEN);
+		split = (size_t)random() % (len + 1);
+		fill(buf, len);
+		ref = ref_crc32c(0xffffffff, buf, len);
+
+		crc1 = ref_crc32c(0xffffffff, buf, split);
+		crc2 = ref_crc32c(0, buf + split, len - split);
+		crc = sctp_crc32c_combine(crc1, crc2, len - split);
+		if (crc != ref && failed++ < 10)
+			printf("len %zu split %zu: 0x%08x != 0x%08x\n",
+			    len, split, crc, ref);
+	}
+	ATF_CHECK_EQ_MSG(failed, 0, "%u bad combinations", failed);
+
+	free(buf);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, select);
+	ATF_TP_ADD_TC(tp, check);
+	ATF_TP_ADD_TC(tp, buffers);
+	ATF_TP_ADD_TC(tp, combine);
+
+	return atf_no_error();
+}
@@ -0,0 +1,197 @@
+/*	$NetBSD$	*/
+
+/*-
+ * Copyright (c) 2026 The NetBSD Foundation, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE NETBSD FOUNDATION, INC. AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Check the association lookup of the host kernel's SCTP with many
+ * associations: connect one-to-one clients to a one-to-many server on
+ * the loopback, have the server reply to each with sendto(2), so that
+ * every reply needs a lookup by address, and check that each reply
+ * reaches the client it was meant for, before and after some of the
+ * associations are gone.
+ */
+
+#include <sys/cdefs.h>
+__RCSID("$NetBSD$");
+
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <atf-c.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NCLIENTS	64
+
+static int
+server_socket(struct sockaddr_in *server)
+{
+	socklen_t len;
+	int sfd;
+
+	sfd = socket(AF_INET, SOCK_SEQPACKET, IPPROTO_SCTP);
+	if (sfd == -1 && errno == EPROTONOSUPPORT)
+		atf_tc_skip("the kernel has no SCTP");
+	ATF_REQUIRE_MSG(sfd != -1, "socket: %s", strerror(errno));
+
+	memset(server, 0, sizeof(*server));
+	server->sin_len = sizeof(*server);
+	server->sin_family = AF_INET;
+	server->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ATF_REQUIRE(bind(sfd, (const struct sockaddr *)server,
+	    sizeof(*server)) == 0);
+	ATF_REQUIRE(listen(sfd, NCLIENTS) == 0);
+	len = sizeof(*server);
+	ATF_REQUIRE(getsockname(sfd, (struct sockaddr *)server, &len) == 0);
+	return sfd;
+}
+
+static int
+client_socket(const struct sockaddr_in *server)
+{
+	int fd;
+
+	ATF_REQUIRE((fd = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP)) != -1);
+	ATF_REQUIRE_MSG(connect(fd, (const struct sockaddr *)server,
+	    sizeof(*server)) == 0, "connect: %s", strerror(errno));
+	return fd;
+}
+
+/*
+ * Send each live client's index to the server, which echoes it back to
+ * where it came from, and check that every client gets its own back.
+ */
+static void
+bounce(int sfd, const int *fds, unsigned n)
+{
+	struct sockaddr_in from;
+	socklen_t fromlen;
+	uint32_t msg;
+	unsigned i, live = 0;
+
+	for (i = 0; i < n; i++) {
+		if (fds[i] == -1)
+			continue;
+		msg = htonl(i);
+		ATF_REQUIRE(send(fds[i], &msg, sizeof(msg), 0) ==
+		    sizeof(msg));
+		live++;
+	}
+	for (i = 0; i < live; i++) {
+		fromlen = sizeof(from);
+		ATF_REQUIRE(recvfrom(sfd, &msg, sizeof(msg), 0,
+		    (struct sockaddr *)&from, &fromlen) == sizeof(msg));
+		ATF_REQUIRE(sendto(sfd, &msg, sizeof(msg), 0,
+		    (const struct sockaddr *)&from, fromlen) == sizeof(msg));
+	}
+	for (i = 0; i < n; i++) {
+		if (fds[i] == -1)
+			continue;
+		ATF_REQUIRE(recv(fds[i], &msg, sizeof(msg), 0) ==
+		    sizeof(msg));
+		ATF_CHECK_EQ_MSG(ntohl(msg), i,
+		    "client %u got the reply for %u", i, ntohl(msg));
+	}
+}
+
+ATF_TC(lookup);
+ATF_TC_HEAD(lookup, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks that replies by address reach the right one of many "
+	    "associations");
+}
+
+ATF_TC_BODY(lookup, tc)
+{
+	struct sockaddr_in server;
+	int fds[NCLIENTS], sfd;
+	unsigned i;
+
+	sfd = server_socket(&server);
+	for (i = 0; i < NCLIENTS; i++)
+		fds[i] = client_socket(&server);
+
+	bounce(sfd, fds, NCLIENTS);
+	bounce(sfd, fds, NCLIENTS);
+
+	for (i = 0; i < NCLIENTS; i++)
+		close(fds[i]);
+	close(sfd);
+}
+
+ATF_TC(remove);
+ATF_TC_HEAD(remove, tc)
+{
+
+	atf_tc_set_md_var(tc, "descr",
+	    "Checks the association lookup after some associations are "
+	    "closed and others take their place");
+}
+
+ATF_TC_BODY(remove, tc)
+{
+	struct sockaddr_in server;
+	int fds[NCLIENTS], sfd;
+	unsigned i;
+
+	sfd = server_socket(&server);
+	for (i = 0; i < NCLIENTS; i++)
+		fds[i] = client_socket(&server);
+	bounce(sfd, fds, NCLIENTS);
+
+	/* Let every other association go, then check the rest. */
+	for (i = 0; i < NCLIENTS; i += 2) {
+		close(fds[i]);
+		fds[i] = -1;
+	}
+	bounce(sfd, fds, NCLIENTS);
+
+	/* New associations in their place, likely on reused ports. */
+	for (i = 0; i < NCLIENTS; i += 2)
+		fds[i] = client_socket(&server);
+	bounce(sfd, fds, NCLIENTS);
+
+	for (i = 0; i < NCLIENTS; i++)
+		close(fds[i]);
+	close(sfd);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+
+	ATF_TP_ADD_TC(tp, lookup);
+	ATF_TP_ADD_TC(tp, remove);
+
+	return atf_no_error();
+}